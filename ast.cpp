@@ -10,6 +10,43 @@ namespace ast {
  */
 Entity::~Entity() {}
 
+GlobalEntity::GlobalEntity(std::unique_ptr<Type>&& type, const std::string& name):
+    type(std::move(type)),
+    name(name)
+{
+    offset = this->type->offset;
+}
+
+FunctionArgument::FunctionArgument(std::unique_ptr<Type>&& type, const std::string& name):
+    type(std::move(type)),
+    name(name),
+    offset(this->type->offset)
+{}
+
+StructField::StructField(std::unique_ptr<Type>&& type, const std::string& name, std::uint32_t alignment):
+    type(std::move(type)),
+    name(name),
+    alignment(alignment),
+    offset(this->type->offset)
+{}
+
+int StructEntity::find(const std::string& field) const {
+    for(std::size_t i = 0; i < fields.size(); ++i) {
+        if(fields[i].name == field) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+FunctionEntity::FunctionEntity(std::unique_ptr<Type>&& return_type, const std::string& name):
+    return_type(std::move(return_type)),
+    name(name)
+{
+    offset = this->return_type->offset;
+}
+
 void AssemblyEntity::accept(EntityVisitor& v) const {
     v.visit(*this);
 }
@@ -18,6 +55,10 @@ void GlobalEntity::accept(EntityVisitor& v) const {
     v.visit(*this);
 }
 
+void StructEntity::accept(EntityVisitor& v) const {
+    v.visit(*this);
+}
+
 void FunctionEntity::accept(EntityVisitor& v) const {
     v.visit(*this);
 }
@@ -27,6 +68,20 @@ void FunctionEntity::accept(EntityVisitor& v) const {
  */
 Instruction::~Instruction() {}
 
+DeclarationInstruction::DeclarationInstruction(std::unique_ptr<Type>&& type, const std::string& name, std::unique_ptr<Expression>&& expression):
+    type(std::move(type)),
+    name(name),
+    expression(std::move(expression))
+{
+    offset = this->type->offset;
+}
+
+ExpressionInstruction::ExpressionInstruction(std::unique_ptr<Expression>&& expression):
+    expression(std::move(expression))
+{
+    offset = this->expression->offset;
+}
+
 void BlockInstruction::accept(InstructionVisitor& v) const {
     v.visit(*this);
 }
@@ -47,10 +102,27 @@ void WhileInstruction::accept(InstructionVisitor& v) const {
     v.visit(*this);
 }
 
+void ForInstruction::accept(InstructionVisitor& v) const {
+    v.visit(*this);
+}
+
+void BreakInstruction::accept(InstructionVisitor& v) const {
+    v.visit(*this);
+}
+
+void ContinueInstruction::accept(InstructionVisitor& v) const {
+    v.visit(*this);
+}
+
 void ReturnInstruction::accept(InstructionVisitor& v) const {
     v.visit(*this);
 }
 
+AsmOperand::AsmOperand(const std::string& constraint, std::unique_ptr<Expression>&& expression):
+    constraint(constraint),
+    expression(std::move(expression))
+{}
+
 void AssemblyInstruction::accept(InstructionVisitor& v) const {
     v.visit(*this);
 }
@@ -105,6 +177,14 @@ const char* UnaryExpression::operator_str(Operator op) {
     }
 }
 
+BinaryExpression::BinaryExpression(Operator op, std::unique_ptr<Expression>&& left, std::unique_ptr<Expression>&& right):
+    op(op),
+    left(std::move(left)),
+    right(std::move(right))
+{
+    offset = this->left->offset;
+}
+
 void BinaryExpression::accept(ExpressionVisitor& v) const {
     v.visit(*this);
 }
@@ -133,6 +213,13 @@ const char* BinaryExpression::operator_str(Operator op) {
     }
 }
 
+AffectationExpression::AffectationExpression(std::unique_ptr<Expression>&& affected, std::unique_ptr<Expression>&& value):
+    affected(std::move(affected)),
+    value(std::move(value))
+{
+    offset = this->affected->offset;
+}
+
 void AffectationExpression::accept(ExpressionVisitor& v) const {
     v.visit(*this);
 }
@@ -145,6 +232,33 @@ void AccessExpression::accept(ExpressionVisitor& v) const {
     v.visit(*this);
 }
 
+MemberExpression::MemberExpression(std::unique_ptr<Expression>&& expression, const std::string& member, bool arrow):
+    expression(std::move(expression)),
+    member(member),
+    arrow(arrow)
+{
+    offset = this->expression->offset;
+}
+
+void MemberExpression::accept(ExpressionVisitor& v) const {
+    v.visit(*this);
+}
+
+IndexExpression::IndexExpression(std::unique_ptr<Expression>&& array, std::unique_ptr<Expression>&& index):
+    array(std::move(array)),
+    index(std::move(index))
+{
+    offset = this->array->offset;
+}
+
+void IndexExpression::accept(ExpressionVisitor& v) const {
+    v.visit(*this);
+}
+
+void SizeofExpression::accept(ExpressionVisitor& v) const {
+    v.visit(*this);
+}
+
 void CallExpression::accept(ExpressionVisitor& v) const {
     v.visit(*this);
 }
@@ -154,6 +268,10 @@ void CallExpression::accept(ExpressionVisitor& v) const {
  */
 Type::~Type() {}
 
+std::size_t Type::alignment() const {
+    return size() == 0 ? 1 : size();
+}
+
 std::size_t VoidType::size() const {
     return 0;
 }
@@ -210,23 +328,188 @@ std::unique_ptr<Type> PointerType::clone() const {
     return std::make_unique<PointerType>(pointed_type_->clone(), size_);
 }
 
+std::size_t ArrayType::size() const {
+    return element_type_->size() * count_;
+}
+
+std::size_t ArrayType::alignment() const {
+    return element_type_->alignment();
+}
+
+void ArrayType::accept(TypeVisitor& v) const {
+    v.visit(*this);
+}
+
+std::unique_ptr<Type> ArrayType::clone() const {
+    return std::make_unique<ArrayType>(element_type_->clone(), count_);
+}
+
+std::size_t StructType::size() const {
+    return definition == nullptr ? 0 : definition->layout.size;
+}
+
+std::size_t StructType::alignment() const {
+    return definition == nullptr ? 1 : definition->layout.alignment;
+}
+
+void StructType::accept(TypeVisitor& v) const {
+    v.visit(*this);
+}
+
+std::unique_ptr<Type> StructType::clone() const {
+    auto type = std::make_unique<StructType>(name);
+    type->definition = definition;
+    return type;
+}
+
+/*
+ * Type helpers
+ */
+void TypeKind::visit(const VoidType&) {
+    kind = Void;
+}
+
+void TypeKind::visit(const IntegerType&) {
+    kind = Integer;
+}
+
+void TypeKind::visit(const BooleanType&) {
+    kind = Boolean;
+}
+
+void TypeKind::visit(const CharType&) {
+    kind = Char;
+}
+
+void TypeKind::visit(const NullType&) {
+    kind = Null;
+}
+
+void TypeKind::visit(const PointerType& type) {
+    kind = Pointer;
+    pointed = type.pointed_type();
+}
+
+void TypeKind::visit(const ArrayType& type) {
+    kind = Array;
+    pointed = type.element_type();
+    count = type.count();
+}
+
+void TypeKind::visit(const StructType& type) {
+    kind = Struct;
+    structure = type.definition;
+}
+
+bool operator==(const Type& a, const Type& b) {
+    TypeKind ka(a), kb(b);
+
+    if(ka.kind != kb.kind) {
+        return false;
+    }
+
+    if(ka.kind == TypeKind::Pointer) {
+        return *ka.pointed == *kb.pointed;
+    }
+
+    if(ka.kind == TypeKind::Array) {
+        return ka.count == kb.count && *ka.pointed == *kb.pointed;
+    }
+
+    if(ka.kind == TypeKind::Struct) {
+        return static_cast<const StructType&>(a).name == static_cast<const StructType&>(b).name;
+    }
+
+    return true;
+}
+
+bool operator!=(const Type& a, const Type& b) {
+    return !(a == b);
+}
+
 /*
- * operator<<
+ * operator<<, printing source the parser reads back into the same tree
  */
+namespace {
+
+std::string quote(const std::string& s) {
+    std::string quoted = "\"";
+
+    for(char c : s) {
+        switch(c) {
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            case '"':  quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            default:   quoted += c; break;
+        }
+    }
+
+    return quoted + "\"";
+}
+
+// int a[2][3], the dimensions of an array follow the name
+void declaration(std::ostream& o, const Type& type, const std::string& name) {
+    const Type* element = &type;
+    std::string dimensions;
+
+    while(auto array = dynamic_cast<const ArrayType*>(element)) {
+        dimensions += "[" + std::to_string(array->count()) + "]";
+        element = array->element_type();
+    }
+
+    o << *element << " " << name << dimensions;
+}
+
+} // namespace
+
 class PrintEntityVisitor : public EntityVisitor {
     public:
         explicit PrintEntityVisitor(std::ostream& o): o(o) {}
 
         void visit(const AssemblyEntity& entity) {
-            o << "asm(\"" << entity.assembly << "\");";
+            o << "asm(" << quote(entity.assembly) << ");";
         }
 
         void visit(const GlobalEntity& entity) {
-            o << *entity.type << " " << entity.name << ";";
+            declaration(o, *entity.type, entity.name);
+            o << ";";
+        }
+
+        void visit(const StructEntity& entity) {
+            o << "struct " << entity.name;
+
+            if(entity.packed) {
+                o << " packed";
+            }
+
+            if(entity.alignment != 0) {
+                o << " aligned(" << entity.alignment << ")";
+            }
+
+            o << " {" << std::endl;
+
+            for(const auto& field : entity.fields) {
+                declaration(o, *field.type, field.name);
+
+                if(field.alignment != 0) {
+                    o << " aligned(" << field.alignment << ")";
+                }
+
+                o << ";" << std::endl;
+            }
+
+            o << "};";
         }
 
         void visit(const FunctionEntity& entity) {
             bool first_argument = true;
+
+            if(entity.exported) {
+                o << "export ";
+            }
+
             o << *entity.return_type << " " << entity.name << "(";
 
             for(const auto& arg : entity.arguments) {
@@ -234,7 +517,7 @@ class PrintEntityVisitor : public EntityVisitor {
                     o << ", ";
                 }
 
-                o << *arg.type << " " << arg.name;
+                declaration(o, *arg.type, arg.name);
                 first_argument = false;
             }
 
@@ -266,7 +549,7 @@ class PrintInstructionVisitor : public InstructionVisitor {
         }
 
         virtual void visit(const DeclarationInstruction& instr) {
-            o << *instr.type << " " << instr.name;
+            declaration(o, *instr.type, instr.name);
 
             if(instr.expression != nullptr) {
                 o << " = " << *instr.expression;
@@ -305,12 +588,70 @@ class PrintInstructionVisitor : public InstructionVisitor {
             o << "}";
         }
 
+        virtual void visit(const ForInstruction& instr) {
+            o << "for (";
+
+            if(instr.initialization != nullptr) {
+                o << *instr.initialization;
+            }
+            else {
+                o << ";";
+            }
+
+            if(instr.condition != nullptr) {
+                o << " " << *instr.condition;
+            }
+
+            o << ";";
+
+            if(instr.step != nullptr) {
+                o << " " << *instr.step;
+            }
+
+            o << ") {" << std::endl;
+
+            for(const auto& ins : instr.instructions) {
+                o << *ins << std::endl;
+            }
+
+            o << "}";
+        }
+
+        virtual void visit(const BreakInstruction&) {
+            o << "break;";
+        }
+
+        virtual void visit(const ContinueInstruction&) {
+            o << "continue;";
+        }
+
         virtual void visit(const ReturnInstruction& instr) {
             o << "return " << *instr.expression << ";";
         }
 
         virtual void visit(const AssemblyInstruction& instr) {
-            o << "asm(\"" << instr.assembly << "\");";
+            o << "asm(" << quote(instr.assembly);
+
+            if(instr.extended) {
+                print_operands(instr.outputs);
+                print_operands(instr.inputs);
+                o << " :";
+
+                for(std::size_t i = 0; i < instr.clobbers.size(); ++i) {
+                    o << (i == 0 ? " " : ", ") << quote(instr.clobbers[i]);
+                }
+            }
+
+            o << ");";
+        }
+
+    private:
+        void print_operands(const std::vector<AsmOperand>& operands) {
+            o << " :";
+
+            for(std::size_t i = 0; i < operands.size(); ++i) {
+                o << (i == 0 ? " " : ", ") << quote(operands[i].constraint) << "(" << *operands[i].expression << ")";
+            }
         }
 
     private:
@@ -326,7 +667,14 @@ class PrintExpressionVisitor : public ExpressionVisitor {
         }
 
         virtual void visit(const IntegerExpression& expr) {
-            o << expr.value;
+            // a negative literal only comes from an integer that wrapped,
+            // -5 would read back as a negation
+            if(expr.value < 0) {
+                o << "0x" << std::hex << static_cast<std::uint32_t>(expr.value) << std::dec;
+            }
+            else {
+                o << expr.value;
+            }
         }
 
         virtual void visit(const CharExpression& expr) {
@@ -351,7 +699,7 @@ class PrintExpressionVisitor : public ExpressionVisitor {
         }
 
         virtual void visit(const StringExpression& expr) {
-            o << '"' << expr.value << '"';
+            o << quote(expr.value);
         }
 
         virtual void visit(const TrueExpression&) {
@@ -382,13 +730,30 @@ class PrintExpressionVisitor : public ExpressionVisitor {
         }
 
         virtual void visit(const CastExpression& expr) {
-            o << "(" << *expr.type << ") " << *expr.expression;
+            o << "(" << *expr.type << ") (" << *expr.expression << ")";
         }
 
         virtual void visit(const AccessExpression& expr) {
             o << "*(" << *expr.expression << ")";
         }
 
+        virtual void visit(const MemberExpression& expr) {
+            o << "(" << *expr.expression << ")" << (expr.arrow ? "->" : ".") << expr.member;
+        }
+
+        virtual void visit(const IndexExpression& expr) {
+            o << "(" << *expr.array << ")[" << *expr.index << "]";
+        }
+
+        virtual void visit(const SizeofExpression& expr) {
+            if(expr.type) {
+                o << "sizeof(" << *expr.type << ")";
+            }
+            else {
+                o << "sizeof(" << *expr.expression << ")";
+            }
+        }
+
         virtual void visit(const CallExpression& expr) {
             bool first_argument = true;
             o << expr.function_name << "(";
@@ -437,18 +802,32 @@ class PrintTypeVisitor : public TypeVisitor {
             o << *type.pointed_type() << '*';
         }
 
+        virtual void visit(const ArrayType& type) {
+            // int[2][3] is an array of 2 arrays of 3 ints
+            const Type* element = &type;
+            std::string dimensions;
+
+            while(auto array = dynamic_cast<const ArrayType*>(element)) {
+                dimensions += "[" + std::to_string(array->count()) + "]";
+                element = array->element_type();
+            }
+
+            o << *element << dimensions;
+        }
+
+        virtual void visit(const StructType& type) {
+            o << "struct " << type.name;
+        }
+
     private:
         std::ostream& o;
 };
 
 std::ostream& operator<<(std::ostream& o, const Program& prog) {
-    o << "program {" << std::endl;
-
     for(const auto& entity : prog.entities) {
         o << *entity << std::endl;
     }
 
-    o << "}" << std::endl;
     return o;
 }
 
@@ -1,6 +1,7 @@
 #ifndef MICROC_AST_HPP
 #define MICROC_AST_HPP
 
+#include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -22,8 +23,17 @@ class TypeVisitor;
 class Program {
     public:
         std::vector<std::unique_ptr<Entity>> entities;
+
+        // types of expressions not written in the source, see Expression::resolved_type
+        std::vector<std::unique_ptr<Type>> types;
 };
 
+/*
+ * Every node stores the offset of its first character in the source, see
+ * SourceMap to get a line and a column. Nodes starting with one of their
+ * children take its offset in their constructor, the parser sets the others.
+ */
+
 /*
  * Entities
  */
@@ -31,6 +41,10 @@ class Entity {
     public:
         virtual ~Entity() = 0;
         virtual void accept(EntityVisitor&) const = 0;
+
+    public:
+        std::uint32_t offset = 0;
+        bool imported = false;      // declared by a module, defined where it is compiled
 };
 
 class AssemblyEntity : public Entity {
@@ -44,10 +58,7 @@ class AssemblyEntity : public Entity {
 
 class GlobalEntity : public Entity {
     public:
-        GlobalEntity(std::unique_ptr<Type>&& type, const std::string& name):
-            type(std::move(type)),
-            name(name)
-        {}
+        GlobalEntity(std::unique_ptr<Type>&& type, const std::string& name);
 
         virtual void accept(EntityVisitor&) const;
 
@@ -58,10 +69,7 @@ class GlobalEntity : public Entity {
 
 class FunctionArgument {
     public:
-        FunctionArgument(std::unique_ptr<Type>&& type, const std::string& name):
-            type(std::move(type)),
-            name(name)
-        {}
+        FunctionArgument(std::unique_ptr<Type>&& type, const std::string& name);
 
         FunctionArgument(FunctionArgument&&) = default;
         FunctionArgument& operator=(FunctionArgument&&) = default;
@@ -69,14 +77,60 @@ class FunctionArgument {
     public:
         std::unique_ptr<Type> type;
         std::string name;
+        std::uint32_t offset;
+};
+
+class StructField {
+    public:
+        StructField(std::unique_ptr<Type>&& type, const std::string& name, std::uint32_t alignment);
+
+        StructField(StructField&&) = default;
+        StructField& operator=(StructField&&) = default;
+
+    public:
+        std::unique_ptr<Type> type;
+        std::string name;
+        std::uint32_t alignment;    // aligned(n), 0 if not given
+        std::uint32_t offset;
+};
+
+/*
+ * Byte offset of every field, computed once by the semantic analysis.
+ */
+class StructLayout {
+    public:
+        std::vector<std::uint32_t> offsets;
+        std::uint32_t size = 0;
+        std::uint32_t alignment = 1;
+};
+
+/*
+ * struct name [packed] [aligned(n)] { fields };
+ *
+ * Fields are laid out in order, each aligned on its natural alignment, or
+ * on 1 byte if the struct is packed. aligned(n) on a field or on the struct
+ * raises its alignment to n, which also pads the size of the struct.
+ */
+class StructEntity : public Entity {
+    public:
+        explicit StructEntity(const std::string& name): name(name) {}
+
+        virtual void accept(EntityVisitor&) const;
+
+        // index of the field, -1 if there is none
+        int find(const std::string& field) const;
+
+    public:
+        std::string name;
+        bool packed = false;
+        std::uint32_t alignment = 0;
+        std::vector<StructField> fields;
+        mutable StructLayout layout;
 };
 
 class FunctionEntity : public Entity {
     public:
-        FunctionEntity(std::unique_ptr<Type>&& return_type, const std::string& name):
-            return_type(std::move(return_type)),
-            name(name)
-        {}
+        FunctionEntity(std::unique_ptr<Type>&& return_type, const std::string& name);
 
         virtual void accept(EntityVisitor&) const;
 
@@ -85,6 +139,7 @@ class FunctionEntity : public Entity {
         std::string name;
         std::vector<FunctionArgument> arguments;
         std::vector<std::unique_ptr<Instruction>> instructions;
+        bool exported = false;      // may be called from outside the program
 };
 
 /*
@@ -94,6 +149,9 @@ class Instruction {
     public:
         virtual ~Instruction() = 0;
         virtual void accept(InstructionVisitor&) const = 0;
+
+    public:
+        std::uint32_t offset = 0;
 };
 
 class BlockInstruction : public Instruction {
@@ -111,11 +169,7 @@ class BlockInstruction : public Instruction {
 
 class DeclarationInstruction : public Instruction {
     public:
-        DeclarationInstruction(std::unique_ptr<Type>&& type, const std::string& name, std::unique_ptr<Expression>&& expression):
-            type(std::move(type)),
-            name(name),
-            expression(std::move(expression))
-        {}
+        DeclarationInstruction(std::unique_ptr<Type>&& type, const std::string& name, std::unique_ptr<Expression>&& expression);
 
         virtual void accept(InstructionVisitor&) const;
 
@@ -127,9 +181,7 @@ class DeclarationInstruction : public Instruction {
 
 class ExpressionInstruction : public Instruction {
     public:
-        explicit ExpressionInstruction(std::unique_ptr<Expression>&& expression):
-            expression(std::move(expression))
-        {}
+        explicit ExpressionInstruction(std::unique_ptr<Expression>&& expression);
 
         virtual void accept(InstructionVisitor&) const;
 
@@ -164,6 +216,47 @@ class WhileInstruction : public Instruction {
         std::vector<std::unique_ptr<Instruction>> instructions;
 };
 
+/*
+ * for(initialization; condition; step) { instructions }
+ *
+ * The initialization is a declaration or an expression instruction, scoped
+ * to the loop. Every part is optional, a missing condition is always true.
+ */
+class ForInstruction : public Instruction {
+    public:
+        ForInstruction(std::unique_ptr<Instruction>&& init, std::unique_ptr<Expression>&& cond,
+                       std::unique_ptr<Expression>&& step):
+            initialization(std::move(init)),
+            condition(std::move(cond)),
+            step(std::move(step))
+        {}
+
+        virtual void accept(InstructionVisitor&) const;
+
+    public:
+        std::unique_ptr<Instruction> initialization;
+        std::unique_ptr<Expression> condition;
+        std::unique_ptr<Expression> step;
+        std::vector<std::unique_ptr<Instruction>> instructions;
+
+        // set by the semantic analysis if the loop counts the local variable
+        // `counter` up and its body never assigns it: in the body, counter
+        // is then between low and high
+        mutable std::string counter;
+        mutable std::int32_t low = 0;
+        mutable std::int32_t high = 0;
+};
+
+class BreakInstruction : public Instruction {
+    public:
+        virtual void accept(InstructionVisitor&) const;
+};
+
+class ContinueInstruction : public Instruction {
+    public:
+        virtual void accept(InstructionVisitor&) const;
+};
+
 class ReturnInstruction : public Instruction {
     public:
         explicit ReturnInstruction(std::unique_ptr<Expression>&& expression):
@@ -176,6 +269,23 @@ class ReturnInstruction : public Instruction {
         std::unique_ptr<Expression> expression;
 };
 
+/*
+ * "constraint"(expression), an operand of an extended asm
+ */
+class AsmOperand {
+    public:
+        AsmOperand(const std::string& constraint, std::unique_ptr<Expression>&& expression);
+
+    public:
+        std::string constraint;
+        std::unique_ptr<Expression> expression;
+};
+
+/*
+ * asm(assembly), which may clobber anything, or the extended form of GCC
+ * asm(assembly : outputs : inputs : clobbers), whose operands are
+ * referenced in assembly as %0, %1... outputs first.
+ */
 class AssemblyInstruction : public Instruction {
     public:
         explicit AssemblyInstruction(const std::string& a): assembly(a) {}
@@ -183,6 +293,10 @@ class AssemblyInstruction : public Instruction {
 
     public:
         std::string assembly;
+        bool extended = false;
+        std::vector<AsmOperand> outputs;
+        std::vector<AsmOperand> inputs;
+        std::vector<std::string> clobbers;
 };
 
 /*
@@ -192,6 +306,12 @@ class Expression {
     public:
         virtual ~Expression() = 0;
         virtual void accept(ExpressionVisitor&) const = 0;
+
+    public:
+        std::uint32_t offset = 0;
+
+        // set by the semantic analysis, owned by the program or the AST
+        mutable const Type* resolved_type = nullptr;
 };
 
 class IdentExpression : public Expression {
@@ -284,11 +404,7 @@ class BinaryExpression : public Expression {
         static const char* operator_str(Operator op);
 
     public:
-        BinaryExpression(Operator op, std::unique_ptr<Expression>&& left, std::unique_ptr<Expression>&& right):
-            op(op),
-            left(std::move(left)),
-            right(std::move(right))
-        {}
+        BinaryExpression(Operator op, std::unique_ptr<Expression>&& left, std::unique_ptr<Expression>&& right);
 
         virtual void accept(ExpressionVisitor&) const;
 
@@ -302,10 +418,7 @@ typedef BinaryExpression::Operator BinaryOperator;
 
 class AffectationExpression : public Expression {
     public:
-        AffectationExpression(std::unique_ptr<Expression>&& affected, std::unique_ptr<Expression>&& value):
-            affected(std::move(affected)),
-            value(std::move(value))
-        {}
+        AffectationExpression(std::unique_ptr<Expression>&& affected, std::unique_ptr<Expression>&& value);
 
         virtual void accept(ExpressionVisitor&) const;
 
@@ -340,6 +453,56 @@ class AccessExpression : public Expression {
         std::unique_ptr<Expression> expression;
 };
 
+/*
+ * expression.member, or expression->member if arrow is set
+ */
+class MemberExpression : public Expression {
+    public:
+        MemberExpression(std::unique_ptr<Expression>&& expression, const std::string& member, bool arrow);
+
+        virtual void accept(ExpressionVisitor&) const;
+
+    public:
+        std::unique_ptr<Expression> expression;
+        std::string member;
+        bool arrow;
+
+        // index of the member in its struct, set by the semantic analysis
+        mutable int field = -1;
+};
+
+/*
+ * array[index], where array is an array or a pointer
+ */
+class IndexExpression : public Expression {
+    public:
+        IndexExpression(std::unique_ptr<Expression>&& array, std::unique_ptr<Expression>&& index);
+
+        virtual void accept(ExpressionVisitor&) const;
+
+    public:
+        std::unique_ptr<Expression> array;
+        std::unique_ptr<Expression> index;
+};
+
+/*
+ * sizeof(type) or sizeof(expression), the other one being null.
+ */
+class SizeofExpression : public Expression {
+    public:
+        explicit SizeofExpression(std::unique_ptr<Type>&& type): type(std::move(type)) {}
+        explicit SizeofExpression(std::unique_ptr<Expression>&& expression): expression(std::move(expression)) {}
+
+        virtual void accept(ExpressionVisitor&) const;
+
+        // the type whose size is taken, once the expression is analyzed
+        const Type* operand() const { return type ? type.get() : expression->resolved_type; }
+
+    public:
+        std::unique_ptr<Type> type;
+        std::unique_ptr<Expression> expression;
+};
+
 class CallExpression : public Expression {
     public:
         explicit CallExpression(const std::string& name):
@@ -363,6 +526,10 @@ class Type {
         virtual void accept(TypeVisitor& v) const = 0;
         virtual std::unique_ptr<Type> clone() const = 0;
         virtual std::size_t size() const = 0;
+        virtual std::size_t alignment() const;
+
+    public:
+        std::uint32_t offset = 0;
 };
 
 class VoidType : public Type {
@@ -414,7 +581,9 @@ class PointerType : public ScalarType {
         PointerType(std::unique_ptr<Type>&& pointed_type, std::size_t size):
             ScalarType(size),
             pointed_type_(std::move(pointed_type))
-        {}
+        {
+            offset = pointed_type_->offset;
+        }
 
         virtual void accept(TypeVisitor&) const;
         virtual std::unique_ptr<Type> clone() const;
@@ -424,6 +593,46 @@ class PointerType : public ScalarType {
         std::unique_ptr<Type> pointed_type_;
 };
 
+/*
+ * Arrays decay to a pointer to their first element when used as a value.
+ */
+class ArrayType : public Type {
+    public:
+        ArrayType(std::unique_ptr<Type>&& element_type, std::uint32_t count):
+            element_type_(std::move(element_type)),
+            count_(count)
+        {
+            offset = element_type_->offset;
+        }
+
+        virtual std::size_t size() const;
+        virtual std::size_t alignment() const;
+        virtual void accept(TypeVisitor&) const;
+        virtual std::unique_ptr<Type> clone() const;
+        const Type* element_type() const { return element_type_.get(); }
+        std::uint32_t count() const { return count_; }
+
+    private:
+        std::unique_ptr<Type> element_type_;
+        std::uint32_t count_;
+};
+
+class StructType : public Type {
+    public:
+        explicit StructType(const std::string& name): name(name) {}
+
+        virtual std::size_t size() const;
+        virtual std::size_t alignment() const;
+        virtual void accept(TypeVisitor&) const;
+        virtual std::unique_ptr<Type> clone() const;
+
+    public:
+        std::string name;
+
+        // set by the semantic analysis, null if the struct is not defined
+        mutable const StructEntity* definition = nullptr;
+};
+
 /*
  * Visitors
  */
@@ -431,6 +640,7 @@ class EntityVisitor {
     public:
         virtual void visit(const AssemblyEntity&) = 0;
         virtual void visit(const GlobalEntity&) = 0;
+        virtual void visit(const StructEntity&) = 0;
         virtual void visit(const FunctionEntity&) = 0;
 };
 
@@ -441,6 +651,9 @@ class InstructionVisitor {
         virtual void visit(const ExpressionInstruction&) = 0;
         virtual void visit(const IfInstruction&) = 0;
         virtual void visit(const WhileInstruction&) = 0;
+        virtual void visit(const ForInstruction&) = 0;
+        virtual void visit(const BreakInstruction&) = 0;
+        virtual void visit(const ContinueInstruction&) = 0;
         virtual void visit(const ReturnInstruction&) = 0;
         virtual void visit(const AssemblyInstruction&) = 0;
 };
@@ -459,6 +672,9 @@ class ExpressionVisitor {
         virtual void visit(const AffectationExpression&) = 0;
         virtual void visit(const CastExpression&) = 0;
         virtual void visit(const AccessExpression&) = 0;
+        virtual void visit(const MemberExpression&) = 0;
+        virtual void visit(const IndexExpression&) = 0;
+        virtual void visit(const SizeofExpression&) = 0;
         virtual void visit(const CallExpression&) = 0;
 };
 
@@ -470,8 +686,52 @@ class TypeVisitor {
         virtual void visit(const CharType&) = 0;
         virtual void visit(const NullType&) = 0;
         virtual void visit(const PointerType&) = 0;
+        virtual void visit(const ArrayType&) = 0;
+        virtual void visit(const StructType&) = 0;
+};
+
+/*
+ * Type helpers
+ */
+class TypeKind : public TypeVisitor {
+    public:
+        enum Kind {
+            Void,
+            Integer,
+            Boolean,
+            Char,
+            Null,
+            Pointer,
+            Array,
+            Struct,
+        };
+
+    public:
+        explicit TypeKind(const Type& type) { type.accept(*this); }
+
+        virtual void visit(const VoidType&);
+        virtual void visit(const IntegerType&);
+        virtual void visit(const BooleanType&);
+        virtual void visit(const CharType&);
+        virtual void visit(const NullType&);
+        virtual void visit(const PointerType&);
+        virtual void visit(const ArrayType&);
+        virtual void visit(const StructType&);
+
+        bool is_integral() const { return kind == Integer || kind == Char || kind == Boolean; }
+        bool is_pointer() const { return kind == Pointer || kind == Null || kind == Array; }
+        bool is_scalar() const { return kind != Void && kind != Array && kind != Struct; }
+
+    public:
+        Kind kind = Void;
+        const Type* pointed = nullptr;          // pointers and arrays
+        std::uint32_t count = 0;                // arrays
+        const StructEntity* structure = nullptr;
 };
 
+bool operator==(const Type& a, const Type& b);
+bool operator!=(const Type& a, const Type& b);
+
 /*
  * operator<<
  */
@@ -0,0 +1,460 @@
+#include "callgraph.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace microc {
+
+namespace {
+
+std::vector<std::string> function_names(const std::vector<ir::Function>& functions) {
+    std::vector<std::string> names;
+
+    for(const auto& function : functions) {
+        names.push_back(function.name);
+    }
+
+    return names;
+}
+
+std::vector<std::vector<std::string>> called_names(const std::vector<ir::Function>& functions) {
+    std::vector<std::vector<std::string>> calls(functions.size());
+
+    for(std::size_t i = 0; i < functions.size(); ++i) {
+        for(const auto& block : functions[i].blocks) {
+            for(const auto& instr : block.instrs) {
+                if(instr.op == ir::Opcode::Call) {
+                    calls[i].push_back(instr.symbol);
+                }
+            }
+        }
+    }
+
+    return calls;
+}
+
+} // namespace
+
+CallGraph::CallGraph(const std::vector<ir::Function>& functions):
+    CallGraph(function_names(functions), called_names(functions))
+{}
+
+CallGraph::CallGraph(const std::vector<std::string>& names, const std::vector<std::vector<std::string>>& calls):
+    callees_(names.size()),
+    calls_external_(names.size()),
+    recursive_(names.size()),
+    order_(names.size(), -1),
+    low_(names.size()),
+    on_stack_(names.size())
+{
+    for(std::size_t i = 0; i < names.size(); ++i) {
+        index_.emplace(names[i], i);
+    }
+
+    for(std::size_t i = 0; i < names.size(); ++i) {
+        for(const auto& symbol : calls[i]) {
+            int callee = find(symbol);
+
+            if(callee < 0) {
+                calls_external_[i] = true;
+            }
+            else if(std::find(callees_[i].begin(), callees_[i].end(), callee) == callees_[i].end()) {
+                callees_[i].push_back(callee);
+
+                if(static_cast<std::size_t>(callee) == i) {
+                    recursive_[i] = true;
+                }
+            }
+        }
+    }
+
+    for(std::uint32_t f = 0; f < names.size(); ++f) {
+        if(order_[f] < 0) {
+            connect(f);
+        }
+    }
+}
+
+int CallGraph::find(const std::string& name) const {
+    auto it = index_.find(name);
+    return it == index_.end() ? -1 : static_cast<int>(it->second);
+}
+
+std::vector<std::uint32_t> CallGraph::bottom_up() const {
+    std::vector<std::uint32_t> result;
+
+    for(const auto& component : components_) {
+        result.insert(result.end(), component.begin(), component.end());
+    }
+
+    return result;
+}
+
+/*
+ * Tarjan emits a component once all the components it reaches are emitted,
+ * which is the bottom-up order. Iterative, chains of calls may be long.
+ */
+void CallGraph::connect(std::uint32_t root) {
+    std::vector<std::pair<std::uint32_t, std::size_t>> calls;     // function, next callee
+
+    auto enter = [&](std::uint32_t f) {
+        order_[f] = low_[f] = counter_++;
+        stack_.push_back(f);
+        on_stack_[f] = true;
+        calls.emplace_back(f, 0);
+    };
+
+    enter(root);
+
+    while(!calls.empty()) {
+        std::uint32_t f = calls.back().first;
+
+        if(calls.back().second < callees_[f].size()) {
+            std::uint32_t callee = callees_[f][calls.back().second++];
+
+            if(order_[callee] < 0) {
+                enter(callee);
+            }
+            else if(on_stack_[callee]) {
+                low_[f] = std::min(low_[f], order_[callee]);
+            }
+
+            continue;
+        }
+
+        calls.pop_back();
+
+        if(!calls.empty()) {
+            std::uint32_t caller = calls.back().first;
+            low_[caller] = std::min(low_[caller], low_[f]);
+        }
+
+        if(low_[f] != order_[f]) {
+            continue;
+        }
+
+        std::vector<std::uint32_t> component;
+        std::uint32_t g;
+
+        do {
+            g = stack_.back();
+            stack_.pop_back();
+            on_stack_[g] = false;
+            component.push_back(g);
+        } while(g != f);
+
+        if(component.size() > 1) {
+            for(std::uint32_t h : component) {
+                recursive_[h] = true;
+            }
+        }
+
+        std::reverse(component.begin(), component.end());
+        components_.push_back(std::move(component));
+    }
+}
+
+namespace {
+
+class ArgumentValue {
+    public:
+        enum class State : std::uint8_t {
+            Unknown,    // no call seen yet
+            Constant,
+            Varying,
+        };
+
+    public:
+        State state = State::Unknown;
+        std::int32_t value = 0;
+
+        void merge(const ir::Operand& operand) {
+            if(!operand.is_immediate()) {
+                state = State::Varying;
+            }
+            else if(state == State::Unknown) {
+                state = State::Constant;
+                value = operand.value;
+            }
+            else if(state == State::Constant && value != operand.value) {
+                state = State::Varying;
+            }
+        }
+};
+
+void substitute(ir::Operand& operand, const std::unordered_map<ir::Register, std::int32_t>& constants) {
+    if(operand.is_register()) {
+        auto it = constants.find(operand.value);
+
+        if(it != constants.end()) {
+            operand = ir::Operand::imm(it->second);
+        }
+    }
+}
+
+} // namespace
+
+void propagate_constant_arguments(std::vector<ir::Function>& functions, const CallGraph& graph,
+                                  const std::vector<bool>& external) {
+    std::vector<std::uint32_t> order = graph.bottom_up();
+
+    // callers first, so that the constants they receive reach their callees
+    for(auto f = order.rbegin(); f != order.rend(); ++f) {
+        ir::Function& function = functions[*f];
+
+        if(external[*f]) {
+            continue;
+        }
+
+        std::vector<ArgumentValue> arguments;
+
+        for(const auto& slot : function.slots) {
+            if(slot.argument >= 0 && static_cast<std::size_t>(slot.argument) >= arguments.size()) {
+                arguments.resize(slot.argument + 1);
+            }
+        }
+
+        for(const auto& caller : functions) {
+            for(const auto& block : caller.blocks) {
+                for(const auto& instr : block.instrs) {
+                    if(instr.op != ir::Opcode::Call || instr.symbol != function.name) {
+                        continue;
+                    }
+
+                    for(std::size_t i = 0; i < arguments.size() && i < instr.args.size(); ++i) {
+                        arguments[i].merge(instr.args[i]);
+                    }
+                }
+            }
+        }
+
+        // arguments which are assigned keep their slot
+        std::vector<bool> assigned(function.slots.size());
+
+        for(const auto& block : function.blocks) {
+            for(const auto& instr : block.instrs) {
+                bool writes = instr.op == ir::Opcode::Store || instr.op == ir::Opcode::Address;
+
+                if(writes && instr.a.kind == ir::Operand::Kind::Slot) {
+                    assigned[instr.a.value] = true;
+                }
+            }
+        }
+
+        std::unordered_map<ir::Register, std::int32_t> constants;
+
+        for(auto& block : function.blocks) {
+            auto end = std::remove_if(block.instrs.begin(), block.instrs.end(), [&](const ir::Instr& instr) {
+                if(instr.op != ir::Opcode::Load || instr.a.kind != ir::Operand::Kind::Slot || instr.disp != 0) {
+                    return false;
+                }
+
+                const ir::Slot& slot = function.slots[instr.a.value];
+
+                if(slot.argument < 0 || assigned[instr.a.value]
+                   || arguments[slot.argument].state != ArgumentValue::State::Constant) {
+                    return false;
+                }
+
+                std::int32_t value = arguments[slot.argument].value;
+
+                if(instr.size == 1) {
+                    value = instr.sign ? static_cast<std::int8_t>(value) : static_cast<std::uint8_t>(value);
+                }
+
+                constants[instr.dst] = value;
+                return true;
+            });
+
+            block.instrs.erase(end, block.instrs.end());
+        }
+
+        if(constants.empty()) {
+            continue;
+        }
+
+        for(auto& block : function.blocks) {
+            for(auto& instr : block.instrs) {
+                substitute(instr.a, constants);
+                substitute(instr.b, constants);
+                substitute(instr.index, constants);
+
+                for(auto& arg : instr.args) {
+                    substitute(arg, constants);
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+std::size_t instr_count(const ir::Function& function) {
+    std::size_t n = 0;
+
+    for(const auto& block : function.blocks) {
+        n += block.instrs.size();
+    }
+
+    return n;
+}
+
+bool inlinable(const ir::Function& function) {
+    if(function.counts.empty() || function.counts[0] == 0 || function.counters > 0
+       || instr_count(function) > max_inlined_instrs) {
+        return false;
+    }
+
+    for(const auto& block : function.blocks) {
+        for(const auto& instr : block.instrs) {
+            if(instr.op == ir::Opcode::Asm) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Replaces the call at instrs[i] of a block of caller by a copy of the
+ * blocks of callee. The instructions after the call move to a new block,
+ * which the returns of the copy jump to.
+ */
+void inline_call(ir::Function& caller, std::uint32_t block, std::size_t i, const ir::Function& callee) {
+    ir::Register registers = caller.registers;
+    std::uint32_t slots = caller.slots.size();
+    std::uint32_t rest = caller.new_block();
+    std::uint32_t blocks = caller.blocks.size();
+    std::uint64_t calls = caller.counts[block];
+    ir::Instr call = caller.blocks[block].instrs[i];
+
+    caller.registers += callee.registers;
+    caller.counts.push_back(calls);
+    caller.taken.push_back(caller.taken[block]);
+    caller.taken[block] = 0;
+
+    for(const auto& slot : callee.slots) {
+        caller.new_slot(slot.size, slot.alignment);
+    }
+
+    auto& instrs = caller.blocks[block].instrs;
+    caller.blocks[rest].instrs.assign(instrs.begin() + i + 1, instrs.end());
+    instrs.erase(instrs.begin() + i, instrs.end());
+
+    for(std::uint32_t s = 0; s < callee.slots.size(); ++s) {
+        int argument = callee.slots[s].argument;
+
+        if(argument >= 0 && static_cast<std::size_t>(argument) < call.args.size()) {
+            ir::Instr store(ir::Opcode::Store);
+            store.size = callee.slots[s].size;
+            store.a = ir::Operand::slot(slots + s);
+            store.b = call.args[argument];
+            store.offset = call.offset;
+            instrs.push_back(store);
+        }
+    }
+
+    ir::Instr jump(ir::Opcode::Jump);
+    jump.targets[0] = blocks;
+    jump.offset = call.offset;
+    instrs.push_back(jump);
+
+    auto rename = [&](ir::Operand& op) {
+        if(op.is_register()) {
+            op.value += registers;
+        }
+        else if(op.kind == ir::Operand::Kind::Slot) {
+            op.value += slots;
+        }
+    };
+
+    for(const auto& original : callee.blocks) {
+        std::uint32_t id = caller.new_block();
+        caller.counts.push_back(callee.counts[original.id] * static_cast<double>(calls) / callee.counts[0]);
+        caller.taken.push_back(callee.taken[original.id] * static_cast<double>(calls) / callee.counts[0]);
+
+        for(ir::Instr instr : original.instrs) {
+            rename(instr.a);
+            rename(instr.b);
+            rename(instr.index);
+
+            for(auto& arg : instr.args) {
+                rename(arg);
+            }
+
+            if(instr.dst != ir::no_register) {
+                instr.dst += registers;
+            }
+
+            for(auto& result : instr.results) {
+                result += registers;
+            }
+
+            if(instr.op == ir::Opcode::Jump || instr.op == ir::Opcode::Branch) {
+                instr.targets[0] += blocks;
+                instr.targets[1] += blocks;
+            }
+
+            if(instr.op == ir::Opcode::Return) {
+                if(call.dst != ir::no_register) {
+                    ir::Instr copy(ir::Opcode::Copy);
+                    copy.dst = call.dst;
+                    copy.a = instr.a.is_none() ? ir::Operand::imm(0) : instr.a;
+                    copy.offset = instr.offset;
+                    caller.blocks[id].instrs.push_back(copy);
+                }
+
+                instr = ir::Instr(ir::Opcode::Jump);
+                instr.targets[0] = rest;
+                instr.offset = call.offset;
+            }
+
+            caller.blocks[id].instrs.push_back(instr);
+        }
+    }
+}
+
+} // namespace
+
+void inline_hot_calls(std::vector<ir::Function>& functions, const CallGraph& graph) {
+    std::uint64_t hottest = 0;
+
+    for(const auto& function : functions) {
+        for(std::uint64_t count : function.counts) {
+            hottest = std::max(hottest, count);
+        }
+    }
+
+    for(std::uint32_t f : graph.bottom_up()) {
+        ir::Function& caller = functions[f];
+
+        if(caller.counts.empty()) {
+            continue;
+        }
+
+        std::size_t size = instr_count(caller);
+
+        // blocks added by inlining are visited too, for the calls of the copies
+        for(std::uint32_t b = 0; b < caller.blocks.size(); ++b) {
+            for(std::size_t i = 0; i < caller.blocks[b].instrs.size(); ++i) {
+                const ir::Instr& instr = caller.blocks[b].instrs[i];
+                int callee = instr.op == ir::Opcode::Call ? graph.find(instr.symbol) : -1;
+
+                if(callee < 0 || static_cast<std::uint32_t>(callee) == f || graph.recursive(callee)
+                   || caller.counts[b] == 0 || caller.counts[b] * 100 < hottest
+                   || !inlinable(functions[callee])
+                   || size + instr_count(functions[callee]) > max_inlining_size) {
+                    continue;
+                }
+
+                size += instr_count(functions[callee]);
+                inline_call(caller, b, i, functions[callee]);
+                break;
+            }
+        }
+    }
+}
+
+} // namespace microc
@@ -0,0 +1,89 @@
+#ifndef MICROC_CALLGRAPH_HPP
+#define MICROC_CALLGRAPH_HPP
+
+#include "ir.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace microc {
+
+/*
+ * Calls between the functions of a program, from the Call instructions of
+ * their intermediate representation. Functions are numbered by their index
+ * in the vector given to the constructor.
+ */
+class CallGraph {
+    public:
+        explicit CallGraph(const std::vector<ir::Function>& functions);
+
+        // calls[f] names the functions f calls, in or outside the program
+        CallGraph(const std::vector<std::string>& names, const std::vector<std::vector<std::string>>& calls);
+
+        std::size_t size() const { return callees_.size(); }
+
+        // index of the function, -1 if it is not defined in the program
+        int find(const std::string& name) const;
+
+        // functions of the program called by f, without duplicates
+        const std::vector<std::uint32_t>& callees(std::uint32_t f) const { return callees_[f]; }
+
+        // whether f calls code outside the program, e.g. assembly
+        bool calls_external(std::uint32_t f) const { return calls_external_[f]; }
+
+        // whether f belongs to a cycle of calls
+        bool recursive(std::uint32_t f) const { return recursive_[f]; }
+
+        // strongly connected components, callees before their callers
+        const std::vector<std::vector<std::uint32_t>>& components() const { return components_; }
+
+        // every function, callees before their callers
+        std::vector<std::uint32_t> bottom_up() const;
+
+    private:
+        void connect(std::uint32_t root);
+
+    private:
+        std::unordered_map<std::string, std::uint32_t> index_;
+        std::vector<std::vector<std::uint32_t>> callees_;
+        std::vector<bool> calls_external_;
+        std::vector<bool> recursive_;
+        std::vector<std::vector<std::uint32_t>> components_;
+
+        // Tarjan's algorithm
+        std::vector<int> order_;
+        std::vector<int> low_;
+        std::vector<bool> on_stack_;
+        std::vector<std::uint32_t> stack_;
+        int counter_ = 0;
+};
+
+/*
+ * Replaces the arguments of a function by constants when every call in the
+ * program passes the same constant, and the function never assigns them.
+ * Functions marked external may be called from outside the program and are
+ * left alone.
+ */
+void propagate_constant_arguments(std::vector<ir::Function>& functions, const CallGraph& graph,
+                                  const std::vector<bool>& external);
+
+/*
+ * Inlines the hot calls to small functions, from the counts of a profile:
+ * calls made from a block which ran at least 1% as often as the hottest
+ * block of the program, to a function of at most max_inlined_instrs
+ * instructions which neither is recursive nor contains assembly. The
+ * arguments are stored into local copies of the callee's slots, and its
+ * blocks get counts in proportion to the calls. The callees are kept, and
+ * callees are done before their callers, until a caller reaches
+ * max_inlining_size instructions.
+ */
+const std::size_t max_inlined_instrs = 40;
+const std::size_t max_inlining_size = 2000;
+
+void inline_hot_calls(std::vector<ir::Function>& functions, const CallGraph& graph);
+
+} // namespace microc
+
+#endif // MICROC_CALLGRAPH_HPP
@@ -0,0 +1,1842 @@
+#include "callgraph.hpp"
+#include "codegen.hpp"
+#include "lowering.hpp"
+#include "mem2reg.hpp"
+#include "placement.hpp"
+#include "vectorize.hpp"
+#include "regalloc.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_set>
+
+namespace microc {
+
+namespace {
+
+const char* cond_suffix(ir::Cond c) {
+    switch(c) {
+        case ir::Cond::Eq:      return "e";
+        case ir::Cond::Ne:      return "ne";
+        case ir::Cond::Lt:      return "l";
+        case ir::Cond::Le:      return "le";
+        case ir::Cond::Gt:      return "g";
+        case ir::Cond::Ge:      return "ge";
+        case ir::Cond::Below:   return "b";
+        case ir::Cond::BelowEq: return "be";
+        case ir::Cond::Above:   return "a";
+        case ir::Cond::AboveEq: return "ae";
+        default: assert(false && "unknown condition");
+    }
+}
+
+const char* binary_mnemonic(ir::Opcode op) {
+    switch(op) {
+        case ir::Opcode::Add: return "addl";
+        case ir::Opcode::Sub: return "subl";
+        case ir::Opcode::Mul: return "imull";
+        case ir::Opcode::And: return "andl";
+        case ir::Opcode::Or:  return "orl";
+        case ir::Opcode::Xor: return "xorl";
+        default: assert(false && "not a two-operand instruction");
+    }
+}
+
+/*
+ * Adds the names appearing in a piece of assembly code to names.
+ */
+void collect_identifiers(const std::string& assembly, std::unordered_set<std::string>& names) {
+    auto is_start = [](char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$'; };
+    auto is_part = [&](char c) { return is_start(c) || std::isdigit(static_cast<unsigned char>(c)); };
+
+    for(std::size_t i = 0; i < assembly.size();) {
+        if(!is_start(assembly[i]) || (i > 0 && is_part(assembly[i - 1]))) {
+            ++i;
+            continue;
+        }
+
+        std::size_t end = i;
+
+        while(end < assembly.size() && is_part(assembly[end])) {
+            ++end;
+        }
+
+        names.insert(assembly.substr(i, end - i));
+        i = end;
+    }
+}
+
+std::string escape(const std::string& s) {
+    std::string result;
+
+    for(unsigned char c : s) {
+        switch(c) {
+            case '\n': result += "\\n"; break;
+            case '\t': result += "\\t"; break;
+            case '\r': result += "\\r"; break;
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            default:
+                if(c < 0x20 || c >= 0x7f) {
+                    char buffer[5];
+                    std::snprintf(buffer, sizeof(buffer), "\\%03o", c);
+                    result += buffer;
+                }
+                else {
+                    result += c;
+                }
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Estimated length of an instruction line, for the forms the generator
+ * emits: an opcode, a ModR/M byte when there is an operand, a SIB byte, a
+ * displacement and an immediate. Jumps are assumed short, the assembler
+ * making them near when their target is too far.
+ */
+std::size_t instruction_size(const std::string& line) {
+    std::size_t start = line.find_first_not_of(" \t");
+
+    if(start == std::string::npos || line[start] == '.' || line[start] == '#' || line.back() == ':') {
+        return 0;
+    }
+
+    std::size_t space = line.find_first_of(" \t", start);
+    std::string mnemonic = line.substr(start, space == std::string::npos ? std::string::npos : space - start);
+    std::vector<std::string> operands;
+
+    if(space != std::string::npos) {
+        int depth = 0;
+        std::string operand;
+
+        for(char c : line.substr(space)) {
+            if(c == ',' && depth == 0) {
+                operands.push_back(operand);
+                operand.clear();
+                continue;
+            }
+
+            depth += c == '(' ? 1 : c == ')' ? -1 : 0;
+
+            if(c != ' ' && c != '\t') {
+                operand += c;
+            }
+        }
+
+        if(!operand.empty()) {
+            operands.push_back(operand);
+        }
+    }
+
+    auto is_register = [](const std::string& op) { return !op.empty() && op[0] == '%'; };
+    auto is_immediate = [](const std::string& op) { return !op.empty() && op[0] == '$'; };
+    auto is_small = [](const std::string& digits) {
+        char* end;
+        long value = std::strtol(digits.c_str(), &end, 0);
+        return !digits.empty() && *end == '\0' && value >= -128 && value <= 127;
+    };
+
+    // bytes after the ModR/M byte addressing a register or memory operand
+    auto addressing = [&](const std::string& op) -> std::size_t {
+        if(is_register(op)) {
+            return 0;
+        }
+
+        std::size_t paren = op.find('(');
+
+        if(paren == std::string::npos) {
+            return 4;
+        }
+
+        std::string disp = op.substr(0, paren);
+        std::string inside = op.substr(paren + 1, op.size() - paren - 2);
+        std::string base = inside.substr(0, inside.find(','));
+        std::size_t sib = inside.find(',') != std::string::npos || base == "%esp" ? 1 : 0;
+
+        if(base.empty()) {
+            return sib + 4;
+        }
+        else if((disp.empty() || disp == "0") && base != "%ebp") {
+            return sib;
+        }
+
+        return sib + (is_small(disp.empty() ? "0" : disp) ? 1 : 4);
+    };
+
+    std::string op1 = operands.size() > 0 ? operands[0] : "";
+    std::string op2 = operands.size() > 1 ? operands[1] : "";
+    std::string rm = operands.size() > 1 && !is_register(op1) && !is_immediate(op1) ? op1 : op2.empty() ? op1 : op2;
+    std::size_t immediate = is_immediate(op1) ? (is_small(op1.substr(1)) ? 1 : 4) : 0;
+
+    if(operands.empty()) {
+        return mnemonic == "ud2" ? 2 : 1;
+    }
+    else if(mnemonic == "call") {
+        return 5;
+    }
+    else if(mnemonic[0] == 'j') {
+        return op1[0] == '*' ? 2 + addressing(op1.substr(1)) : 2;
+    }
+    else if(mnemonic == "int") {
+        return 2;
+    }
+    else if(mnemonic.compare(0, 4, "movd") == 0 || (mnemonic[0] == 'p' && mnemonic.compare(0, 3, "pop") != 0
+                                                    && mnemonic.compare(0, 4, "push") != 0)) {
+        // SSE2: a prefix, 0x0f and the opcode
+        return (mnemonic == "pshufd" ? 5 : 4) + addressing(is_register(op1) || is_immediate(op1) ? op2 : op1);
+    }
+    else if(mnemonic == "pushl" || mnemonic == "popl") {
+        return is_register(op1) ? 1 : is_immediate(op1) ? 1 + immediate : 2 + addressing(op1);
+    }
+    else if(mnemonic.compare(0, 3, "set") == 0 || mnemonic.compare(0, 4, "cmov") == 0
+            || mnemonic == "movzbl" || mnemonic == "movsbl" || (mnemonic == "imull" && operands.size() == 2 && !is_immediate(op1))) {
+        return 3 + addressing(operands.size() > 1 && !is_register(op1) ? op1 : rm);
+    }
+    else if(mnemonic == "movl" && is_immediate(op1)) {
+        return is_register(op2) ? 5 : 6 + addressing(op2);
+    }
+    else if(mnemonic == "movb" && is_immediate(op1)) {
+        return 3 + addressing(op2);
+    }
+    else if(mnemonic == "sall" || mnemonic == "sarl" || mnemonic == "shrl") {
+        return (op1 == "$1" || op1 == "%cl" ? 2 : 3) + addressing(op2);
+    }
+    else if(mnemonic == "imull" && is_immediate(op1)) {
+        return 2 + immediate + addressing(op2);
+    }
+    else if(is_immediate(op1)) {
+        // the 32-bit form is one byte shorter on %eax
+        return immediate == 4 && op2 == "%eax" ? 5 : 2 + immediate + addressing(op2);
+    }
+
+    return 2 + addressing(rm);
+}
+
+// registers of the arguments passed in registers, in order
+const x86::Register regparm_registers[] = {x86::eax, x86::edx, x86::ecx};
+
+/*
+ * Instruction selection for one function, once registers are allocated.
+ *
+ * Frame layout, from the incoming arguments down to %esp:
+ *
+ *   8+4i(%ebp)     argument i
+ *   4(%ebp)        return address
+ *   0(%ebp)        saved %ebp
+ *                  saved callee registers
+ *                  locals, then spill slots
+ *   4i(%esp)       outgoing argument i
+ *
+ * %esp stays 16-byte aligned at calls. Leaf functions, which neither call
+ * nor contain inline assembly, do not save %ebp and address their frame
+ * from %esp.
+ *
+ * With regparm, the first arguments come in %eax, %edx and %ecx instead,
+ * and are stored into local slots on entry; the stack arguments are
+ * numbered from the first one which is not in a register.
+ */
+class FunctionGenerator {
+    public:
+        FunctionGenerator(std::ostream& out, const ir::Function& function, const SourceMap& source,
+                          const CodeGenOptions& options, const std::unordered_map<std::string, std::uint8_t>& regparm):
+            sink_(out),
+            function_(function),
+            source_(source),
+            debug_(options.debug),
+            tail_calls_(options.tail_calls),
+            align_functions_(options.align_functions),
+            align_loops_(options.align_loops),
+            measure_(options.code_size),
+            regparm_(regparm),
+            allocation_(function)
+        {
+            layout();
+        }
+
+        // bytes of stack used by the function, return address included
+        std::uint32_t stack_size() const {
+            return 4 + (leaf_ ? 0 : 4) + 4 * allocation_.saved.size() + frame_size_;
+        }
+
+        // with CodeGenOptions::code_size, once emitted
+        const CodeSize& code_size() const { return size_; }
+
+        OptimizationReport optimizations() const {
+            OptimizationReport report;
+            report.name = function_.name;
+            report.offset = function_.offset;
+            report.eliminated = function_.eliminated;
+            report.promoted = function_.promoted;
+            return report;
+        }
+
+        void emit() {
+            const std::string& name = function_.name;
+
+            out_ << "\t.text\n";
+            align(align_functions_);
+            out_ << "\t.globl\t" << name << "\n"
+                 << "\t.type\t" << name << ", @function\n"
+                 << name << ":\n"
+                 << "\t.cfi_startproc\n";
+
+            location(function_.offset);
+
+            if(!leaf_) {
+                out_ << "\tpushl\t%ebp\n"
+                     << "\t.cfi_def_cfa_offset 8\n"
+                     << "\t.cfi_offset 5, -8\n"
+                     << "\tmovl\t%esp, %ebp\n"
+                     << "\t.cfi_def_cfa_register 5\n";
+            }
+
+            int cfa = leaf_ ? 4 : 8;
+
+            for(x86::Register reg : allocation_.saved) {
+                cfa += 4;
+                out_ << "\tpushl\t" << x86::register_str(reg) << "\n";
+
+                if(leaf_) {
+                    out_ << "\t.cfi_def_cfa_offset " << cfa << "\n";
+                }
+
+                out_ << "\t.cfi_offset " << static_cast<int>(reg) << ", " << -cfa << "\n";
+            }
+
+            if(frame_size_ > 0) {
+                out_ << "\tsubl\t$" << frame_size_ << ", %esp\n";
+
+                if(leaf_) {
+                    out_ << "\t.cfi_def_cfa_offset " << cfa + frame_size_ << "\n";
+                }
+            }
+
+            for(std::size_t i = 0; i < function_.slots.size(); ++i) {
+                int argument = function_.slots[i].argument;
+
+                if(argument >= 0 && argument < function_.regparm && used_[i]) {
+                    out_ << "\tmovl\t" << x86::register_str(regparm_registers[argument]) << ", " << slot(i) << "\n";
+                }
+            }
+
+            std::vector<bool> targeted(function_.blocks.size());
+
+            for(const auto& block : function_.blocks) {
+                if(block.terminated()) {
+                    for(std::uint32_t succ : block.successors()) {
+                        targeted[succ] = true;
+                    }
+                }
+            }
+
+            // the cold blocks at the end go after the epilogue, out of line
+            cold_ = function_.blocks.size();
+
+            while(cold_ > 1 && function_.blocks[cold_ - 1].cold) {
+                --cold_;
+            }
+
+            for(const auto& block : function_.blocks) {
+                if(block.id == cold_) {
+                    emit_epilogue(cfa, true);
+                }
+
+                if(block.align) {
+                    align(align_loops_);
+                    ++size_.loops;
+                }
+
+                if(targeted[block.id]) {
+                    out_ << label(block.id) << ":\n";
+                }
+
+                for(std::size_t i = 0; i < block.instrs.size(); ++i) {
+                    location(block.instrs[i].offset);
+
+                    if(is_tail_call(block, i)) {
+                        emit_tail_call(block.instrs[i]);
+                        break;
+                    }
+
+                    emit(block, block.instrs[i]);
+                }
+            }
+
+            if(cold_ == function_.blocks.size()) {
+                emit_epilogue(cfa, false);
+            }
+
+            if(traps_) {
+                out_ << ".L" << name << "_trap:\n"
+                     << "\tud2\n";
+            }
+
+            out_ << "\t.cfi_endproc\n";
+            std::string code = out_.str();
+            out_ << ".L" << name << "_end:\n"
+                 << "\t.size\t" << name << ", .-" << name << "\n";
+
+            if(function_.counters > 0) {
+                emit_counters();
+            }
+
+            if(measure_) {
+                measure(code);
+            }
+
+            sink_ << out_.str();
+        }
+
+    private:
+        /*
+         * Emitted at the end of the hot blocks, so that the cold ones follow
+         * it: their unwind information is then the one of the body, which
+         * the epilogue changes.
+         */
+        void emit_epilogue(int cfa, bool more) {
+            out_ << ".L" << function_.name << "_ret:\n";
+
+            if(dumps_profile()) {
+                out_ << "\tcall\t__microc_profile_dump\n";
+            }
+
+            if(more) {
+                out_ << "\t.cfi_remember_state\n";
+            }
+
+            if(leaf_) {
+                if(frame_size_ > 0) {
+                    out_ << "\taddl\t$" << frame_size_ << ", %esp\n"
+                         << "\t.cfi_def_cfa_offset " << cfa << "\n";
+                }
+
+                for(auto it = allocation_.saved.rbegin(); it != allocation_.saved.rend(); ++it) {
+                    cfa -= 4;
+                    out_ << "\tpopl\t" << x86::register_str(*it) << "\n"
+                         << "\t.cfi_def_cfa_offset " << cfa << "\n";
+                }
+            }
+            else {
+                leave();
+            }
+
+            out_ << "\tret\n";
+
+            if(more) {
+                out_ << "\t.cfi_restore_state\n";
+            }
+
+            cold_start_ = out_.tellp();
+        }
+
+        void align(std::uint32_t bytes) {
+            if(bytes > 1) {
+                int log = 0;
+
+                while((1u << log) < bytes) {
+                    ++log;
+                }
+
+                out_ << "\t.p2align\t" << log << "\n";
+            }
+        }
+
+        /*
+         * The estimated size of the function from its code, up to the end of
+         * its epilogue for the hot part, the start of the function being
+         * taken as aligned.
+         */
+        void measure(const std::string& code) {
+            std::istringstream lines(code);
+            std::string line;
+            std::uint32_t offset = 0;
+
+            size_.name = function_.name;
+            size_.offset = function_.offset;
+
+            for(std::streamoff pos = 0; std::getline(lines, line); pos = lines.tellg()) {
+                bool cold = pos >= cold_start_;
+
+                if(line.compare(0, 10, "\t.p2align\t") == 0) {
+                    std::uint32_t bytes = 1u << std::stoi(line.substr(10));
+                    std::uint32_t padding = (bytes - offset % bytes) % bytes;
+                    size_.padding += padding;
+                    offset += padding;
+                    continue;
+                }
+
+                std::uint32_t bytes = instruction_size(line);
+                offset += bytes;
+                (cold ? size_.cold : size_.hot) += bytes;
+            }
+        }
+
+        /*
+         * The record of the function in the profile, see Profile, its
+         * counters being zero until the program runs.
+         */
+        void emit_counters() {
+            const std::string& name = function_.name;
+
+            out_ << "\t.section\tmicroc_profile,\"aw\",@progbits\n"
+                 << "\t.p2align\t2\n"
+                 << "\t.long\t" << name.size() << "\n"
+                 << "\t.ascii\t\"" << name << "\"\n"
+                 << "\t.balign\t4, 0\n"
+                 << "\t.long\t" << function_.checksum << "\n"
+                 << "\t.long\t" << function_.counters << "\n"
+                 << ".L" << name << "_counts:\n"
+                 << "\t.zero\t" << 8 * function_.counters << "\n";
+        }
+
+        // main writes the profile when it returns
+        bool dumps_profile() const {
+            return function_.counters > 0 && function_.name == "main";
+        }
+
+        void layout() {
+            std::size_t outgoing = 0;
+            leaf_ = true;
+            used_.resize(function_.slots.size());
+
+            auto use = [&](const ir::Operand& op) {
+                if(op.kind == ir::Operand::Kind::Slot) {
+                    used_[op.value] = true;
+                }
+            };
+
+            for(const auto& block : function_.blocks) {
+                for(const auto& instr : block.instrs) {
+                    if(instr.op == ir::Opcode::Call) {
+                        outgoing = std::max(outgoing, instr.args.size() - passed_in_registers(instr));
+                        leaf_ = false;
+                    }
+                    else if(instr.op == ir::Opcode::Asm && !instr.extended) {
+                        leaf_ = false;
+                    }
+
+                    // the address of a local may outlive the frame
+                    bool based = instr.op == ir::Opcode::Load || instr.op == ir::Opcode::Store;
+
+                    if((instr.a.kind == ir::Operand::Kind::Slot && !based)
+                       || instr.b.kind == ir::Operand::Kind::Slot || instr.index.kind == ir::Operand::Kind::Slot) {
+                        frame_escapes_ = true;
+                    }
+
+                    for(const auto& arg : instr.args) {
+                        frame_escapes_ = frame_escapes_ || arg.kind == ir::Operand::Kind::Slot;
+                        use(arg);
+                    }
+
+                    use(instr.a);
+                    use(instr.b);
+                    use(instr.index);
+                }
+            }
+
+            // offsets are relative to where %ebp points, or would point
+            // without the saved %ebp in leaf functions
+            std::int32_t cursor = 4 * allocation_.saved.size();
+            std::int32_t arguments = leaf_ ? 4 : 8;
+            slot_offsets_.resize(function_.slots.size());
+
+            // %esp is only known to be 4-byte aligned
+            auto alignment = [&](std::size_t i) {
+                return std::min<std::int32_t>(function_.slots[i].alignment, 4);
+            };
+
+            // unused slots, such as promoted locals, take no room, and the
+            // most aligned go first so that no padding is needed
+            std::vector<std::size_t> locals;
+
+            for(std::size_t i = 0; i < function_.slots.size(); ++i) {
+                const ir::Slot& slot = function_.slots[i];
+
+                if(slot.argument >= function_.regparm) {
+                    slot_offsets_[i] = arguments + 4 * (slot.argument - function_.regparm);
+                }
+                else if(used_[i]) {
+                    locals.push_back(i);
+                }
+            }
+
+            std::stable_sort(locals.begin(), locals.end(), [&](std::size_t a, std::size_t b) {
+                return alignment(a) > alignment(b);
+            });
+
+            for(std::size_t i : locals) {
+                std::int32_t align = alignment(i);
+                cursor += function_.slots[i].size;
+                cursor = (cursor + align - 1) / align * align;
+                slot_offsets_[i] = -cursor;
+            }
+
+            cursor = (cursor + 3) / 4 * 4;
+            spill_base_ = cursor;
+            cursor += 4 * allocation_.spills;
+            cursor += 4 * outgoing;
+
+            if(!leaf_) {
+                // return address and saved %ebp are above the cursor
+                cursor = (cursor + 8 + 15) / 16 * 16 - 8;
+            }
+
+            frame_size_ = cursor - 4 * allocation_.saved.size();
+        }
+
+        /*
+         * Restores the registers of the caller and pops the frame, in a
+         * function which is not a leaf.
+         */
+        void leave() {
+            if(!allocation_.saved.empty()) {
+                out_ << "\tleal\t" << -4 * static_cast<int>(allocation_.saved.size()) << "(%ebp), %esp\n";
+
+                for(auto it = allocation_.saved.rbegin(); it != allocation_.saved.rend(); ++it) {
+                    out_ << "\tpopl\t" << x86::register_str(*it) << "\n";
+                }
+            }
+            else if(frame_size_ > 0) {
+                out_ << "\tmovl\t%ebp, %esp\n";
+            }
+
+            out_ << "\tpopl\t%ebp\n"
+                 << "\t.cfi_def_cfa 4, 4\n";
+        }
+
+        std::uint8_t regparm(const std::string& callee) const {
+            auto it = regparm_.find(callee);
+            return it == regparm_.end() ? 0 : it->second;
+        }
+
+        std::size_t passed_in_registers(const ir::Instr& call) const {
+            return std::min<std::size_t>(call.args.size(), regparm(call.symbol));
+        }
+
+        /*
+         * A call whose result is returned right away, or a call followed by
+         * a return without value, can jump to the callee, which returns
+         * to our caller. Its stack arguments replace ours, so there must be
+         * at most as many, and nothing it receives may point into our
+         * frame.
+         */
+        bool is_tail_call(const ir::Block& block, std::size_t i) const {
+            const ir::Instr& instr = block.instrs[i];
+
+            if(!tail_calls_ || instr.op != ir::Opcode::Call || i + 2 != block.instrs.size() || frame_escapes_
+               || dumps_profile()) {
+                return false;
+            }
+
+            const ir::Instr& ret = block.instrs[i + 1];
+
+            const ir::Operand& result = ret.a;
+            bool returns_call = result.is_none() || (result.is_register() && result.value == static_cast<std::int32_t>(instr.dst));
+
+            if(ret.op != ir::Opcode::Return || !returns_call) {
+                return false;
+            }
+
+            std::size_t incoming = 0;
+
+            for(const auto& slot : function_.slots) {
+                if(slot.argument >= function_.regparm) {
+                    incoming = std::max<std::size_t>(incoming, slot.argument - function_.regparm + 1);
+                }
+            }
+
+            return instr.args.size() - passed_in_registers(instr) <= incoming;
+        }
+
+        /*
+         * Arguments are written over ours, the frame is popped, then the
+         * callee is entered with a jump.
+         */
+        void emit_tail_call(const ir::Instr& call) {
+            std::size_t in_registers = passed_in_registers(call);
+
+            for(std::size_t i = in_registers; i < call.args.size(); ++i) {
+                std::string v = value_in_register(call.args[i], call, x86::eax);
+                out_ << "\tmovl\t" << v << ", " << frame(8 + 4 * (i - in_registers)) << "\n";
+            }
+
+            load_register_arguments(call);
+
+            out_ << "\t.cfi_remember_state\n";
+            leave();
+            out_ << "\tjmp\t" << call.symbol << "\n"
+                 << "\t.cfi_restore_state\n";
+        }
+
+        void load_register_arguments(const ir::Instr& call) {
+            for(std::size_t i = 0; i < passed_in_registers(call); ++i) {
+                x86::Register reg = regparm_registers[i];
+                move(value(call.args[i], call, reg), x86::register_str(reg));
+            }
+        }
+
+        /*
+         * Inputs are moved into the registers of their operands, which hold
+         * no other live value, %N is replaced by operand N in the template,
+         * and outputs are moved to their virtual registers.
+         */
+        void emit_extended_asm(const ir::Instr& instr) {
+            AsmRegisters registers(instr);
+            const auto& operands = instr.extended->operands;
+
+            for(std::size_t i = 0; i < operands.size(); ++i) {
+                char c = operands[i].constraint;
+
+                if(operands[i].arg >= 0 && c != 'i' && c != 'n') {
+                    x86::Register reg = registers.operands[i];
+                    move(value(instr.args[operands[i].arg], instr, reg), x86::register_str(reg));
+                }
+            }
+
+            const std::string& assembly = instr.symbol;
+
+            for(std::size_t i = 0; i < assembly.size(); ++i) {
+                char next = i + 1 < assembly.size() ? assembly[i + 1] : '\0';
+                std::size_t n = next - '0';
+
+                if(assembly[i] != '%' || (next != '%' && (!std::isdigit(next) || n >= operands.size()))) {
+                    out_ << assembly[i];
+                    continue;
+                }
+
+                ++i;
+
+                if(next == '%') {
+                    out_ << '%';
+                }
+                else if(operands[n].constraint == 'i' || operands[n].constraint == 'n') {
+                    out_ << "$" << instr.args[operands[n].arg].value;
+                }
+                else if(operands[n].constraint == 'm') {
+                    out_ << "(" << x86::register_str(registers.operands[n]) << ")";
+                }
+                else {
+                    out_ << x86::register_str(registers.operands[n]);
+                }
+            }
+
+            out_ << "\n";
+
+            for(std::size_t i = 0; i < operands.size(); ++i) {
+                if(operands[i].result >= 0) {
+                    move(x86::register_str(registers.operands[i]), loc(instr.results[operands[i].result]));
+                }
+            }
+        }
+
+        /*
+         * 16 bytes per iteration, %ecx going from 0 to instr.b. Values are
+         * first broadcast to %xmm1 and %xmm2, arrays are read into %xmm0
+         * and %xmm3 without alignment, their addresses being kept in their
+         * registers, in %eax and %edx when spilled, or reloaded every time
+         * if the three of them are.
+         */
+        void emit_vector(const ir::Instr& instr) {
+            const ir::VectorOp& vector = *instr.vector;
+            std::string loop = ".L" + function_.name + "_vector" + std::to_string(vectors_++);
+            const char* element = instr.size == 1 ? "b" : "d";
+            std::vector<const ir::Operand*> arrays;
+
+            for(std::size_t i = 0; i < instr.args.size(); ++i) {
+                std::string xmm = "%xmm" + std::to_string(i + 1);
+
+                if(vector.arrays[i]) {
+                    arrays.push_back(&instr.args[i]);
+                    continue;
+                }
+
+                move(value(instr.args[i], instr, x86::eax), "%eax");
+
+                if(instr.size == 1) {
+                    out_ << "\tmovzbl\t%al, %eax\n"
+                         << "\timull\t$0x01010101, %eax, %eax\n";
+                }
+
+                out_ << "\tmovd\t%eax, " << xmm << "\n"
+                     << "\tpshufd\t$0, " << xmm << ", " << xmm << "\n";
+            }
+
+            arrays.push_back(&instr.a);
+            std::size_t spilled = std::count_if(arrays.begin(), arrays.end(), [this](const ir::Operand* op) {
+                return in_memory(*op);
+            });
+            std::vector<std::string> bases;
+            const char* const scratch[] = {"%eax", "%edx"};
+            std::size_t hoisted = 0;
+
+            for(const ir::Operand* op : arrays) {
+                bases.push_back(loc(op->value));
+
+                if(in_memory(*op) && spilled <= 2) {
+                    move(bases.back(), scratch[hoisted]);
+                    bases.back() = scratch[hoisted++];
+                }
+            }
+
+            auto base = [&](std::size_t k) {
+                if(bases[k][0] != '%') {
+                    move(bases[k], "%eax");
+                    return std::string("%eax");
+                }
+
+                return bases[k];
+            };
+
+            std::string count = value(instr.b, instr, x86::edx);
+            std::string result = "%xmm0";
+            out_ << "\txorl\t%ecx, %ecx\n"
+                 << loop << ":\n";
+
+            if(vector.arrays[0]) {
+                out_ << "\tmovdqu\t(" << base(0) << ",%ecx), %xmm0\n";
+            }
+            else if(vector.op != ir::Opcode::Copy) {
+                out_ << "\tmovdqa\t%xmm1, %xmm0\n";
+            }
+            else {
+                result = "%xmm1";
+            }
+
+            if(vector.op != ir::Opcode::Copy) {
+                std::string operand = "%xmm2";
+
+                if(vector.arrays[1]) {
+                    out_ << "\tmovdqu\t(" << base(vector.arrays[0] ? 1 : 0) << ",%ecx), %xmm3\n";
+                    operand = "%xmm3";
+                }
+
+                switch(vector.op) {
+                    case ir::Opcode::Add: out_ << "\tpadd" << element; break;
+                    case ir::Opcode::Sub: out_ << "\tpsub" << element; break;
+                    case ir::Opcode::And: out_ << "\tpand"; break;
+                    case ir::Opcode::Or:  out_ << "\tpor"; break;
+                    case ir::Opcode::Xor: out_ << "\tpxor"; break;
+                    default: assert(false && "unknown vector operation");
+                }
+
+                out_ << "\t" << operand << ", %xmm0\n";
+            }
+
+            out_ << "\tmovdqu\t" << result << ", (" << base(arrays.size() - 1) << ",%ecx)\n"
+                 << "\taddl\t$16, %ecx\n"
+                 << "\tcmpl\t" << count << ", %ecx\n"
+                 << "\tjb\t" << loop << "\n";
+        }
+
+        void location(std::uint32_t offset) {
+            if(!debug_) {
+                return;
+            }
+
+            SourceLocation loc = source_.location(offset);
+
+            if(loc.line != line_ || loc.column != column_) {
+                out_ << "\t.loc 1 " << loc.line << " " << loc.column << "\n";
+                line_ = loc.line;
+                column_ = loc.column;
+            }
+        }
+
+        // whether the code of target directly follows the block
+        bool falls_to(const ir::Block& block, std::uint32_t target) const {
+            return target == block.id + 1 && target != cold_;
+        }
+
+        std::string label(std::uint32_t block) const {
+            return ".L" + function_.name + "_" + std::to_string(block);
+        }
+
+        std::string frame(std::int32_t offset) const {
+            if(leaf_) {
+                offset += 4 * allocation_.saved.size() + frame_size_;
+                return std::to_string(offset) + "(%esp)";
+            }
+
+            return std::to_string(offset) + "(%ebp)";
+        }
+
+        std::string slot(std::uint32_t s, std::int32_t disp = 0) const {
+            return frame(slot_offsets_[s] + disp);
+        }
+
+        /*
+         * Where a virtual register lives: a register or a spill slot.
+         */
+        std::string loc(ir::Register r) const {
+            const Location& l = allocation_[r];
+
+            if(l.kind == Location::Kind::Register) {
+                return x86::register_str(l.reg);
+            }
+
+            return frame(-spill_base_ - 4 - 4 * static_cast<std::int32_t>(l.spill));
+        }
+
+        bool in_register(ir::Register r) const {
+            return allocation_[r].kind == Location::Kind::Register;
+        }
+
+        bool in_memory(const ir::Operand& op) const {
+            return op.is_register() && !in_register(op.value);
+        }
+
+        /*
+         * A register, memory or immediate operand holding the value of op.
+         * Slot addresses are first computed into scratch.
+         */
+        std::string value(const ir::Operand& op, const ir::Instr& instr, x86::Register scratch) {
+            switch(op.kind) {
+                case ir::Operand::Kind::Register:
+                    return loc(op.value);
+                case ir::Operand::Kind::Immediate:
+                    return "$" + std::to_string(op.value);
+                case ir::Operand::Kind::Symbol:
+                    return "$" + instr.symbol;
+                case ir::Operand::Kind::Slot:
+                    out_ << "\tleal\t" << slot(op.value) << ", " << x86::register_str(scratch) << "\n";
+                    return x86::register_str(scratch);
+                default:
+                    assert(false && "no value");
+            }
+        }
+
+        /*
+         * Same as value(), but never a memory operand.
+         */
+        std::string value_in_register(const ir::Operand& op, const ir::Instr& instr, x86::Register scratch) {
+            std::string v = value(op, instr, scratch);
+
+            if(in_memory(op)) {
+                move(v, x86::register_str(scratch));
+                return x86::register_str(scratch);
+            }
+
+            return v;
+        }
+
+        /*
+         * The memory operand at instr.a + instr.disp + instr.index * scale,
+         * the base and the index being loaded into scratch registers if
+         * needed.
+         */
+        std::string memory(const ir::Instr& instr, x86::Register scratch, x86::Register index_scratch) {
+            const ir::Operand& a = instr.a;
+            std::int32_t disp = instr.disp;
+            std::string index;
+
+            if(instr.index.is_immediate()) {
+                disp += instr.index.value * instr.scale;
+            }
+            else if(!instr.index.is_none()) {
+                index = "," + value_in_register(instr.index, instr, index_scratch) + ","
+                        + std::to_string(instr.scale);
+            }
+
+            switch(a.kind) {
+                case ir::Operand::Kind::Slot: {
+                    std::string mem = slot(a.value, disp);
+                    return mem.insert(mem.size() - 1, index);
+                }
+                case ir::Operand::Kind::Symbol: {
+                    std::string mem = disp == 0 ? instr.symbol : instr.symbol + "+" + std::to_string(disp);
+                    return index.empty() ? mem : mem + "(" + index + ")";
+                }
+                case ir::Operand::Kind::Immediate:
+                    return std::to_string(a.value + disp) + (index.empty() ? "" : "(" + index + ")");
+                case ir::Operand::Kind::Register: {
+                    std::string base = value_in_register(a, instr, scratch);
+                    return (disp == 0 ? "" : std::to_string(disp)) + "(" + base + index + ")";
+                }
+                default:
+                    assert(false && "no address");
+            }
+        }
+
+        void move(const std::string& src, const std::string& dst) {
+            if(src != dst) {
+                out_ << "\tmovl\t" << src << ", " << dst << "\n";
+            }
+        }
+
+        /*
+         * The register to compute instr.dst into: its own register if it
+         * has one that does not hold the second operand, %eax otherwise.
+         */
+        std::string target(const ir::Instr& instr) const {
+            if(in_register(instr.dst) && !(instr.b.is_register() && loc(instr.b.value) == loc(instr.dst))) {
+                return loc(instr.dst);
+            }
+
+            return "%eax";
+        }
+
+        void store_result(const ir::Instr& instr, const std::string& reg) {
+            move(reg, loc(instr.dst));
+        }
+
+        void compare(const ir::Instr& instr) {
+            std::string b = value(instr.b, instr, x86::edx);
+            std::string a;
+
+            if(instr.a.is_register() && (in_register(instr.a.value) || !in_memory(instr.b))) {
+                a = loc(instr.a.value);
+            }
+            else {
+                a = "%eax";
+                move(value(instr.a, instr, x86::eax), a);
+            }
+
+            out_ << "\tcmpl\t" << b << ", " << a << "\n";
+        }
+
+        void emit(const ir::Block& block, const ir::Instr& instr) {
+            switch(instr.op) {
+                case ir::Opcode::Copy: {
+                    std::string a = value(instr.a, instr, x86::eax);
+
+                    if(!in_register(instr.dst) && in_memory(instr.a)) {
+                        move(a, "%eax");
+                        a = "%eax";
+                    }
+
+                    move(a, loc(instr.dst));
+                    break;
+                }
+                case ir::Opcode::Address: {
+                    std::string t = in_register(instr.dst) ? loc(instr.dst) : "%eax";
+
+                    if(instr.a.kind == ir::Operand::Kind::Symbol && instr.index.is_none()) {
+                        move("$" + instr.symbol + (instr.disp == 0 ? "" : "+" + std::to_string(instr.disp)), t);
+                    }
+                    else {
+                        // memory() may load the base or the index first
+                        std::string mem = memory(instr, x86::ecx, x86::edx);
+                        out_ << "\tleal\t" << mem << ", " << t << "\n";
+                    }
+
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::Load: {
+                    std::string mem = memory(instr, x86::ecx, x86::edx);
+                    std::string t = in_register(instr.dst) ? loc(instr.dst) : "%eax";
+
+                    if(instr.size == 1) {
+                        out_ << (instr.sign ? "\tmovsbl\t" : "\tmovzbl\t") << mem << ", " << t << "\n";
+                    }
+                    else {
+                        out_ << "\tmovl\t" << mem << ", " << t << "\n";
+                    }
+
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::Store: {
+                    std::string v = value(instr.b, instr, x86::edx);
+                    std::string mem = memory(instr, x86::ecx, x86::eax);
+
+                    if(instr.size == 1) {
+                        if(instr.b.is_immediate()) {
+                            v = "$" + std::to_string(static_cast<std::int8_t>(instr.b.value));
+                        }
+                        else if(instr.b.is_register() && in_register(instr.b.value) && allocation_[instr.b.value].reg == x86::ebx) {
+                            v = "%bl";
+                        }
+                        else {
+                            move(v, "%edx");
+                            v = "%dl";
+                        }
+
+                        out_ << "\tmovb\t" << v << ", " << mem << "\n";
+                    }
+                    else {
+                        if(in_memory(instr.b)) {
+                            move(v, "%edx");
+                            v = "%edx";
+                        }
+
+                        out_ << "\tmovl\t" << v << ", " << mem << "\n";
+                    }
+                    break;
+                }
+                case ir::Opcode::Neg:
+                case ir::Opcode::Not: {
+                    std::string t = target(instr);
+                    move(value(instr.a, instr, x86::eax), t);
+                    out_ << (instr.op == ir::Opcode::Neg ? "\tnegl\t" : "\tnotl\t") << t << "\n";
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::Add:
+                case ir::Opcode::Sub:
+                case ir::Opcode::Mul:
+                case ir::Opcode::And:
+                case ir::Opcode::Or:
+                case ir::Opcode::Xor: {
+                    std::string b = value(instr.b, instr, x86::edx);
+                    std::string t = target(instr);
+                    move(value(instr.a, instr, x86::eax), t);
+                    out_ << "\t" << binary_mnemonic(instr.op) << "\t" << b << ", " << t << "\n";
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::Shl:
+                case ir::Opcode::Shr: {
+                    const char* mnemonic = instr.op == ir::Opcode::Shl ? "sall" : "sarl";
+                    std::string count;
+
+                    if(instr.b.is_immediate()) {
+                        count = "$" + std::to_string(instr.b.value & 31);
+                    }
+                    else {
+                        move(value(instr.b, instr, x86::ecx), "%ecx");
+                        count = "%cl";
+                    }
+
+                    std::string t = target(instr);
+                    move(value(instr.a, instr, x86::eax), t);
+                    out_ << "\t" << mnemonic << "\t" << count << ", " << t << "\n";
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::MulHigh:
+                case ir::Opcode::Div:
+                case ir::Opcode::Mod: {
+                    std::string b = value(instr.b, instr, x86::ecx);
+
+                    if(!instr.b.is_register()) {
+                        move(b, "%ecx");
+                        b = "%ecx";
+                    }
+
+                    move(value(instr.a, instr, x86::eax), "%eax");
+
+                    if(instr.op == ir::Opcode::MulHigh) {
+                        out_ << "\timull\t" << b << "\n";
+                    }
+                    else {
+                        out_ << "\tcltd\n"
+                             << "\tidivl\t" << b << "\n";
+                    }
+
+                    store_result(instr, instr.op == ir::Opcode::Div ? "%eax" : "%edx");
+                    break;
+                }
+                case ir::Opcode::Set: {
+                    compare(instr);
+                    std::string t = in_register(instr.dst) ? loc(instr.dst) : "%eax";
+                    out_ << "\tset" << cond_suffix(instr.cond) << "\t%al\n"
+                         << "\tmovzbl\t%al, " << t << "\n";
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::Select: {
+                    compare(instr);
+
+                    // the moves below leave the flags alone
+                    const ir::Operand& if_true = instr.args[0];
+                    bool clobbers = if_true.is_register() && loc(if_true.value) == loc(instr.dst);
+                    std::string t = in_register(instr.dst) && !clobbers ? loc(instr.dst) : "%eax";
+                    move(value(instr.args[1], instr, x86::ecx), t);
+
+                    std::string v = value(if_true, instr, x86::edx);
+
+                    if(!if_true.is_register()) {
+                        move(v, "%edx");
+                        v = "%edx";
+                    }
+
+                    out_ << "\tcmov" << cond_suffix(instr.cond) << "\t" << v << ", " << t << "\n";
+                    store_result(instr, t);
+                    break;
+                }
+                case ir::Opcode::Call: {
+                    std::size_t in_registers = passed_in_registers(instr);
+
+                    for(std::size_t i = in_registers; i < instr.args.size(); ++i) {
+                        std::size_t offset = 4 * (i - in_registers);
+                        std::string v = value_in_register(instr.args[i], instr, x86::eax);
+                        out_ << "\tmovl\t" << v << ", " << (offset == 0 ? "" : std::to_string(offset)) << "(%esp)\n";
+                    }
+
+                    load_register_arguments(instr);
+                    out_ << "\tcall\t" << instr.symbol << "\n";
+
+                    if(instr.dst != ir::no_register) {
+                        store_result(instr, "%eax");
+                    }
+                    break;
+                }
+                case ir::Opcode::Asm:
+                    if(instr.extended) {
+                        emit_extended_asm(instr);
+                    }
+                    else {
+                        out_ << instr.symbol << "\n";
+                    }
+                    break;
+                case ir::Opcode::Jump:
+                    if(!falls_to(block, instr.targets[0])) {
+                        out_ << "\tjmp\t" << label(instr.targets[0]) << "\n";
+                    }
+                    break;
+                case ir::Opcode::Branch: {
+                    compare(instr);
+
+                    if(falls_to(block, instr.targets[0])) {
+                        out_ << "\tj" << cond_suffix(ir::negate(instr.cond)) << "\t" << label(instr.targets[1]) << "\n";
+                    }
+                    else {
+                        out_ << "\tj" << cond_suffix(instr.cond) << "\t" << label(instr.targets[0]) << "\n";
+
+                        if(!falls_to(block, instr.targets[1])) {
+                            out_ << "\tjmp\t" << label(instr.targets[1]) << "\n";
+                        }
+                    }
+                    break;
+                }
+                case ir::Opcode::Return:
+                    if(!instr.a.is_none()) {
+                        move(value(instr.a, instr, x86::eax), "%eax");
+                    }
+
+                    if(block.id + 1 != cold_) {
+                        out_ << "\tjmp\t.L" << function_.name << "_ret\n";
+                    }
+                    break;
+                case ir::Opcode::Check:
+                    compare(instr);
+                    out_ << "\tjae\t.L" << function_.name << "_trap\n";
+                    traps_ = true;
+                    break;
+                case ir::Opcode::Vector:
+                    emit_vector(instr);
+                    break;
+                case ir::Opcode::Count: {
+                    // 64-bit counters
+                    std::string counter = ".L" + function_.name + "_counts+" + std::to_string(8 * instr.disp);
+
+                    if(instr.a.is_none()) {
+                        out_ << "\taddl\t$1, " << counter << "\n";
+                    }
+                    else {
+                        compare(instr);
+                        out_ << "\tset" << cond_suffix(instr.cond) << "\t%al\n"
+                             << "\tmovzbl\t%al, %eax\n"
+                             << "\taddl\t%eax, " << counter << "\n";
+                    }
+
+                    out_ << "\tadcl\t$0, " << counter << "+4\n";
+                    break;
+                }
+                default:
+                    assert(false && "unknown opcode");
+            }
+        }
+
+    private:
+        std::ostream& sink_;
+        std::ostringstream out_;        // the function, written to sink_ once complete
+        const ir::Function& function_;
+        const SourceMap& source_;
+        bool debug_;
+        bool tail_calls_;
+        std::uint32_t align_functions_;
+        std::uint32_t align_loops_;
+        bool measure_;
+        const std::unordered_map<std::string, std::uint8_t>& regparm_;
+
+        Allocation allocation_;
+        std::vector<std::int32_t> slot_offsets_;
+        std::vector<bool> used_;            // slots referenced by an instruction
+        bool leaf_ = false;
+        bool frame_escapes_ = false;        // the address of a slot is taken
+        std::int32_t spill_base_ = 0;
+        std::int32_t frame_size_ = 0;
+        bool traps_ = false;        // a Check jumps to the trap label
+        std::uint32_t vectors_ = 0;     // loops of Vector instructions, for their labels
+        std::size_t cold_ = 0;      // the first of the cold blocks at the end
+        std::streamoff cold_start_ = 0;     // in out_, after the epilogue
+        CodeSize size_;
+
+        int line_ = 0;
+        int column_ = 0;
+};
+
+const std::size_t max_pending_strings = 4096;
+
+/*
+ * The stack used by each function of usage and its callees, from the size
+ * of its frame.
+ */
+void add_depths(const CallGraph& graph, std::vector<StackUsage>& usage) {
+    for(std::uint32_t f : graph.bottom_up()) {
+        StackUsage& u = usage[f];
+        u.depth = u.frame;
+        u.bounded = !graph.recursive(f);
+        u.external = graph.calls_external(f);
+
+        for(std::uint32_t callee : graph.callees(f)) {
+            if(callee == f) {
+                continue;
+            }
+
+            u.depth = std::max(u.depth, u.frame + usage[callee].depth);
+            u.bounded = u.bounded && usage[callee].bounded;
+            u.external = u.external || usage[callee].external;
+        }
+    }
+}
+
+} // namespace
+
+class EntityGenerator : public ast::EntityVisitor {
+    public:
+        EntityGenerator(CodeGenerator& generator, std::ostream& out, const Globals& globals, ir::StringTable& strings,
+                        std::vector<ir::Function>& functions, std::unordered_set<std::string>& referenced):
+            generator_(generator),
+            out_(out),
+            globals_(globals),
+            strings_(strings),
+            functions_(functions),
+            referenced_(referenced)
+        {}
+
+        // imported entities are only declared, except for the names the
+        // assembly of a module uses
+        virtual void visit(const ast::AssemblyEntity& e) {
+            if(!e.imported) {
+                out_ << e.assembly << "\n";
+            }
+
+            collect_identifiers(e.assembly, referenced_);
+        }
+
+        virtual void visit(const ast::GlobalEntity& e) {
+            if(!e.imported) {
+                generator_.emit_global(out_, e);
+            }
+        }
+
+        virtual void visit(const ast::StructEntity&) {}
+
+        virtual void visit(const ast::FunctionEntity& e) {
+            if(e.imported) {
+                return;
+            }
+
+            functions_.push_back(lower(e, globals_, strings_, generator_.options_.lowering, generator_.names_));
+
+            if(e.exported) {
+                referenced_.insert(e.name);
+            }
+        }
+
+    private:
+        CodeGenerator& generator_;
+        std::ostream& out_;
+        const Globals& globals_;
+        ir::StringTable& strings_;
+        std::vector<ir::Function>& functions_;
+        std::unordered_set<std::string>& referenced_;
+};
+
+CodeGenerator::CodeGenerator(std::ostream& out, const SourceMap& source, const CodeGenOptions& options,
+                             Interner& names):
+    out_(out),
+    source_(source),
+    options_(options),
+    names_(names)
+{}
+
+/*
+ * Assembly and globals are emitted in source order, functions once the
+ * whole program is lowered, callees first.
+ */
+void CodeGenerator::generate(const ast::Program& prog) {
+    Globals globals(prog);
+    ir::StringTable strings;
+    std::vector<ir::Function> functions;
+    std::unordered_set<std::string> referenced;
+    EntityGenerator visitor(*this, out_, globals, strings, functions, referenced);
+
+    emit_header();
+
+    for(const auto& entity : prog.entities) {
+        entity->accept(visitor);
+    }
+
+    for(const auto& function : functions) {
+        for(const auto& block : function.blocks) {
+            for(const auto& instr : block.instrs) {
+                if(instr.op == ir::Opcode::Asm) {
+                    collect_identifiers(instr.symbol, referenced);
+                }
+            }
+        }
+    }
+
+    // functions named in assembly, exported functions and main may be
+    // called from anywhere, and keep the standard calling convention, as
+    // every function of a unit without main, a module for -fimport
+    std::vector<bool> external(functions.size());
+    bool module = std::none_of(functions.begin(), functions.end(), [](const ir::Function& function) {
+        return function.name == "main";
+    });
+
+    for(std::size_t i = 0; i < functions.size(); ++i) {
+        external[i] = module || functions[i].name == "main" || referenced.count(functions[i].name) > 0;
+        functions[i].regparm = external[i] ? 0 : options_.regparm;
+        regparm_[functions[i].name] = functions[i].regparm;
+    }
+
+    if(options_.lowering.optimize && options_.lowering.profile) {
+        inline_hot_calls(functions, CallGraph(functions));
+    }
+
+    if(options_.lowering.optimize && options_.sse2) {
+        for(auto& function : functions) {
+            vectorize_loops(function);
+        }
+    }
+
+    CallGraph graph(functions);
+    propagate_constant_arguments(functions, graph, external);
+
+    std::vector<StackUsage> usage(functions.size());
+    code_size_.clear();
+    optimizations_.clear();
+
+    for(std::uint32_t f : graph.bottom_up()) {
+        if(options_.lowering.optimize) {
+            functions[f].promoted = promote_locals(functions[f]);
+            place_blocks(functions[f]);
+        }
+
+        usage[f].name = functions[f].name;
+        usage[f].offset = functions[f].offset;
+        usage[f].frame = emit_function(functions[f]);
+    }
+
+    add_depths(graph, usage);
+    stack_usage_ = std::move(usage);
+
+    emit_strings(strings);
+    emit_profile_dump();
+    emit_string_routines();
+
+    if(options_.debug) {
+        out_ << "\t.text\n"
+             << ".Letext0:\n";
+        emit_debug_info();
+    }
+}
+
+void CodeGenerator::begin() {
+    globals_ = Globals();
+    strings_ = ir::StringTable();
+    stack_usage_.clear();
+    code_size_.clear();
+    optimizations_.clear();
+    calls_.clear();
+    regparm_.clear();
+    functions_.clear();
+    emit_header();
+}
+
+void CodeGenerator::generate(const ast::Entity& entity) {
+    Unit unit = lower(entity);
+    emit(unit);
+    write(unit);
+}
+
+/*
+ * Literals are written every max_pending_strings, so that their number
+ * does not grow with the program either.
+ */
+CodeGenerator::Unit CodeGenerator::lower(const ast::Entity& entity) {
+    Unit unit;
+    std::ostringstream out;
+    std::unordered_set<std::string> referenced;
+    EntityGenerator visitor(*this, out, globals_, strings_, unit.functions, referenced);
+
+    globals_.add(entity);
+    entity.accept(visitor);
+    unit.assembly = out.str();
+
+    if(strings_.strings.size() >= max_pending_strings) {
+        unit.strings = std::move(strings_);
+        strings_ = ir::StringTable();
+        strings_.first = unit.strings.first + unit.strings.strings.size();
+    }
+
+    return unit;
+}
+
+void CodeGenerator::emit(Unit& unit) const {
+    std::ostringstream out;
+    out << unit.assembly;
+
+    for(auto& function : unit.functions) {
+        if(options_.lowering.optimize && options_.sse2) {
+            vectorize_loops(function);
+        }
+
+        if(options_.lowering.optimize) {
+            function.promoted = promote_locals(function);
+            place_blocks(function);
+        }
+
+        FunctionGenerator generator(out, function, source_, options_, regparm_);
+        generator.emit();
+
+        if(options_.code_size) {
+            unit.sizes.push_back(generator.code_size());
+        }
+
+        if(options_.optimization_report) {
+            unit.optimizations.push_back(generator.optimizations());
+        }
+
+        StackUsage usage;
+        usage.name = function.name;
+        usage.offset = function.offset;
+        usage.frame = generator.stack_size();
+        unit.usage.push_back(usage);
+        unit.calls.emplace_back();
+
+        for(const auto& block : function.blocks) {
+            for(const auto& instr : block.instrs) {
+                if(instr.op == ir::Opcode::Call
+                   && std::find(unit.calls.back().begin(), unit.calls.back().end(), instr.symbol)
+                      == unit.calls.back().end()) {
+                    unit.calls.back().push_back(instr.symbol);
+                }
+            }
+        }
+    }
+
+    unit.functions.clear();
+    unit.assembly = out.str();
+}
+
+void CodeGenerator::write(const Unit& unit) {
+    out_ << unit.assembly;
+
+    for(std::size_t i = 0; i < unit.usage.size(); ++i) {
+        functions_.push_back(FunctionInfo{unit.usage[i].name, source_.location(unit.usage[i].offset).line});
+        stack_usage_.push_back(unit.usage[i]);
+        calls_.push_back(unit.calls[i]);
+    }
+
+    code_size_.insert(code_size_.end(), unit.sizes.begin(), unit.sizes.end());
+    optimizations_.insert(optimizations_.end(), unit.optimizations.begin(), unit.optimizations.end());
+
+    if(!unit.strings.strings.empty()) {
+        emit_strings(unit.strings);
+        out_ << "\t.text\n";
+    }
+}
+
+void CodeGenerator::end() {
+    std::vector<std::string> names;
+
+    for(const auto& usage : stack_usage_) {
+        names.push_back(usage.name);
+    }
+
+    add_depths(CallGraph(names, calls_), stack_usage_);
+    calls_.clear();
+
+    emit_strings(strings_);
+    strings_.clear();
+    emit_profile_dump();
+    emit_string_routines();
+
+    if(options_.debug) {
+        out_ << "\t.text\n"
+             << ".Letext0:\n";
+        emit_debug_info();
+    }
+}
+
+void CodeGenerator::emit_header() {
+    out_ << "\t.file\t\"" << escape(options_.source_name) << "\"\n";
+
+    if(options_.debug) {
+        out_ << "\t.file 1 \"" << escape(options_.source_name) << "\"\n"
+             << "\t.section\t.debug_line,\"\",@progbits\n"
+             << ".Ldebug_line0:\n"
+             << "\t.text\n"
+             << ".Ltext0:\n";
+    }
+}
+
+std::uint32_t CodeGenerator::emit_function(const ir::Function& function) {
+    FunctionGenerator generator(out_, function, source_, options_, regparm_);
+    generator.emit();
+    functions_.push_back(FunctionInfo{function.name, source_.location(function.offset).line});
+
+    if(options_.code_size) {
+        code_size_.push_back(generator.code_size());
+    }
+
+    if(options_.optimization_report) {
+        optimizations_.push_back(generator.optimizations());
+    }
+
+    return generator.stack_size();
+}
+
+void CodeGenerator::emit_global(std::ostream& out, const ast::GlobalEntity& global) {
+    std::size_t size = global.type->size();
+
+    out << "\t.globl\t" << global.name << "\n"
+         << "\t.bss\n"
+         << "\t.align " << global.type->alignment() << "\n"
+         << "\t.type\t" << global.name << ", @object\n"
+         << "\t.size\t" << global.name << ", " << size << "\n"
+         << global.name << ":\n"
+         << "\t.zero\t" << size << "\n";
+}
+
+/*
+ * One pool for the literals of the program: each distinct string is
+ * emitted once, and the ones ending a longer string are symbols into it.
+ * With -fmerge-constants the pool goes to a mergeable string section, so
+ * that the linker also merges literals across object files.
+ */
+void CodeGenerator::emit_strings(const ir::StringTable& strings) {
+    if(strings.strings.empty()) {
+        return;
+    }
+
+    std::vector<ir::StringTable::Placement> placements = strings.merge_suffixes();
+    std::vector<std::size_t> plain, mergeable;
+
+    for(std::size_t i = 0; i < strings.strings.size(); ++i) {
+        // the linker would split strings containing a NUL
+        bool has_nul = strings.strings[i].find('\0') != std::string::npos;
+
+        if(placements[i].host == i) {
+            (options_.merge_strings && !has_nul ? mergeable : plain).push_back(i);
+        }
+    }
+
+    auto emit_section = [&](const char* section, const std::vector<std::size_t>& hosts) {
+        if(hosts.empty()) {
+            return;
+        }
+
+        out_ << "\t.section\t" << section << "\n";
+
+        for(std::size_t i : hosts) {
+            out_ << ir::StringTable::symbol(strings.first + i) << ":\n"
+                 << "\t.string\t\"" << escape(strings.strings[i]) << "\"\n";
+        }
+    };
+
+    emit_section(".rodata", plain);
+    emit_section(".rodata.str1.1,\"aMS\",@progbits,1", mergeable);
+
+    for(std::size_t i = 0; i < strings.strings.size(); ++i) {
+        const ir::StringTable::Placement& p = placements[i];
+
+        if(p.host != i) {
+            out_ << "\t.set\t" << ir::StringTable::symbol(strings.first + i) << ", "
+                 << ir::StringTable::symbol(strings.first + p.host)
+                 << "+" << p.offset << "\n";
+        }
+    }
+}
+
+/*
+ * __microc_profile_dump writes the microc_profile section with the open,
+ * write and close system calls, keeping %eax, which holds the result of
+ * main. Every object file defines it, weak, for the linker to keep one.
+ */
+void CodeGenerator::emit_profile_dump() {
+    if(options_.lowering.profile_generate.empty()) {
+        return;
+    }
+
+    out_ << "\t.section\t.rodata\n"
+         << ".Lprofile_path:\n"
+         << "\t.string\t\"" << escape(options_.lowering.profile_generate) << "\"\n"
+         << "\t.text\n"
+         << "\t.weak\t__microc_profile_dump\n"
+         << "\t.type\t__microc_profile_dump, @function\n"
+         << "__microc_profile_dump:\n"
+         << "\tpushl\t%eax\n"
+         << "\tpushl\t%ebx\n"
+         << "\tmovl\t$5, %eax\n"                     // open
+         << "\tmovl\t$.Lprofile_path, %ebx\n"
+         << "\tmovl\t$0x241, %ecx\n"                 // O_WRONLY | O_CREAT | O_TRUNC
+         << "\tmovl\t$420, %edx\n"                   // 0644
+         << "\tint\t$0x80\n"
+         << "\ttestl\t%eax, %eax\n"
+         << "\tjs\t.Lprofile_done\n"
+         << "\tmovl\t%eax, %ebx\n"
+         << "\tmovl\t$4, %eax\n"                     // write
+         << "\tmovl\t$__start_microc_profile, %ecx\n"
+         << "\tmovl\t$__stop_microc_profile, %edx\n"
+         << "\tsubl\t%ecx, %edx\n"
+         << "\tint\t$0x80\n"
+         << "\tmovl\t$6, %eax\n"                     // close
+         << "\tint\t$0x80\n"
+         << ".Lprofile_done:\n"
+         << "\tpopl\t%ebx\n"
+         << "\tpopl\t%eax\n"
+         << "\tret\n"
+         << "\t.size\t__microc_profile_dump, .-__microc_profile_dump\n";
+}
+
+/*
+ * The routines vectorize_loops() calls, weak so that a program may bring
+ * its own: __microc_memset(d, c, n) and __microc_memcpy(d, s, n), which
+ * copies forward, 16 bytes at a time then byte by byte, and so also
+ * works when d is below s.
+ */
+void CodeGenerator::emit_string_routines() {
+    if(!options_.lowering.optimize || !options_.sse2) {
+        return;
+    }
+
+    out_ << "\t.text\n"
+         << "\t.weak\t__microc_memset\n"
+         << "\t.type\t__microc_memset, @function\n"
+         << "__microc_memset:\n"
+         << "\tmovl\t4(%esp), %edx\n"
+         << "\tmovzbl\t8(%esp), %eax\n"
+         << "\timull\t$0x01010101, %eax, %eax\n"
+         << "\tmovl\t12(%esp), %ecx\n"
+         << "\tmovd\t%eax, %xmm0\n"
+         << "\tpshufd\t$0, %xmm0, %xmm0\n"
+         << "\tjmp\t.Lmemset_test\n"
+         << ".Lmemset_vector:\n"
+         << "\tmovdqu\t%xmm0, (%edx)\n"
+         << "\taddl\t$16, %edx\n"
+         << "\tsubl\t$16, %ecx\n"
+         << ".Lmemset_test:\n"
+         << "\tcmpl\t$16, %ecx\n"
+         << "\tjae\t.Lmemset_vector\n"
+         << "\ttestl\t%ecx, %ecx\n"
+         << "\tje\t.Lmemset_done\n"
+         << ".Lmemset_byte:\n"
+         << "\tmovb\t%al, (%edx)\n"
+         << "\taddl\t$1, %edx\n"
+         << "\tsubl\t$1, %ecx\n"
+         << "\tjne\t.Lmemset_byte\n"
+         << ".Lmemset_done:\n"
+         << "\tmovl\t4(%esp), %eax\n"
+         << "\tret\n"
+         << "\t.size\t__microc_memset, .-__microc_memset\n"
+         << "\t.weak\t__microc_memcpy\n"
+         << "\t.type\t__microc_memcpy, @function\n"
+         << "__microc_memcpy:\n"
+         << "\tpushl\t%ebx\n"
+         << "\tmovl\t8(%esp), %edx\n"
+         << "\tmovl\t12(%esp), %eax\n"
+         << "\tmovl\t16(%esp), %ecx\n"
+         << "\tjmp\t.Lmemcpy_test\n"
+         << ".Lmemcpy_vector:\n"
+         << "\tmovdqu\t(%eax), %xmm0\n"
+         << "\tmovdqu\t%xmm0, (%edx)\n"
+         << "\taddl\t$16, %eax\n"
+         << "\taddl\t$16, %edx\n"
+         << "\tsubl\t$16, %ecx\n"
+         << ".Lmemcpy_test:\n"
+         << "\tcmpl\t$16, %ecx\n"
+         << "\tjae\t.Lmemcpy_vector\n"
+         << "\ttestl\t%ecx, %ecx\n"
+         << "\tje\t.Lmemcpy_done\n"
+         << ".Lmemcpy_byte:\n"
+         << "\tmovzbl\t(%eax), %ebx\n"
+         << "\tmovb\t%bl, (%edx)\n"
+         << "\taddl\t$1, %eax\n"
+         << "\taddl\t$1, %edx\n"
+         << "\tsubl\t$1, %ecx\n"
+         << "\tjne\t.Lmemcpy_byte\n"
+         << ".Lmemcpy_done:\n"
+         << "\tmovl\t8(%esp), %eax\n"
+         << "\tpopl\t%ebx\n"
+         << "\tret\n"
+         << "\t.size\t__microc_memcpy, .-__microc_memcpy\n";
+}
+
+/*
+ * A compilation unit with one subprogram per function, in DWARF 4. The line
+ * program itself is generated by the assembler from the .loc directives.
+ */
+void CodeGenerator::emit_debug_info() {
+    out_ << "\t.section\t.debug_info,\"\",@progbits\n"
+         << ".Ldebug_info0:\n"
+         << "\t.long\t.Ldebug_info_end - .Ldebug_info_start\n"
+         << ".Ldebug_info_start:\n"
+         << "\t.value\t0x4\n"                         // version
+         << "\t.long\t.Ldebug_abbrev0\n"
+         << "\t.byte\t0x4\n"                          // address size
+         << "\t.uleb128 0x1\n"                        // DW_TAG_compile_unit
+         << "\t.string\t\"microc\"\n"                 // DW_AT_producer
+         << "\t.byte\t0x1\n"                          // DW_AT_language: C89
+         << "\t.string\t\"" << escape(options_.source_name) << "\"\n"
+         << "\t.string\t\"" << escape(options_.directory) << "\"\n"
+         << "\t.long\t.Ltext0\n"                      // DW_AT_low_pc
+         << "\t.long\t.Letext0 - .Ltext0\n"           // DW_AT_high_pc
+         << "\t.long\t.Ldebug_line0\n";               // DW_AT_stmt_list
+
+    for(const auto& function : functions_) {
+        out_ << "\t.uleb128 0x2\n"                    // DW_TAG_subprogram
+             << "\t.string\t\"" << function.name << "\"\n"
+             << "\t.byte\t0x1\n"                      // DW_AT_decl_file
+             << "\t.long\t" << function.line << "\n"  // DW_AT_decl_line
+             << "\t.long\t" << function.name << "\n"  // DW_AT_low_pc
+             << "\t.long\t.L" << function.name << "_end - " << function.name << "\n"
+             << "\t.uleb128 0x1\n"                    // DW_AT_frame_base
+             << "\t.byte\t0x9c\n";                    // DW_OP_call_frame_cfa
+    }
+
+    out_ << "\t.byte\t0\n"
+         << ".Ldebug_info_end:\n";
+
+    static const char* const abbrev =
+        "\t.section\t.debug_abbrev,\"\",@progbits\n"
+        ".Ldebug_abbrev0:\n"
+        // 1: DW_TAG_compile_unit, DW_CHILDREN_yes
+        "\t.uleb128 0x1\n\t.uleb128 0x11\n\t.byte\t0x1\n"
+        "\t.uleb128 0x25\n\t.uleb128 0x8\n"           // DW_AT_producer, DW_FORM_string
+        "\t.uleb128 0x13\n\t.uleb128 0xb\n"           // DW_AT_language, DW_FORM_data1
+        "\t.uleb128 0x3\n\t.uleb128 0x8\n"            // DW_AT_name, DW_FORM_string
+        "\t.uleb128 0x1b\n\t.uleb128 0x8\n"           // DW_AT_comp_dir, DW_FORM_string
+        "\t.uleb128 0x11\n\t.uleb128 0x1\n"           // DW_AT_low_pc, DW_FORM_addr
+        "\t.uleb128 0x12\n\t.uleb128 0x6\n"           // DW_AT_high_pc, DW_FORM_data4
+        "\t.uleb128 0x10\n\t.uleb128 0x17\n"          // DW_AT_stmt_list, DW_FORM_sec_offset
+        "\t.byte\t0\n\t.byte\t0\n"
+        // 2: DW_TAG_subprogram, DW_CHILDREN_no
+        "\t.uleb128 0x2\n\t.uleb128 0x2e\n\t.byte\t0\n"
+        "\t.uleb128 0x3f\n\t.uleb128 0x19\n"          // DW_AT_external, DW_FORM_flag_present
+        "\t.uleb128 0x3\n\t.uleb128 0x8\n"            // DW_AT_name, DW_FORM_string
+        "\t.uleb128 0x3a\n\t.uleb128 0xb\n"           // DW_AT_decl_file, DW_FORM_data1
+        "\t.uleb128 0x3b\n\t.uleb128 0x6\n"           // DW_AT_decl_line, DW_FORM_data4
+        "\t.uleb128 0x11\n\t.uleb128 0x1\n"           // DW_AT_low_pc, DW_FORM_addr
+        "\t.uleb128 0x12\n\t.uleb128 0x6\n"           // DW_AT_high_pc, DW_FORM_data4
+        "\t.uleb128 0x40\n\t.uleb128 0x18\n"          // DW_AT_frame_base, DW_FORM_exprloc
+        "\t.byte\t0\n\t.byte\t0\n"
+        "\t.byte\t0\n";
+
+    out_ << abbrev;
+}
+
+} // namespace microc
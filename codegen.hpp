@@ -0,0 +1,192 @@
+#ifndef MICROC_CODEGEN_HPP
+#define MICROC_CODEGEN_HPP
+
+#include "ast.hpp"
+#include "ir.hpp"
+#include "lowering.hpp"
+#include "source.hpp"
+#include "symbols.hpp"
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace microc {
+
+class CodeGenOptions {
+    public:
+        bool debug = false;             // -g
+        std::string source_name;        // as given on the command line
+        std::string directory;          // compilation directory
+        std::uint8_t regparm = 0;       // -mregparm=N, internal functions only
+        bool tail_calls = true;         // -fno-optimize-sibling-calls
+        bool merge_strings = false;     // -fmerge-constants
+        bool sse2 = false;              // -msse2: vectorize_loops() when optimizing
+        std::uint32_t align_functions = 16;     // -falign-functions=N, in bytes, a power of 2
+        std::uint32_t align_loops = 16;         // -falign-loops=N, for hot loops, see place_blocks()
+        bool code_size = false;         // -fcode-size-report: estimate the CodeSize of each function
+        bool optimization_report = false;   // -fopt-report: an OptimizationReport for each function
+        LoweringOptions lowering;
+};
+
+/*
+ * Stack used by a function and by the deepest chain of calls it makes.
+ */
+class StackUsage {
+    public:
+        std::string name;
+        std::uint32_t offset = 0;
+        std::uint32_t frame = 0;    // bytes, return address included
+        std::uint32_t depth = 0;    // bytes, callees included
+        bool bounded = true;        // false if a cycle of calls is reachable
+        bool external = false;      // calls assembly code, not counted in depth
+};
+
+/*
+ * Bytes of machine code of a function, estimated from the instructions
+ * emitted, the assembler choosing the final encoding of jumps.
+ */
+class CodeSize {
+    public:
+        std::string name;
+        std::uint32_t offset = 0;
+        std::uint32_t hot = 0;      // up to the cold blocks, epilogue included
+        std::uint32_t cold = 0;     // cold blocks at the end, and the trap
+        std::uint32_t padding = 0;  // aligning its loops
+        std::uint32_t loops = 0;    // aligned
+};
+
+/*
+ * What the optimizations removed from a function.
+ */
+class OptimizationReport {
+    public:
+        std::string name;
+        std::uint32_t offset = 0;
+        std::uint32_t eliminated = 0;   // redundant instructions, see gvn.hpp
+        std::uint32_t promoted = 0;     // locals and arguments kept in registers, see mem2reg.hpp
+};
+
+/*
+ * Emits GNU assembler code for x86_32, System V ABI (cdecl).
+ *
+ * The whole program is lowered before any function is emitted, so that
+ * the call graph can be used: functions are emitted callees first, and
+ * arguments which are the same constant at every call are propagated into
+ * the called function.
+ *
+ * When optimizing, the locals which do not escape are moved to registers
+ * by promote_locals(), and the blocks of each function are ordered by
+ * place_blocks(): cold blocks go after the epilogue, hot loops and
+ * functions start on aligned boundaries. With -msse2, loops over arrays
+ * are first vectorized by vectorize_loops().
+ *
+ * The frame only holds the slots still used, largest alignment first,
+ * and the spilled values whose live intervals do not overlap share a
+ * spill slot.
+ *
+ * Functions which cannot be called from outside the program, that is
+ * neither main, exported, nor named in inline assembly, receive their
+ * first regparm arguments in registers. A unit without main is a module,
+ * whose functions may all be called by the programs importing it. Calls
+ * followed by a return become jumps when the callee's stack arguments fit
+ * in the caller's.
+ *
+ * With -g, instructions are mapped to their source lines with .file/.loc
+ * directives, from which the assembler builds .debug_line, and every
+ * function gets a DW_TAG_subprogram entry covering its code in
+ * .debug_info.
+ *
+ * With --profile-generate, each function is followed by its counters, in
+ * a microc_profile section which the linker gathers from every object
+ * file, and main writes the section to the profile file when it returns;
+ * a program ending with exit() writes no profile. With --profile-use, the
+ * hot calls to small functions are inlined, and the blocks of a function
+ * are ordered along its hot paths.
+ *
+ * A program can also be streamed, begin(), then generate() on each entity
+ * in source order, then end(): each function is emitted as soon as it is
+ * given, so there is no call graph to work with. Every function keeps the
+ * standard calling convention and its arguments, and only its name, frame
+ * size and the names it calls are kept for stack_usage().
+ *
+ * generate(entity) is lower(), emit() and write(). A pipeline may call them
+ * on different threads: lower() in source order on one thread, emit() on
+ * any, and write() in source order on another one.
+ */
+class CodeGenerator {
+    public:
+        /*
+         * An entity on its way through generate(entity).
+         */
+        class Unit {
+            public:
+                std::vector<ir::Function> functions;    // until emitted
+                std::string assembly;
+                std::vector<StackUsage> usage;          // of each function, without depth
+                std::vector<CodeSize> sizes;            // with CodeGenOptions::code_size
+                std::vector<OptimizationReport> optimizations;  // with CodeGenOptions::optimization_report
+                std::vector<std::vector<std::string>> calls;
+                ir::StringTable strings;                // literals to write after the entity, if any
+        };
+
+    public:
+        CodeGenerator(std::ostream& out, const SourceMap& source, const CodeGenOptions& options, Interner& names);
+
+        void generate(const ast::Program& prog);
+
+        void begin();
+        void generate(const ast::Entity& entity);
+        void end();
+
+        Unit lower(const ast::Entity& entity);
+        void emit(Unit& unit) const;
+        void write(const Unit& unit);
+
+        // one entry per function of the last generated program
+        const std::vector<StackUsage>& stack_usage() const { return stack_usage_; }
+
+        // with CodeGenOptions::code_size, one entry per function
+        const std::vector<CodeSize>& code_size() const { return code_size_; }
+
+        // with CodeGenOptions::optimization_report, one entry per function
+        const std::vector<OptimizationReport>& optimizations() const { return optimizations_; }
+
+    private:
+        class FunctionInfo {
+            public:
+                std::string name;
+                int line;
+        };
+
+        void emit_header();
+        std::uint32_t emit_function(const ir::Function& function);
+        void emit_global(std::ostream& out, const ast::GlobalEntity& global);
+        void emit_strings(const ir::StringTable& strings);
+        void emit_profile_dump();
+        void emit_string_routines();
+        void emit_debug_info();
+
+        friend class EntityGenerator;
+
+    private:
+        std::ostream& out_;
+        const SourceMap& source_;
+        const CodeGenOptions& options_;
+        Interner& names_;
+        std::vector<FunctionInfo> functions_;
+        std::vector<StackUsage> stack_usage_;
+        std::vector<CodeSize> code_size_;
+        std::vector<OptimizationReport> optimizations_;
+        std::unordered_map<std::string, std::uint8_t> regparm_;    // by function name
+
+        // streaming: lower() uses the first two, write() the last
+        Globals globals_;
+        ir::StringTable strings_;
+        std::vector<std::vector<std::string>> calls_;   // names called by each function of stack_usage_
+};
+
+} // namespace microc
+
+#endif // MICROC_CODEGEN_HPP
@@ -0,0 +1,522 @@
+#include "compiler.hpp"
+#include "interpreter.hpp"
+#include "lowering.hpp"
+#include "module.hpp"
+#include "parser/parser.h"
+#include "profile.hpp"
+#include "sema.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace microc {
+
+namespace {
+
+std::string located_message(const SourceMap& source, std::uint32_t offset, const std::string& message) {
+    SourceLocation loc = source.location(offset);
+    return "error line " + std::to_string(loc.line) + ", column " + std::to_string(loc.column) + ", " + message;
+}
+
+void dump_ir(std::ostream& out, const ast::Program& prog, const CompileOptions& options, Interner& names) {
+    Globals globals(prog);
+    ir::StringTable strings;
+
+    for(const auto& entity : prog.entities) {
+        auto function = dynamic_cast<const ast::FunctionEntity*>(entity.get());
+
+        if(function != nullptr && !function->imported) {
+            out << lower(*function, globals, strings, options.codegen.lowering, names) << std::endl;
+        }
+    }
+
+    for(std::size_t i = 0; i < strings.strings.size(); ++i) {
+        out << ir::StringTable::symbol(i) << ": \"" << strings.strings[i] << "\"" << std::endl;
+    }
+}
+
+int run(const ast::Program& prog, const CompileOptions& options, std::ostream& out, Interner& names) {
+    Globals globals(prog);
+    ir::StringTable strings;
+    std::vector<ir::Function> functions;
+
+    for(const auto& entity : prog.entities) {
+        auto function = dynamic_cast<const ast::FunctionEntity*>(entity.get());
+
+        if(function != nullptr && !function->imported) {
+            functions.push_back(lower(*function, globals, strings, options.codegen.lowering, names));
+        }
+    }
+
+    Interpreter interpreter(functions, strings, globals);
+    int status = interpreter.run(options.input, out, options.error);
+
+    if(!options.codegen.lowering.profile_generate.empty()) {
+        Profile profile;
+
+        for(std::size_t i = 0; i < functions.size(); ++i) {
+            profile.functions[functions[i].name] = FunctionProfile{functions[i].checksum, interpreter.counters(i)};
+        }
+
+        profile.write(options.codegen.lowering.profile_generate);
+    }
+
+    return status;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * The stages of -fpipeline after the parser: lowered entities are queued to
+ * codegen workers, which emit them in any order, and written in source
+ * order by the thread calling write(). At most max_jobs entities are on
+ * their way, the parser waits beyond.
+ */
+class Pipeline {
+    public:
+        static const std::size_t max_jobs = 256;
+
+    public:
+        Pipeline(CodeGenerator& generator, unsigned workers): generator_(generator) {
+            for(unsigned i = 0; i < std::max(workers, 1u); ++i) {
+                workers_.emplace_back([this]() { work(); });
+            }
+        }
+
+        ~Pipeline() {
+            finish();
+
+            for(auto& worker : workers_) {
+                worker.join();
+            }
+        }
+
+        // parsing thread
+        void push(CodeGenerator::Unit&& unit) {
+            std::unique_ptr<Job> job(new Job{std::move(unit), false});
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            if(ordered_.size() >= max_jobs) {
+                auto start = std::chrono::steady_clock::now();
+                room_.wait(lock, [this]() { return ordered_.size() < max_jobs; });
+                push_wait_ += seconds_since(start);
+            }
+
+            pending_.push_back(job.get());
+            ordered_.push_back(std::move(job));
+            ++pushed_;
+            ready_.notify_one();
+        }
+
+        void finish() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+            ready_.notify_all();
+            emitted_.notify_all();
+        }
+
+        // writing thread, returns once finish() is called and everything is written
+        void write() {
+            auto start = std::chrono::steady_clock::now();
+
+            while(true) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto next = [this]() { return !ordered_.empty() && ordered_.front()->emitted; };
+
+                if(!next() && !(finished_ && ordered_.empty())) {
+                    auto wait = std::chrono::steady_clock::now();
+                    emitted_.wait(lock, [&]() { return next() || (finished_ && ordered_.empty()); });
+                    write_wait_ += seconds_since(wait);
+                }
+
+                if(ordered_.empty()) {
+                    break;
+                }
+
+                std::unique_ptr<Job> job = std::move(ordered_.front());
+                ordered_.pop_front();
+                room_.notify_one();
+                lock.unlock();
+
+                generator_.write(job->unit);
+                ++written_;
+            }
+
+            write_time_ = seconds_since(start);
+        }
+
+        // once write() has returned
+        std::vector<StageStats> stats(StageStats parse) {
+            for(auto& worker : workers_) {
+                worker.join();
+            }
+
+            workers_.clear();
+
+            StageStats codegen{"codegen", emitted_functions_, work_time_ - work_wait_, work_wait_, 0};
+            StageStats write{"write", written_, write_time_ - write_wait_, write_wait_, 0};
+            parse.items = pushed_;
+            parse.blocked = push_wait_;
+            parse.busy -= push_wait_;
+            return {parse, codegen, write};
+        }
+
+    private:
+        class Job {
+            public:
+                CodeGenerator::Unit unit;
+                bool emitted;
+        };
+
+        void work() {
+            auto start = std::chrono::steady_clock::now();
+            double waited = 0;
+            std::uint64_t functions = 0;
+
+            while(true) {
+                std::unique_lock<std::mutex> lock(mutex_);
+
+                if(pending_.empty() && !finished_) {
+                    auto wait = std::chrono::steady_clock::now();
+                    ready_.wait(lock, [this]() { return !pending_.empty() || finished_; });
+                    waited += seconds_since(wait);
+                }
+
+                if(pending_.empty()) {
+                    break;
+                }
+
+                Job* job = pending_.front();
+                pending_.pop_front();
+                lock.unlock();
+
+                generator_.emit(job->unit);
+                functions += job->unit.usage.size();
+
+                lock.lock();
+                job->emitted = true;
+                emitted_.notify_one();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            work_time_ += seconds_since(start);
+            work_wait_ += waited;
+            emitted_functions_ += functions;
+        }
+
+    private:
+        CodeGenerator& generator_;
+        std::vector<std::thread> workers_;
+
+        std::mutex mutex_;
+        std::condition_variable ready_;     // pending_ is not empty
+        std::condition_variable emitted_;   // the first of ordered_ may be written
+        std::condition_variable room_;      // ordered_ is not full
+        std::deque<Job*> pending_;          // to emit
+        std::deque<std::unique_ptr<Job>> ordered_;     // to write
+        bool finished_ = false;
+
+        std::uint64_t pushed_ = 0;
+        std::uint64_t written_ = 0;
+        std::uint64_t emitted_functions_ = 0;
+        double push_wait_ = 0;
+        double write_time_ = 0;
+        double write_wait_ = 0;
+        double work_time_ = 0;
+        double work_wait_ = 0;
+};
+
+/*
+ * Analyzes and emits the entities of a program as the parser gives them,
+ * keeping only their declarations. After the first error, entities are
+ * still analyzed, for their errors to be reported, but no longer emitted.
+ */
+class StreamingCompiler {
+    public:
+        StreamingCompiler(const Parser& parser, CodeGenerator& generator, Interner& names):
+            parser_(parser),
+            analyzer_(declarations_, names),
+            generator_(generator)
+        {}
+
+        void add(std::unique_ptr<ast::Entity>&& entity) {
+            for(auto& error : analyzer_.analyze(*entity)) {
+                errors.push_back(std::move(error));
+            }
+
+            if(errors.empty() && codegen_errors.empty() && parser_.diagnostics().empty()) {
+                try {
+                    if(pipeline != nullptr) {
+                        pipeline->push(generator_.lower(*entity));
+                    }
+                    else {
+                        generator_.generate(*entity);
+                    }
+                }
+                catch(const codegen_exception& e) {
+                    codegen_errors.push_back(e);
+                }
+            }
+
+            if(auto function = dynamic_cast<ast::FunctionEntity*>(entity.get())) {
+                function->instructions.clear();
+                analyzer_.release();
+            }
+
+            if(dynamic_cast<const ast::AssemblyEntity*>(entity.get()) == nullptr) {
+                declarations_.entities.push_back(std::move(entity));
+            }
+        }
+
+    public:
+        Pipeline* pipeline = nullptr;   // emits instead of generate(), with -fpipeline
+        std::vector<SemanticError> errors;
+        std::vector<codegen_exception> codegen_errors;
+
+    private:
+        const Parser& parser_;
+        ast::Program declarations_;
+        StreamAnalyzer analyzer_;
+        CodeGenerator& generator_;
+};
+
+/*
+ * Parses on a thread of its own, fed by another one scanning ahead,
+ * while the calling thread writes what the codegen workers emit. The
+ * source map is built first, for tokens to be located on any thread.
+ */
+int parse_pipelined(Parser& parser, StreamingCompiler& streamed, CodeGenerator& generator, unsigned workers,
+                    std::vector<StageStats>& stages) {
+    const std::size_t ring_size = 1 << 12;
+
+    parser.source().prepare();
+    SpscRing<Token> tokens(ring_size);
+    Pipeline pipeline(generator, workers);
+    parser.setTokens(&tokens);
+    streamed.pipeline = &pipeline;
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t scanned = 0;
+    double scan_time = 0;
+    int success = 0;
+    std::exception_ptr failure;
+    double parse_time = 0;
+
+    std::thread scanner([&]() {
+        scanned = parser.scan(tokens);
+        scan_time = seconds_since(start);
+    });
+
+    std::thread parsing([&]() {
+        try {
+            success = parser.parse();
+        }
+        catch(...) {
+            failure = std::current_exception();
+        }
+
+        // the scanner may be waiting for room after an early stop
+        tokens.close();
+        pipeline.finish();
+        parse_time = seconds_since(start);
+    });
+
+    pipeline.write();
+    parsing.join();
+    scanner.join();
+
+    StageStats scan{"scan", scanned, scan_time - tokens.push_wait(), 0, tokens.push_wait()};
+    StageStats parse{"parse", 0, parse_time - tokens.pop_wait(), tokens.pop_wait(), 0};
+    stages.push_back(scan);
+
+    for(const auto& stage : pipeline.stats(parse)) {
+        stages.push_back(stage);
+    }
+
+    parser.setTokens(nullptr);
+    streamed.pipeline = nullptr;
+
+    if(failure) {
+        std::rethrow_exception(failure);
+    }
+
+    return success;
+}
+
+} // namespace
+
+CompileResult CompilerContext::compile(const std::string& source, const CompileOptions& options) {
+    std::istringstream in(source);
+    std::ostringstream out;
+    CompileResult result;
+    compile(in, options, out, result);
+    result.output = out.str();
+    return result;
+}
+
+void CompilerContext::compile(std::istream& in, const CompileOptions& options, std::ostream& out,
+                              CompileResult& result) {
+    if(names_.size() > max_names) {
+        reset();
+    }
+
+    std::vector<std::unique_ptr<ast::Entity>> imported;
+
+    try {
+        for(const auto& path : options.imports) {
+            for(auto& entity : import_module(path, names_)) {
+                imported.push_back(std::move(entity));
+            }
+        }
+    }
+    catch(const module_exception& e) {
+        result.diagnostics = e.diagnostics();
+        result.status = CompileStatus::ParseError;
+        return;
+    }
+
+    int success;
+    Parser parser(in);
+    parser.setMaxErrors(options.max_errors);
+
+    bool streaming = (options.streaming || options.pipeline > 0) && !options.dump_ast && !options.dump_ir && !options.run;
+    CodeGenerator generator(out, parser.source(), options.codegen, names_);
+    StreamingCompiler streamed(parser, generator, names_);
+
+    if(streaming) {
+        generator.begin();
+
+        for(auto& entity : imported) {
+            streamed.add(std::move(entity));
+        }
+
+        parser.setEntityHandler([&streamed](std::unique_ptr<ast::Entity>&& entity) {
+            streamed.add(std::move(entity));
+        });
+    }
+    else {
+        parser.prog().entities = std::move(imported);
+    }
+
+    try {
+        if(streaming && options.pipeline > 0) {
+            success = parse_pipelined(parser, streamed, generator, options.pipeline, result.stages);
+        }
+        else {
+            success = parser.parse();
+        }
+    }
+    catch(const std::exception& e) {
+        result.diagnostics.push_back(e.what());
+        result.status = CompileStatus::ParseError;
+        return;
+    }
+
+    for(const auto& diagnostic : parser.diagnostics()) {
+        result.diagnostics.push_back(diagnostic.message);
+    }
+
+    if(parser.tooManyErrors()) {
+        result.diagnostics.push_back("too many errors, stopping now (-fmax-errors="
+                                     + std::to_string(options.max_errors) + ")");
+    }
+    else if(parser.diagnostics().empty() && success != 0) {
+        result.diagnostics.push_back("syntax error");
+    }
+
+    if(!result.diagnostics.empty()) {
+        result.status = CompileStatus::ParseError;
+        return;
+    }
+
+    if(streaming) {
+        // errors in calls made before a definition are found with it
+        std::stable_sort(streamed.errors.begin(), streamed.errors.end(),
+                         [](const SemanticError& a, const SemanticError& b) { return a.offset < b.offset; });
+
+        for(const auto& error : streamed.errors) {
+            result.diagnostics.push_back(located_message(parser.source(), error.offset, error.message));
+        }
+
+        if(!result.diagnostics.empty()) {
+            result.status = CompileStatus::SemanticError;
+            return;
+        }
+
+        if(!streamed.codegen_errors.empty()) {
+            const codegen_exception& e = streamed.codegen_errors.front();
+            result.diagnostics.push_back(located_message(parser.source(), e.offset(), e.what()));
+            result.status = CompileStatus::CodegenError;
+            return;
+        }
+
+        generator.end();
+        result.stack_usage = generator.stack_usage();
+        result.code_size = generator.code_size();
+        result.optimizations = generator.optimizations();
+        return;
+    }
+
+    ast::Program& prog = parser.prog();
+
+    if(options.dump_ast) {
+        out << "parsed:" << std::endl << prog << std::endl;
+        return;
+    }
+
+    for(const auto& error : analyze(prog, names_)) {
+        result.diagnostics.push_back(located_message(parser.source(), error.offset, error.message));
+    }
+
+    if(!result.diagnostics.empty()) {
+        result.status = CompileStatus::SemanticError;
+        return;
+    }
+
+    try {
+        if(options.dump_ir) {
+            dump_ir(out, prog, options, names_);
+        }
+        else if(options.run) {
+            result.exit_status = run(prog, options, out, names_);
+        }
+        else {
+            generator.generate(prog);
+            result.stack_usage = generator.stack_usage();
+            result.code_size = generator.code_size();
+            result.optimizations = generator.optimizations();
+        }
+    }
+    catch(const codegen_exception& e) {
+        result.diagnostics.push_back(located_message(parser.source(), e.offset(), e.what()));
+        result.status = CompileStatus::CodegenError;
+    }
+    catch(const run_exception& e) {
+        result.diagnostics.push_back(located_message(parser.source(), e.offset(), e.what()));
+        result.status = CompileStatus::RuntimeError;
+    }
+    catch(const profile_exception& e) {
+        result.diagnostics.push_back(std::string("error: ") + e.what());
+        result.status = CompileStatus::RuntimeError;
+    }
+}
+
+void CompilerContext::reset() {
+    names_.clear();
+}
+
+CompileResult compile(const std::string& source, const CompileOptions& options) {
+    thread_local CompilerContext context;
+    return context.compile(source, options);
+}
+
+} // namespace microc
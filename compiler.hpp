@@ -0,0 +1,93 @@
+#ifndef MICROC_COMPILER_HPP
+#define MICROC_COMPILER_HPP
+
+#include "codegen.hpp"
+#include "symbols.hpp"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace microc {
+
+class CompileOptions {
+    public:
+        std::size_t max_errors = 20;    // -fmax-errors=N, 0 means no limit
+        bool dump_ast = false;          // -fdump-ast
+        bool dump_ir = false;           // -fdump-ir
+        bool run = false;               // --run: interpret instead of emitting assembly
+        bool streaming = false;         // -fstreaming: emit each entity as soon as it is parsed, see StreamAnalyzer
+        std::vector<std::string> imports;   // -fimport=FILE, see import_module()
+        unsigned pipeline = 0;          // -fpipeline=N: streaming, on threads, with N codegen workers
+        std::istream* input = nullptr;  // read by the program run, none if null
+        std::ostream* error = nullptr;  // written by the program run on fd 2, discarded if null
+        CodeGenOptions codegen;
+};
+
+enum class CompileStatus : std::uint8_t {
+    Success,
+    ParseError,
+    SemanticError,
+    CodegenError,
+    RuntimeError,
+};
+
+/*
+ * Time spent by a stage of the pipeline. Waiting is split by what was
+ * waited for: the stage before, or room in the queue to the stage after.
+ */
+class StageStats {
+    public:
+        std::string name;
+        std::uint64_t items = 0;    // given to the next stage
+        double busy = 0;            // seconds, summed over the threads of the stage
+        double starved = 0;         // waiting for input
+        double blocked = 0;         // waiting for the next stage
+};
+
+class CompileResult {
+    public:
+        CompileStatus status = CompileStatus::Success;
+        std::string output;                     // assembly, the requested dump, or what the program wrote
+        int exit_status = 0;                    // of the program run
+        std::vector<std::string> diagnostics;   // one message per error, in source order
+        std::vector<StackUsage> stack_usage;    // one entry per function
+        std::vector<CodeSize> code_size;        // with -fcode-size-report, one entry per function
+        std::vector<OptimizationReport> optimizations;  // with -fopt-report, one entry per function
+        std::vector<StageStats> stages;         // with -fpipeline, in pipeline order
+};
+
+/*
+ * Compiles programs one after the other, keeping what is worth keeping
+ * from one to the next: the names interned by the analysis and the
+ * lowering, whose table is only dropped once it holds more than max_names
+ * names.
+ *
+ * A context must not be used by two threads at once; compile() below
+ * gives each thread its own.
+ */
+class CompilerContext {
+    public:
+        static const std::size_t max_names = 1 << 16;
+
+    public:
+        CompileResult compile(const std::string& source, const CompileOptions& options);
+        void compile(std::istream& in, const CompileOptions& options, std::ostream& out, CompileResult& result);
+
+        // forgets everything kept from previous compilations
+        void reset();
+
+    private:
+        Interner names_;
+};
+
+/*
+ * Compiles source with a context private to the calling thread.
+ */
+CompileResult compile(const std::string& source, const CompileOptions& options);
+
+} // namespace microc
+
+#endif // MICROC_COMPILER_HPP
@@ -0,0 +1,692 @@
+#include "compiler.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Fuzz target for the whole compiler, built with libFuzzer by
+ * `make fuzz-libfuzzer`, or with the standalone driver at the end of this
+ * file by `make fuzz`.
+ *
+ * Every input is used three ways:
+ *  - as source text, which must go through the scanner, the parser, the
+ *    analysis and the code generator without crashing;
+ *  - as the choices of a generator of programs that are valid and always
+ *    terminate, each one run by the interpreter with and without
+ *    optimization, both runs having to give the same output and status;
+ *  - as edits to the generated program, to reach the parser's error
+ *    recovery with source that is almost right.
+ *
+ * Whatever parses must print as source that parses back to the same tree.
+ * A failed check prints the program and aborts.
+ */
+
+namespace {
+
+using microc::CompileOptions;
+using microc::CompileResult;
+using microc::CompileStatus;
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+ * Time spent in each kind of compilation, to spot a slow component.
+ */
+class Stats {
+    public:
+        static const int parse = 0, compile = 1, run = 2;
+
+        double seconds[3] = {0, 0, 0};
+        unsigned long long execs = 0;
+};
+
+Stats stats;
+
+CompileResult timed_compile(int stage, const std::string& source, const CompileOptions& options) {
+    Clock::time_point start = Clock::now();
+    CompileResult result = microc::compile(source, options);
+    stats.seconds[stage] += std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+[[noreturn]] void fail(const std::string& what, const std::string& source) {
+    std::cerr << "==== " << what << std::endl << source << std::endl << "====" << std::endl;
+    std::abort();
+}
+
+std::string describe(const CompileResult& result) {
+    std::ostringstream o;
+    o << "status " << static_cast<int>(result.status) << ", exit " << result.exit_status << std::endl;
+
+    for(const auto& diagnostic : result.diagnostics) {
+        o << diagnostic << std::endl;
+    }
+
+    o << "output:" << std::endl << result.output;
+    return o.str();
+}
+
+/*
+ * Prints the tree of source and parses it back, when source parses.
+ */
+void check_round_trip(const std::string& source) {
+    static const std::string header = "parsed:\n";
+    CompileOptions options;
+    options.dump_ast = true;
+
+    CompileResult first = timed_compile(Stats::parse, source, options);
+
+    if(first.status != CompileStatus::Success) {
+        return;
+    }
+
+    std::string printed = first.output.substr(header.size());
+    CompileResult second = timed_compile(Stats::parse, printed, options);
+
+    if(second.status != CompileStatus::Success) {
+        fail("printed program does not parse\n" + describe(second), printed);
+    }
+
+    if(second.output != first.output) {
+        fail("printed program parses to another tree\n" + second.output, source);
+    }
+}
+
+/*
+ * Decisions taken from the bytes of an input. Once they are all used,
+ * every decision is 0, which generators must make the end of recursion.
+ */
+class Choices {
+    public:
+        Choices(const std::uint8_t* data, std::size_t size): data_(data), size_(size) {}
+
+        // a number below n, n at most 1 << 24
+        unsigned below(unsigned n) {
+            std::uint32_t value = 0, range = 1;
+
+            while(range < n && position_ < size_) {
+                value = value << 8 | data_[position_++];
+                range <<= 8;
+            }
+
+            return n == 0 ? 0 : value % n;
+        }
+
+        // true once in n
+        bool one_in(unsigned n) {
+            return below(n) == 1 % n;
+        }
+
+    private:
+        const std::uint8_t* data_;
+        std::size_t size_;
+        std::size_t position_ = 0;
+};
+
+/*
+ * Generates a program from choices. Loops are counted and never run more
+ * than 8 times, functions only call those defined before them, indices
+ * are masked and divisors positive, so that the program terminates
+ * without trapping; main writes the globals and returns a checksum.
+ */
+class Generator {
+    public:
+        explicit Generator(Choices& choices): choices_(choices) {}
+
+        std::string program() {
+            o_ << "int g0;\nint g1;\nint g2;\nchar gc;\nint garr[8];\n";
+            o_ << "struct pair" << (choices_.one_in(2) ? " packed" : "") << " {\nchar c;\nint x;\n};\n";
+            o_ << "struct pair gp;\n";
+            o_ << "char text[9];\n\n";
+            o_ << "void emit(int x) {\n"
+                  "    for(int i = 7; i >= 0; i = i - 1) {\n"
+                  "        int d = x & 15;\n"
+                  "        if(d < 10) { text[i] = (char) (d + '0'); } else { text[i] = (char) (d - 10 + 'a'); }\n"
+                  "        x = x >> 4;\n"
+                  "    }\n"
+                  "    text[8] = '\\n';\n"
+                  "    write(1, text, 9);\n"
+                  "}\n";
+
+            unsigned count = 1 + choices_.below(5);
+
+            for(functions_ = 0; functions_ < count; ++functions_) {
+                function();
+            }
+
+            o_ << "\nint main() {\n";
+            begin_body(4);
+            main_ = true;
+            statements(1, 3 + choices_.below(12));
+            o_ << "    emit(g0);\n    emit(g1);\n    emit(g2);\n    emit(gc);\n    emit(gp.x);\n    emit(gp.c);\n";
+            o_ << "    for(int i = 0; i < 8; i = i + 1) { emit(garr[i]); }\n";
+            o_ << "    return " << expression(2) << ";\n}\n";
+            return o_.str();
+        }
+
+    private:
+        class Variable {
+            public:
+                std::string name;
+                char kind;          // 'i'nt, 'c'har, 'b'ool, 'a'rray of 8 ints, 'p'ointer to int
+                bool assignable;
+        };
+
+        void function() {
+            o_ << "\nint f" << functions_ << "(int a, char c) {\n";
+            begin_body(2);
+            variables_.push_back(Variable{"a", 'i', true});
+            variables_.push_back(Variable{"c", 'c', true});
+            statements(1, choices_.below(10));
+            o_ << "    return " << expression(2) << ";\n}\n";
+        }
+
+        void begin_body(int calls) {
+            variables_.clear();
+            calls_ = calls;
+            budget_ = 40;
+            loops_ = 0;
+        }
+
+        std::string fresh(const char* prefix) {
+            return prefix + std::to_string(names_++);
+        }
+
+        void indent(int depth) {
+            o_ << std::string(4 * depth, ' ');
+        }
+
+        void statements(int depth, unsigned count) {
+            std::size_t scope = variables_.size();
+
+            for(unsigned i = 0; i < count && budget_ > 0; ++i) {
+                statement(depth);
+            }
+
+            variables_.resize(scope);
+        }
+
+        void block(int depth) {
+            o_ << "{\n";
+            statements(depth + 1, choices_.below(5));
+            indent(depth);
+            o_ << "}";
+        }
+
+        void statement(int depth) {
+            --budget_;
+            unsigned kind = choices_.below(depth > 3 ? 3 : 11);
+            indent(depth);
+
+            switch(kind) {
+                case 0:
+                    assignment();
+                    break;
+                case 1:
+                    declaration(depth);
+                    break;
+                case 2:
+                    o_ << "gp.x = gp.x + (" << expression(2) << ");\n";
+                    break;
+                case 3:
+                    o_ << "if(" << condition(2) << ") ";
+                    block(depth);
+
+                    if(choices_.one_in(2)) {
+                        o_ << " else ";
+
+                        if(choices_.one_in(2)) {
+                            o_ << "if(" << condition(2) << ") ";
+                        }
+
+                        block(depth);
+                    }
+
+                    o_ << "\n";
+                    break;
+                case 4:
+                case 5: {
+                    if(loops_ >= 2) {
+                        assignment();
+                        break;
+                    }
+
+                    std::string counter = fresh("i");
+                    unsigned trips = choices_.below(9);
+                    ++loops_;
+
+                    if(kind == 4) {
+                        o_ << "for(int " << counter << " = 0; " << counter << " < " << trips << "; "
+                           << counter << " = " << counter << " + 1) ";
+                        variables_.push_back(Variable{counter, 'i', false});
+                        block(depth);
+                        variables_.pop_back();
+                        o_ << "\n";
+                    }
+                    else {
+                        // incremented first, continue cannot skip it
+                        o_ << "int " << counter << " = 0;\n";
+                        indent(depth);
+                        o_ << "while(" << counter << " < " << trips << ") {\n";
+                        indent(depth + 1);
+                        o_ << counter << " = " << counter << " + 1;\n";
+                        variables_.push_back(Variable{counter, 'i', false});
+                        statements(depth + 1, choices_.below(5));
+                        indent(depth);
+                        o_ << "}\n";
+                    }
+
+                    --loops_;
+                    break;
+                }
+                case 6:
+                    block(depth);
+                    o_ << "\n";
+                    break;
+                case 7:
+                    if(loops_ > 0) {
+                        o_ << "if(" << condition(1) << ") { " << (choices_.one_in(2) ? "break" : "continue")
+                           << "; }\n";
+                    }
+                    else if(!main_) {
+                        o_ << "if(" << condition(1) << ") { return " << expression(1) << "; }\n";
+                    }
+                    else {
+                        o_ << "g2 = " << expression(1) << ";\n";
+                    }
+                    break;
+                case 8:
+                    o_ << "garr[(" << expression(2) << ") & 7] = " << expression(2) << ";\n";
+                    break;
+                case 9:
+                    if(loops_ == 0 && calls_ > 0 && functions_ > 0) {
+                        o_ << call(1) << ";\n";
+                    }
+                    else {
+                        o_ << "g1 = g1 ^ (" << expression(1) << ");\n";
+                    }
+                    break;
+                default:
+                    o_ << "gc = (char) (" << expression(2) << ");\n";
+                    break;
+            }
+        }
+
+        void assignment() {
+            std::vector<const Variable*> targets;
+
+            for(const auto& v : variables_) {
+                if(v.assignable && v.kind != 'p') {
+                    targets.push_back(&v);
+                }
+            }
+
+            if(targets.empty() || choices_.one_in(4)) {
+                o_ << "g" << choices_.below(3) << " = " << expression(3) << ";\n";
+                return;
+            }
+
+            const Variable& v = *targets[choices_.below(targets.size())];
+
+            switch(v.kind) {
+                case 'c':
+                    o_ << v.name << " = (char) (" << expression(3) << ");\n";
+                    break;
+                case 'b':
+                    o_ << v.name << " = " << condition(2) << ";\n";
+                    break;
+                case 'a':
+                    o_ << v.name << "[(" << expression(2) << ") & 7] = " << expression(3) << ";\n";
+                    break;
+                default:
+                    o_ << v.name << " = " << expression(3) << ";\n";
+                    break;
+            }
+        }
+
+        void declaration(int depth) {
+            switch(choices_.below(5)) {
+                case 0: {
+                    std::string init = expression(3);
+                    std::string name = fresh("v");
+                    o_ << "int " << name << " = " << init << ";\n";
+                    variables_.push_back(Variable{name, 'i', true});
+                    break;
+                }
+                case 1: {
+                    std::string init = expression(2);
+                    std::string name = fresh("v");
+                    o_ << "char " << name << " = (char) (" << init << ");\n";
+                    variables_.push_back(Variable{name, 'c', true});
+                    break;
+                }
+                case 2: {
+                    std::string init = condition(2);
+                    std::string name = fresh("v");
+                    o_ << "bool " << name << " = " << init << ";\n";
+                    variables_.push_back(Variable{name, 'b', true});
+                    break;
+                }
+                case 3: {
+                    // initialized before use, its elements read nothing uninitialized
+                    std::string name = fresh("v"), counter = fresh("i");
+                    o_ << "int " << name << "[8];\n";
+                    indent(depth);
+                    o_ << "for(int " << counter << " = 0; " << counter << " < 8; " << counter << " = "
+                       << counter << " + 1) { " << name << "[" << counter << "] = " << expression(2) << "; }\n";
+                    variables_.push_back(Variable{name, 'a', true});
+                    break;
+                }
+                default: {
+                    std::vector<std::string> arrays = {"garr"};
+
+                    for(const auto& v : variables_) {
+                        if(v.kind == 'a') {
+                            arrays.push_back(v.name);
+                        }
+                    }
+
+                    std::string name = fresh("p");
+                    o_ << "int* " << name << " = " << arrays[choices_.below(arrays.size())] << ";\n";
+                    variables_.push_back(Variable{name, 'p', false});
+                    break;
+                }
+            }
+        }
+
+        std::string call(int depth) {
+            --calls_;
+            unsigned callee = choices_.below(functions_);
+            return "f" + std::to_string(callee) + "(" + expression(depth) + ", (char) (" + expression(depth) + "))";
+        }
+
+        std::string literal() {
+            switch(choices_.below(4)) {
+                case 0:
+                    return std::to_string(choices_.below(10));
+                case 1:
+                    return std::to_string(choices_.below(100000));
+                case 2: {
+                    std::ostringstream o;
+                    o << "0x" << std::hex << (choices_.below(1 << 16) << 16 | choices_.below(1 << 16));
+                    return o.str();
+                }
+                default:
+                    return "'" + std::string(1, static_cast<char>('a' + choices_.below(26))) + "'";
+            }
+        }
+
+        const Variable* pick(char kind) {
+            std::vector<const Variable*> candidates;
+
+            for(const auto& v : variables_) {
+                if(v.kind == kind || (kind == 'i' && v.kind == 'c')) {
+                    candidates.push_back(&v);
+                }
+            }
+
+            return candidates.empty() ? nullptr : candidates[choices_.below(candidates.size())];
+        }
+
+        std::string expression(int depth) {
+            static const char* arithmetic[] = {"+", "-", "*", "&", "|", "^", "<<", ">>"};
+            static const char* divisors[] = {"1", "2", "3", "4", "5", "7", "8", "10", "16", "1000", "-3", "-8"};
+
+            switch(choices_.below(depth <= 0 ? 3 : 12)) {
+                case 0:
+                    return literal();
+                case 1: {
+                    const Variable* v = pick('i');
+                    return v ? v->name : "g" + std::to_string(choices_.below(3));
+                }
+                case 2:
+                    return choices_.one_in(2) ? "gc" : "gp.c";
+                case 3:
+                case 4:
+                    return "(" + expression(depth - 1) + ") " + arithmetic[choices_.below(8)]
+                           + " (" + expression(depth - 1) + ")";
+                case 5:
+                    return "(" + expression(depth - 1) + ") " + (choices_.one_in(2) ? "/" : "%") + " (("
+                           + expression(depth - 1) + ") % 7 + 8)";
+                case 6:
+                    return "(" + expression(depth - 1) + ") " + (choices_.one_in(2) ? "/ " : "% ")
+                           + divisors[choices_.below(12)];
+                case 7:
+                    return std::string(choices_.one_in(2) ? "-" : "~") + "(" + expression(depth - 1) + ")";
+                case 8:
+                    return "(int) (" + condition(depth - 1) + ")";
+                case 9: {
+                    const Variable* v = pick(choices_.one_in(2) ? 'a' : 'p');
+                    std::string array = v ? v->name : "garr";
+
+                    if(v && v->kind == 'p' && choices_.one_in(2)) {
+                        return "*(" + array + " + ((" + expression(depth - 1) + ") & 7))";
+                    }
+
+                    return array + "[(" + expression(depth - 1) + ") & 7]";
+                }
+                case 10:
+                    if(loops_ == 0 && calls_ > 0 && functions_ > 0) {
+                        return call(depth - 1);
+                    }
+
+                    return "gp.x";
+                default:
+                    return choices_.one_in(2) ? "sizeof(struct pair)" : "sizeof(garr)";
+            }
+        }
+
+        std::string condition(int depth) {
+            static const char* comparisons[] = {"<", "<=", ">", ">=", "==", "!="};
+
+            switch(choices_.below(depth <= 0 ? 3 : 7)) {
+                case 0:
+                    return "(" + expression(depth - 1) + ") " + comparisons[choices_.below(6)] + " ("
+                           + expression(depth - 1) + ")";
+                case 1: {
+                    const Variable* v = pick('b');
+                    return v ? v->name : (choices_.one_in(2) ? "true" : "false");
+                }
+                case 2:
+                    return "(" + expression(depth - 1) + ") " + comparisons[choices_.below(6)] + " " + literal();
+                case 3:
+                    return "!(" + condition(depth - 1) + ")";
+                case 4:
+                    return "(" + condition(depth - 1) + ") && (" + condition(depth - 1) + ")";
+                case 5:
+                    return "(" + condition(depth - 1) + ") || (" + condition(depth - 1) + ")";
+                default: {
+                    const Variable* v = pick('p');
+                    return v ? v->name + " != NULL" : "gp.x != 0";
+                }
+            }
+        }
+
+    private:
+        Choices& choices_;
+        std::ostringstream o_;
+        std::vector<Variable> variables_;
+        unsigned functions_ = 0;    // defined so far, those callable
+        unsigned names_ = 0;
+        int calls_ = 0;             // left in the function being generated
+        int budget_ = 0;            // statements left in the function being generated
+        int loops_ = 0;             // enclosing the statement being generated
+        bool main_ = false;         // main must reach the end, where it writes the globals
+};
+
+/*
+ * Runs program with and without optimization, both runs must agree, and
+ * compiles it to assembly both ways.
+ */
+void check_program(const std::string& program) {
+    CompileOptions options;
+    options.run = true;
+    options.codegen.lowering.optimize = false;
+    CompileResult plain = timed_compile(Stats::run, program, options);
+
+    if(plain.status != CompileStatus::Success) {
+        fail("generated program does not run\n" + describe(plain), program);
+    }
+
+    options.codegen.lowering.optimize = true;
+    CompileResult optimized = timed_compile(Stats::run, program, options);
+
+    if(optimized.status != plain.status || optimized.output != plain.output
+       || optimized.exit_status != plain.exit_status || optimized.diagnostics != plain.diagnostics) {
+        fail("optimized program behaves differently\nwithout optimization: " + describe(plain)
+             + "\nwith optimization: " + describe(optimized), program);
+    }
+
+    options.run = false;
+
+    for(bool optimize : {false, true}) {
+        options.codegen.lowering.optimize = optimize;
+        options.codegen.regparm = optimize ? 3 : 0;
+        CompileResult compiled = timed_compile(Stats::compile, program, options);
+
+        if(compiled.status != CompileStatus::Success) {
+            fail("generated program does not compile\n" + describe(compiled), program);
+        }
+    }
+}
+
+/*
+ * A few edits of program, to be compiled as is.
+ */
+std::string mutate(const std::string& program, Choices& choices) {
+    static const char* tokens[] = {"(", ")", "{", "}", ";", ",", "=", "*", "[", "]", "0", "x", "int ", "if ",
+                                   "else ", "\"", "'", "struct ", "->", ".", "/*", "asm(\"nop\");", "return "};
+    std::string mutated = program;
+    unsigned edits = 1 + choices.below(4);
+
+    for(unsigned i = 0; i < edits && !mutated.empty(); ++i) {
+        std::size_t position = choices.below(mutated.size());
+
+        switch(choices.below(3)) {
+            case 0:
+                mutated.erase(position, 1 + choices.below(8));
+                break;
+            case 1:
+                mutated.insert(position, tokens[choices.below(sizeof(tokens) / sizeof(tokens[0]))]);
+                break;
+            default:
+                mutated[position] = static_cast<char>(choices.below(128));
+                break;
+        }
+    }
+
+    return mutated;
+}
+
+void compile_any(const std::string& source) {
+    CompileOptions options;
+    options.max_errors = 0;
+    timed_compile(Stats::compile, source, options);
+    check_round_trip(source);
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+    ++stats.execs;
+    compile_any(std::string(reinterpret_cast<const char*>(data), size));
+
+    Choices choices(data, size);
+    std::string program = Generator(choices).program();
+    check_round_trip(program);
+    check_program(program);
+    compile_any(mutate(program, choices));
+    return 0;
+}
+
+#ifndef MICROC_LIBFUZZER
+
+namespace {
+
+void report(Clock::time_point start) {
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    double total = stats.seconds[Stats::parse] + stats.seconds[Stats::compile] + stats.seconds[Stats::run];
+    total = total > 0 ? total : 1;
+
+    std::fprintf(stderr, "#%llu\texecs/s: %.0f\tparse: %.0f%%\tcompile: %.0f%%\trun: %.0f%%\n", stats.execs,
+                 stats.execs / (elapsed > 0 ? elapsed : 1), 100 * stats.seconds[Stats::parse] / total,
+                 100 * stats.seconds[Stats::compile] / total, 100 * stats.seconds[Stats::run] / total);
+}
+
+} // namespace
+
+/*
+ * Runs the files given on the command line, or random inputs of up to
+ * -max_len bytes, the options being those of libFuzzer.
+ */
+int main(int argc, char** argv) {
+    unsigned long long runs = 100000;
+    std::size_t max_len = 4096;
+    unsigned seed = std::random_device()();
+    std::vector<const char*> files;
+
+    for(int i = 1; i < argc; ++i) {
+        if(std::strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = std::strtoull(argv[i] + 6, nullptr, 10);
+        }
+        else if(std::strncmp(argv[i], "-max_len=", 9) == 0) {
+            max_len = std::strtoul(argv[i] + 9, nullptr, 10);
+        }
+        else if(std::strncmp(argv[i], "-seed=", 6) == 0) {
+            seed = std::strtoul(argv[i] + 6, nullptr, 10);
+        }
+        else if(argv[i][0] == '-') {
+            std::cerr << "usage: " << argv[0] << " [-runs=N] [-max_len=N] [-seed=N] [FILE...]" << std::endl;
+            return 1;
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    Clock::time_point start = Clock::now();
+
+    for(const char* file : files) {
+        std::ifstream in(file, std::ios::binary);
+        std::string input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(input.data()), input.size());
+    }
+
+    if(!files.empty()) {
+        report(start);
+        return 0;
+    }
+
+    std::cerr << "seed: " << seed << std::endl;
+    std::mt19937 random(seed);
+    std::vector<std::uint8_t> input;
+
+    for(unsigned long long i = 1; i <= runs; ++i) {
+        input.resize(std::uniform_int_distribution<std::size_t>(0, max_len)(random));
+
+        for(auto& byte : input) {
+            byte = random();
+        }
+
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+
+        if((i & (i - 1)) == 0) {
+            report(start);
+        }
+    }
+
+    report(start);
+    return 0;
+}
+
+#endif // MICROC_LIBFUZZER
@@ -0,0 +1,446 @@
+#include "gvn.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace microc {
+
+namespace {
+
+/*
+ * What an instruction computes, its register operands being value
+ * numbers, and the memory it reads for a load.
+ */
+class Expression {
+    public:
+        explicit Expression(const ir::Instr& instr):
+            op(instr.op),
+            cond(instr.cond),
+            size(instr.size),
+            sign(instr.sign || instr.size == 4),
+            a(instr.a),
+            b(instr.b),
+            index(instr.index),
+            disp(instr.disp),
+            scale(instr.scale),
+            args(instr.args),
+            symbol(instr.symbol)
+        {
+            bool commutative = op == ir::Opcode::Add || op == ir::Opcode::Mul || op == ir::Opcode::And
+                               || op == ir::Opcode::Or || op == ir::Opcode::Xor;
+
+            if(commutative && (b.kind < a.kind || (b.kind == a.kind && b.value < a.value))) {
+                std::swap(a, b);
+            }
+        }
+
+        bool operator==(const Expression& o) const {
+            return op == o.op && cond == o.cond && size == o.size && sign == o.sign && a == o.a && b == o.b
+                   && index == o.index && disp == o.disp && scale == o.scale && args == o.args && symbol == o.symbol
+                   && memory == o.memory;
+        }
+
+    public:
+        ir::Opcode op;
+        ir::Cond cond;
+        std::uint8_t size;
+        bool sign;
+        ir::Operand a;
+        ir::Operand b;
+        ir::Operand index;
+        std::int32_t disp;
+        std::uint8_t scale;
+        std::vector<ir::Operand> args;
+        std::string symbol;
+        std::uint64_t memory = 0;
+};
+
+class ExpressionHash {
+    public:
+        std::size_t operator()(const Expression& e) const {
+            std::size_t hash = 14695981039346656037ull;
+
+            auto mix = [&hash](std::uint64_t value) {
+                hash = (hash ^ value) * 1099511628211ull;
+            };
+
+            auto mix_operand = [&mix](const ir::Operand& op) {
+                mix(static_cast<std::uint64_t>(op.kind) << 32 | static_cast<std::uint32_t>(op.value));
+            };
+
+            mix(static_cast<std::uint64_t>(e.op) << 16 | static_cast<std::uint64_t>(e.cond) << 8 | e.size);
+            mix_operand(e.a);
+            mix_operand(e.b);
+            mix_operand(e.index);
+            mix(static_cast<std::uint32_t>(e.disp));
+            mix(e.memory);
+
+            for(const auto& arg : e.args) {
+                mix_operand(arg);
+            }
+
+            return hash ^ std::hash<std::string>()(e.symbol);
+        }
+};
+
+/*
+ * Versions of the memory at a point of the function.
+ */
+class Memory {
+    public:
+        std::uint64_t local(std::uint32_t slot) const {
+            auto it = locals.find(slot);
+            return it == locals.end() ? epoch : it->second;
+        }
+
+    public:
+        std::uint64_t epoch = 0;        // of the locals not stored to since
+        std::uint64_t shared = 0;       // of everything else
+        std::unordered_map<std::uint32_t, std::uint64_t> locals;
+};
+
+class Numbering {
+    public:
+        explicit Numbering(ir::Function& function):
+            function_(function),
+            escaped_(function.escaped_slots()),
+            predecessors_(function.blocks.size()),
+            removed_(function.blocks.size())
+        {
+            for(const auto& block : function.blocks) {
+                removed_[block.id].resize(block.instrs.size());
+
+                if(block.terminated()) {
+                    for(std::uint32_t succ : block.successors()) {
+                        predecessors_[succ].push_back(block.id);
+                    }
+                }
+
+                for(const auto& instr : block.instrs) {
+                    define(instr.dst);
+
+                    for(ir::Register r : instr.results) {
+                        define(r);
+                    }
+                }
+            }
+        }
+
+        std::uint32_t run() {
+            std::vector<std::vector<std::uint32_t>> children = dominator_tree();
+            std::vector<Memory> exits(function_.blocks.size());
+
+            // down the tree, each block seeing the expressions of its
+            // dominators: (block, next child, size of the log at its entry)
+            std::vector<std::pair<std::uint32_t, std::size_t>> stack;
+            std::vector<std::size_t> markers;
+
+            auto enter = [&](std::uint32_t b) {
+                const std::vector<std::uint32_t>& preds = predecessors_[b];
+                Memory memory;
+
+                if(b != 0 && preds.size() == 1 && !stack.empty() && preds[0] == stack.back().first) {
+                    memory = exits[preds[0]];
+                }
+                else {
+                    memory.epoch = ++version_;
+                    memory.shared = ++version_;
+                }
+
+                stack.emplace_back(b, 0);
+                markers.push_back(log_.size());
+                visit(function_.blocks[b], memory);
+                exits[b] = std::move(memory);
+            };
+
+            enter(0);
+
+            while(!stack.empty()) {
+                std::uint32_t b = stack.back().first;
+
+                if(stack.back().second < children[b].size()) {
+                    enter(children[b][stack.back().second++]);
+                    continue;
+                }
+
+                for(std::size_t i = markers.back(); i < log_.size(); ++i) {
+                    table_.erase(log_[i]);
+                }
+
+                log_.erase(log_.begin() + markers.back(), log_.end());
+                markers.pop_back();
+                exits[b] = Memory();
+                stack.pop_back();
+            }
+
+            std::uint32_t eliminated = 0;
+
+            for(auto& block : function_.blocks) {
+                std::vector<ir::Instr> kept;
+
+                for(std::size_t i = 0; i < block.instrs.size(); ++i) {
+                    if(removed_[block.id][i]) {
+                        ++eliminated;
+                    }
+                    else {
+                        kept.push_back(std::move(block.instrs[i]));
+                        replace(kept.back());
+                    }
+                }
+
+                block.instrs = std::move(kept);
+            }
+
+            return eliminated;
+        }
+
+    private:
+        void define(ir::Register r) {
+            if(r != ir::no_register) {
+                if(r >= definitions_.size()) {
+                    definitions_.resize(r + 1);
+                }
+
+                ++definitions_[r];
+            }
+        }
+
+        // not a register defined more than once
+        bool stable(const ir::Operand& op) const {
+            return !op.is_register() || (static_cast<std::size_t>(op.value) < definitions_.size()
+                                         && definitions_[op.value] == 1);
+        }
+
+        bool stable(const ir::Instr& instr) const {
+            return (instr.dst == ir::no_register || stable(ir::Operand::reg(instr.dst))) && stable(instr.a) && stable(instr.b) && stable(instr.index)
+                   && std::all_of(instr.args.begin(), instr.args.end(), [this](const ir::Operand& op) {
+                          return stable(op);
+                      });
+        }
+
+        void replace(ir::Operand& op) const {
+            if(op.is_register()) {
+                auto it = replaced_.find(op.value);
+
+                if(it != replaced_.end()) {
+                    op = it->second;
+                }
+            }
+        }
+
+        void replace(ir::Instr& instr) const {
+            replace(instr.a);
+            replace(instr.b);
+            replace(instr.index);
+
+            for(auto& arg : instr.args) {
+                replace(arg);
+            }
+        }
+
+        // a local only read and written by its name
+        bool is_local(const ir::Instr& access) const {
+            return access.a.kind == ir::Operand::Kind::Slot && access.index.is_none() && access.disp == 0
+                   && !escaped_[access.a.value];
+        }
+
+        std::uint64_t version(const ir::Instr& access, const Memory& memory) const {
+            return is_local(access) ? memory.local(access.a.value) : memory.shared;
+        }
+
+        // whether an earlier instruction computed the same, else it is one
+        bool redundant(const Expression& e, const ir::Instr& instr, std::size_t i, std::uint32_t block) {
+            auto it = table_.find(e);
+
+            if(it == table_.end()) {
+                table_.emplace(e, instr.dst == ir::no_register ? ir::Operand() : ir::Operand::reg(instr.dst));
+                log_.push_back(e);
+                return false;
+            }
+
+            if(instr.dst != ir::no_register) {
+                replaced_[instr.dst] = it->second;
+            }
+
+            removed_[block][i] = true;
+            return true;
+        }
+
+        void visit(ir::Block& block, Memory& memory) {
+            for(std::size_t i = 0; i < block.instrs.size(); ++i) {
+                ir::Instr& instr = block.instrs[i];
+                replace(instr);
+
+                switch(instr.op) {
+                    case ir::Opcode::Load:
+                        if(stable(instr)) {
+                            Expression e(instr);
+                            e.memory = version(instr, memory);
+                            redundant(e, instr, i, block.id);
+                        }
+                        break;
+                    case ir::Opcode::Store: {
+                        std::uint64_t stored = ++version_;
+
+                        if(is_local(instr)) {
+                            memory.locals[instr.a.value] = stored;
+                        }
+                        else {
+                            memory.shared = stored;
+                        }
+
+                        // the value stored is what a load would read
+                        if(instr.size == 4 && stable(instr)) {
+                            ir::Instr load(ir::Opcode::Load);
+                            load.a = instr.a;
+                            load.symbol = instr.symbol;
+                            load.disp = instr.disp;
+                            load.index = instr.index;
+                            load.scale = instr.scale;
+
+                            Expression e(load);
+                            e.memory = stored;
+                            table_.emplace(e, instr.b);
+                            log_.push_back(e);
+                        }
+                        break;
+                    }
+                    case ir::Opcode::Call:
+                    case ir::Opcode::Vector:
+                        memory.shared = ++version_;
+                        break;
+                    case ir::Opcode::Asm:
+                        memory.epoch = ++version_;
+                        memory.shared = ++version_;
+                        memory.locals.clear();
+                        break;
+                    case ir::Opcode::Address:
+                    case ir::Opcode::Neg:
+                    case ir::Opcode::Not:
+                    case ir::Opcode::Add:
+                    case ir::Opcode::Sub:
+                    case ir::Opcode::Mul:
+                    case ir::Opcode::MulHigh:
+                    case ir::Opcode::Div:
+                    case ir::Opcode::Mod:
+                    case ir::Opcode::And:
+                    case ir::Opcode::Or:
+                    case ir::Opcode::Xor:
+                    case ir::Opcode::Shl:
+                    case ir::Opcode::Shr:
+                    case ir::Opcode::Set:
+                    case ir::Opcode::Select:
+                    case ir::Opcode::Check:
+                        if(stable(instr)) {
+                            redundant(Expression(instr), instr, i, block.id);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        /*
+         * Children of each block in the dominator tree, by Cooper, Harvey
+         * and Kennedy's iteration over the blocks in reverse postorder.
+         */
+        std::vector<std::vector<std::uint32_t>> dominator_tree() const {
+            std::size_t n = function_.blocks.size();
+            std::vector<std::uint32_t> postorder;
+            std::vector<std::uint32_t> number(n, n);
+            std::vector<bool> seen(n);
+            std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 0}};
+            seen[0] = true;
+
+            while(!stack.empty()) {
+                const ir::Block& block = function_.blocks[stack.back().first];
+                std::vector<std::uint32_t> succs = block.terminated() ? block.successors() : std::vector<std::uint32_t>();
+
+                if(stack.back().second == succs.size()) {
+                    number[block.id] = postorder.size();
+                    postorder.push_back(block.id);
+                    stack.pop_back();
+                    continue;
+                }
+
+                std::uint32_t succ = succs[stack.back().second++];
+
+                if(!seen[succ]) {
+                    seen[succ] = true;
+                    stack.emplace_back(succ, 0);
+                }
+            }
+
+            std::vector<std::uint32_t> idom(n, n);
+            idom[0] = 0;
+
+            auto intersect = [&](std::uint32_t a, std::uint32_t b) {
+                while(a != b) {
+                    while(number[a] < number[b]) {
+                        a = idom[a];
+                    }
+
+                    while(number[b] < number[a]) {
+                        b = idom[b];
+                    }
+                }
+
+                return a;
+            };
+
+            for(bool changed = true; changed;) {
+                changed = false;
+
+                for(auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+                    std::uint32_t dom = n;
+
+                    if(*it == 0) {
+                        continue;
+                    }
+
+                    for(std::uint32_t pred : predecessors_[*it]) {
+                        if(idom[pred] != n) {
+                            dom = dom == n ? pred : intersect(pred, dom);
+                        }
+                    }
+
+                    if(dom != idom[*it]) {
+                        idom[*it] = dom;
+                        changed = true;
+                    }
+                }
+            }
+
+            std::vector<std::vector<std::uint32_t>> children(n);
+
+            for(auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+                if(*it != 0) {
+                    children[idom[*it]].push_back(*it);
+                }
+            }
+
+            return children;
+        }
+
+    private:
+        ir::Function& function_;
+        std::vector<bool> escaped_;
+        std::vector<std::vector<std::uint32_t>> predecessors_;
+        std::vector<std::uint32_t> definitions_;        // by register
+        std::vector<std::vector<bool>> removed_;        // instructions, by block
+        std::unordered_map<ir::Register, ir::Operand> replaced_;
+
+        std::unordered_map<Expression, ir::Operand, ExpressionHash> table_;
+        std::vector<Expression> log_;                   // added to the table, innermost block last
+        std::uint64_t version_ = 0;
+};
+
+} // namespace
+
+std::uint32_t eliminate_redundancies(ir::Function& function) {
+    return Numbering(function).run();
+}
+
+} // namespace microc
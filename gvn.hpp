@@ -0,0 +1,36 @@
+#ifndef MICROC_GVN_HPP
+#define MICROC_GVN_HPP
+
+#include "ir.hpp"
+
+#include <cstdint>
+
+namespace microc {
+
+/*
+ * Global value numbering: going down the dominator tree, an instruction
+ * computing what a dominating one already did is removed, its register
+ * being replaced by the earlier one. Expressions are looked up in a hash
+ * table keyed by their operator and the value numbers of their operands,
+ * a register standing for its value once replaced, so that chains of
+ * redundant expressions go away together. Bounds checks made again are
+ * removed too.
+ *
+ * Loads are keyed by the version of the memory they read, which changes
+ * at each store that may write it, and at each block with more than one
+ * predecessor. Locals whose address is never taken are versioned on their
+ * own: only stores to them change them, not pointer stores, nor calls.
+ * Every other store, call, or vector loop may write any other memory, and
+ * inline assembly any memory at all. A load after a 4-byte store to the
+ * same address reads the value stored.
+ *
+ * Registers defined more than once, such as the results of inlined calls,
+ * are left alone.
+ *
+ * Returns the number of instructions removed.
+ */
+std::uint32_t eliminate_redundancies(ir::Function& function);
+
+} // namespace microc
+
+#endif // MICROC_GVN_HPP
@@ -0,0 +1,804 @@
+#include "interpreter.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+
+#if defined(__GNUC__)
+#define MICROC_COMPUTED_GOTO 1
+#endif
+
+namespace microc {
+
+#define MICROC_OPS(X)                                                                               \
+    X(Move) X(FrameAddress) X(Address)                                                              \
+    X(Load8) X(Load8u) X(Load32) X(Store8) X(Store32)                                               \
+    X(LoadFrame8) X(LoadFrame8u) X(LoadFrame32) X(StoreFrame8) X(StoreFrame32)                      \
+    X(Neg) X(Not) X(Add) X(Sub) X(Mul) X(MulHigh) X(Div) X(Mod) X(And) X(Or) X(Xor) X(Shl) X(Shr)  \
+    X(Set) X(Select) X(Jump)                                                                        \
+    X(BranchEq) X(BranchNe) X(BranchLt) X(BranchLe) X(BranchGt) X(BranchGe)                         \
+    X(BranchBelow) X(BranchBelowEq) X(BranchAbove) X(BranchAboveEq)                                 \
+    X(Call) X(TailCall) X(Write) X(Read) X(Exit) X(Return) X(Check) X(Count) X(Trap)
+
+// Branch opcodes are in the order of ir::Cond
+enum class Interpreter::Op : std::uint8_t {
+#define MICROC_OP(name) name,
+    MICROC_OPS(MICROC_OP)
+#undef MICROC_OP
+};
+
+run_exception::run_exception(std::uint32_t offset, const std::string& message):
+    offset_(offset),
+    what_(message)
+{}
+
+const char* run_exception::what() const noexcept {
+    return what_.c_str();
+}
+
+namespace {
+
+const std::uint32_t data_base = 0x1000;         // below is unmapped, NULL included
+const std::uint32_t stack_size = 8 << 20;
+const std::uint64_t max_data_size = 256 << 20;  // allocated whole when running, with the stack
+const std::size_t register_stack_size = 1 << 20;
+
+class Trap {
+    public:
+        std::string message;
+};
+
+bool compare(std::uint8_t cond, std::int32_t x, std::int32_t y) {
+    std::uint32_t ux = x, uy = y;
+
+    switch(static_cast<ir::Cond>(cond)) {
+        case ir::Cond::Eq:      return x == y;
+        case ir::Cond::Ne:      return x != y;
+        case ir::Cond::Lt:      return x < y;
+        case ir::Cond::Le:      return x <= y;
+        case ir::Cond::Gt:      return x > y;
+        case ir::Cond::Ge:      return x >= y;
+        case ir::Cond::Below:   return ux < uy;
+        case ir::Cond::BelowEq: return ux <= uy;
+        case ir::Cond::Above:   return ux > uy;
+        case ir::Cond::AboveEq: return ux >= uy;
+        default: assert(false && "unknown condition");
+    }
+
+    return false;
+}
+
+std::uint32_t round_up(std::uint32_t n, std::uint32_t align) {
+    return (n + align - 1) / align * align;
+}
+
+} // namespace
+
+/*
+ * Translates one function: operands become register indices, constants
+ * and symbol addresses being given a constant register, and slot
+ * addresses being computed into temporaries, except for the frame loads
+ * and stores which address the frame directly.
+ */
+class Interpreter::Translator {
+    public:
+        Translator(Interpreter& interpreter, const ir::Function& function,
+                   const std::unordered_map<std::string, std::uint32_t>& indices, Compiled& result):
+            interpreter_(interpreter),
+            function_(function),
+            indices_(indices),
+            result_(result)
+        {}
+
+        void translate() {
+            std::uint32_t frame = 0;
+
+            for(const auto& slot : function_.slots) {
+                frame = round_up(frame, std::max<std::uint32_t>(slot.alignment, 1));
+                slot_offsets_.push_back(frame);
+                frame += slot.size;
+
+                if(slot.argument >= 0) {
+                    std::size_t n = slot.argument;
+                    result_.arguments.resize(std::max(result_.arguments.size(), n + 1));
+                    result_.argument_sizes.resize(result_.arguments.size());
+                    result_.arguments[n] = slot_offsets_.back();
+                    result_.argument_sizes[n] = slot.size;
+                }
+            }
+
+            result_.frame_size = round_up(frame, 16);
+            result_.name = function_.name;
+            result_.first_counter = interpreter_.counters_.size();
+            result_.counters = function_.counters;
+            interpreter_.counters_.resize(interpreter_.counters_.size() + function_.counters);
+            result_.registers = function_.registers + 1;
+            escapes_ = frame_escapes();
+
+            std::vector<std::size_t> block_starts;
+
+            for(const auto& block : function_.blocks) {
+                block_starts.push_back(result_.code.size());
+
+                for(std::size_t i = 0; i < block.instrs.size(); ++i) {
+                    const ir::Instr& instr = block.instrs[i];
+                    offset_ = instr.offset;
+
+                    if(instr.op == ir::Opcode::Jump && instr.targets[0] == block.id + 1) {
+                        continue;
+                    }
+
+                    bool tail = i + 1 < block.instrs.size() && is_tail_call(instr, block.instrs[i + 1]);
+                    translate(instr, tail);
+                }
+            }
+
+            for(auto& code : result_.code) {
+                if(code.op == Op::Jump) {
+                    code.c = block_starts[code.c];
+                }
+                else if(code.op >= Op::BranchEq && code.op <= Op::BranchAboveEq) {
+                    code.c = block_starts[code.c];
+                    code.disp = block_starts[code.disp];
+                }
+            }
+        }
+
+    private:
+        void translate(const ir::Instr& instr, bool tail) {
+            Code code;
+            code.dst = instr.dst;
+
+            switch(instr.op) {
+                case ir::Opcode::Copy:
+                    code.op = Op::Move;
+                    code.a = operand(instr.a, instr);
+                    break;
+                case ir::Opcode::Address:
+                    if(instr.a.kind == ir::Operand::Kind::Slot && instr.index.is_none()) {
+                        code.op = Op::FrameAddress;
+                        code.disp = slot_offsets_[instr.a.value] + instr.disp;
+                    }
+                    else {
+                        code.op = Op::Address;
+                        address(code, instr);
+                    }
+                    break;
+                case ir::Opcode::Load:
+                case ir::Opcode::Store: {
+                    bool load = instr.op == ir::Opcode::Load;
+
+                    if(instr.size != 1 && instr.size != 4) {
+                        throw codegen_exception(instr.offset, "cannot run accesses of " + std::to_string(instr.size) + " bytes");
+                    }
+
+                    if(!load) {
+                        code.c = operand(instr.b, instr);
+                    }
+
+                    if(instr.a.kind == ir::Operand::Kind::Slot && instr.index.is_none()) {
+                        code.op = load ? (instr.size == 4 ? Op::LoadFrame32 : instr.sign ? Op::LoadFrame8 : Op::LoadFrame8u)
+                                       : (instr.size == 4 ? Op::StoreFrame32 : Op::StoreFrame8);
+                        code.disp = slot_offsets_[instr.a.value] + instr.disp;
+                    }
+                    else {
+                        code.op = load ? (instr.size == 4 ? Op::Load32 : instr.sign ? Op::Load8 : Op::Load8u)
+                                       : (instr.size == 4 ? Op::Store32 : Op::Store8);
+                        address(code, instr);
+                    }
+                    break;
+                }
+                case ir::Opcode::Neg:
+                case ir::Opcode::Not:
+                    code.op = instr.op == ir::Opcode::Neg ? Op::Neg : Op::Not;
+                    code.a = operand(instr.a, instr);
+                    break;
+                case ir::Opcode::Add:     code.op = Op::Add;     binary(code, instr); break;
+                case ir::Opcode::Sub:     code.op = Op::Sub;     binary(code, instr); break;
+                case ir::Opcode::Mul:     code.op = Op::Mul;     binary(code, instr); break;
+                case ir::Opcode::MulHigh: code.op = Op::MulHigh; binary(code, instr); break;
+                case ir::Opcode::Div:     code.op = Op::Div;     binary(code, instr); break;
+                case ir::Opcode::Mod:     code.op = Op::Mod;     binary(code, instr); break;
+                case ir::Opcode::And:     code.op = Op::And;     binary(code, instr); break;
+                case ir::Opcode::Or:      code.op = Op::Or;      binary(code, instr); break;
+                case ir::Opcode::Xor:     code.op = Op::Xor;     binary(code, instr); break;
+                case ir::Opcode::Shl:     code.op = Op::Shl;     binary(code, instr); break;
+                case ir::Opcode::Shr:     code.op = Op::Shr;     binary(code, instr); break;
+                case ir::Opcode::Set:
+                    code.op = Op::Set;
+                    code.cond = static_cast<std::uint8_t>(instr.cond);
+                    binary(code, instr);
+                    break;
+                case ir::Opcode::Select:
+                    code.op = Op::Select;
+                    code.cond = static_cast<std::uint8_t>(instr.cond);
+                    binary(code, instr);
+                    code.c = operand(instr.args[0], instr);
+                    code.disp = operand(instr.args[1], instr);
+                    break;
+                case ir::Opcode::Call:
+                    call(code, instr, tail);
+                    break;
+                case ir::Opcode::Asm:
+                    trap(code, "asm statements cannot run");
+                    break;
+                case ir::Opcode::Jump:
+                    code.op = Op::Jump;
+                    code.c = instr.targets[0];
+                    break;
+                case ir::Opcode::Branch:
+                    code.op = static_cast<Op>(static_cast<std::uint8_t>(Op::BranchEq) + static_cast<std::uint8_t>(instr.cond));
+                    binary(code, instr);
+                    code.c = instr.targets[0];
+                    code.disp = instr.targets[1];
+                    break;
+                case ir::Opcode::Return:
+                    code.op = Op::Return;
+                    code.a = instr.a.is_none() ? constant(0) : operand(instr.a, instr);
+                    break;
+                case ir::Opcode::Check:
+                    code.op = Op::Check;
+                    binary(code, instr);
+                    break;
+                case ir::Opcode::Count:
+                    code.op = Op::Count;
+
+                    if(instr.a.is_none()) {
+                        code.cond = static_cast<std::uint8_t>(ir::Cond::Eq);
+                        code.a = code.b = constant(0);
+                    }
+                    else {
+                        code.cond = static_cast<std::uint8_t>(instr.cond);
+                        binary(code, instr);
+                    }
+
+                    code.disp = result_.first_counter + instr.disp;
+                    break;
+                default:
+                    assert(false && "unknown opcode");
+            }
+
+            emit(code);
+        }
+
+        void binary(Code& code, const ir::Instr& instr) {
+            code.a = operand(instr.a, instr);
+            code.b = operand(instr.b, instr);
+        }
+
+        // code.a + code.b * code.scale + code.disp
+        void address(Code& code, const ir::Instr& instr) {
+            code.a = operand(instr.a, instr);
+            code.b = instr.index.is_none() ? constant(0) : operand(instr.index, instr);
+            code.scale = instr.scale;
+            code.disp = instr.disp;
+        }
+
+        void call(Code& code, const ir::Instr& instr, bool tail) {
+            auto it = indices_.find(instr.symbol);
+            code.dst = instr.dst == ir::no_register ? -1 : static_cast<std::int32_t>(instr.dst);
+
+            if(it != indices_.end()) {
+                code.op = tail ? Op::TailCall : Op::Call;
+                code.a = it->second;
+                code.b = result_.operands.size();
+                code.c = instr.args.size();
+
+                for(const auto& arg : instr.args) {
+                    std::int32_t r = operand(arg, instr);
+                    result_.operands.push_back(r);
+                }
+                return;
+            }
+
+            std::int32_t args[3];
+
+            for(std::size_t i = 0; i < 3; ++i) {
+                args[i] = i < instr.args.size() ? operand(instr.args[i], instr) : constant(0);
+            }
+
+            code.a = args[0];
+            code.b = args[1];
+            code.c = args[2];
+
+            if(instr.symbol == "write") {
+                code.op = Op::Write;
+            }
+            else if(instr.symbol == "read") {
+                code.op = Op::Read;
+            }
+            else if(instr.symbol == "exit") {
+                code.op = Op::Exit;
+            }
+            else {
+                trap(code, "call to '" + instr.symbol + "', which is not defined in the program");
+            }
+        }
+
+        void trap(Code& code, const std::string& message) {
+            code.op = Op::Trap;
+            code.a = interpreter_.messages_.size();
+            interpreter_.messages_.push_back(message);
+        }
+
+        std::int32_t operand(const ir::Operand& op, const ir::Instr& instr) {
+            switch(op.kind) {
+                case ir::Operand::Kind::Register:
+                    return op.value;
+                case ir::Operand::Kind::Immediate:
+                    return constant(op.value);
+                case ir::Operand::Kind::Symbol: {
+                    auto it = interpreter_.addresses_.find(instr.symbol);
+
+                    if(it == interpreter_.addresses_.end()) {
+                        throw codegen_exception(instr.offset, "cannot run code using '" + instr.symbol
+                                                              + "', which is defined in assembly");
+                    }
+
+                    return constant(it->second);
+                }
+                case ir::Operand::Kind::Slot: {
+                    Code code;
+                    code.op = Op::FrameAddress;
+                    code.dst = result_.registers++;
+                    code.disp = slot_offsets_[op.value];
+                    emit(code);
+                    return code.dst;
+                }
+                default:
+                    return constant(0);
+            }
+        }
+
+        std::int32_t constant(std::int32_t value) {
+            auto it = constants_.find(value);
+
+            if(it != constants_.end()) {
+                return it->second;
+            }
+
+            std::int32_t r = -1 - static_cast<std::int32_t>(result_.constants.size());
+            result_.constants.push_back(value);
+            constants_.emplace(value, r);
+            return r;
+        }
+
+        void emit(const Code& code) {
+            result_.code.push_back(code);
+            result_.offsets.push_back(offset_);
+        }
+
+        /*
+         * A call followed by the return of its result reuses the frame,
+         * unless the address of a slot may be held by the callee.
+         */
+        bool is_tail_call(const ir::Instr& call, const ir::Instr& ret) const {
+            if(call.op != ir::Opcode::Call || ret.op != ir::Opcode::Return || escapes_
+               || indices_.count(call.symbol) == 0) {
+                return false;
+            }
+
+            return ret.a.is_none() || (ret.a.is_register() && ret.a.value == static_cast<std::int32_t>(call.dst));
+        }
+
+        bool frame_escapes() const {
+            for(const auto& block : function_.blocks) {
+                for(const auto& instr : block.instrs) {
+                    bool based = instr.op == ir::Opcode::Load || instr.op == ir::Opcode::Store;
+
+                    if((instr.a.kind == ir::Operand::Kind::Slot && !based)
+                       || instr.b.kind == ir::Operand::Kind::Slot || instr.index.kind == ir::Operand::Kind::Slot) {
+                        return true;
+                    }
+
+                    for(const auto& arg : instr.args) {
+                        if(arg.kind == ir::Operand::Kind::Slot) {
+                            return true;
+                        }
+                    }
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        Interpreter& interpreter_;
+        const ir::Function& function_;
+        const std::unordered_map<std::string, std::uint32_t>& indices_;
+        Compiled& result_;
+
+        std::vector<std::uint32_t> slot_offsets_;
+        std::unordered_map<std::int32_t, std::int32_t> constants_;
+        std::uint32_t offset_ = 0;
+        bool escapes_ = false;
+};
+
+Interpreter::Interpreter(const std::vector<ir::Function>& functions, const ir::StringTable& strings,
+                         const Globals& globals):
+    functions_(functions.size())
+{
+    for(std::size_t i = 0; i < strings.strings.size(); ++i) {
+        addresses_[ir::StringTable::symbol(i)] = data_base + data_.size();
+        data_.insert(data_.end(), strings.strings[i].begin(), strings.strings[i].end());
+        data_.push_back(0);
+    }
+
+    // sorted, so that addresses do not depend on hashing
+    std::map<std::string, const ast::GlobalEntity*> variables(globals.variables.begin(), globals.variables.end());
+
+    for(const auto& variable : variables) {
+        std::uint64_t alignment = variable.second->type->alignment();
+        std::uint64_t address = (data_base + data_.size() + alignment - 1) / alignment * alignment;
+        std::uint64_t size = address - data_base + variable.second->type->size();
+
+        if(size > max_data_size) {
+            throw run_exception(variable.second->offset, "global variables too large to run, past "
+                                + std::to_string(max_data_size >> 20) + " MiB");
+        }
+
+        addresses_[variable.first] = address;
+        data_.resize(size);
+    }
+
+    std::unordered_map<std::string, std::uint32_t> indices;
+
+    for(std::size_t i = 0; i < functions.size(); ++i) {
+        indices.emplace(functions[i].name, i);
+
+        if(functions[i].name == "main") {
+            main_ = i;
+        }
+    }
+
+    for(std::size_t i = 0; i < functions.size(); ++i) {
+        Translator(*this, functions[i], indices, functions_[i]).translate();
+    }
+}
+
+std::vector<std::uint64_t> Interpreter::counters(std::size_t f) const {
+    auto first = counters_.begin() + functions_[f].first_counter;
+    return std::vector<std::uint64_t>(first, first + functions_[f].counters);
+}
+
+int Interpreter::run(std::istream* input, std::ostream& output, std::ostream* error) {
+    if(main_ < 0) {
+        throw run_exception(0, "no main function to run");
+    }
+
+    return execute(functions_[main_], input, output, error);
+}
+
+/*
+ * The dispatch loop. Calls push an activation and switch to the registers
+ * following the caller's; the frame of the callee is below the caller's
+ * on the simulated stack.
+ */
+int Interpreter::execute(const Compiled& entry, std::istream* input, std::ostream& output, std::ostream* error) {
+    std::vector<std::uint8_t> memory(round_up(data_base + data_.size(), 16) + stack_size);
+    std::copy(data_.begin(), data_.end(), memory.begin() + data_base);
+    std::uint8_t* mem = memory.data();
+    const std::uint32_t stack_limit = memory.size() - stack_size;
+
+    std::vector<std::int32_t> register_stack(register_stack_size);
+    std::int32_t* const registers_end = register_stack.data() + register_stack.size();
+    std::vector<Activation> stack;
+    std::vector<std::int32_t> arguments;
+
+    const Compiled* function = &entry;
+    std::int32_t* r = register_stack.data() + entry.constants.size();
+    std::uint32_t fp = memory.size() - entry.frame_size;
+    const Code* pc = entry.code.data();
+    std::reverse_copy(entry.constants.begin(), entry.constants.end(), register_stack.data());
+
+    auto at = [&](std::uint32_t address, std::uint32_t width) {
+        if(address < data_base || address > memory.size() - width) {
+            throw Trap{"invalid memory access at address " + std::to_string(address)};
+        }
+
+        return mem + address;
+    };
+
+    // the buffer of a system call, size bytes from address
+    auto buffer = [&](std::uint32_t address, std::uint32_t size) {
+        if(size > 0 && (address < data_base || address > memory.size() || size > memory.size() - address)) {
+            throw Trap{"invalid memory access at address " + std::to_string(address)};
+        }
+
+        return mem + address;
+    };
+
+    // enters callee with its registers at window and its frame below top
+    auto enter = [&](const Compiled& callee, std::int32_t* window, std::uint32_t top, const std::int32_t* args,
+                     std::size_t count) {
+        if(window + callee.constants.size() + callee.registers > registers_end
+           || top < static_cast<std::uint64_t>(stack_limit) + callee.frame_size) {
+            throw Trap{"stack overflow"};
+        }
+
+        std::reverse_copy(callee.constants.begin(), callee.constants.end(), window);
+        r = window + callee.constants.size();
+        fp = top - callee.frame_size;
+
+        for(std::size_t i = 0; i < count && i < callee.arguments.size(); ++i) {
+            std::memcpy(mem + fp + callee.arguments[i], &args[i], callee.argument_sizes[i]);
+        }
+
+        function = &callee;
+        pc = callee.code.data();
+    };
+
+    try {
+#ifdef MICROC_COMPUTED_GOTO
+#define MICROC_LABEL(name) &&op_##name,
+        static void* const labels[] = { MICROC_OPS(MICROC_LABEL) };
+#undef MICROC_LABEL
+#define CASE(name) op_##name
+#define DISPATCH() goto *labels[static_cast<std::uint8_t>(pc->op)]
+        DISPATCH();
+#else
+#define CASE(name) case Op::name
+#define DISPATCH() continue
+        for(;;) switch(pc->op) {
+#endif
+
+#define BINARY(name, expression)                            \
+        CASE(name): {                                       \
+            std::uint32_t x = r[pc->a], y = r[pc->b];       \
+            (void) x; (void) y;                             \
+            r[pc->dst] = (expression);                      \
+            ++pc;                                           \
+            DISPATCH();                                     \
+        }
+
+#define BRANCH(name, expression)                            \
+        CASE(name): {                                       \
+            std::int32_t x = r[pc->a], y = r[pc->b];        \
+            std::uint32_t ux = x, uy = y;                   \
+            (void) ux; (void) uy;                           \
+            pc = function->code.data() + ((expression) ? pc->c : pc->disp); \
+            DISPATCH();                                     \
+        }
+
+        CASE(Move):
+            r[pc->dst] = r[pc->a];
+            ++pc;
+            DISPATCH();
+        CASE(FrameAddress):
+            r[pc->dst] = fp + pc->disp;
+            ++pc;
+            DISPATCH();
+        CASE(Address):
+            r[pc->dst] = static_cast<std::uint32_t>(r[pc->a]) + static_cast<std::uint32_t>(r[pc->b]) * pc->scale + pc->disp;
+            ++pc;
+            DISPATCH();
+        CASE(Load8): {
+            std::uint32_t address = static_cast<std::uint32_t>(r[pc->a]) + static_cast<std::uint32_t>(r[pc->b]) * pc->scale + pc->disp;
+            r[pc->dst] = static_cast<std::int8_t>(*at(address, 1));
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Load8u): {
+            std::uint32_t address = static_cast<std::uint32_t>(r[pc->a]) + static_cast<std::uint32_t>(r[pc->b]) * pc->scale + pc->disp;
+            r[pc->dst] = *at(address, 1);
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Load32): {
+            std::uint32_t address = static_cast<std::uint32_t>(r[pc->a]) + static_cast<std::uint32_t>(r[pc->b]) * pc->scale + pc->disp;
+            std::memcpy(&r[pc->dst], at(address, 4), 4);
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Store8): {
+            std::uint32_t address = static_cast<std::uint32_t>(r[pc->a]) + static_cast<std::uint32_t>(r[pc->b]) * pc->scale + pc->disp;
+            *at(address, 1) = static_cast<std::uint8_t>(r[pc->c]);
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Store32): {
+            std::uint32_t address = static_cast<std::uint32_t>(r[pc->a]) + static_cast<std::uint32_t>(r[pc->b]) * pc->scale + pc->disp;
+            std::memcpy(at(address, 4), &r[pc->c], 4);
+            ++pc;
+            DISPATCH();
+        }
+        CASE(LoadFrame8):
+            r[pc->dst] = static_cast<std::int8_t>(mem[fp + pc->disp]);
+            ++pc;
+            DISPATCH();
+        CASE(LoadFrame8u):
+            r[pc->dst] = mem[fp + pc->disp];
+            ++pc;
+            DISPATCH();
+        CASE(LoadFrame32):
+            std::memcpy(&r[pc->dst], mem + fp + pc->disp, 4);
+            ++pc;
+            DISPATCH();
+        CASE(StoreFrame8):
+            mem[fp + pc->disp] = static_cast<std::uint8_t>(r[pc->c]);
+            ++pc;
+            DISPATCH();
+        CASE(StoreFrame32):
+            std::memcpy(mem + fp + pc->disp, &r[pc->c], 4);
+            ++pc;
+            DISPATCH();
+        CASE(Neg):
+            r[pc->dst] = -static_cast<std::uint32_t>(r[pc->a]);
+            ++pc;
+            DISPATCH();
+        CASE(Not):
+            r[pc->dst] = ~r[pc->a];
+            ++pc;
+            DISPATCH();
+
+        BINARY(Add, x + y)
+        BINARY(Sub, x - y)
+        BINARY(Mul, x * y)
+        BINARY(MulHigh, static_cast<std::int64_t>(static_cast<std::int32_t>(x)) * static_cast<std::int32_t>(y) >> 32)
+        BINARY(And, x & y)
+        BINARY(Or, x | y)
+        BINARY(Xor, x ^ y)
+        BINARY(Shl, x << (y & 31))
+        BINARY(Shr, static_cast<std::int32_t>(x) >> (y & 31))
+
+        CASE(Div):
+        CASE(Mod): {
+            std::int32_t x = r[pc->a], y = r[pc->b];
+
+            if(y == 0 || (x == std::numeric_limits<std::int32_t>::min() && y == -1)) {
+                throw Trap{y == 0 ? "division by zero" : "division overflow"};
+            }
+
+            r[pc->dst] = pc->op == Op::Div ? x / y : x % y;
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Set):
+            r[pc->dst] = compare(pc->cond, r[pc->a], r[pc->b]);
+            ++pc;
+            DISPATCH();
+        CASE(Select):
+            r[pc->dst] = compare(pc->cond, r[pc->a], r[pc->b]) ? r[pc->c] : r[pc->disp];
+            ++pc;
+            DISPATCH();
+        CASE(Jump):
+            pc = function->code.data() + pc->c;
+            DISPATCH();
+
+        BRANCH(BranchEq, x == y)
+        BRANCH(BranchNe, x != y)
+        BRANCH(BranchLt, x < y)
+        BRANCH(BranchLe, x <= y)
+        BRANCH(BranchGt, x > y)
+        BRANCH(BranchGe, x >= y)
+        BRANCH(BranchBelow, ux < uy)
+        BRANCH(BranchBelowEq, ux <= uy)
+        BRANCH(BranchAbove, ux > uy)
+        BRANCH(BranchAboveEq, ux >= uy)
+
+        CASE(Call): {
+            const Compiled& callee = functions_[pc->a];
+            const std::int32_t* operands = function->operands.data() + pc->b;
+            arguments.resize(pc->c);
+
+            for(std::int32_t i = 0; i < pc->c; ++i) {
+                arguments[i] = r[operands[i]];
+            }
+
+            stack.push_back(Activation{function, pc + 1, r, fp, pc->dst});
+            enter(callee, r + function->registers, fp, arguments.data(), arguments.size());
+            DISPATCH();
+        }
+        CASE(TailCall): {
+            const Compiled& callee = functions_[pc->a];
+            const std::int32_t* operands = function->operands.data() + pc->b;
+            arguments.resize(pc->c);
+
+            for(std::int32_t i = 0; i < pc->c; ++i) {
+                arguments[i] = r[operands[i]];
+            }
+
+            enter(callee, r - function->constants.size(), fp + function->frame_size, arguments.data(), arguments.size());
+            DISPATCH();
+        }
+        CASE(Write): {
+            std::int32_t fd = r[pc->a];
+            std::uint32_t size = r[pc->c];
+            std::int32_t written = size;
+            const std::uint8_t* data = buffer(r[pc->b], size);
+
+            if(fd == 1) {
+                output.write(reinterpret_cast<const char*>(data), size);
+            }
+            else if(fd == 2) {
+                if(error != nullptr) {
+                    error->write(reinterpret_cast<const char*>(data), size);
+                }
+            }
+            else {
+                written = -9;   // -EBADF, as the system call
+            }
+
+            if(pc->dst >= 0) {
+                r[pc->dst] = written;
+            }
+
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Read): {
+            std::int32_t fd = r[pc->a];
+            std::uint32_t size = r[pc->c];
+            std::int32_t count = 0;
+            std::uint8_t* data = buffer(r[pc->b], size);
+
+            if(fd != 0) {
+                count = -9;
+            }
+            else if(input != nullptr && size > 0) {
+                input->read(reinterpret_cast<char*>(data), size);
+                count = input->gcount();
+                input->clear();
+            }
+
+            if(pc->dst >= 0) {
+                r[pc->dst] = count;
+            }
+
+            ++pc;
+            DISPATCH();
+        }
+        CASE(Exit):
+            return r[pc->a];
+        CASE(Return): {
+            std::int32_t value = r[pc->a];
+
+            if(stack.empty()) {
+                return value;
+            }
+
+            const Activation& caller = stack.back();
+            function = caller.function;
+            pc = caller.pc;
+            r = caller.registers;
+            fp = caller.fp;
+
+            if(caller.dst >= 0) {
+                r[caller.dst] = value;
+            }
+
+            stack.pop_back();
+            DISPATCH();
+        }
+        CASE(Check):
+            if(static_cast<std::uint32_t>(r[pc->a]) >= static_cast<std::uint32_t>(r[pc->b])) {
+                throw Trap{"index out of bounds"};
+            }
+
+            ++pc;
+            DISPATCH();
+        CASE(Count):
+            counters_[pc->disp] += compare(pc->cond, r[pc->a], r[pc->b]);
+            ++pc;
+            DISPATCH();
+        CASE(Trap):
+            throw Trap{messages_[pc->a]};
+
+#ifndef MICROC_COMPUTED_GOTO
+        }
+#endif
+#undef BRANCH
+#undef BINARY
+#undef DISPATCH
+#undef CASE
+    }
+    catch(const Trap& trap) {
+        std::size_t index = pc - function->code.data();
+        throw run_exception(function->offsets[index], trap.message + " in '" + function->name + "'");
+    }
+}
+
+} // namespace microc
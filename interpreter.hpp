@@ -0,0 +1,109 @@
+#ifndef MICROC_INTERPRETER_HPP
+#define MICROC_INTERPRETER_HPP
+
+#include "ir.hpp"
+#include "lowering.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace microc {
+
+class run_exception : public std::exception {
+    public:
+        run_exception(std::uint32_t offset, const std::string& message);
+        virtual const char* what() const noexcept;
+        std::uint32_t offset() const noexcept { return offset_; }
+
+    private:
+        std::uint32_t offset_;
+        std::string what_;
+};
+
+/*
+ * Runs a lowered program without assembling it, for --run.
+ *
+ * Every function is translated into a register bytecode: virtual registers
+ * and the constants a function uses live in a window of 32-bit registers
+ * per call, constants below the window base, so that every operand is a
+ * register index. Frame slots, globals and string literals live in one
+ * simulated 32-bit address space whose first page is left unmapped, with
+ * the stack at its top. The loop dispatches with computed goto where the
+ * compiler supports it, and with a switch elsewhere.
+ *
+ * Functions defined in assembly cannot run: write(fd, buffer, n),
+ * read(fd, buffer, n) and exit(status) are provided instead, on the given
+ * streams, fd 2 being discarded without an error stream, and any other call to an undefined function stops the program,
+ * as does reaching an asm statement.
+ */
+class Interpreter {
+    public:
+        Interpreter(const std::vector<ir::Function>& functions, const ir::StringTable& strings,
+                    const Globals& globals);
+
+        // calls main, returns its result or the status given to exit()
+        int run(std::istream* input, std::ostream& output, std::ostream* error);
+
+        // the profile counters of functions[f] once run, see instrument()
+        std::vector<std::uint64_t> counters(std::size_t f) const;
+
+    private:
+        enum class Op : std::uint8_t;
+
+        class Code {
+            public:
+                Op op;
+                std::uint8_t cond = 0;
+                std::uint8_t scale = 1;
+                std::int32_t dst = 0;
+                std::int32_t a = 0;
+                std::int32_t b = 0;
+                std::int32_t c = 0;
+                std::int32_t disp = 0;
+        };
+
+        class Compiled {
+            public:
+                std::vector<Code> code;
+                std::vector<std::uint32_t> offsets;     // source offset of each code
+                std::vector<std::int32_t> constants;    // constant k is register -1 - k
+                std::vector<std::int32_t> operands;     // arguments of calls
+                std::vector<std::uint32_t> arguments;   // frame offset of each argument
+                std::vector<std::uint32_t> argument_sizes;
+                std::uint32_t registers = 0;            // virtual registers and temporaries
+                std::uint32_t frame_size = 0;
+                std::uint32_t first_counter = 0;        // of the function in counters_
+                std::uint32_t counters = 0;
+                std::string name;
+        };
+
+        class Activation {
+            public:
+                const Compiled* function;
+                const Code* pc;         // to resume at
+                std::int32_t* registers;
+                std::uint32_t fp;
+                std::int32_t dst;       // caller register receiving the result, -1 if none
+        };
+
+        class Translator;
+
+        int execute(const Compiled& entry, std::istream* input, std::ostream& output, std::ostream* error);
+
+    private:
+        std::vector<Compiled> functions_;
+        std::unordered_map<std::string, std::uint32_t> addresses_;   // of globals and literals
+        std::vector<std::uint8_t> data_;    // initial content of the address space after the first page
+        std::vector<std::string> messages_;
+        std::vector<std::uint64_t> counters_;   // of the Count instructions
+        int main_ = -1;
+};
+
+} // namespace microc
+
+#endif // MICROC_INTERPRETER_HPP
@@ -0,0 +1,359 @@
+#include "ir.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace microc {
+namespace ir {
+
+Cond negate(Cond c) {
+    switch(c) {
+        case Cond::Eq:      return Cond::Ne;
+        case Cond::Ne:      return Cond::Eq;
+        case Cond::Lt:      return Cond::Ge;
+        case Cond::Le:      return Cond::Gt;
+        case Cond::Gt:      return Cond::Le;
+        case Cond::Ge:      return Cond::Lt;
+        case Cond::Below:   return Cond::AboveEq;
+        case Cond::BelowEq: return Cond::Above;
+        case Cond::Above:   return Cond::BelowEq;
+        case Cond::AboveEq: return Cond::Below;
+        default: assert(false && "unknown condition");
+    }
+}
+
+Cond swap(Cond c) {
+    switch(c) {
+        case Cond::Eq:      return Cond::Eq;
+        case Cond::Ne:      return Cond::Ne;
+        case Cond::Lt:      return Cond::Gt;
+        case Cond::Le:      return Cond::Ge;
+        case Cond::Gt:      return Cond::Lt;
+        case Cond::Ge:      return Cond::Le;
+        case Cond::Below:   return Cond::Above;
+        case Cond::BelowEq: return Cond::AboveEq;
+        case Cond::Above:   return Cond::Below;
+        case Cond::AboveEq: return Cond::BelowEq;
+        default: assert(false && "unknown condition");
+    }
+}
+
+std::vector<Register> Instr::uses() const {
+    std::vector<Register> result;
+
+    if(a.is_register()) {
+        result.push_back(a.value);
+    }
+
+    if(b.is_register()) {
+        result.push_back(b.value);
+    }
+
+    if(index.is_register()) {
+        result.push_back(index.value);
+    }
+
+    for(const auto& arg : args) {
+        if(arg.is_register()) {
+            result.push_back(arg.value);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::uint32_t> Block::successors() const {
+    const Instr& term = terminator();
+
+    switch(term.op) {
+        case Opcode::Jump:   return {term.targets[0]};
+        case Opcode::Branch: return {term.targets[0], term.targets[1]};
+        default:             return {};
+    }
+}
+
+std::uint32_t Function::new_block() {
+    std::uint32_t id = blocks.size();
+    blocks.emplace_back(id);
+    return id;
+}
+
+std::uint32_t Function::new_slot(std::uint32_t size, std::uint32_t alignment, int argument) {
+    slots.emplace_back(size, alignment, argument);
+    return slots.size() - 1;
+}
+
+std::vector<bool> Function::escaped_slots() const {
+    std::vector<bool> escaped(slots.size());
+
+    auto escape = [&](const Operand& op) {
+        if(op.kind == Operand::Kind::Slot) {
+            escaped[op.value] = true;
+        }
+    };
+
+    for(const auto& block : blocks) {
+        for(const auto& instr : block.instrs) {
+            bool access = instr.op == Opcode::Load || instr.op == Opcode::Store;
+
+            if(!access || !instr.index.is_none() || instr.disp != 0) {
+                escape(instr.a);
+            }
+
+            escape(instr.b);
+            escape(instr.index);
+
+            for(const auto& arg : instr.args) {
+                escape(arg);
+            }
+        }
+    }
+
+    return escaped;
+}
+
+void Function::reorder(const std::vector<std::uint32_t>& order) {
+    std::vector<std::uint32_t> renamed(blocks.size());
+
+    for(std::uint32_t i = 0; i < order.size(); ++i) {
+        renamed[order[i]] = i;
+    }
+
+    std::vector<Block> reordered;
+    std::vector<std::uint64_t> reordered_counts, reordered_taken;
+
+    for(std::uint32_t i = 0; i < order.size(); ++i) {
+        reordered.push_back(std::move(blocks[order[i]]));
+        reordered.back().id = i;
+
+        for(auto& instr : reordered.back().instrs) {
+            if(instr.op == Opcode::Jump || instr.op == Opcode::Branch) {
+                instr.targets[0] = renamed[instr.targets[0]];
+                instr.targets[1] = renamed[instr.targets[1]];
+            }
+        }
+
+        if(!counts.empty()) {
+            reordered_counts.push_back(counts[order[i]]);
+            reordered_taken.push_back(taken[order[i]]);
+        }
+    }
+
+    blocks = std::move(reordered);
+    counts = std::move(reordered_counts);
+    taken = std::move(reordered_taken);
+}
+
+std::string StringTable::add(const std::string& value) {
+    auto it = index_.find(value);
+
+    if(it != index_.end()) {
+        return symbol(first + it->second);
+    }
+
+    index_.emplace(value, strings.size());
+    strings.push_back(value);
+    return symbol(first + strings.size() - 1);
+}
+
+void StringTable::clear() {
+    first += strings.size();
+    strings.clear();
+    index_.clear();
+}
+
+/*
+ * Sorted by their reversed content, the strings which end with s follow s,
+ * so s fits in the next string if it fits anywhere, and that one may
+ * itself end a longer string. Strings containing a NUL are left alone:
+ * in a mergeable section, the linker would split them.
+ */
+std::vector<StringTable::Placement> StringTable::merge_suffixes() const {
+    std::vector<Placement> result;
+    std::vector<std::size_t> order;
+
+    for(std::size_t i = 0; i < strings.size(); ++i) {
+        result.push_back(Placement{i, 0});
+
+        if(strings[i].find('\0') == std::string::npos) {
+            order.push_back(i);
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+        return std::lexicographical_compare(strings[a].rbegin(), strings[a].rend(),
+                                            strings[b].rbegin(), strings[b].rend());
+    });
+
+    for(std::size_t k = order.size(); k-- > 1;) {
+        const std::string& s = strings[order[k - 1]];
+        const std::string& t = strings[order[k]];
+
+        if(s.size() <= t.size() && t.compare(t.size() - s.size(), s.size(), s) == 0) {
+            const Placement& host = result[order[k]];
+            result[order[k - 1]] = Placement{host.host, host.offset + t.size() - s.size()};
+        }
+    }
+
+    return result;
+}
+
+std::string StringTable::symbol(std::size_t index) {
+    return ".LC" + std::to_string(index);
+}
+
+/*
+ * operator<<
+ */
+const char* opcode_str(Opcode op) {
+    switch(op) {
+        case Opcode::Copy:    return "copy";
+        case Opcode::Address: return "address";
+        case Opcode::Load:    return "load";
+        case Opcode::Store:   return "store";
+        case Opcode::Neg:     return "neg";
+        case Opcode::Not:     return "not";
+        case Opcode::Add:     return "add";
+        case Opcode::Sub:     return "sub";
+        case Opcode::Mul:     return "mul";
+        case Opcode::MulHigh: return "mulh";
+        case Opcode::Div:     return "div";
+        case Opcode::Mod:     return "mod";
+        case Opcode::And:     return "and";
+        case Opcode::Or:      return "or";
+        case Opcode::Xor:     return "xor";
+        case Opcode::Shl:     return "shl";
+        case Opcode::Shr:     return "shr";
+        case Opcode::Set:     return "set";
+        case Opcode::Select:  return "select";
+        case Opcode::Call:    return "call";
+        case Opcode::Asm:     return "asm";
+        case Opcode::Jump:    return "jump";
+        case Opcode::Branch:  return "branch";
+        case Opcode::Return:  return "return";
+        case Opcode::Check:   return "check";
+        case Opcode::Count:   return "count";
+        case Opcode::Vector:  return "vector";
+        default: assert(false && "unknown opcode");
+    }
+}
+
+const char* cond_str(Cond c) {
+    switch(c) {
+        case Cond::Eq:      return "eq";
+        case Cond::Ne:      return "ne";
+        case Cond::Lt:      return "lt";
+        case Cond::Le:      return "le";
+        case Cond::Gt:      return "gt";
+        case Cond::Ge:      return "ge";
+        case Cond::Below:   return "below";
+        case Cond::BelowEq: return "beloweq";
+        case Cond::Above:   return "above";
+        case Cond::AboveEq: return "aboveeq";
+        default: assert(false && "unknown condition");
+    }
+}
+
+std::ostream& operator<<(std::ostream& o, const Operand& operand) {
+    switch(operand.kind) {
+        case Operand::Kind::None:      return o << "_";
+        case Operand::Kind::Register:  return o << "%" << operand.value;
+        case Operand::Kind::Immediate: return o << operand.value;
+        case Operand::Kind::Slot:      return o << "slot" << operand.value;
+        case Operand::Kind::Symbol:    return o << "@";
+        default: assert(false && "unknown operand");
+    }
+}
+
+std::ostream& operator<<(std::ostream& o, const Instr& instr) {
+    if(instr.dst != no_register) {
+        o << "%" << instr.dst << " = ";
+    }
+
+    for(std::size_t i = 0; i < instr.results.size(); ++i) {
+        o << "%" << instr.results[i] << (i + 1 == instr.results.size() ? " = " : ", ");
+    }
+
+    o << opcode_str(instr.op);
+
+    if(instr.op == Opcode::Set || instr.op == Opcode::Select || instr.op == Opcode::Branch
+       || (instr.op == Opcode::Count && !instr.a.is_none())) {
+        o << "." << cond_str(instr.cond);
+    }
+    else if(instr.op == Opcode::Vector) {
+        o << "." << static_cast<int>(instr.size) << " " << opcode_str(instr.vector->op);
+    }
+    else if(instr.op == Opcode::Load || instr.op == Opcode::Store) {
+        o << "." << static_cast<int>(instr.size);
+
+        if(instr.op == Opcode::Load && !instr.sign) {
+            o << "u";
+        }
+    }
+
+    if(!instr.symbol.empty()) {
+        o << " \"" << instr.symbol << "\"";
+    }
+
+    if(!instr.a.is_none()) {
+        o << " " << instr.a;
+
+        if(instr.disp != 0 && instr.op != Opcode::Count) {
+            o << "+" << instr.disp;
+        }
+
+        if(!instr.index.is_none()) {
+            o << "+" << instr.index << "*" << static_cast<int>(instr.scale);
+        }
+    }
+
+    if(!instr.b.is_none()) {
+        o << ", " << instr.b;
+    }
+
+    if(instr.op == Opcode::Count) {
+        o << " #" << instr.disp;
+    }
+
+    for(std::size_t i = 0; i < instr.args.size(); ++i) {
+        bool array = instr.op == Opcode::Vector && instr.vector->arrays[i];
+        o << ", " << (array ? "[" : "") << instr.args[i] << (array ? "]" : "");
+    }
+
+    if(instr.op == Opcode::Jump) {
+        o << " bb" << instr.targets[0];
+    }
+    else if(instr.op == Opcode::Branch) {
+        o << " ? bb" << instr.targets[0] << " : bb" << instr.targets[1];
+    }
+
+    return o;
+}
+
+std::ostream& operator<<(std::ostream& o, const Function& function) {
+    o << "function " << function.name << " {" << std::endl;
+
+    for(std::size_t i = 0; i < function.slots.size(); ++i) {
+        o << "  slot" << i << ": " << function.slots[i].size << " bytes";
+
+        if(function.slots[i].argument >= 0) {
+            o << ", argument " << function.slots[i].argument;
+        }
+
+        o << std::endl;
+    }
+
+    for(const auto& block : function.blocks) {
+        o << "bb" << block.id << ":" << std::endl;
+
+        for(const auto& instr : block.instrs) {
+            o << "  " << instr << std::endl;
+        }
+    }
+
+    o << "}" << std::endl;
+    return o;
+}
+
+} // namespace ir
+} // namespace microc
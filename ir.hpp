@@ -0,0 +1,265 @@
+#ifndef MICROC_IR_HPP
+#define MICROC_IR_HPP
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace microc {
+namespace ir {
+
+/*
+ * Three-address representation between the AST and the x86_32 code
+ * generator. A function is a list of basic blocks, each one ending with a
+ * terminator (Jump, Branch or Return). Values are 32-bit and live in an
+ * unbounded set of virtual registers, locals and arguments live in frame
+ * slots.
+ */
+
+typedef std::uint32_t Register;
+
+const Register no_register = 0;
+
+class Operand {
+    public:
+        enum class Kind : std::uint8_t {
+            None,
+            Register,
+            Immediate,
+            Slot,       // address of a frame slot
+            Symbol,     // address of Instr::symbol
+        };
+
+    public:
+        Operand(): kind(Kind::None), value(0) {}
+        Operand(Kind kind, std::int32_t value): kind(kind), value(value) {}
+
+        static Operand reg(Register r) { return Operand(Kind::Register, r); }
+        static Operand imm(std::int32_t v) { return Operand(Kind::Immediate, v); }
+        static Operand slot(std::uint32_t s) { return Operand(Kind::Slot, s); }
+        static Operand symbol() { return Operand(Kind::Symbol, 0); }
+
+        bool is_none() const { return kind == Kind::None; }
+        bool is_register() const { return kind == Kind::Register; }
+        bool is_immediate() const { return kind == Kind::Immediate; }
+
+        bool operator==(const Operand& o) const { return kind == o.kind && value == o.value; }
+        bool operator!=(const Operand& o) const { return !(*this == o); }
+
+    public:
+        Kind kind;
+        std::int32_t value;
+};
+
+enum class Opcode : std::uint8_t {
+    Copy,       // dst = a
+    Address,    // dst = a + disp + index * scale (a slot, a symbol or a register)
+    Load,       // dst = [a + disp + index * scale]
+    Store,      // [a + disp + index * scale] = b
+    Neg,        // dst = -a
+    Not,        // dst = ~a
+    Add,        // dst = a + b
+    Sub,
+    Mul,
+    MulHigh,    // dst = (a * b) >> 32, signed
+    Div,
+    Mod,
+    And,
+    Or,
+    Xor,
+    Shl,
+    Shr,
+    Set,        // dst = (a cond b)
+    Select,     // dst = (a cond b) ? args[0] : args[1], without branching
+    Call,       // dst = symbol(args...)
+    Asm,        // symbol is copied verbatim, or is the template of an extended asm
+    Jump,       // goto targets[0]
+    Branch,     // if (a cond b) goto targets[0] else goto targets[1]
+    Return,     // return a
+    Check,      // abort the program unless a < b, unsigned (bounds checks)
+    Count,      // adds 1 to profile counter disp, if (a cond b) when a is given
+    Vector,     // b bytes from address a = args[0] op args[1], 16 at a time, see VectorOp
+};
+
+enum class Cond : std::uint8_t {
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Below,      // unsigned comparisons
+    BelowEq,
+    Above,
+    AboveEq,
+};
+
+Cond negate(Cond c);
+Cond swap(Cond c);      // cond such that (a c b) == (b swap(c) a)
+
+/*
+ * Operand %N of an extended asm: a constraint letter (r, a, b, c, d, S, D,
+ * m, i, n) or the digit of the output it is tied to, the index of its value
+ * in Instr::args if it is read, and of its register in Instr::results if it
+ * is written.
+ */
+class AsmOperand {
+    public:
+        char constraint = 'r';
+        int arg = -1;
+        int result = -1;
+};
+
+class ExtendedAsm {
+    public:
+        std::vector<AsmOperand> operands;
+        std::vector<std::string> clobbers;
+};
+
+/*
+ * The operation of a Vector instruction on each element of Instr::size
+ * bytes: Copy of its first operand, or Add, Sub, And, Or or Xor of both.
+ * An operand is either the address of an array going along with the
+ * destination, or a value for every element.
+ */
+class VectorOp {
+    public:
+        Opcode op = Opcode::Copy;
+        bool arrays[2] = {false, false};
+};
+
+class Instr {
+    public:
+        explicit Instr(Opcode op): op(op) {}
+
+        bool is_terminator() const {
+            return op == Opcode::Jump || op == Opcode::Branch || op == Opcode::Return;
+        }
+
+        std::vector<Register> uses() const;
+
+    public:
+        Opcode op;
+        Cond cond = Cond::Ne;
+        std::uint8_t size = 4;      // Load and Store, in bytes
+        bool sign = true;           // Load: sign or zero extension
+        Register dst = no_register;
+        Operand a;
+        Operand b;
+        std::int32_t disp = 0;
+        Operand index;              // Address, Load and Store
+        std::uint8_t scale = 1;     // 1, 2, 4 or 8
+        std::vector<Operand> args;
+        std::string symbol;
+        std::uint32_t targets[2] = {0, 0};
+        std::uint32_t offset = 0;   // source offset, for debug info
+        std::vector<Register> results;              // Asm outputs
+        std::shared_ptr<const ExtendedAsm> extended;    // null for basic asm
+        std::shared_ptr<const VectorOp> vector;         // Vector only
+};
+
+class Block {
+    public:
+        explicit Block(std::uint32_t id): id(id) {}
+
+        bool terminated() const { return !instrs.empty() && instrs.back().is_terminator(); }
+        const Instr& terminator() const { return instrs.back(); }
+        std::vector<std::uint32_t> successors() const;
+
+    public:
+        std::uint32_t id;
+        std::vector<Instr> instrs;
+        bool cold = false;      // predicted or found to run rarely, e.g. an else branch
+        bool align = false;     // starts a hot loop, see place_blocks()
+};
+
+class Slot {
+    public:
+        Slot(std::uint32_t size, std::uint32_t alignment, int argument):
+            size(size),
+            alignment(alignment),
+            argument(argument)
+        {}
+
+    public:
+        std::uint32_t size;
+        std::uint32_t alignment;
+        int argument;   // index of the incoming argument, -1 for a local
+};
+
+class Function {
+    public:
+        explicit Function(const std::string& name): name(name) {}
+
+        Register new_register() { return ++registers; }
+        std::uint32_t new_block();
+        std::uint32_t new_slot(std::uint32_t size, std::uint32_t alignment, int argument = -1);
+
+        // puts the blocks in the given order, order[0] being 0, and renumbers them
+        void reorder(const std::vector<std::uint32_t>& order);
+
+        // slots which may be read or written other than by name: their
+        // address is used, or they are accessed at an offset
+        std::vector<bool> escaped_slots() const;
+
+    public:
+        std::string name;
+        std::uint32_t offset = 0;
+        std::uint8_t regparm = 0;   // arguments passed in %eax, %edx, %ecx
+        std::vector<Block> blocks;  // indexed by id, blocks[0] is the entry
+        std::vector<Slot> slots;
+        Register registers = 0;     // number of virtual registers
+        std::uint32_t eliminated = 0;   // redundant instructions removed, see gvn.hpp
+        std::uint32_t promoted = 0;     // slots moved to registers, see mem2reg.hpp
+
+        // profiles, see profile.hpp
+        std::uint32_t counters = 0;         // Count instructions
+        std::uint32_t checksum = 0;         // of the blocks as lowered
+        std::vector<std::uint64_t> counts;  // executions of each block, empty without a profile
+        std::vector<std::uint64_t> taken;   // times the Branch ending each block went to targets[0]
+};
+
+/*
+ * String literals of the whole program, referenced by Address instructions
+ * through their symbol. Equal literals share one symbol.
+ */
+class StringTable {
+    public:
+        class Placement {
+            public:
+                std::size_t host;       // string stored in, itself if not merged
+                std::size_t offset;     // of this string in host
+        };
+
+    public:
+        std::string add(const std::string& value);
+        static std::string symbol(std::size_t index);
+
+        // forgets the strings added so far, the next ones are numbered after them
+        void clear();
+
+        // a string which ends another one is stored at the end of it
+        std::vector<Placement> merge_suffixes() const;
+
+    public:
+        std::vector<std::string> strings;
+        std::size_t first = 0;      // number of strings[0]
+
+    private:
+        std::unordered_map<std::string, std::size_t> index_;
+};
+
+const char* opcode_str(Opcode op);
+const char* cond_str(Cond c);
+
+std::ostream& operator<<(std::ostream& o, const Operand& operand);
+std::ostream& operator<<(std::ostream& o, const Instr& instr);
+std::ostream& operator<<(std::ostream& o, const Function& function);
+
+} // namespace ir
+} // namespace microc
+
+#endif // MICROC_IR_HPP
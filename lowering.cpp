@@ -0,0 +1,1435 @@
+#include "lowering.hpp"
+#include "gvn.hpp"
+#include "symbols.hpp"
+
+#include <cassert>
+#include <limits>
+#include <memory>
+#include <utility>
+
+namespace microc {
+
+codegen_exception::codegen_exception(std::uint32_t offset, const std::string& message):
+    offset_(offset),
+    what_(message)
+{}
+
+const char* codegen_exception::what() const noexcept {
+    return what_.c_str();
+}
+
+class GlobalsVisitor : public ast::EntityVisitor {
+    public:
+        explicit GlobalsVisitor(Globals& globals): globals_(globals) {}
+
+        virtual void visit(const ast::AssemblyEntity&) {}
+
+        virtual void visit(const ast::GlobalEntity& e) {
+            globals_.variables[e.name] = &e;
+        }
+
+        virtual void visit(const ast::StructEntity&) {}
+
+        virtual void visit(const ast::FunctionEntity& e) {
+            globals_.functions[e.name] = &e;
+        }
+
+    private:
+        Globals& globals_;
+};
+
+Globals::Globals(const ast::Program& prog) {
+    for(const auto& entity : prog.entities) {
+        add(*entity);
+    }
+}
+
+void Globals::add(const ast::Entity& entity) {
+    GlobalsVisitor visitor(*this);
+    entity.accept(visitor);
+}
+
+namespace {
+
+/*
+ * Size of the object pointed by a pointer of the given type, used to scale
+ * pointer arithmetic.
+ */
+std::int32_t pointed_size(const ast::Type& type) {
+    ast::TypeKind kind(type);
+
+    if(kind.pointed == nullptr || kind.pointed->size() == 0) {
+        return 1;
+    }
+
+    return kind.pointed->size();
+}
+
+class Variable {
+    public:
+        ir::Operand address;    // a slot, or a symbol for globals
+        std::string symbol;
+};
+
+/*
+ * Where an lvalue lives: [base + disp], the base being a slot, a symbol or a
+ * register holding a pointer.
+ */
+class Address {
+    public:
+        ir::Operand base;
+        std::string symbol;
+        std::int32_t disp = 0;
+        ir::Operand index;
+        std::uint8_t scale = 1;
+};
+
+/*
+ * Values of a local variable known to hold in part of a function.
+ */
+class Range {
+    public:
+        std::uint32_t slot;
+        std::int32_t low;
+        std::int32_t high;
+};
+
+/*
+ * A condition lowered by Lowering::lower_condition(), its branches are in
+ * block and in the blocks from first to last, excluded.
+ */
+class Condition {
+    public:
+        std::uint32_t block = 0;
+        std::uint32_t first = 0;
+        std::uint32_t last = 0;
+};
+
+// branch targets of a condition which are not created yet
+const std::uint32_t true_target = std::numeric_limits<std::uint32_t>::max();
+const std::uint32_t false_target = true_target - 1;
+
+bool is_aggregate(const ast::Type& type) {
+    ast::TypeKind kind(type);
+    return kind.kind == ast::TypeKind::Struct || kind.kind == ast::TypeKind::Array;
+}
+
+/*
+ * Multiplier and shift replacing a signed division by d, for |d| >= 3 and
+ * not a power of 2: n / d is the high half of M * n, corrected by n when
+ * M and d have different signs, shifted right by s, plus one if negative.
+ * See Hacker's Delight, 10-1.
+ */
+class Magic {
+    public:
+        std::int32_t multiplier;
+        int shift;
+};
+
+Magic signed_magic(std::int32_t d) {
+    const std::uint32_t two31 = 0x80000000;
+    std::uint32_t ad = d < 0 ? 0u - static_cast<std::uint32_t>(d) : d;
+    std::uint32_t t = two31 + (static_cast<std::uint32_t>(d) >> 31);
+    std::uint32_t anc = t - 1 - t % ad;     // |nc|, the largest n with n % d == d - 1
+    std::uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    std::uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    std::uint32_t delta;
+    int p = 31;
+
+    do {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+
+        if(r1 >= anc) {
+            ++q1;
+            r1 -= anc;
+        }
+
+        q2 *= 2;
+        r2 *= 2;
+
+        if(r2 >= ad) {
+            ++q2;
+            r2 -= ad;
+        }
+
+        delta = ad - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+
+    std::uint32_t multiplier = q2 + 1;
+    return Magic{static_cast<std::int32_t>(d < 0 ? 0u - multiplier : multiplier), p - 32};
+}
+
+/*
+ * Inverse of an odd number modulo 2^32, by Newton's iteration: each step
+ * doubles the number of correct low bits, and x * x == 1 mod 8 for odd x.
+ */
+std::uint32_t inverse(std::uint32_t odd) {
+    std::uint32_t x = odd;
+
+    for(int i = 0; i < 4; ++i) {
+        x *= 2 - odd * x;
+    }
+
+    return x;
+}
+
+int log2(std::uint32_t power) {
+    int k = 0;
+
+    while(power > 1) {
+        power >>= 1;
+        ++k;
+    }
+
+    return k;
+}
+
+/*
+ * Value of an instruction on constant operands, false if it cannot be
+ * computed at compile time.
+ */
+bool fold(ir::Opcode op, std::int32_t a, std::int32_t b, std::int32_t& result) {
+    std::uint32_t ua = a, ub = b;
+
+    switch(op) {
+        case ir::Opcode::Neg: result = 0u - ua; return true;
+        case ir::Opcode::Not: result = ~ua; return true;
+        case ir::Opcode::Add: result = ua + ub; return true;
+        case ir::Opcode::Sub: result = ua - ub; return true;
+        case ir::Opcode::Mul: result = ua * ub; return true;
+        case ir::Opcode::And: result = a & b; return true;
+        case ir::Opcode::Or:  result = a | b; return true;
+        case ir::Opcode::Xor: result = a ^ b; return true;
+        case ir::Opcode::Shl: result = ua << (b & 31); return true;
+        case ir::Opcode::Shr: result = a >> (b & 31); return true;
+        case ir::Opcode::Div:
+        case ir::Opcode::Mod:
+            // would fault at run time
+            if(b == 0 || (a == std::numeric_limits<std::int32_t>::min() && b == -1)) {
+                return false;
+            }
+
+            result = op == ir::Opcode::Div ? a / b : a % b;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * The condition tested by a comparison, false for other operators.
+ * Pointers compare unsigned.
+ */
+bool comparison(const ast::BinaryExpression& e, ir::Cond& cond) {
+    ast::TypeKind left_kind(*e.left->resolved_type), right_kind(*e.right->resolved_type);
+    bool is_unsigned = left_kind.is_pointer() || right_kind.is_pointer();
+
+    switch(e.op) {
+        case ast::BinaryOperator::Eq:
+            cond = ir::Cond::Eq;
+            return true;
+        case ast::BinaryOperator::Neq:
+            cond = ir::Cond::Ne;
+            return true;
+        case ast::BinaryOperator::Inf:
+            cond = is_unsigned ? ir::Cond::Below : ir::Cond::Lt;
+            return true;
+        case ast::BinaryOperator::InfEq:
+            cond = is_unsigned ? ir::Cond::BelowEq : ir::Cond::Le;
+            return true;
+        case ast::BinaryOperator::Sup:
+            cond = is_unsigned ? ir::Cond::Above : ir::Cond::Gt;
+            return true;
+        case ast::BinaryOperator::SupEq:
+            cond = is_unsigned ? ir::Cond::AboveEq : ir::Cond::Ge;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Whether an expression can be evaluated even when its value is not used:
+ * it has no side effect, cannot fault, and takes at most budget nodes, so
+ * that computing it is cheaper than a mispredicted branch.
+ */
+bool speculatable(const ast::Expression& e, int& budget) {
+    if(--budget < 0) {
+        return false;
+    }
+
+    if(dynamic_cast<const ast::IdentExpression*>(&e) || dynamic_cast<const ast::IntegerExpression*>(&e)
+       || dynamic_cast<const ast::CharExpression*>(&e) || dynamic_cast<const ast::TrueExpression*>(&e)
+       || dynamic_cast<const ast::FalseExpression*>(&e) || dynamic_cast<const ast::NullExpression*>(&e)
+       || dynamic_cast<const ast::SizeofExpression*>(&e)) {
+        return true;
+    }
+
+    if(auto unary = dynamic_cast<const ast::UnaryExpression*>(&e)) {
+        return speculatable(*unary->expression, budget);
+    }
+
+    if(auto binary = dynamic_cast<const ast::BinaryExpression*>(&e)) {
+        // division by zero traps
+        return binary->op != ast::BinaryOperator::Div && binary->op != ast::BinaryOperator::Mod
+               && speculatable(*binary->left, budget) && speculatable(*binary->right, budget);
+    }
+
+    if(auto cast = dynamic_cast<const ast::CastExpression*>(&e)) {
+        return speculatable(*cast->expression, budget);
+    }
+
+    if(auto member = dynamic_cast<const ast::MemberExpression*>(&e)) {
+        return !member->arrow && speculatable(*member->expression, budget);
+    }
+
+    return false;
+}
+
+bool speculatable(const ast::Expression& e) {
+    int budget = 6;
+    return speculatable(e, budget);
+}
+
+/*
+ * e is `name = value;`, with name a variable of scalar type.
+ */
+const ast::AffectationExpression* scalar_assignment(const ast::Instruction& i) {
+    auto instr = dynamic_cast<const ast::ExpressionInstruction*>(&i);
+    auto e = instr ? dynamic_cast<const ast::AffectationExpression*>(instr->expression.get()) : nullptr;
+
+    if(e == nullptr || dynamic_cast<const ast::IdentExpression*>(e->affected.get()) == nullptr
+       || !ast::TypeKind(*e->resolved_type).is_scalar()) {
+        return nullptr;
+    }
+
+    return e;
+}
+
+/*
+ * Expression types come from the semantic analysis, which also rejected
+ * undeclared names and invalid operands.
+ */
+class Lowering : public ast::InstructionVisitor, public ast::ExpressionVisitor {
+    public:
+        Lowering(ir::Function& function, const Globals& globals, ir::StringTable& strings,
+                 const LoweringOptions& options, Interner& names):
+            function_(function),
+            globals_(globals),
+            strings_(strings),
+            options_(options),
+            names_(names),
+            fold_(options.optimize)
+        {
+            block_ = function_.new_block();
+        }
+
+        void lower(const ast::FunctionEntity& e) {
+            offset_ = e.offset;
+            locals_.enter();
+
+            for(std::size_t i = 0; i < e.arguments.size(); ++i) {
+                std::uint32_t slot = function_.new_slot(4, 4, i);
+                locals_.declare(names_.intern(e.arguments[i].name), Variable{ir::Operand::slot(slot), ""});
+            }
+
+            for(const auto& instr : e.instructions) {
+                instr->accept(*this);
+            }
+
+            locals_.leave();
+
+            if(!function_.blocks[block_].terminated()) {
+                emit(ir::Instr(ir::Opcode::Return));
+            }
+        }
+
+        /*
+         * Instructions
+         */
+        virtual void visit(const ast::BlockInstruction& i) {
+            lower_scope(i.instructions);
+        }
+
+        virtual void visit(const ast::DeclarationInstruction& i) {
+            offset_ = i.offset;
+            std::uint32_t slot = function_.new_slot(i.type->size(), i.type->alignment());
+
+            if(i.expression) {
+                ir::Operand value = lower(*i.expression);
+                ir::Instr store(ir::Opcode::Store);
+                store.a = ir::Operand::slot(slot);
+                store.b = value;
+                store.size = i.type->size();
+                emit(std::move(store));
+            }
+
+            // declared after the initializer, `int x = x;` reads the outer x
+            locals_.declare(names_.intern(i.name), Variable{ir::Operand::slot(slot), ""});
+        }
+
+        virtual void visit(const ast::ExpressionInstruction& i) {
+            offset_ = i.offset;
+            lower_discarded(*i.expression);
+        }
+
+        virtual void visit(const ast::IfInstruction& i) {
+            offset_ = i.offset;
+
+            if(options_.optimize && lower_select(i)) {
+                return;
+            }
+
+            Condition cond = lower_condition(*i.condition);
+
+            std::uint32_t then_block = function_.new_block();
+            std::uint32_t else_block = i.false_instrs.empty() ? 0 : function_.new_block();
+            std::uint32_t end_block = function_.new_block();
+
+            resolve(cond, then_block, else_block ? else_block : end_block);
+
+            block_ = then_block;
+            lower_scope(i.true_instrs);
+            jump(end_block);
+
+            if(else_block) {
+                block_ = else_block;
+                function_.blocks[else_block].cold = true;
+                lower_scope(i.false_instrs);
+                jump(end_block);
+            }
+
+            block_ = end_block;
+        }
+
+        virtual void visit(const ast::WhileInstruction& i) {
+            offset_ = i.offset;
+            lower_loop(i.offset, i.condition.get(), nullptr, i.instructions);
+        }
+
+        virtual void visit(const ast::ForInstruction& i) {
+            offset_ = i.offset;
+            locals_.enter();
+
+            if(i.initialization) {
+                i.initialization->accept(*this);
+            }
+
+            if(i.counter.empty()) {
+                lower_loop(i.offset, i.condition.get(), i.step.get(), i.instructions);
+            }
+            else {
+                Range range{static_cast<std::uint32_t>(lookup(i.counter).address.value), i.low, i.high};
+                lower_loop(i.offset, i.condition.get(), i.step.get(), i.instructions, &range);
+            }
+
+            locals_.leave();
+        }
+
+        virtual void visit(const ast::BreakInstruction& i) {
+            offset_ = i.offset;
+            jump(loops_.back().break_target);
+        }
+
+        virtual void visit(const ast::ContinueInstruction& i) {
+            offset_ = i.offset;
+            jump(loops_.back().continue_target);
+        }
+
+        virtual void visit(const ast::ReturnInstruction& i) {
+            offset_ = i.offset;
+            ir::Instr ret(ir::Opcode::Return);
+
+            if(i.expression) {
+                ret.a = lower(*i.expression);
+            }
+
+            emit(std::move(ret));
+        }
+
+        virtual void visit(const ast::AssemblyInstruction& i) {
+            offset_ = i.offset;
+            ir::Instr instr(ir::Opcode::Asm);
+            instr.symbol = i.assembly;
+
+            if(!i.extended) {
+                emit(std::move(instr));
+                return;
+            }
+
+            auto extended = std::make_shared<ir::ExtendedAsm>();
+            extended->clobbers = i.clobbers;
+            std::vector<Address> outputs;
+
+            // register outputs are stored to their lvalue after the asm
+            for(const auto& output : i.outputs) {
+                ir::AsmOperand operand;
+                operand.constraint = output.constraint.back();
+                Address target = address(*output.expression);
+
+                if(operand.constraint == 'm') {
+                    operand.arg = instr.args.size();
+                    instr.args.push_back(address_value(target));
+                }
+                else {
+                    if(output.constraint[0] == '+') {
+                        operand.arg = instr.args.size();
+                        instr.args.push_back(load(target, *output.expression->resolved_type));
+                    }
+
+                    operand.result = instr.results.size();
+                    instr.results.push_back(function_.new_register());
+                    outputs.push_back(target);
+                }
+
+                extended->operands.push_back(operand);
+            }
+
+            for(const auto& input : i.inputs) {
+                ir::AsmOperand operand;
+                operand.constraint = input.constraint[0];
+                operand.arg = instr.args.size();
+
+                bool immediate = operand.constraint == 'i' || operand.constraint == 'n';
+
+                if(operand.constraint == 'm') {
+                    instr.args.push_back(address_value(address(*input.expression)));
+                }
+                else {
+                    bool folding = fold_;
+                    fold_ = fold_ || immediate;
+                    instr.args.push_back(lower(*input.expression));
+                    fold_ = folding;
+                }
+
+                if(immediate && !instr.args.back().is_immediate()) {
+                    throw codegen_exception(input.expression->offset, "asm operand '" + input.constraint
+                                                                      + "' is not a constant");
+                }
+
+                extended->operands.push_back(operand);
+            }
+
+            instr.extended = std::move(extended);
+            std::vector<ir::Register> results = instr.results;
+            emit(std::move(instr));
+            std::size_t k = 0;
+
+            for(const auto& output : i.outputs) {
+                if(output.constraint.back() == 'm') {
+                    continue;
+                }
+
+                const Address& target = outputs[k];
+                ir::Instr store(ir::Opcode::Store);
+                store.a = target.base;
+                store.symbol = target.symbol;
+                store.disp = target.disp;
+                store.index = target.index;
+                store.scale = target.scale;
+                store.b = ir::Operand::reg(results[k++]);
+                store.size = output.expression->resolved_type->size();
+                emit(std::move(store));
+            }
+        }
+
+        /*
+         * Expressions
+         */
+        virtual void visit(const ast::IdentExpression& e) {
+            value_ = load(address(e), *e.resolved_type);
+        }
+
+        virtual void visit(const ast::IntegerExpression& e) {
+            value_ = ir::Operand::imm(e.value);
+        }
+
+        virtual void visit(const ast::CharExpression& e) {
+            value_ = ir::Operand::imm(e.value);
+        }
+
+        virtual void visit(const ast::StringExpression& e) {
+            ir::Instr address(ir::Opcode::Address);
+            address.a = ir::Operand::symbol();
+            address.symbol = strings_.add(e.value);
+            value_ = emit_value(std::move(address));
+        }
+
+        virtual void visit(const ast::TrueExpression&) {
+            value_ = ir::Operand::imm(1);
+        }
+
+        virtual void visit(const ast::FalseExpression&) {
+            value_ = ir::Operand::imm(0);
+        }
+
+        virtual void visit(const ast::NullExpression&) {
+            value_ = ir::Operand::imm(0);
+        }
+
+        virtual void visit(const ast::UnaryExpression& e) {
+            ir::Operand value = lower(*e.expression);
+
+            switch(e.op) {
+                case ast::UnaryOperator::Plus:
+                    value_ = value;
+                    break;
+                case ast::UnaryOperator::Minus:
+                    value_ = emit_unary(ir::Opcode::Neg, value);
+                    break;
+                case ast::UnaryOperator::Not:
+                    value_ = emit_set(ir::Cond::Eq, value, ir::Operand::imm(0));
+                    break;
+                case ast::UnaryOperator::BitNot:
+                    value_ = emit_unary(ir::Opcode::Not, value);
+                    break;
+                default:
+                    assert(false && "unknown unary operator");
+            }
+        }
+
+        virtual void visit(const ast::BinaryExpression& e) {
+            if(e.op == ast::BinaryOperator::And || e.op == ast::BinaryOperator::Or) {
+                lower_logical(e);
+                return;
+            }
+
+            ir::Operand left = lower(*e.left);
+            ir::Operand right = lower(*e.right);
+            ir::Cond cond;
+
+            if(comparison(e, cond)) {
+                value_ = emit_set(cond, left, right);
+                return;
+            }
+
+            ast::TypeKind left_kind(*e.left->resolved_type), right_kind(*e.right->resolved_type);
+
+            switch(e.op) {
+                case ast::BinaryOperator::Add:
+                    if(right_kind.is_pointer()) {
+                        std::swap(left, right);
+                    }
+                    if(left_kind.is_pointer() || right_kind.is_pointer()) {
+                        right = scale(right, pointed_size(*e.resolved_type));
+                    }
+                    value_ = emit_binary(ir::Opcode::Add, left, right);
+                    break;
+                case ast::BinaryOperator::Sub:
+                    if(left_kind.is_pointer() && right_kind.is_pointer()) {
+                        ir::Operand diff = emit_binary(ir::Opcode::Sub, left, right);
+                        value_ = divide_exact(diff, pointed_size(*e.left->resolved_type));
+                    }
+                    else {
+                        if(left_kind.is_pointer()) {
+                            right = scale(right, pointed_size(*e.left->resolved_type));
+                        }
+                        value_ = emit_binary(ir::Opcode::Sub, left, right);
+                    }
+                    break;
+                case ast::BinaryOperator::Mul:
+                    value_ = emit_binary(ir::Opcode::Mul, left, right);
+                    break;
+                case ast::BinaryOperator::Div:
+                case ast::BinaryOperator::Mod: {
+                    bool modulo = e.op == ast::BinaryOperator::Mod;
+
+                    if(options_.optimize && right.is_immediate() && !left.is_immediate()) {
+                        value_ = divide(left, right.value, modulo);
+                    }
+                    else {
+                        value_ = emit_binary(modulo ? ir::Opcode::Mod : ir::Opcode::Div, left, right);
+                    }
+                    break;
+                }
+                case ast::BinaryOperator::BitOr:
+                    value_ = emit_binary(ir::Opcode::Or, left, right);
+                    break;
+                case ast::BinaryOperator::BitAnd:
+                    value_ = emit_binary(ir::Opcode::And, left, right);
+                    break;
+                case ast::BinaryOperator::BitXor:
+                    value_ = emit_binary(ir::Opcode::Xor, left, right);
+                    break;
+                case ast::BinaryOperator::Lshift:
+                    value_ = emit_binary(ir::Opcode::Shl, left, right);
+                    break;
+                case ast::BinaryOperator::Rshift:
+                    value_ = emit_binary(ir::Opcode::Shr, left, right);
+                    break;
+                default:
+                    assert(false && "unknown binary operator");
+            }
+        }
+
+        virtual void visit(const ast::AffectationExpression& e) {
+            value_ = assign(e, true);
+        }
+
+        virtual void visit(const ast::CastExpression& e) {
+            ir::Operand value = lower(*e.expression);
+            ast::TypeKind kind(*e.type);
+
+            if(kind.kind == ast::TypeKind::Char) {
+                // truncate, then sign extend
+                value = emit_binary(ir::Opcode::Shl, value, ir::Operand::imm(24));
+                value = emit_binary(ir::Opcode::Shr, value, ir::Operand::imm(24));
+            }
+            else if(kind.kind == ast::TypeKind::Boolean) {
+                value = emit_set(ir::Cond::Ne, value, ir::Operand::imm(0));
+            }
+
+            value_ = value;
+        }
+
+        virtual void visit(const ast::AccessExpression& e) {
+            value_ = load(address(e), *e.resolved_type);
+        }
+
+        virtual void visit(const ast::MemberExpression& e) {
+            value_ = load(address(e), *e.resolved_type);
+        }
+
+        virtual void visit(const ast::IndexExpression& e) {
+            value_ = load(address(e), *e.resolved_type);
+        }
+
+        virtual void visit(const ast::SizeofExpression& e) {
+            value_ = ir::Operand::imm(e.operand()->size());
+        }
+
+        virtual void visit(const ast::CallExpression& e) {
+            ir::Instr call(ir::Opcode::Call);
+            call.symbol = e.function_name;
+
+            for(const auto& arg : e.arguments) {
+                call.args.push_back(lower(*arg));
+            }
+
+            if(ast::TypeKind(*e.resolved_type).kind == ast::TypeKind::Void) {
+                emit(std::move(call));
+                value_ = ir::Operand();
+            }
+            else {
+                value_ = emit_value(std::move(call));
+            }
+        }
+
+    private:
+        ir::Operand lower(const ast::Expression& e) {
+            e.accept(*this);
+            return value_;
+        }
+
+        void lower_scope(const std::vector<std::unique_ptr<ast::Instruction>>& instructions) {
+            locals_.enter();
+
+            for(const auto& instr : instructions) {
+                instr->accept(*this);
+            }
+
+            locals_.leave();
+        }
+
+        /*
+         * a && b is lowered as: r = a != 0; if r goto rhs else end;
+         * rhs: r = b != 0; end:
+         *
+         * When b can be evaluated unconditionally, both sides are computed
+         * and combined with a bitwise and/or, without branching.
+         */
+        void lower_logical(const ast::BinaryExpression& e) {
+            if(options_.optimize && speculatable(*e.right)) {
+                ir::Operand left = truth(*e.left);
+                ir::Operand right = truth(*e.right);
+                value_ = emit_binary(e.op == ast::BinaryOperator::And ? ir::Opcode::And : ir::Opcode::Or, left, right);
+                return;
+            }
+
+            ir::Register r = function_.new_register();
+
+            ir::Instr left(ir::Opcode::Set);
+            left.cond = ir::Cond::Ne;
+            left.dst = r;
+            left.a = lower(*e.left);
+            left.b = ir::Operand::imm(0);
+            emit(std::move(left));
+
+            std::uint32_t rhs = function_.new_block();
+            std::uint32_t end = function_.new_block();
+
+            if(e.op == ast::BinaryOperator::And) {
+                branch(ir::Operand::reg(r), rhs, end);
+            }
+            else {
+                branch(ir::Operand::reg(r), end, rhs);
+            }
+
+            block_ = rhs;
+            ir::Instr right(ir::Opcode::Set);
+            right.cond = ir::Cond::Ne;
+            right.dst = r;
+            right.a = lower(*e.right);
+            right.b = ir::Operand::imm(0);
+            emit(std::move(right));
+            jump(end);
+
+            block_ = end;
+            value_ = ir::Operand::reg(r);
+        }
+
+        /*
+         * Lowers a condition into compares and branches whose targets are
+         * created afterwards, so that the blocks of && and || come first in
+         * the layout. Its branches go to true_target and false_target until
+         * resolve() patches them.
+         */
+        Condition lower_condition(const ast::Expression& e) {
+            Condition result;
+            result.block = block_;
+            result.first = function_.blocks.size();
+            condition(e, true_target, false_target);
+            result.last = function_.blocks.size();
+            return result;
+        }
+
+        void resolve(const Condition& cond, std::uint32_t if_true, std::uint32_t if_false) {
+            auto patch = [&](ir::Block& block) {
+                if(!block.terminated()) {
+                    return;
+                }
+
+                for(auto& target : block.instrs.back().targets) {
+                    if(target == true_target) {
+                        target = if_true;
+                    }
+                    else if(target == false_target) {
+                        target = if_false;
+                    }
+                }
+            };
+
+            patch(function_.blocks[cond.block]);
+
+            for(std::uint32_t b = cond.first; b < cond.last; ++b) {
+                patch(function_.blocks[b]);
+            }
+        }
+
+        /*
+         * Comparisons branch on their own flags, never materializing a
+         * boolean, and every operand of && and || branches straight to the
+         * final target once the result is known, instead of going through
+         * a join block testing it again. ! swaps the targets.
+         */
+        void condition(const ast::Expression& e, std::uint32_t if_true, std::uint32_t if_false) {
+            if(auto binary = dynamic_cast<const ast::BinaryExpression*>(&e)) {
+                ir::Cond cond;
+
+                if(binary->op == ast::BinaryOperator::And || binary->op == ast::BinaryOperator::Or) {
+                    bool is_and = binary->op == ast::BinaryOperator::And;
+                    Condition left = lower_condition(*binary->left);
+                    std::uint32_t rhs = function_.new_block();
+                    resolve(left, is_and ? rhs : if_true, is_and ? if_false : rhs);
+
+                    block_ = rhs;
+                    condition(*binary->right, if_true, if_false);
+                    return;
+                }
+
+                if(comparison(*binary, cond)) {
+                    ir::Operand left = lower(*binary->left);
+                    ir::Operand right = lower(*binary->right);
+                    branch(cond, left, right, if_true, if_false);
+                    return;
+                }
+            }
+
+            auto unary = dynamic_cast<const ast::UnaryExpression*>(&e);
+
+            if(unary != nullptr && unary->op == ast::UnaryOperator::Not) {
+                condition(*unary->expression, if_false, if_true);
+            }
+            else if(dynamic_cast<const ast::TrueExpression*>(&e)) {
+                jump(if_true);
+            }
+            else if(dynamic_cast<const ast::FalseExpression*>(&e)) {
+                jump(if_false);
+            }
+            else {
+                branch(lower(e), if_true, if_false);
+            }
+        }
+
+        /*
+         * The value of e as a boolean, 0 or 1.
+         */
+        ir::Operand truth(const ast::Expression& e) {
+            ir::Operand value = lower(e);
+
+            if(ast::TypeKind(*e.resolved_type).kind == ast::TypeKind::Boolean) {
+                return value;
+            }
+
+            return emit_set(ir::Cond::Ne, value, ir::Operand::imm(0));
+        }
+
+        /*
+         * if(c) { x = a; } else { x = b; }, with a and b cheap enough to be
+         * both computed, is lowered as x = c ? a : b with a Select, which
+         * becomes a cmov. Without else, b is x itself.
+         */
+        bool lower_select(const ast::IfInstruction& i) {
+            if(i.true_instrs.size() != 1 || i.false_instrs.size() > 1) {
+                return false;
+            }
+
+            const ast::AffectationExpression* if_true = scalar_assignment(*i.true_instrs[0]);
+            const ast::AffectationExpression* if_false = i.false_instrs.empty()
+                                                         ? nullptr : scalar_assignment(*i.false_instrs[0]);
+
+            if(if_true == nullptr || (!i.false_instrs.empty() && if_false == nullptr)) {
+                return false;
+            }
+
+            const auto& name = static_cast<const ast::IdentExpression&>(*if_true->affected).name;
+
+            if(if_false && static_cast<const ast::IdentExpression&>(*if_false->affected).name != name) {
+                return false;
+            }
+
+            auto binary = dynamic_cast<const ast::BinaryExpression*>(i.condition.get());
+            ir::Cond cond = ir::Cond::Ne;
+            bool compares = binary != nullptr && comparison(*binary, cond);
+
+            if(!speculatable(*if_true->value) || (if_false && !speculatable(*if_false->value))
+               || (!compares && !speculatable(*i.condition))) {
+                return false;
+            }
+
+            ir::Instr select(ir::Opcode::Select);
+            select.cond = cond;
+
+            if(compares) {
+                select.a = lower(*binary->left);
+                select.b = lower(*binary->right);
+            }
+            else {
+                select.a = lower(*i.condition);
+                select.b = ir::Operand::imm(0);
+            }
+
+            Address target = address(*if_true->affected);
+            offset_ = i.true_instrs[0]->offset;
+            select.args.push_back(lower(*if_true->value));
+
+            if(if_false) {
+                offset_ = i.false_instrs[0]->offset;
+                select.args.push_back(lower(*if_false->value));
+            }
+            else {
+                select.args.push_back(load(target, *if_true->resolved_type));
+            }
+
+            ir::Instr store(ir::Opcode::Store);
+            store.a = target.base;
+            store.symbol = target.symbol;
+            store.disp = target.disp;
+            store.size = if_true->resolved_type->size();
+            store.b = emit_value(std::move(select));
+            emit(std::move(store));
+            return true;
+        }
+
+        /*
+         * Blocks are laid out as body, step, condition, end: the condition
+         * is tested once before entering the loop, then at the bottom of
+         * every iteration, whose only branch is the one going back to the
+         * body. break and continue are plain jumps.
+         *
+         * The condition is lowered first, so that the blocks of its && and
+         * || come before end.
+         */
+        void lower_loop(std::uint32_t offset, const ast::Expression* condition, const ast::Expression* step,
+                        const std::vector<std::unique_ptr<ast::Instruction>>& instructions,
+                        const Range* counter = nullptr) {
+            std::uint32_t body = function_.new_block();
+            std::uint32_t latch = step ? function_.new_block() : 0;
+            std::uint32_t header = condition ? function_.new_block() : body;
+
+            jump(header);
+            Condition cond;
+
+            if(condition) {
+                block_ = header;
+                offset_ = offset;
+                cond = lower_condition(*condition);
+            }
+
+            std::uint32_t end = function_.new_block();
+
+            if(condition) {
+                resolve(cond, body, end);
+            }
+
+            std::uint32_t next = step ? latch : header;
+
+            block_ = body;
+            loops_.push_back(Loop{next, end});
+
+            if(counter != nullptr) {
+                ranges_.push_back(*counter);
+            }
+
+            lower_scope(instructions);
+
+            if(counter != nullptr) {
+                ranges_.pop_back();
+            }
+
+            loops_.pop_back();
+            jump(next);
+
+            if(step) {
+                block_ = latch;
+                offset_ = offset;
+                lower_discarded(*step);
+                jump(header);
+            }
+
+            block_ = end;
+        }
+
+        Address address(const ast::Expression& e) {
+            if(auto ident = dynamic_cast<const ast::IdentExpression*>(&e)) {
+                Variable var = lookup(ident->name);
+                Address result;
+                result.base = var.address;
+                result.symbol = var.symbol;
+                return result;
+            }
+
+            if(auto access = dynamic_cast<const ast::AccessExpression*>(&e)) {
+                Address result;
+                result.base = lower(*access->expression);
+                return result;
+            }
+
+            if(auto index = dynamic_cast<const ast::IndexExpression*>(&e)) {
+                ast::TypeKind array(*index->array->resolved_type);
+                Address result;
+
+                // an array is indexed from its own address, a pointer from its value
+                if(array.kind == ast::TypeKind::Array) {
+                    result = address(*index->array);
+                }
+                else {
+                    result.base = lower(*index->array);
+                }
+
+                ir::Operand value = lower(*index->index);
+
+                if(array.kind == ast::TypeKind::Array && options_.bounds_check) {
+                    check_bounds(*index->index, value, array.count);
+                }
+
+                return indexed(result, value, index->resolved_type->size());
+            }
+
+            auto member = dynamic_cast<const ast::MemberExpression*>(&e);
+            assert(member != nullptr && "not an lvalue");
+
+            const ast::Type* type = member->expression->resolved_type;
+            Address result;
+
+            if(member->arrow) {
+                type = ast::TypeKind(*type).pointed;
+                result.base = lower(*member->expression);
+            }
+            else {
+                result = address(*member->expression);
+            }
+
+            // the whole access folds into one displacement
+            result.disp += ast::TypeKind(*type).structure->layout.offsets[member->field];
+            return result;
+        }
+
+        /*
+         * Adds index elements of the given size to an address, with a
+         * scaled index when the size allows it.
+         */
+        Address indexed(Address address, ir::Operand index, std::int32_t size) {
+            if(index.is_immediate()) {
+                address.disp += index.value * size;
+                return address;
+            }
+
+            if(!address.index.is_none()) {
+                // a[i][j]: only one index fits in an addressing mode
+                Address base;
+                base.base = address_value(address);
+                address = base;
+            }
+
+            if(size == 1 || size == 2 || size == 4 || size == 8) {
+                address.index = index;
+                address.scale = size;
+            }
+            else {
+                address.index = scale(index, size);
+            }
+
+            return address;
+        }
+
+        ir::Operand address_value(const Address& address) {
+            if(address.base.is_register() && address.index.is_none()) {
+                return address.disp == 0 ? address.base
+                                         : emit_binary(ir::Opcode::Add, address.base, ir::Operand::imm(address.disp));
+            }
+
+            ir::Instr instr(ir::Opcode::Address);
+            instr.a = address.base;
+            instr.symbol = address.symbol;
+            instr.disp = address.disp;
+            instr.index = address.index;
+            instr.scale = address.scale;
+            return emit_value(std::move(instr));
+        }
+
+        /*
+         * The value at an address. Arrays and structs are not loaded, their
+         * value is their address.
+         */
+        /*
+         * Stores the value of e, and returns the value of the assignment if
+         * used: that of the target once stored, a char being truncated and
+         * extended as when loaded back.
+         */
+        ir::Operand assign(const ast::AffectationExpression& e, bool used) {
+            Address target = address(*e.affected);
+            ir::Instr store(ir::Opcode::Store);
+            store.a = target.base;
+            store.symbol = target.symbol;
+            store.disp = target.disp;
+            store.index = target.index;
+            store.scale = target.scale;
+            store.b = lower(*e.value);
+            store.size = e.resolved_type->size();
+
+            ir::Operand value = store.b;
+            emit(std::move(store));
+
+            if(used && ast::TypeKind(*e.resolved_type).kind == ast::TypeKind::Char) {
+                value = emit_binary(ir::Opcode::Shl, value, ir::Operand::imm(24));
+                value = emit_binary(ir::Opcode::Shr, value, ir::Operand::imm(24));
+            }
+
+            return value;
+        }
+
+        // an assignment whose value is not used is not extended
+        void lower_discarded(const ast::Expression& e) {
+            auto assignment = dynamic_cast<const ast::AffectationExpression*>(&e);
+
+            if(assignment != nullptr) {
+                assign(*assignment, false);
+            }
+            else {
+                lower(e);
+            }
+        }
+
+        ir::Operand load(const Address& address, const ast::Type& type) {
+            if(is_aggregate(type)) {
+                return address_value(address);
+            }
+
+            ir::Instr instr(ir::Opcode::Load);
+            instr.a = address.base;
+            instr.symbol = address.symbol;
+            instr.disp = address.disp;
+            instr.index = address.index;
+            instr.scale = address.scale;
+            set_size(instr, type);
+            return emit_value(std::move(instr));
+        }
+
+        void check_bounds(const ast::Expression& index, ir::Operand value, std::uint32_t count) {
+            std::int32_t low, high;
+
+            if(!range(index, value, low, high) || low < 0 || static_cast<std::uint32_t>(high) >= count) {
+                ir::Instr check(ir::Opcode::Check);
+                check.a = value;
+                check.b = ir::Operand::imm(count);
+                emit(std::move(check));
+            }
+        }
+
+        /*
+         * Bounds of the value of an index, when they are known.
+         */
+        bool range(const ast::Expression& index, ir::Operand value, std::int32_t& low, std::int32_t& high) {
+            if(value.is_immediate()) {
+                low = high = value.value;
+                return true;
+            }
+
+            auto ident = dynamic_cast<const ast::IdentExpression*>(&index);
+
+            if(ident == nullptr) {
+                return false;
+            }
+
+            ir::Operand address = lookup(ident->name).address;
+
+            for(auto it = ranges_.rbegin(); it != ranges_.rend(); ++it) {
+                if(address.kind == ir::Operand::Kind::Slot && static_cast<std::uint32_t>(address.value) == it->slot) {
+                    low = it->low;
+                    high = it->high;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        Variable lookup(const std::string& name) {
+            const Variable* local = locals_.find(names_.intern(name));
+
+            if(local != nullptr) {
+                return *local;
+            }
+
+            assert(globals_.variables.count(name) && "undeclared identifier");
+            return Variable{ir::Operand::symbol(), name};
+        }
+
+        static void set_size(ir::Instr& instr, const ast::Type& type) {
+            instr.size = type.size();
+            instr.sign = ast::TypeKind(type).kind != ast::TypeKind::Boolean;
+        }
+
+        ir::Operand scale(ir::Operand value, std::int32_t size) {
+            if(size == 1) {
+                return value;
+            }
+
+            if(value.is_immediate()) {
+                return ir::Operand::imm(value.value * size);
+            }
+
+            return emit_binary(ir::Opcode::Mul, value, ir::Operand::imm(size));
+        }
+
+        void emit(ir::Instr&& instr) {
+            if(function_.blocks[block_].terminated()) {
+                // unreachable code after a return
+                block_ = function_.new_block();
+            }
+
+            instr.offset = offset_;
+            function_.blocks[block_].instrs.push_back(std::move(instr));
+        }
+
+        ir::Operand emit_value(ir::Instr&& instr) {
+            instr.dst = function_.new_register();
+            ir::Operand result = ir::Operand::reg(instr.dst);
+            emit(std::move(instr));
+            return result;
+        }
+
+        /*
+         * n / d or n % d for a constant d, without idiv. A power of 2 is an
+         * arithmetic shift, after adding d - 1 to negative numbers so that
+         * the quotient rounds toward zero; other divisors multiply by a
+         * magic number. The remainder is n - q * d.
+         */
+        ir::Operand divide(ir::Operand n, std::int32_t d, bool modulo) {
+            std::uint32_t ad = d < 0 ? 0u - static_cast<std::uint32_t>(d) : d;
+
+            if(d == 0) {
+                return emit_binary(modulo ? ir::Opcode::Mod : ir::Opcode::Div, n, ir::Operand::imm(d));
+            }
+
+            ir::Operand q = n;
+
+            if((ad & (ad - 1)) == 0) {
+                if(ad > 1) {
+                    ir::Operand bias = emit_binary(ir::Opcode::Shr, n, ir::Operand::imm(31));
+                    bias = emit_binary(ir::Opcode::And, bias, ir::Operand::imm(ad - 1));
+                    q = emit_binary(ir::Opcode::Add, n, bias);
+                    q = emit_binary(ir::Opcode::Shr, q, ir::Operand::imm(log2(ad)));
+                }
+
+                if(d < 0) {
+                    q = emit_unary(ir::Opcode::Neg, q);
+                }
+            }
+            else {
+                Magic magic = signed_magic(d);
+                q = emit_binary(ir::Opcode::MulHigh, n, ir::Operand::imm(magic.multiplier));
+
+                if(d > 0 && magic.multiplier < 0) {
+                    q = emit_binary(ir::Opcode::Add, q, n);
+                }
+                else if(d < 0 && magic.multiplier > 0) {
+                    q = emit_binary(ir::Opcode::Sub, q, n);
+                }
+
+                if(magic.shift > 0) {
+                    q = emit_binary(ir::Opcode::Shr, q, ir::Operand::imm(magic.shift));
+                }
+
+                // q - (q >> 31) adds one to a negative quotient
+                q = emit_binary(ir::Opcode::Sub, q, emit_binary(ir::Opcode::Shr, q, ir::Operand::imm(31)));
+            }
+
+            if(!modulo) {
+                return q;
+            }
+
+            return emit_binary(ir::Opcode::Sub, n, emit_binary(ir::Opcode::Mul, q, ir::Operand::imm(d)));
+        }
+
+        /*
+         * n / d, d dividing n, as for the difference of two pointers: a
+         * shift by the power of 2 in d, then a multiplication by the
+         * inverse of its odd part.
+         */
+        ir::Operand divide_exact(ir::Operand n, std::uint32_t d) {
+            int k = 0;
+
+            while((d & 1) == 0) {
+                d >>= 1;
+                ++k;
+            }
+
+            if(k > 0) {
+                n = emit_binary(ir::Opcode::Shr, n, ir::Operand::imm(k));
+            }
+
+            return d == 1 ? n : emit_binary(ir::Opcode::Mul, n, ir::Operand::imm(inverse(d)));
+        }
+
+        ir::Operand emit_unary(ir::Opcode op, ir::Operand a) {
+            std::int32_t result;
+
+            if(fold_ && a.is_immediate() && fold(op, a.value, 0, result)) {
+                return ir::Operand::imm(result);
+            }
+
+            ir::Instr instr(op);
+            instr.a = a;
+            return emit_value(std::move(instr));
+        }
+
+        ir::Operand emit_binary(ir::Opcode op, ir::Operand a, ir::Operand b) {
+            std::int32_t result;
+
+            if(fold_ && a.is_immediate() && b.is_immediate() && fold(op, a.value, b.value, result)) {
+                return ir::Operand::imm(result);
+            }
+
+            ir::Instr instr(op);
+            instr.a = a;
+            instr.b = b;
+            return emit_value(std::move(instr));
+        }
+
+        ir::Operand emit_set(ir::Cond cond, ir::Operand a, ir::Operand b) {
+            ir::Instr instr(ir::Opcode::Set);
+            instr.cond = cond;
+            instr.a = a;
+            instr.b = b;
+            return emit_value(std::move(instr));
+        }
+
+        void jump(std::uint32_t target) {
+            if(function_.blocks[block_].terminated()) {
+                return;
+            }
+
+            ir::Instr instr(ir::Opcode::Jump);
+            instr.targets[0] = target;
+            emit(std::move(instr));
+        }
+
+        void branch(ir::Operand cond, std::uint32_t if_true, std::uint32_t if_false) {
+            branch(ir::Cond::Ne, cond, ir::Operand::imm(0), if_true, if_false);
+        }
+
+        void branch(ir::Cond cond, ir::Operand a, ir::Operand b, std::uint32_t if_true, std::uint32_t if_false) {
+            if(function_.blocks[block_].terminated()) {
+                return;
+            }
+
+            // cmpl wants the immediate second
+            if(a.is_immediate() && !b.is_immediate()) {
+                std::swap(a, b);
+                cond = ir::swap(cond);
+            }
+
+            ir::Instr instr(ir::Opcode::Branch);
+            instr.cond = cond;
+            instr.a = a;
+            instr.b = b;
+            instr.targets[0] = if_true;
+            instr.targets[1] = if_false;
+            emit(std::move(instr));
+        }
+
+    private:
+        ir::Function& function_;
+        const Globals& globals_;
+        ir::StringTable& strings_;
+        const LoweringOptions& options_;
+
+        Interner& names_;
+        bool fold_;     // constant operations are folded, always for 'i' asm operands
+        ScopedTable<Variable> locals_;
+
+        class Loop {
+            public:
+                std::uint32_t continue_target;
+                std::uint32_t break_target;
+        };
+
+        std::vector<Loop> loops_;
+
+        // for loop counters in scope, see ast::ForInstruction::counter
+        std::vector<Range> ranges_;
+
+        std::uint32_t block_;
+        std::uint32_t offset_ = 0;
+        ir::Operand value_;
+};
+
+} // namespace
+
+ir::Function lower(const ast::FunctionEntity& function, const Globals& globals, ir::StringTable& strings,
+                   const LoweringOptions& options, Interner& names) {
+    ir::Function result(function.name);
+    result.offset = function.offset;
+
+    Lowering lowering(result, globals, strings, options, names);
+    lowering.lower(function);
+
+    if(options.optimize) {
+        result.eliminated = eliminate_redundancies(result);
+    }
+
+    if(!options.profile_generate.empty()) {
+        instrument(result);
+    }
+    else if(options.profile) {
+        annotate(result, *options.profile);
+    }
+
+    return result;
+}
+
+} // namespace microc
@@ -0,0 +1,75 @@
+#ifndef MICROC_LOWERING_HPP
+#define MICROC_LOWERING_HPP
+
+#include "ast.hpp"
+#include "ir.hpp"
+#include "profile.hpp"
+#include "symbols.hpp"
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace microc {
+
+class codegen_exception : public std::exception {
+    public:
+        codegen_exception(std::uint32_t offset, const std::string& message);
+        virtual const char* what() const noexcept;
+        std::uint32_t offset() const noexcept { return offset_; }
+
+    private:
+        std::uint32_t offset_;
+        std::string what_;
+};
+
+/*
+ * Declarations visible from every function of a program.
+ */
+class Globals {
+    public:
+        Globals() = default;
+        explicit Globals(const ast::Program& prog);
+
+        // declares the entity if it is a global or a function
+        void add(const ast::Entity& entity);
+
+    public:
+        std::unordered_map<std::string, const ast::GlobalEntity*> variables;
+        std::unordered_map<std::string, const ast::FunctionEntity*> functions;
+};
+
+class LoweringOptions {
+    public:
+        bool bounds_check = false;      // -fbounds-check
+        bool optimize = true;           // -O0 turns off folding, strength reduction, if-conversion and value numbering
+        std::string profile_generate;   // --profile-generate=FILE: count blocks and branches, written to FILE
+        std::shared_ptr<const Profile> profile;     // --profile-use=FILE
+};
+
+/*
+ * Translates a function into the intermediate representation. Locals and
+ * arguments get a frame slot each, and every read or write of a variable is
+ * a Load or a Store. The program must have gone through analyze().
+ *
+ * With bounds checks, indexing an array, not a pointer, checks the index
+ * against the length of the array, unless it is a constant or the counter
+ * of a for loop whose range is within bounds.
+ *
+ * Without optimization, every operator is emitted as written: constants
+ * are not folded, divisions by constants are not strength reduced and
+ * conditions are always lowered to branches. The result must behave the
+ * same, which the fuzzer checks. With it, redundant expressions and loads
+ * are then removed, see gvn.hpp.
+ *
+ * With --profile-generate, the function is then instrumented; with
+ * --profile-use, it gets the counts of the profile collected on the same
+ * code, see profile.hpp.
+ */
+ir::Function lower(const ast::FunctionEntity& function, const Globals& globals, ir::StringTable& strings,
+                   const LoweringOptions& options, Interner& names);
+
+} // namespace microc
+
+#endif // MICROC_LOWERING_HPP
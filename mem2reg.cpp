@@ -0,0 +1,309 @@
+#include "mem2reg.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace microc {
+
+namespace {
+
+/*
+ * How a slot is accessed, if only by name.
+ */
+class Variable {
+    public:
+        bool promotable = true;
+        bool stored = false;
+        bool extended = false;      // loaded as a char
+        std::uint8_t size = 0;      // of every access
+        bool sign = true;           // of every load of a char
+        ir::Register reg = ir::no_register;
+};
+
+bool is_access(const ir::Instr& instr) {
+    return (instr.op == ir::Opcode::Load || instr.op == ir::Opcode::Store) && instr.a.kind == ir::Operand::Kind::Slot;
+}
+
+// times each register is defined, or used
+std::vector<std::uint32_t> count(const ir::Function& function, bool uses) {
+    std::vector<std::uint32_t> counts(function.registers + 1);
+
+    for(const auto& block : function.blocks) {
+        for(const auto& instr : block.instrs) {
+            if(uses) {
+                for(ir::Register r : instr.uses()) {
+                    ++counts[r];
+                }
+            }
+            else if(instr.dst != ir::no_register) {
+                ++counts[instr.dst];
+            }
+        }
+    }
+
+    return counts;
+}
+
+/*
+ * Reads the register of the variable rather than a copy of it loaded
+ * earlier, wherever the variable holds the same value on every path from
+ * the copy: a forward dataflow over the copies, each one killed by the
+ * stores to its variable.
+ */
+void rename_loads(ir::Function& function, const std::vector<ir::Register>& loaded,
+                  const std::vector<ir::Register>& sources,
+                  const std::unordered_map<ir::Register, std::size_t>& load_index) {
+    std::size_t n = function.blocks.size();
+
+    // copies of each variable
+    std::unordered_map<ir::Register, std::vector<std::size_t>> copies;
+
+    for(std::size_t i = 0; i < loaded.size(); ++i) {
+        copies[sources[i]].push_back(i);
+    }
+
+    auto transfer = [&](const ir::Instr& instr, std::vector<bool>& same) {
+        auto killed = copies.find(instr.dst);
+
+        if(killed != copies.end()) {
+            for(std::size_t i : killed->second) {
+                same[i] = false;
+            }
+        }
+
+        auto copy = load_index.find(instr.dst);
+
+        if(instr.op == ir::Opcode::Copy && copy != load_index.end()) {
+            same[copy->second] = true;
+        }
+    };
+
+    // a copy not made yet on some path is not read there, which is the
+    // same as still holding the variable's value
+    std::vector<std::vector<bool>> in(n, std::vector<bool>(loaded.size(), true));
+    std::vector<std::vector<bool>> out = in;
+    std::vector<std::vector<std::uint32_t>> predecessors(n);
+
+    for(const auto& block : function.blocks) {
+        if(block.terminated()) {
+            for(std::uint32_t succ : block.successors()) {
+                predecessors[succ].push_back(block.id);
+            }
+        }
+    }
+
+    for(bool changed = true; changed;) {
+        changed = false;
+
+        for(const auto& block : function.blocks) {
+            std::vector<bool> same(loaded.size(), true);
+
+            for(std::uint32_t pred : predecessors[block.id]) {
+                for(std::size_t i = 0; i < loaded.size(); ++i) {
+                    same[i] = same[i] && out[pred][i];
+                }
+            }
+
+            in[block.id] = same;
+
+            for(const auto& instr : block.instrs) {
+                transfer(instr, same);
+            }
+
+            if(same != out[block.id]) {
+                out[block.id] = std::move(same);
+                changed = true;
+            }
+        }
+    }
+
+    for(auto& block : function.blocks) {
+        std::vector<bool>& same = in[block.id];
+
+        auto rename = [&](ir::Operand& op) {
+            auto it = op.is_register() ? load_index.find(op.value) : load_index.end();
+
+            if(it != load_index.end() && same[it->second]) {
+                op = ir::Operand::reg(sources[it->second]);
+            }
+        };
+
+        for(auto& instr : block.instrs) {
+            rename(instr.a);
+            rename(instr.b);
+            rename(instr.index);
+
+            for(auto& arg : instr.args) {
+                rename(arg);
+            }
+
+            transfer(instr, same);
+        }
+    }
+}
+
+} // namespace
+
+std::uint32_t promote_locals(ir::Function& function) {
+    std::vector<bool> escaped = function.escaped_slots();
+    std::vector<Variable> variables(function.slots.size());
+
+    for(const auto& block : function.blocks) {
+        for(const auto& instr : block.instrs) {
+            if(!is_access(instr)) {
+                continue;
+            }
+
+            Variable& variable = variables[instr.a.value];
+            bool load = instr.op == ir::Opcode::Load;
+
+            if(variable.size != 0 && variable.size != instr.size) {
+                variable.promotable = false;
+            }
+
+            if(load && instr.size == 1) {
+                if(variable.extended && variable.sign != instr.sign) {
+                    variable.promotable = false;
+                }
+
+                variable.sign = instr.sign;
+                variable.extended = true;
+            }
+
+            variable.size = instr.size;
+            variable.stored = variable.stored || !load;
+        }
+    }
+
+    std::uint32_t promoted = 0;
+    std::vector<ir::Instr> entry;
+
+    for(std::size_t s = 0; s < variables.size(); ++s) {
+        Variable& variable = variables[s];
+
+        bool argument = function.slots[s].argument >= 0;
+
+        // an argument never assigned is as well read from where it is passed
+        if(escaped[s] || !variable.promotable || (variable.size != 1 && variable.size != 4)
+           || (argument && !variable.stored)) {
+            continue;
+        }
+
+        variable.reg = function.new_register();
+        ++promoted;
+
+        if(argument) {
+            ir::Instr load(ir::Opcode::Load);
+            load.dst = variable.reg;
+            load.a = ir::Operand::slot(s);
+            load.size = variable.size;
+            load.sign = variable.sign;
+            load.offset = function.offset;
+            entry.push_back(load);
+            variable.stored = true;
+        }
+    }
+
+    if(promoted == 0) {
+        return 0;
+    }
+
+    std::vector<std::uint32_t> definitions = count(function, false);
+    std::vector<std::uint32_t> uses = count(function, true);
+
+    // registers loaded from a variable, by index
+    std::vector<ir::Register> loaded;
+    std::vector<ir::Register> sources;
+    std::unordered_map<ir::Register, std::size_t> load_index;
+
+    for(auto& block : function.blocks) {
+        std::vector<ir::Instr> instrs = block.id == 0 ? std::move(entry) : std::vector<ir::Instr>();
+
+        for(auto& instr : block.instrs) {
+            const Variable* variable = is_access(instr) ? &variables[instr.a.value] : nullptr;
+
+            if(variable == nullptr || variable->reg == ir::no_register) {
+                instrs.push_back(std::move(instr));
+                continue;
+            }
+
+            ir::Instr copy(ir::Opcode::Copy);
+            copy.offset = instr.offset;
+
+            if(instr.op == ir::Opcode::Load) {
+                // a local read before any store has whatever value, 0 here
+                copy.dst = instr.dst;
+                copy.a = variable->stored ? ir::Operand::reg(variable->reg) : ir::Operand::imm(0);
+
+                if(variable->stored && definitions[instr.dst] == 1) {
+                    load_index[instr.dst] = loaded.size();
+                    loaded.push_back(instr.dst);
+                    sources.push_back(variable->reg);
+                }
+
+                instrs.push_back(std::move(copy));
+                continue;
+            }
+
+            // the value stored is computed into the variable's register
+            // rather than copied there, if nothing else reads it
+            const ir::Operand& value = instr.b;
+
+            if(variable->size == 4 && value.is_register() && !instrs.empty()
+               && instrs.back().dst == static_cast<ir::Register>(value.value)
+               && definitions[value.value] == 1 && uses[value.value] == 1) {
+                instrs.back().dst = variable->reg;
+                continue;
+            }
+
+            if(variable->size == 4 || value.is_immediate()) {
+                copy.dst = variable->reg;
+                copy.a = value;
+
+                if(variable->size == 1) {
+                    copy.a.value = variable->sign ? static_cast<std::int8_t>(value.value)
+                                                  : static_cast<std::uint8_t>(value.value);
+                }
+            }
+            else if(variable->sign) {
+                ir::Instr shift(ir::Opcode::Shl);
+                shift.dst = function.new_register();
+                shift.a = value;
+                shift.b = ir::Operand::imm(24);
+                shift.offset = instr.offset;
+                instrs.push_back(shift);
+
+                copy.op = ir::Opcode::Shr;
+                copy.dst = variable->reg;
+                copy.a = ir::Operand::reg(shift.dst);
+                copy.b = ir::Operand::imm(24);
+            }
+            else {
+                copy.op = ir::Opcode::And;
+                copy.dst = variable->reg;
+                copy.a = value;
+                copy.b = ir::Operand::imm(255);
+            }
+
+            instrs.push_back(std::move(copy));
+        }
+
+        block.instrs = std::move(instrs);
+    }
+
+    rename_loads(function, loaded, sources, load_index);
+
+    // the copies of loads whose uses were all renamed are dead
+    uses = count(function, true);
+
+    for(auto& block : function.blocks) {
+        block.instrs.erase(std::remove_if(block.instrs.begin(), block.instrs.end(), [&](const ir::Instr& instr) {
+            return instr.op == ir::Opcode::Copy && load_index.count(instr.dst) > 0 && uses[instr.dst] == 0;
+        }), block.instrs.end());
+    }
+
+    return promoted;
+}
+
+} // namespace microc
@@ -0,0 +1,31 @@
+#ifndef MICROC_MEM2REG_HPP
+#define MICROC_MEM2REG_HPP
+
+#include "ir.hpp"
+
+#include <cstdint>
+
+namespace microc {
+
+/*
+ * Moves the locals which do not escape, i.e. whose address is never used,
+ * from their slot to a virtual register of their own, left to the register
+ * allocator: a store to one becomes a Copy into its register, truncated
+ * and extended as its loads do for a char, or the instruction computing
+ * the value writes the register directly. A load becomes a Copy from the
+ * register, and its readers read the register itself where no store can
+ * come in between. Arguments which are assigned are loaded once, on
+ * entry; the others are still read from where they are passed.
+ *
+ * The IR has no phi, so the register is defined by every store, as the
+ * results of inlined calls are. Slots accessed with different sizes or
+ * extensions stay in memory.
+ *
+ * Returns the number of slots promoted. The frame has no room for the
+ * locals among them, see CodeGenerator.
+ */
+std::uint32_t promote_locals(ir::Function& function);
+
+} // namespace microc
+
+#endif // MICROC_MEM2REG_HPP
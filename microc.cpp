@@ -1,58 +1,547 @@
-#include "ast.hpp"
-#include "parser/parser.h"
+#include "compiler.hpp"
+#include "server.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <system_error>
+#include <thread>
 
-
-namespace ast = microc::ast;
+#include <unistd.h>
 
 namespace result {
 enum code_t {
     success = 0,
     missing_argument_error,
     no_such_file_error,
-    parse_error
+    parse_error,
+    semantic_error,
+    codegen_error,
+    output_error,
+    invalid_argument_error,
+    server_error,
+    runtime_error,
+    profile_error
 };
 }
 
-int compile(std::istream& in, std::ostream& out) {
-    int success;
-    microc::Parser parser(in);
+struct options {
+    const char* file = nullptr;
+    const char* output = nullptr;
+    std::size_t max_errors = 20;
+    bool debug = false;
+    bool dump_ast = false;
+    bool dump_ir = false;
+    bool run = false;
+    bool streaming = false;
+    std::vector<std::string> imports;   // -fimport=FILE
+    unsigned pipeline = 0;              // -fpipeline[=N], codegen workers
+    bool pipeline_report = false;
+    std::istream* input = &std::cin;    // of the program run
+    bool stack_usage = false;
+    bool bounds_check = false;
+    bool optimize = true;
+    unsigned regparm = 0;
+    bool tail_calls = true;
+    bool merge_strings = false;
+    bool sse2 = false;
+    unsigned align_functions = 16;      // -falign-functions=N
+    unsigned align_loops = 16;          // -falign-loops=N
+    bool code_size_report = false;
+    bool optimization_report = false;   // -fopt-report
+    std::string profile_generate;       // --profile-generate[=FILE]
+    std::string profile_use;            // --profile-use[=FILE]
+    const char* server = nullptr;       // --server=SOCKET
+    const char* connect = nullptr;      // --connect=SOCKET
+    unsigned jobs = 0;                  // -jN, server workers
+    std::string directory;              // where relative paths are resolved
+};
+
+/*
+ * Writes FILE.su with one line per function: its location, the bytes of
+ * stack it uses, and the bytes used by the deepest chain of calls from it
+ * ("unbounded" when recursive, with a "+" when assembly code is called).
+ */
+void write_stack_usage(const std::vector<microc::StackUsage>& usage, const microc::SourceMap& source, const options& opts) {
+    std::string path = opts.output ? opts.output : opts.file;
+    std::size_t slash = path.rfind('/');
+    std::size_t dot = path.rfind('.');
 
-    try {
-        success = parser.parse();
+    if(opts.output == nullptr && slash != std::string::npos) {
+        path = path.substr(slash + 1);
+        dot = path.rfind('.');
+        slash = std::string::npos;
+    }
+
+    if(dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        path.erase(dot);
+    }
+
+    std::ofstream out(path + ".su");
+    std::vector<microc::StackUsage> sorted = usage;
+    std::sort(sorted.begin(), sorted.end(), [](const microc::StackUsage& a, const microc::StackUsage& b) {
+        return a.offset < b.offset;
+    });
+
+    for(const auto& u : sorted) {
+        microc::SourceLocation loc = source.location(u.offset);
+        out << opts.file << ":" << loc.line << ":" << loc.column << ":" << u.name
+            << "\t" << u.frame << "\t";
+
+        if(!u.bounded) {
+            out << "unbounded";
+        }
+        else {
+            out << u.depth << (u.external ? "+" : "");
+        }
+
+        out << std::endl;
+    }
+}
+
+/*
+ * One line per function with the estimated bytes of its hot code, of its
+ * cold code, out of line, and of the padding aligning its loops, then the
+ * totals.
+ */
+void write_code_size_report(const std::vector<microc::CodeSize>& sizes, std::ostream& err) {
+    microc::CodeSize total;
+    total.name = "total";
+
+    auto write = [&](const microc::CodeSize& size) {
+        err << std::left << std::setw(24) << size.name << std::right
+            << std::setw(8) << size.hot << " hot"
+            << std::setw(8) << size.cold << " cold"
+            << std::setw(6) << size.padding << " padding"
+            << std::setw(4) << size.loops << " loops" << std::endl;
+    };
+
+    for(const auto& size : sizes) {
+        write(size);
+        total.hot += size.hot;
+        total.cold += size.cold;
+        total.padding += size.padding;
+        total.loops += size.loops;
     }
-    catch(const std::exception& e) {
-        std::cerr << e.what() << std::endl;
-        return result::parse_error;
+
+    write(total);
+}
+
+/*
+ * One line per function with the redundant instructions removed and the
+ * locals moved to registers, then the totals.
+ */
+void write_optimization_report(const std::vector<microc::OptimizationReport>& reports, std::ostream& err) {
+    microc::OptimizationReport total;
+    total.name = "total";
+
+    auto write = [&](const microc::OptimizationReport& report) {
+        err << std::left << std::setw(24) << report.name << std::right
+            << std::setw(6) << report.eliminated << " eliminated"
+            << std::setw(6) << report.promoted << " promoted" << std::endl;
+    };
+
+    for(const auto& report : reports) {
+        write(report);
+        total.eliminated += report.eliminated;
+        total.promoted += report.promoted;
     }
 
-    if(success != 0) {
-        std::cerr << "syntax error" << std::endl;
-        return result::parse_error;
+    write(total);
+}
+
+/*
+ * One line per stage of -fpipeline: what it passed on, and the seconds it
+ * worked, waited for its input, and waited for the next stage. The stage
+ * which is never starved nor blocked is the bottleneck.
+ */
+void write_pipeline_report(const std::vector<microc::StageStats>& stages, std::ostream& err) {
+    for(const auto& stage : stages) {
+        err << std::left << std::setw(8) << stage.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << stage.items << " items"
+            << std::setw(9) << stage.busy << "s busy"
+            << std::setw(9) << stage.starved << "s starved"
+            << std::setw(9) << stage.blocked << "s blocked" << std::endl;
     }
+}
+
+// path relative to the directory microc was run from, the client's with --connect
+std::string resolve(const options& opts, const std::string& path) {
+    return path[0] == '/' ? path : opts.directory + "/" + path;
+}
+
+// returns a result code, the status of the program run with --run being left in exit_status
+int compile(std::istream& in, std::ostream& out, std::ostream& err, const options& opts,
+            std::vector<microc::StackUsage>& stack_usage, int& exit_status) {
+    microc::CompileOptions compile_opts;
+    compile_opts.max_errors = opts.max_errors;
+    compile_opts.dump_ast = opts.dump_ast;
+    compile_opts.dump_ir = opts.dump_ir;
+    compile_opts.run = opts.run;
+    compile_opts.streaming = opts.streaming;
+    compile_opts.pipeline = opts.pipeline;
+
+    for(const auto& path : opts.imports) {
+        compile_opts.imports.push_back(resolve(opts, path));
+    }
+    compile_opts.input = opts.input;
+    compile_opts.error = &err;
+    compile_opts.codegen.debug = opts.debug;
+    compile_opts.codegen.source_name = opts.file;
+    compile_opts.codegen.directory = opts.directory;
+    compile_opts.codegen.lowering.bounds_check = opts.bounds_check;
+    compile_opts.codegen.lowering.optimize = opts.optimize;
+    compile_opts.codegen.regparm = opts.regparm;
+    compile_opts.codegen.tail_calls = opts.tail_calls;
+    compile_opts.codegen.merge_strings = opts.merge_strings;
+    compile_opts.codegen.sse2 = opts.sse2;
+    compile_opts.codegen.align_functions = opts.align_functions;
+    compile_opts.codegen.align_loops = opts.align_loops;
+    compile_opts.codegen.code_size = opts.code_size_report;
+    compile_opts.codegen.optimization_report = opts.optimization_report;
+
+    if(!opts.profile_generate.empty()) {
+        compile_opts.codegen.lowering.profile_generate = resolve(opts, opts.profile_generate);
+    }
+
+    if(!opts.profile_use.empty()) {
+        std::string path = resolve(opts, opts.profile_use);
+
+        try {
+            compile_opts.codegen.lowering.profile = std::make_shared<microc::Profile>(microc::Profile::read(path));
+        }
+        catch(const microc::profile_exception& e) {
+            err << "error: " << e.what() << std::endl;
+            return result::profile_error;
+        }
+    }
+
+    thread_local microc::CompilerContext context;
+    microc::CompileResult compiled;
+    context.compile(in, compile_opts, out, compiled);
+
+    for(const auto& diagnostic : compiled.diagnostics) {
+        err << diagnostic << std::endl;
+    }
+
+    if(opts.pipeline_report) {
+        write_pipeline_report(compiled.stages, err);
+    }
+
+    switch(compiled.status) {
+        case microc::CompileStatus::ParseError:    return result::parse_error;
+        case microc::CompileStatus::SemanticError: return result::semantic_error;
+        case microc::CompileStatus::CodegenError:  return result::codegen_error;
+        case microc::CompileStatus::RuntimeError:  return result::runtime_error;
+        default: break;
+    }
+
+    if(opts.code_size_report) {
+        write_code_size_report(compiled.code_size, err);
+    }
+
+    if(opts.optimization_report) {
+        write_optimization_report(compiled.optimizations, err);
+    }
+
+    stack_usage = std::move(compiled.stack_usage);
+    exit_status = compiled.exit_status;
+    return result::success;
+}
+
+void usage(const char* argv0, std::ostream& err) {
+    err << "usage: " << argv0
+        << " [-g] [-o OUTPUT] [-fmax-errors=N] [-fstack-usage] [-fbounds-check] [-O0] [-mregparm=N] [-msse2]"
+        << " [-fno-optimize-sibling-calls] [-fmerge-constants]"
+        << " [-falign-functions=N] [-falign-loops=N] [-fcode-size-report] [-fopt-report] [--profile-generate[=FILE]] [--profile-use[=FILE]] [-fstreaming]"
+        << " [-fpipeline[=N]] [-fpipeline-report] [-fimport=FILE]... [-fdump-ast] [-fdump-ir] [--run] [--connect=SOCKET] FILE"
+        << std::endl
+        << "       " << argv0 << " --server=SOCKET [-jN]" << std::endl;
+}
+
+int parse_arguments(int argc, const char* const argv[], options& opts, std::ostream& err) {
+    for(int i = 1; i < argc; ++i) {
+        if(std::strncmp(argv[i], "-fmax-errors=", 13) == 0) {
+            opts.max_errors = std::strtoul(argv[i] + 13, nullptr, 10);
+        }
+        else if(std::strcmp(argv[i], "-g") == 0) {
+            opts.debug = true;
+        }
+        else if(std::strcmp(argv[i], "-fdump-ast") == 0) {
+            opts.dump_ast = true;
+        }
+        else if(std::strcmp(argv[i], "-fdump-ir") == 0) {
+            opts.dump_ir = true;
+        }
+        else if(std::strcmp(argv[i], "--run") == 0) {
+            opts.run = true;
+        }
+        else if(std::strcmp(argv[i], "-fstack-usage") == 0) {
+            opts.stack_usage = true;
+        }
+        else if(std::strcmp(argv[i], "-fbounds-check") == 0) {
+            opts.bounds_check = true;
+        }
+        else if(std::strcmp(argv[i], "-O0") == 0) {
+            opts.optimize = false;
+        }
+        else if(std::strncmp(argv[i], "-mregparm=", 10) == 0) {
+            opts.regparm = std::strtoul(argv[i] + 10, nullptr, 10);
 
-    ast::Program& prog = parser.prog();
-    out << "parsed:" << std::endl << prog << std::endl;
+            if(opts.regparm > 3) {
+                usage(argv[0], err);
+                err << "error: -mregparm takes at most 3 registers" << std::endl;
+                return result::invalid_argument_error;
+            }
+        }
+        else if(std::strcmp(argv[i], "-msse2") == 0) {
+            opts.sse2 = true;
+        }
+        else if(std::strcmp(argv[i], "-fno-optimize-sibling-calls") == 0) {
+            opts.tail_calls = false;
+        }
+        else if(std::strcmp(argv[i], "-fmerge-constants") == 0) {
+            opts.merge_strings = true;
+        }
+        else if(std::strncmp(argv[i], "-falign-functions=", 18) == 0 || std::strncmp(argv[i], "-falign-loops=", 14) == 0) {
+            bool functions = argv[i][8] == 'f';
+            unsigned long bytes = std::strtoul(std::strchr(argv[i], '=') + 1, nullptr, 10);
+
+            if(bytes == 0 || bytes > 4096 || (bytes & (bytes - 1)) != 0) {
+                usage(argv[0], err);
+                err << "error: " << (functions ? "-falign-functions" : "-falign-loops")
+                    << " takes a power of 2 up to 4096" << std::endl;
+                return result::invalid_argument_error;
+            }
+
+            (functions ? opts.align_functions : opts.align_loops) = bytes;
+        }
+        else if(std::strcmp(argv[i], "-fcode-size-report") == 0) {
+            opts.code_size_report = true;
+        }
+        else if(std::strcmp(argv[i], "-fopt-report") == 0) {
+            opts.optimization_report = true;
+        }
+        else if(std::strcmp(argv[i], "--profile-generate") == 0) {
+            opts.profile_generate = "microc.profile";
+        }
+        else if(std::strncmp(argv[i], "--profile-generate=", 19) == 0) {
+            opts.profile_generate = argv[i] + 19;
+        }
+        else if(std::strcmp(argv[i], "--profile-use") == 0) {
+            opts.profile_use = "microc.profile";
+        }
+        else if(std::strncmp(argv[i], "--profile-use=", 14) == 0) {
+            opts.profile_use = argv[i] + 14;
+        }
+        else if(std::strncmp(argv[i], "-fimport=", 9) == 0) {
+            opts.imports.push_back(argv[i] + 9);
+        }
+        else if(std::strcmp(argv[i], "-fstreaming") == 0) {
+            opts.streaming = true;
+        }
+        else if(std::strcmp(argv[i], "-fpipeline") == 0) {
+            // the scanner, the parser and the writer take a core each
+            opts.pipeline = std::max(std::thread::hardware_concurrency(), 4u) - 3;
+        }
+        else if(std::strncmp(argv[i], "-fpipeline=", 11) == 0) {
+            opts.pipeline = std::strtoul(argv[i] + 11, nullptr, 10);
+        }
+        else if(std::strcmp(argv[i], "-fpipeline-report") == 0) {
+            opts.pipeline_report = true;
+        }
+        else if(std::strncmp(argv[i], "--server=", 9) == 0) {
+            opts.server = argv[i] + 9;
+        }
+        else if(std::strncmp(argv[i], "--connect=", 10) == 0) {
+            opts.connect = argv[i] + 10;
+        }
+        else if(std::strncmp(argv[i], "-j", 2) == 0) {
+            opts.jobs = std::strtoul(argv[i] + 2, nullptr, 10);
+        }
+        else if(std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            opts.output = argv[++i];
+        }
+        else {
+            opts.file = argv[i];
+        }
+    }
 
     return result::success;
 }
 
+/*
+ * Compiles as the command line of the request would, the output and the
+ * stack usage being left to the client to write.
+ */
+microc::CompileResponse handle_request(const microc::CompileRequest& request) {
+    microc::CompileResponse response;
+    std::vector<const char*> argv = {"microc"};
+    std::ostringstream out, err;
+    std::istringstream input(request.input);
+    options opts;
+    opts.input = &input;
+
+    for(const auto& argument : request.arguments) {
+        argv.push_back(argument.c_str());
+    }
+
+    response.code = parse_arguments(argv.size(), argv.data(), opts, err);
+    opts.directory = request.directory;
+
+    if(response.code == result::success && opts.file == nullptr) {
+        usage(argv[0], err);
+        err << "error: too few arguments" << std::endl;
+        response.code = result::missing_argument_error;
+    }
+
+    if(response.code == result::success && request.has_source) {
+        std::istringstream in(request.source);
+        response.code = compile(in, out, err, opts, response.stack_usage, response.exit_status);
+    }
+    else if(response.code == result::success) {
+        std::string path = resolve(opts, opts.file);
+        std::ifstream f(path);
+
+        if(f.is_open()) {
+            response.code = compile(f, out, err, opts, response.stack_usage, response.exit_status);
+        }
+        else {
+            usage(argv[0], err);
+            err << "error: no such file or directory" << std::endl;
+            response.code = result::no_such_file_error;
+        }
+    }
+
+    response.output = out.str();
+    response.diagnostics = err.str();
+    return response;
+}
+
+/*
+ * Sends the command line to the server, the source, and with --run the
+ * input of the program, being read here so that the server needs no access
+ * to them.
+ */
+int compile_remotely(int argc, char* argv[], std::istream& in, const options& opts) {
+    microc::CompileRequest request;
+    request.directory = opts.directory;
+    request.has_source = true;
+    request.source.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    if(opts.run) {
+        request.input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+
+    for(int i = 1; i < argc; ++i) {
+        if(std::strncmp(argv[i], "--connect=", 10) != 0) {
+            request.arguments.push_back(argv[i]);
+        }
+    }
+
+    microc::CompileResponse response;
+
+    try {
+        response = microc::send_request(opts.connect, request);
+    }
+    catch(const std::system_error& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return result::server_error;
+    }
+
+    std::cerr << response.diagnostics;
+
+    if(opts.output == nullptr) {
+        std::cout << response.output;
+    }
+    else if(response.code == result::success) {
+        std::ofstream out(opts.output);
+
+        if(!out.is_open()) {
+            std::cerr << "error: cannot open " << opts.output << std::endl;
+            return result::output_error;
+        }
+
+        out << response.output;
+    }
+
+    if(response.code == result::success && opts.stack_usage && !opts.dump_ast && !opts.dump_ir && !opts.run) {
+        write_stack_usage(response.stack_usage, microc::SourceMap(std::string(opts.file)), opts);
+    }
+
+    return response.code == result::success && opts.run ? response.exit_status : response.code;
+}
+
 int main(int argc, char* argv[]) {
-    if(argc < 2) {
-        std::cerr << "usage: " << argv[0] << " FILE" << std::endl
-                  << "error: too few arguments" << std::endl;
+    options opts;
+    int code = parse_arguments(argc, argv, opts, std::cerr);
+    char cwd[4096];
+    opts.directory = getcwd(cwd, sizeof(cwd)) ? cwd : ".";
+
+    if(code != result::success) {
+        return code;
+    }
+
+    if(opts.server != nullptr) {
+        try {
+            microc::serve(opts.server, opts.jobs ? opts.jobs : std::thread::hardware_concurrency(), handle_request);
+        }
+        catch(const std::system_error& e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            return result::server_error;
+        }
+    }
+
+    if(opts.file == nullptr) {
+        usage(argv[0], std::cerr);
+        std::cerr << "error: too few arguments" << std::endl;
         return result::missing_argument_error;
     }
 
-    std::ifstream f(argv[1]);
+    std::ifstream f(opts.file);
 
     if(!f.is_open()) {
-        std::cerr << "usage: " << argv[0] << " FILE" << std::endl
-                  << "error: no such file or directory" << std::endl;
+        usage(argv[0], std::cerr);
+        std::cerr << "error: no such file or directory" << std::endl;
         return result::no_such_file_error;
     }
 
-    return compile(f, std::cout);
+    if(opts.connect != nullptr) {
+        return compile_remotely(argc, argv, f, opts);
+    }
+
+    std::vector<microc::StackUsage> stack_usage;
+    int exit_status = 0;
+
+    if(opts.output == nullptr) {
+        code = compile(f, std::cout, std::cerr, opts, stack_usage, exit_status);
+    }
+    else {
+        std::ofstream out(opts.output);
+
+        if(!out.is_open()) {
+            std::cerr << "error: cannot open " << opts.output << std::endl;
+            return result::output_error;
+        }
+
+        code = compile(f, out, std::cerr, opts, stack_usage, exit_status);
+        out.close();
+
+        if(code != result::success) {
+            std::remove(opts.output);
+        }
+    }
+
+    if(code == result::success && opts.stack_usage && !opts.dump_ast && !opts.dump_ir && !opts.run) {
+        write_stack_usage(stack_usage, microc::SourceMap(std::string(opts.file)), opts);
+    }
+
+    return code == result::success && opts.run ? exit_status : code;
 }
@@ -0,0 +1,497 @@
+#include "module.hpp"
+#include "parser/parser.h"
+#include "sema.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace microc {
+
+module_exception::module_exception(const std::string& path, const std::vector<std::string>& diagnostics) {
+    for(const auto& diagnostic : diagnostics) {
+        diagnostics_.push_back(path + ": " + diagnostic);
+    }
+
+    what_ = "cannot import " + path;
+}
+
+const char* module_exception::what() const noexcept {
+    return what_.c_str();
+}
+
+namespace {
+
+const char magic[8] = {'m', 'i', 'c', 'r', 'o', 'c', 'm', 'i'};
+const std::uint32_t format_version = 1;
+
+enum class TypeTag : std::uint32_t {
+    Void,
+    Integer,
+    Boolean,
+    Char,
+    Null,
+    Pointer,
+    Array,
+    Struct,
+};
+
+enum class EntityTag : std::uint32_t {
+    Assembly,
+    Global,
+    Struct,
+    Function,
+};
+
+// FNV-1a, with the format version so that a new format invalidates old files
+std::uint64_t content_hash(const std::string& content) {
+    std::uint64_t hash = 14695981039346656037ull ^ format_version;
+
+    for(char c : content) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+class Writer : public ast::EntityVisitor, public ast::TypeVisitor {
+    public:
+        void header(std::uint64_t hash, std::uint32_t entities) {
+            data_.append(magic, sizeof(magic));
+            word(format_version);
+            word(entities);
+            word(hash & 0xffffffff);
+            word(hash >> 32);
+        }
+
+        const std::string& data() const { return data_; }
+
+        /*
+         * Entities
+         */
+        virtual void visit(const ast::AssemblyEntity& e) {
+            tag(EntityTag::Assembly);
+            string(e.assembly);
+        }
+
+        virtual void visit(const ast::GlobalEntity& e) {
+            tag(EntityTag::Global);
+            e.type->accept(*this);
+            string(e.name);
+        }
+
+        virtual void visit(const ast::StructEntity& e) {
+            tag(EntityTag::Struct);
+            string(e.name);
+            word(e.packed);
+            word(e.alignment);
+            word(e.fields.size());
+
+            for(const auto& field : e.fields) {
+                field.type->accept(*this);
+                string(field.name);
+                word(field.alignment);
+            }
+        }
+
+        virtual void visit(const ast::FunctionEntity& e) {
+            tag(EntityTag::Function);
+            e.return_type->accept(*this);
+            string(e.name);
+            word(e.exported);
+            word(e.arguments.size());
+
+            for(const auto& argument : e.arguments) {
+                argument.type->accept(*this);
+                string(argument.name);
+            }
+        }
+
+        /*
+         * Types
+         */
+        virtual void visit(const ast::VoidType&) { tag(TypeTag::Void); }
+        virtual void visit(const ast::IntegerType& t) { tag(TypeTag::Integer); word(t.size()); }
+        virtual void visit(const ast::BooleanType& t) { tag(TypeTag::Boolean); word(t.size()); }
+        virtual void visit(const ast::CharType& t) { tag(TypeTag::Char); word(t.size()); }
+        virtual void visit(const ast::NullType& t) { tag(TypeTag::Null); word(t.size()); }
+
+        virtual void visit(const ast::PointerType& t) {
+            tag(TypeTag::Pointer);
+            word(t.size());
+            t.pointed_type()->accept(*this);
+        }
+
+        virtual void visit(const ast::ArrayType& t) {
+            tag(TypeTag::Array);
+            word(t.count());
+            t.element_type()->accept(*this);
+        }
+
+        virtual void visit(const ast::StructType& t) {
+            tag(TypeTag::Struct);
+            string(t.name);
+        }
+
+    private:
+        template<typename Tag>
+        void tag(Tag t) {
+            word(static_cast<std::uint32_t>(t));
+        }
+
+        void word(std::uint32_t w) {
+            data_.append(reinterpret_cast<const char*>(&w), sizeof(w));
+        }
+
+        void string(const std::string& s) {
+            word(s.size());
+            data_ += s;
+            data_.append((4 - s.size() % 4) % 4, '\0');
+        }
+
+    private:
+        std::string data_;
+};
+
+/*
+ * Reads what Writer wrote, from memory which may be mapped from a file.
+ * Every read is checked against the end of the data, and a malformed file
+ * only makes read() return false.
+ */
+class Reader {
+    public:
+        Reader(const char* data, std::size_t size): data_(data), end_(data + size) {}
+
+        bool read(std::uint64_t hash, std::vector<std::unique_ptr<ast::Entity>>& entities) {
+            std::uint32_t count, low, high;
+
+            if(end_ - data_ < static_cast<std::ptrdiff_t>(sizeof(magic))
+               || std::memcmp(data_, magic, sizeof(magic)) != 0) {
+                return false;
+            }
+
+            data_ += sizeof(magic);
+
+            if(!expect(format_version) || !word(count) || !word(low) || !word(high)
+               || (static_cast<std::uint64_t>(high) << 32 | low) != hash) {
+                return false;
+            }
+
+            for(std::uint32_t i = 0; i < count; ++i) {
+                std::unique_ptr<ast::Entity> entity = read_entity();
+
+                if(!entity) {
+                    return false;
+                }
+
+                entity->imported = true;
+                entities.push_back(std::move(entity));
+            }
+
+            return data_ == end_;
+        }
+
+    private:
+        std::unique_ptr<ast::Entity> read_entity() {
+            std::uint32_t tag, flag, count;
+            std::string name;
+
+            if(!word(tag)) {
+                return nullptr;
+            }
+
+            switch(static_cast<EntityTag>(tag)) {
+                case EntityTag::Assembly: {
+                    return string(name) ? std::make_unique<ast::AssemblyEntity>(name) : nullptr;
+                }
+
+                case EntityTag::Global: {
+                    std::unique_ptr<ast::Type> type = read_type();
+
+                    if(!type || !string(name)) {
+                        return nullptr;
+                    }
+
+                    return std::make_unique<ast::GlobalEntity>(std::move(type), name);
+                }
+
+                case EntityTag::Struct: {
+                    if(!string(name)) {
+                        return nullptr;
+                    }
+
+                    auto structure = std::make_unique<ast::StructEntity>(name);
+
+                    if(!word(flag) || !word(structure->alignment) || !word(count)) {
+                        return nullptr;
+                    }
+
+                    structure->packed = flag != 0;
+
+                    for(std::uint32_t i = 0; i < count; ++i) {
+                        std::unique_ptr<ast::Type> type = read_type();
+                        std::uint32_t alignment;
+
+                        if(!type || !string(name) || !word(alignment)) {
+                            return nullptr;
+                        }
+
+                        structure->fields.emplace_back(std::move(type), name, alignment);
+                    }
+
+                    return structure;
+                }
+
+                case EntityTag::Function: {
+                    std::unique_ptr<ast::Type> type = read_type();
+
+                    if(!type || !string(name) || !word(flag) || !word(count)) {
+                        return nullptr;
+                    }
+
+                    auto function = std::make_unique<ast::FunctionEntity>(std::move(type), name);
+                    function->exported = flag != 0;
+
+                    for(std::uint32_t i = 0; i < count; ++i) {
+                        std::unique_ptr<ast::Type> type = read_type();
+
+                        if(!type || !string(name)) {
+                            return nullptr;
+                        }
+
+                        function->arguments.emplace_back(std::move(type), name);
+                    }
+
+                    return function;
+                }
+            }
+
+            return nullptr;
+        }
+
+        std::unique_ptr<ast::Type> read_type(int depth = 0) {
+            std::uint32_t tag, n;
+            std::string name;
+
+            // deep enough for any declaration, and bounds the recursion
+            if(depth > 64 || !word(tag)) {
+                return nullptr;
+            }
+
+            if(static_cast<TypeTag>(tag) == TypeTag::Void) {
+                return std::make_unique<ast::VoidType>();
+            }
+
+            if(static_cast<TypeTag>(tag) == TypeTag::Struct) {
+                return string(name) ? std::make_unique<ast::StructType>(name) : nullptr;
+            }
+
+            if(!word(n)) {
+                return nullptr;
+            }
+
+            switch(static_cast<TypeTag>(tag)) {
+                case TypeTag::Integer: return std::make_unique<ast::IntegerType>(n);
+                case TypeTag::Boolean: return std::make_unique<ast::BooleanType>(n);
+                case TypeTag::Char:    return std::make_unique<ast::CharType>(n);
+                case TypeTag::Null:    return std::make_unique<ast::NullType>(n);
+
+                case TypeTag::Pointer: {
+                    std::unique_ptr<ast::Type> pointed = read_type(depth + 1);
+                    return pointed ? std::make_unique<ast::PointerType>(std::move(pointed), n) : nullptr;
+                }
+
+                case TypeTag::Array: {
+                    std::unique_ptr<ast::Type> element = read_type(depth + 1);
+                    return element ? std::make_unique<ast::ArrayType>(std::move(element), n) : nullptr;
+                }
+
+                default:
+                    return nullptr;
+            }
+        }
+
+        bool word(std::uint32_t& w) {
+            if(end_ - data_ < 4) {
+                return false;
+            }
+
+            std::memcpy(&w, data_, 4);
+            data_ += 4;
+            return true;
+        }
+
+        bool expect(std::uint32_t expected) {
+            std::uint32_t w;
+            return word(w) && w == expected;
+        }
+
+        bool string(std::string& s) {
+            std::uint32_t size;
+
+            if(!word(size)) {
+                return false;
+            }
+
+            // padded to a word, computed wide enough not to wrap
+            std::uint64_t padded = static_cast<std::uint64_t>(size) + (4 - size % 4) % 4;
+
+            if(static_cast<std::uint64_t>(end_ - data_) < padded) {
+                return false;
+            }
+
+            s.assign(data_, size);
+            data_ += padded;
+            return true;
+        }
+
+    private:
+        const char* data_;
+        const char* end_;
+};
+
+/*
+ * Reads the interface file, false if it is missing, stale or malformed.
+ */
+bool read_interface(const std::string& path, std::uint64_t hash, std::vector<std::unique_ptr<ast::Entity>>& entities) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+
+    if(fd < 0) {
+        return false;
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED) {
+        return false;
+    }
+
+    Reader reader(static_cast<const char*>(data), st.st_size);
+    bool valid = reader.read(hash, entities);
+    munmap(data, st.st_size);
+
+    if(!valid) {
+        entities.clear();
+    }
+
+    return valid;
+}
+
+/*
+ * Written next to the final file then renamed over it, so that concurrent
+ * compilations never read half a file. The temporary file is unique to
+ * each writer, process or server thread. Failing to write is not an
+ * error, the module is only parsed again next time.
+ */
+void write_interface(const std::string& path, const std::string& data) {
+    std::string temporary = path + ".XXXXXX";
+    int fd = mkstemp(&temporary[0]);
+
+    if(fd < 0) {
+        return;
+    }
+
+    // readable by all, as a file created with the usual umask
+    bool written = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0;
+
+    for(std::size_t done = 0; written && done < data.size();) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+
+        if(n < 0 && errno != EINTR) {
+            written = false;
+        }
+
+        done += n < 0 ? 0 : n;
+    }
+
+    if(close(fd) != 0 || !written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+    }
+}
+
+} // namespace
+
+/*
+ * The declarations are always taken from the interface, even right after
+ * writing it, so that a module reads the same whether it was just parsed
+ * or not.
+ */
+std::vector<std::unique_ptr<ast::Entity>> import_module(const std::string& path, Interner& names) {
+    std::ifstream file(path, std::ios::binary);
+
+    if(!file.is_open()) {
+        throw module_exception(path, {"no such file or directory"});
+    }
+
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::uint64_t hash = content_hash(content);
+    std::string interface = path + ".mcm";
+    std::vector<std::unique_ptr<ast::Entity>> entities;
+
+    if(read_interface(interface, hash, entities)) {
+        return entities;
+    }
+
+    std::istringstream in(content);
+    Parser parser(in);
+    std::vector<std::string> diagnostics;
+    int success = 1;
+
+    try {
+        success = parser.parse();
+    }
+    catch(const std::exception& e) {
+        throw module_exception(path, {e.what()});
+    }
+
+    for(const auto& diagnostic : parser.diagnostics()) {
+        diagnostics.push_back(diagnostic.message);
+    }
+
+    if(diagnostics.empty() && success != 0) {
+        diagnostics.push_back("syntax error");
+    }
+
+    if(diagnostics.empty()) {
+        for(const auto& error : analyze(parser.prog(), names)) {
+            SourceLocation loc = parser.source().location(error.offset);
+            diagnostics.push_back("error line " + std::to_string(loc.line) + ", column "
+                                  + std::to_string(loc.column) + ", " + error.message);
+        }
+    }
+
+    if(!diagnostics.empty()) {
+        throw module_exception(path, diagnostics);
+    }
+
+    Writer writer;
+    writer.header(hash, parser.prog().entities.size());
+
+    for(const auto& entity : parser.prog().entities) {
+        entity->accept(writer);
+    }
+
+    write_interface(interface, writer.data());
+
+    Reader reader(writer.data().data(), writer.data().size());
+    reader.read(hash, entities);
+    return entities;
+}
+
+} // namespace microc
@@ -0,0 +1,48 @@
+#ifndef MICROC_MODULE_HPP
+#define MICROC_MODULE_HPP
+
+#include "ast.hpp"
+#include "symbols.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace microc {
+
+class module_exception : public std::exception {
+    public:
+        module_exception(const std::string& path, const std::vector<std::string>& diagnostics);
+        virtual const char* what() const noexcept;
+        const std::vector<std::string>& diagnostics() const noexcept { return diagnostics_; }
+
+    private:
+        std::vector<std::string> diagnostics_;  // of the module, each prefixed by its path
+        std::string what_;
+};
+
+/*
+ * Imports the declarations of a shared source file for -fimport, without
+ * parsing it again: its structs and globals, the prototypes of its
+ * functions, and its assembly, for the names it uses. The entities are
+ * marked imported, the code and data of the module being compiled once
+ * from the file itself and linked with the programs importing it. Having
+ * no main, the module compiles its functions for callers it cannot see,
+ * see CodeGenerator.
+ *
+ * The declarations are kept in path.mcm, an interface file written the
+ * first time the module is imported and read in place through mmap next
+ * times. It records a hash of the content of path, and is written again
+ * when the content changes.
+ *
+ * Interface files are made of 32-bit words in host byte order: a header
+ * (magic, format version, number of entities, 64-bit hash) followed by
+ * the entities, strings being a length and bytes padded to a word.
+ */
+std::vector<std::unique_ptr<ast::Entity>> import_module(const std::string& path, Interner& names);
+
+} // namespace microc
+
+#endif // MICROC_MODULE_HPP
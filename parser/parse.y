@@ -6,31 +6,47 @@
 %token OPAR CPAR OCBRA CCBRA COMMA SEMICOLON EXPORT IF ELSE WHILE FOR
       REGISTER STRUCT VOID ASM INT CHAR BOOL TRUE FALSE RETURN BREAK CONTINUE
       NULL_t SIZEOF DOT ARROW COLON OSBRA CSBRA INTEGER CHARACTER STRING IDENT
+      PACKED ALIGNED
 
 %polymorphic
       PROGRAM: ast::Program;
       ENTITY: std::unique_ptr<ast::Entity>;
       PARAMETERS: std::vector<ast::FunctionArgument>;
+      FIELDS: std::vector<ast::StructField>;
+      DIMENSIONS: std::vector<std::uint32_t>;
+      ASM_OPERANDS: std::vector<ast::AsmOperand>;
+      STRINGS: std::vector<std::string>;
       INSTRUCTIONS: std::vector<std::unique_ptr<ast::Instruction>>;
       INSTRUCTION: std::unique_ptr<ast::Instruction>;
       EXPRESSION: std::unique_ptr<ast::Expression>;
       ARGUMENTS: std::vector<std::unique_ptr<ast::Expression>>;
       TYPE: std::unique_ptr<ast::Type>;
+      VARIABLE: std::unique_ptr<ast::IdentExpression>;
+      OFFSET: std::uint32_t;
       INTEGER: int;
+      FLAG: bool;
       CHAR: char;
       STRING: std::string;
 
 %type <PROGRAM> prog
 %type <ENTITY> entity
 %type <PARAMETERS> parameters, parameters_end
-%type <INSTRUCTIONS> instructions, else
-%type <INSTRUCTION> instruction
-%type <EXPRESSION> expression
+%type <FIELDS> fields
+%type <DIMENSIONS> dimensions
+%type <ASM_OPERANDS> asm_operands, asm_operands_end
+%type <STRINGS> clobbers, clobbers_end
+%type <INSTRUCTIONS> block, instructions, else
+%type <INSTRUCTION> instruction, for_init
+%type <EXPRESSION> expression, optional_expression
 %type <ARGUMENTS> arguments, arguments_end
 %type <TYPE> type
-%type <INTEGER> integer
+%type <INTEGER> integer, alignment
+%type <FLAG> packed
 %type <CHAR> character
 %type <STRING> string, ident
+%type <VARIABLE> variable
+%type <OFFSET> at_asm, at_export, at_struct, at_sizeof, at_if, at_while, at_for, at_break, at_continue, at_return, at_ocbra, at_opar,
+      at_plus, at_minus, at_not, at_bit_not, at_mult
 
 %right AFFECT
 %left OR
@@ -44,26 +60,77 @@
 %left PLUS MINUS
 %left MULT DIV MOD
 %right NOT BIT_NOT
+%left DOT ARROW OSBRA
 
 %%
 
 prog
   :             {}
-  | prog entity { d_prog.entities.push_back(std::move($2)); }
+  | prog entity { addEntity(std::move($2)); }
+  | prog error SEMICOLON {}
+  | prog error CCBRA     {}
 ;
 
 entity
-  : ASM OPAR string CPAR SEMICOLON
-      { $$ = std::make_unique<ast::AssemblyEntity>($3); }
-  | type ident SEMICOLON
-      { $$ = std::make_unique<ast::GlobalEntity>(std::move($1), $2); }
-  | type ident OPAR parameters CPAR OCBRA instructions CCBRA
+  : at_asm OPAR string CPAR SEMICOLON
+      { $$ = located(std::make_unique<ast::AssemblyEntity>($3), $1); }
+  | type ident dimensions SEMICOLON
+      { $$ = std::make_unique<ast::GlobalEntity>(arrayOf(std::move($1), $3), $2); }
+  | type ident OPAR parameters CPAR block
       {
         auto f = std::make_unique<ast::FunctionEntity>(std::move($1), $2);
         f->arguments = std::move($4);
+        f->instructions = std::move($6);
+        $$ = std::move(f);
+      }
+  | at_export type ident OPAR parameters CPAR block
+      {
+        auto f = located(std::make_unique<ast::FunctionEntity>(std::move($2), $3), $1);
+        f->exported = true;
+        f->arguments = std::move($5);
         f->instructions = std::move($7);
         $$ = std::move(f);
       }
+  | at_struct ident packed alignment OCBRA fields CCBRA SEMICOLON
+      {
+        auto s = located(std::make_unique<ast::StructEntity>($2), $1);
+        s->packed = $3;
+        s->alignment = $4;
+        s->fields = std::move($6);
+        $$ = std::move(s);
+      }
+;
+
+dimensions
+  :   { $$ = std::vector<std::uint32_t>(); }
+  | dimensions OSBRA integer CSBRA
+      {
+        $$ = std::move($1);
+        $<DIMENSIONS>$.push_back($3);
+      }
+;
+
+packed
+  :   { $$ = false; }
+  | PACKED
+      { $$ = true; }
+;
+
+alignment
+  :   { $$ = 0; }
+  | ALIGNED OPAR integer CPAR
+      { $$ = $3; }
+;
+
+fields
+  :   { $$ = std::vector<ast::StructField>(); }
+  | fields type ident dimensions alignment SEMICOLON
+      {
+        $$ = std::move($1);
+        $<FIELDS>$.emplace_back(arrayOf(std::move($2), $4), $3, $5);
+      }
+  | fields error SEMICOLON
+      { $$ = std::move($1); }
 ;
 
 parameters
@@ -84,55 +151,132 @@ parameters_end
       }
 ;
 
+block
+  : OCBRA instructions CCBRA
+      { $$ = std::move($2); }
+  | OCBRA instructions error CCBRA
+      { $$ = std::move($2); }
+;
+
 instructions
   :   { $$ = std::vector<std::unique_ptr<ast::Instruction>>(); }
-  | instruction instructions
+  | instructions instruction
       {
-        $<INSTRUCTIONS>$ = std::move($2);
-        $<INSTRUCTIONS>$.emplace($<INSTRUCTIONS>$.begin(), std::move($1));
+        $$ = std::move($1);
+        $<INSTRUCTIONS>$.push_back(std::move($2));
       }
+  | instructions error SEMICOLON
+      { $$ = std::move($1); }
 ;
 
 instruction
-  : OCBRA instructions CCBRA
-      { $$ = std::make_unique<ast::BlockInstruction>(std::move($2)); }
-  | type ident SEMICOLON
-      { $$ = std::make_unique<ast::DeclarationInstruction>(std::move($1), $2, nullptr); }
+  : at_ocbra instructions CCBRA
+      { $$ = located(std::make_unique<ast::BlockInstruction>(std::move($2)), $1); }
+  | at_ocbra instructions error CCBRA
+      { $$ = located(std::make_unique<ast::BlockInstruction>(std::move($2)), $1); }
+  | type ident dimensions SEMICOLON
+      { $$ = std::make_unique<ast::DeclarationInstruction>(arrayOf(std::move($1), $3), $2, nullptr); }
   | type ident AFFECT expression SEMICOLON
       { $$ = std::make_unique<ast::DeclarationInstruction>(std::move($1), $2, std::move($4)); }
   | expression SEMICOLON
       { $$ = std::make_unique<ast::ExpressionInstruction>(std::move($1)); }
-  | IF OPAR expression CPAR OCBRA instructions CCBRA else
+  | at_if OPAR expression CPAR block else
       {
-        auto e = std::make_unique<ast::IfInstruction>(std::move($3));
-        e->true_instrs = std::move($6);
-        e->false_instrs = std::move($8);
+        auto e = located(std::make_unique<ast::IfInstruction>(std::move($3)), $1);
+        e->true_instrs = std::move($5);
+        e->false_instrs = std::move($6);
         $$ = std::move(e);
       }
-  | WHILE OPAR expression CPAR OCBRA instructions CCBRA
+  | at_while OPAR expression CPAR block
       {
-        auto e = std::make_unique<ast::WhileInstruction>(std::move($3));
-        e->instructions = std::move($6);
+        auto e = located(std::make_unique<ast::WhileInstruction>(std::move($3)), $1);
+        e->instructions = std::move($5);
         $$ = std::move(e);
       }
-  | RETURN expression SEMICOLON
-      { $$ = std::make_unique<ast::ReturnInstruction>(std::move($2)); }
-  | ASM OPAR string CPAR SEMICOLON
-      { $$ = std::make_unique<ast::AssemblyInstruction>($3); }
+  | at_for OPAR for_init SEMICOLON optional_expression SEMICOLON optional_expression CPAR block
+      {
+        auto e = located(std::make_unique<ast::ForInstruction>(std::move($3), std::move($5), std::move($7)), $1);
+        e->instructions = std::move($9);
+        $$ = std::move(e);
+      }
+  | at_break SEMICOLON
+      { $$ = located(std::make_unique<ast::BreakInstruction>(), $1); }
+  | at_continue SEMICOLON
+      { $$ = located(std::make_unique<ast::ContinueInstruction>(), $1); }
+  | at_return expression SEMICOLON
+      { $$ = located(std::make_unique<ast::ReturnInstruction>(std::move($2)), $1); }
+  | at_asm OPAR string CPAR SEMICOLON
+      { $$ = located(std::make_unique<ast::AssemblyInstruction>($3), $1); }
+  | at_asm OPAR string COLON asm_operands CPAR SEMICOLON
+      { $$ = located(extendedAsm($3, std::move($5), {}, {}), $1); }
+  | at_asm OPAR string COLON asm_operands COLON asm_operands CPAR SEMICOLON
+      { $$ = located(extendedAsm($3, std::move($5), std::move($7), {}), $1); }
+  | at_asm OPAR string COLON asm_operands COLON asm_operands COLON clobbers CPAR SEMICOLON
+      { $$ = located(extendedAsm($3, std::move($5), std::move($7), std::move($9)), $1); }
+;
+
+asm_operands
+  :   { $$ = std::vector<ast::AsmOperand>(); }
+  | string OPAR expression CPAR asm_operands_end
+      {
+        $<ASM_OPERANDS>$ = std::move($5);
+        $<ASM_OPERANDS>$.emplace($<ASM_OPERANDS>$.begin(), $1, std::move($3));
+      }
+;
+
+asm_operands_end
+  :   { $$ = std::vector<ast::AsmOperand>(); }
+  | COMMA string OPAR expression CPAR asm_operands_end
+      {
+        $$ = std::move($6);
+        $<ASM_OPERANDS>$.emplace($<ASM_OPERANDS>$.begin(), $2, std::move($4));
+      }
+;
+
+clobbers
+  :   { $$ = std::vector<std::string>(); }
+  | string clobbers_end
+      {
+        $<STRINGS>$ = std::move($2);
+        $<STRINGS>$.insert($<STRINGS>$.begin(), $1);
+      }
+;
+
+clobbers_end
+  :   { $$ = std::vector<std::string>(); }
+  | COMMA string clobbers_end
+      {
+        $$ = std::move($3);
+        $<STRINGS>$.insert($<STRINGS>$.begin(), $2);
+      }
+;
+
+for_init
+  :   { $$ = nullptr; }
+  | type ident AFFECT expression
+      { $$ = std::make_unique<ast::DeclarationInstruction>(std::move($1), $2, std::move($4)); }
+  | expression
+      { $$ = std::make_unique<ast::ExpressionInstruction>(std::move($1)); }
+;
+
+optional_expression
+  :   { $$ = nullptr; }
+  | expression
+      { $$ = std::move($1); }
 ;
 
 else
   :   { $$ = std::vector<std::unique_ptr<ast::Instruction>>(); }
-  | ELSE IF OPAR expression CPAR OCBRA instructions CCBRA else
+  | ELSE at_if OPAR expression CPAR block else
       {
-        auto e = std::make_unique<ast::IfInstruction>(std::move($4));
-        e->true_instrs = std::move($7);
-        e->false_instrs = std::move($9);
+        auto e = located(std::make_unique<ast::IfInstruction>(std::move($4)), $2);
+        e->true_instrs = std::move($6);
+        e->false_instrs = std::move($7);
         $$ = std::vector<std::unique_ptr<ast::Instruction>>();
         $<INSTRUCTIONS>$.push_back(std::move(e));
       }
-  | ELSE OCBRA instructions CCBRA
-      { $$ = std::move($3); }
+  | ELSE block
+      { $$ = std::move($2); }
 ;
 
 expression
@@ -155,8 +299,6 @@ expression
   | expression INF expression
       { $$ = std::make_unique<ast::BinaryExpression>(ast::BinaryOperator::Inf, std::move($1), std::move($3)); }
   | expression INFEQ expression
-      { $$ = std::make_unique<ast::BinaryExpression>(ast::BinaryOperator::Inf, std::move($1), std::move($3)); }
-  | expression INF expression
       { $$ = std::make_unique<ast::BinaryExpression>(ast::BinaryOperator::InfEq, std::move($1), std::move($3)); }
   | expression SUP expression
       { $$ = std::make_unique<ast::BinaryExpression>(ast::BinaryOperator::Sup, std::move($1), std::move($3)); }
@@ -176,33 +318,43 @@ expression
       { $$ = std::make_unique<ast::BinaryExpression>(ast::BinaryOperator::Div, std::move($1), std::move($3)); }
   | expression MOD expression
       { $$ = std::make_unique<ast::BinaryExpression>(ast::BinaryOperator::Mod, std::move($1), std::move($3)); }
-  | PLUS expression %prec NOT
-      { $$ = std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::Plus, std::move($2)); }
-  | MINUS expression %prec NOT
-      { $$ = std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::Minus, std::move($2)); }
-  | NOT expression
-      { $$ = std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::Not, std::move($2)); }
-  | BIT_NOT expression
-      { $$ = std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::BitNot, std::move($2)); }
-  | MULT expression %prec NOT
-      { $$ = std::make_unique<ast::AccessExpression>(std::move($2)); }
-  | OPAR type CPAR expression %prec NOT
-      { $$ = std::make_unique<ast::CastExpression>(std::move($2), std::move($4)); }
-  | OPAR expression CPAR
+  | at_plus expression %prec NOT
+      { $$ = located(std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::Plus, std::move($2)), $1); }
+  | at_minus expression %prec NOT
+      { $$ = located(std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::Minus, std::move($2)), $1); }
+  | at_not expression %prec NOT
+      { $$ = located(std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::Not, std::move($2)), $1); }
+  | at_bit_not expression %prec BIT_NOT
+      { $$ = located(std::make_unique<ast::UnaryExpression>(ast::UnaryOperator::BitNot, std::move($2)), $1); }
+  | at_mult expression %prec NOT
+      { $$ = located(std::make_unique<ast::AccessExpression>(std::move($2)), $1); }
+  | at_opar type CPAR expression %prec NOT
+      { $$ = located(std::make_unique<ast::CastExpression>(std::move($2), std::move($4)), $1); }
+  | at_opar expression CPAR
       { $$ = std::move($2); }
-  | ident OPAR arguments CPAR %prec NOT
+  | expression DOT ident
+      { $$ = std::make_unique<ast::MemberExpression>(std::move($1), $3, false); }
+  | expression ARROW ident
+      { $$ = std::make_unique<ast::MemberExpression>(std::move($1), $3, true); }
+  | expression OSBRA expression CSBRA
+      { $$ = std::make_unique<ast::IndexExpression>(std::move($1), std::move($3)); }
+  | at_sizeof OPAR type CPAR
+      { $$ = located(std::make_unique<ast::SizeofExpression>(std::move($3)), $1); }
+  | at_sizeof OPAR expression CPAR
+      { $$ = located(std::make_unique<ast::SizeofExpression>(std::move($3)), $1); }
+  | variable OPAR arguments CPAR %prec NOT
       {
-        auto e = std::make_unique<ast::CallExpression>($1);
+        auto e = located(std::make_unique<ast::CallExpression>($1->name), $1->offset);
         e->arguments = std::move($3);
         $$ = std::move(e);
       }
-  | ident     { $$ = std::make_unique<ast::IdentExpression>($1); }
-  | integer   { $$ = std::make_unique<ast::IntegerExpression>($1); }
-  | character { $$ = std::make_unique<ast::CharExpression>($1); }
-  | string    { $$ = std::make_unique<ast::StringExpression>($1); }
-  | NULL_t    { $$ = std::make_unique<ast::NullExpression>(); }
-  | TRUE      { $$ = std::make_unique<ast::TrueExpression>(); }
-  | FALSE     { $$ = std::make_unique<ast::FalseExpression>(); }
+  | variable  { $$ = std::move($1); }
+  | integer   { $$ = located(std::make_unique<ast::IntegerExpression>($1), offset()); }
+  | character { $$ = located(std::make_unique<ast::CharExpression>($1), offset()); }
+  | string    { $$ = located(std::make_unique<ast::StringExpression>($1), offset()); }
+  | NULL_t    { $$ = located(std::make_unique<ast::NullExpression>(), offset()); }
+  | TRUE      { $$ = located(std::make_unique<ast::TrueExpression>(), offset()); }
+  | FALSE     { $$ = located(std::make_unique<ast::FalseExpression>(), offset()); }
 ;
 
 arguments
@@ -224,25 +376,53 @@ arguments_end
 ;
 
 type
-  : VOID      { $$ = std::make_unique<ast::VoidType>(); }
-  | INT       { $$ = std::make_unique<ast::IntegerType>(1); }
-  | BOOL      { $$ = std::make_unique<ast::BooleanType>(1); }
-  | CHAR      { $$ = std::make_unique<ast::CharType>(1); }
-  | type MULT { $$ = std::make_unique<ast::PointerType>(std::move($1), 1); }
+  : VOID      { $$ = located(std::make_unique<ast::VoidType>(), offset()); }
+  | INT       { $$ = located(std::make_unique<ast::IntegerType>(4), offset()); }
+  | BOOL      { $$ = located(std::make_unique<ast::BooleanType>(1), offset()); }
+  | CHAR      { $$ = located(std::make_unique<ast::CharType>(1), offset()); }
+  | at_struct ident
+      { $$ = located(std::make_unique<ast::StructType>($2), $1); }
+  | type MULT { $$ = std::make_unique<ast::PointerType>(std::move($1), 4); }
 ;
 
 integer
-  : INTEGER { $$ = sanitizeIntegerToken(d_scanner.matched()); }
+  : INTEGER { $$ = sanitizeIntegerToken(matched()); }
 ;
 
 character
-  : CHARACTER { $$ = sanitizeCharacterToken(d_scanner.matched()); }
+  : CHARACTER { $$ = sanitizeCharacterToken(matched()); }
 ;
 
 string
-  : STRING { $$ = sanitizeStringToken(d_scanner.matched()); }
+  : STRING { $$ = sanitizeStringToken(matched()); }
 ;
 
 ident
-  : IDENT { $$ = d_scanner.matched(); }
+  : IDENT { $$ = matched(); }
 ;
+
+variable
+  : IDENT { $$ = located(std::make_unique<ast::IdentExpression>(matched()), offset()); }
+;
+
+/*
+ * Offsets of the tokens starting a node. These rules are reduced as soon as
+ * the token is shifted, before the scanner moves on.
+ */
+at_asm      : ASM      { $$ = offset(); };
+at_export   : EXPORT   { $$ = offset(); };
+at_struct   : STRUCT   { $$ = offset(); };
+at_sizeof   : SIZEOF   { $$ = offset(); };
+at_if       : IF       { $$ = offset(); };
+at_while    : WHILE    { $$ = offset(); };
+at_for      : FOR      { $$ = offset(); };
+at_break    : BREAK    { $$ = offset(); };
+at_continue : CONTINUE { $$ = offset(); };
+at_return   : RETURN   { $$ = offset(); };
+at_ocbra    : OCBRA    { $$ = offset(); };
+at_opar     : OPAR     { $$ = offset(); };
+at_plus     : PLUS     { $$ = offset(); };
+at_minus    : MINUS    { $$ = offset(); };
+at_not      : NOT      { $$ = offset(); };
+at_bit_not  : BIT_NOT  { $$ = offset(); };
+at_mult     : MULT     { $$ = offset(); };
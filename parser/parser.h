@@ -5,35 +5,98 @@
 
 #include "../ast.hpp"
 #include "parserbase.h"
+#include "../ring.hpp"
 #include "../scanner/scanner.h"
 
 #include <exception>
+#include <functional>
+#include <vector>
 
 namespace microc {
 
 class parser_exception : public std::exception {
     public:
-        parser_exception(int line, const std::string& matched);
+        // reason is why matched, the text of the token, is rejected
+        parser_exception(int line, int column, const std::string& matched,
+                         const std::string& reason = "unexpected token");
         virtual const char* what() const noexcept;
         int line() const noexcept { return line_; }
+        int column() const noexcept { return column_; }
         const std::string& matched() const noexcept { return matched_; }
 
     private:
         int line_;
+        int column_;
         std::string matched_;
         std::string what_;
 };
 
+/*
+ * An error reported while parsing, kept so that parsing can go on and every
+ * error of the input can be reported at once.
+ */
+class Diagnostic {
+    public:
+        Diagnostic(int line, int column, const std::string& message):
+            line(line),
+            column(column),
+            message(message)
+        {}
+
+    public:
+        int line;
+        int column;
+        std::string message;
+};
+
+typedef std::function<void(std::unique_ptr<ast::Entity>&&)> EntityHandler;
+
+/*
+ * A token scanned ahead of the parser, see Parser::scan().
+ */
+class Token {
+    public:
+        int type = 0;               // 0 at the end of the input
+        bool invalid = false;       // text is a character the scanner rejected
+        std::uint32_t offset = 0;
+        std::string text;
+};
+
 #undef Parser
 class Parser: public ParserBase {
     Scanner d_scanner;
     ast::Program d_prog;
+    EntityHandler d_entityHandler;
+    SpscRing<Token>* d_tokens = nullptr;
+    Token d_token;
+    std::vector<Diagnostic> d_diagnostics;
+    std::size_t d_maxErrors = 20;
 
     public:
         explicit Parser(std::istream &in = std::cin): d_scanner(in) {}
         ast::Program& prog() { return d_prog; }
+        const SourceMap& source() const { return d_scanner.source(); }
         int parse();
 
+        // errors found by the last call to parse(), in input order
+        const std::vector<Diagnostic>& diagnostics() const { return d_diagnostics; }
+
+        // gives every entity to handler as soon as it is parsed, instead
+        // of adding it to prog()
+        void setEntityHandler(EntityHandler handler) { d_entityHandler = std::move(handler); }
+
+        // scans the whole input into tokens, for parse() to read them on
+        // another thread after setTokens(); stops early if tokens is
+        // closed, returns the number of tokens scanned
+        std::size_t scan(SpscRing<Token>& tokens);
+        void setTokens(SpscRing<Token>* tokens) { d_tokens = tokens; }
+
+        // stops parsing after n errors, 0 means no limit
+        void setMaxErrors(std::size_t n) { d_maxErrors = n; }
+        bool tooManyErrors() const {
+            return d_maxErrors != 0 && d_diagnostics.size() >= d_maxErrors;
+        }
+
     private:
         void error(char const *msg);    // called on (syntax) errors
         int lex();                      // returns the next token from the
@@ -48,6 +111,27 @@ class Parser: public ParserBase {
         void print__();
         void exceptionHandler__(std::exception const &exc);
 
+        template<typename Exception>
+        void report(const Exception&);
+
+        void addEntity(std::unique_ptr<ast::Entity>&& entity);
+
+        // text and offset of the last token read
+        const std::string& matched() const { return d_tokens ? d_token.text : d_scanner.matched(); }
+        std::uint32_t offset() const { return d_tokens ? d_token.offset : d_scanner.offset(); }
+
+        template<typename Node>
+        static std::unique_ptr<Node> located(std::unique_ptr<Node>&& node, std::uint32_t offset);
+
+        // int a[2][3] declares an array of 2 arrays of 3 ints
+        static std::unique_ptr<ast::Type> arrayOf(std::unique_ptr<ast::Type>&& type,
+                                                  const std::vector<std::uint32_t>& dimensions);
+
+        static std::unique_ptr<ast::AssemblyInstruction> extendedAsm(const std::string& assembly,
+                                                                     std::vector<ast::AsmOperand>&& outputs,
+                                                                     std::vector<ast::AsmOperand>&& inputs,
+                                                                     std::vector<std::string>&& clobbers);
+
         int sanitizeIntegerToken(const std::string&);
         char sanitizeCharacterToken(const std::string&);
         std::string sanitizeStringToken(const std::string&);
@@ -1,20 +1,23 @@
 #include "parser.h"
 
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
 #include <sstream>
 
 namespace microc {
 
-parser_exception::parser_exception(int line, const std::string& matched):
-    line_(line), matched_(matched)
+parser_exception::parser_exception(int line, int column, const std::string& matched, const std::string& reason):
+    line_(line), column_(column), matched_(matched)
 {
     std::stringstream ss;
-    ss << "error line " << line;
+    ss << "error line " << line << ", column " << column;
 
     if(matched.empty()) {
         ss << ", unexpected end of file";
     }
     else {
-        ss << ", unexpected token \"" << matched << "\"";
+        ss << ", " << reason << " \"" << matched << "\"";
     }
 
     what_ = ss.str();
@@ -24,12 +27,91 @@ const char* parser_exception::what() const noexcept {
     return what_.c_str();
 }
 
+template<typename Exception>
+void Parser::report(const Exception& e) {
+    d_diagnostics.emplace_back(e.line(), e.column(), e.what());
+
+    if(tooManyErrors()) {
+        ABORT();
+    }
+}
+
+inline void Parser::addEntity(std::unique_ptr<ast::Entity>&& entity) {
+    if(d_entityHandler) {
+        d_entityHandler(std::move(entity));
+    }
+    else {
+        d_prog.entities.push_back(std::move(entity));
+    }
+}
+
+template<typename Node>
+std::unique_ptr<Node> Parser::located(std::unique_ptr<Node>&& node, std::uint32_t offset) {
+    node->offset = offset;
+    return std::move(node);
+}
+
 inline void Parser::error(const char*) {
-    throw parser_exception(d_scanner.lineNr(), d_scanner.matched());
+    SourceLocation loc = source().location(offset());
+    report(parser_exception(loc.line, loc.column, matched()));
 }
 
 inline int Parser::lex() {
-    return d_scanner.lex();
+    while(d_tokens != nullptr) {
+        if(!d_tokens->pop(d_token)) {
+            d_token = Token();
+            return 0;
+        }
+
+        if(!d_token.invalid) {
+            return d_token.type;
+        }
+
+        SourceLocation loc = source().location(d_token.offset);
+        report(scanner_exception(loc.line, loc.column, d_token.text));
+    }
+
+    while(true) {
+        try {
+            return d_scanner.lex();
+        }
+        catch(const scanner_exception& e) {
+            // the offending character is dropped, keep scanning
+            report(e);
+        }
+    }
+}
+
+/*
+ * The locations of tokens are computed on the parsing thread, which needs
+ * the source map to be built before scanning starts.
+ */
+std::size_t Parser::scan(SpscRing<Token>& tokens) {
+    std::size_t count = 0;
+
+    while(true) {
+        Token token;
+
+        try {
+            token.type = d_scanner.lex();
+        }
+        catch(const scanner_exception&) {
+            token.invalid = true;
+        }
+
+        token.offset = d_scanner.offset();
+        token.text = d_scanner.matched();
+        bool end = token.type == 0 && !token.invalid;
+
+        if(!tokens.push(std::move(token)) || end) {
+            break;
+        }
+
+        ++count;
+    }
+
+    tokens.close();
+    return count;
 }
 
 inline void Parser::print() {
@@ -40,16 +122,50 @@ inline void Parser::exceptionHandler__(const std::exception&) {
     throw;              // re-implement to handle exceptions thrown by actions
 }
 
-int Parser::sanitizeIntegerToken(const std::string& str) {
-    if(str.length() >= 3 && str[0] == '0' && str[1] == 'x') {
-        return std::strtol(str.substr(2).c_str(), NULL, 16);
+std::unique_ptr<ast::AssemblyInstruction> Parser::extendedAsm(const std::string& assembly,
+                                                             std::vector<ast::AsmOperand>&& outputs,
+                                                             std::vector<ast::AsmOperand>&& inputs,
+                                                             std::vector<std::string>&& clobbers) {
+    auto result = std::make_unique<ast::AssemblyInstruction>(assembly);
+    result->extended = true;
+    result->outputs = std::move(outputs);
+    result->inputs = std::move(inputs);
+    result->clobbers = std::move(clobbers);
+    return result;
+}
+
+std::unique_ptr<ast::Type> Parser::arrayOf(std::unique_ptr<ast::Type>&& type,
+                                           const std::vector<std::uint32_t>& dimensions) {
+    for(auto it = dimensions.rbegin(); it != dimensions.rend(); ++it) {
+        type = std::make_unique<ast::ArrayType>(std::move(type), *it);
     }
-    else if(str.length() >= 3 && str[0] == '0' && str[1] == 'b') {
-        return std::strtol(str.substr(2).c_str(), NULL, 2);
+
+    return std::move(type);
+}
+
+/*
+ * Constants up to 0xffffffff are taken modulo 2^32, so that they can be
+ * written in any base; larger ones are reported, and taken as 0.
+ */
+int Parser::sanitizeIntegerToken(const std::string& str) {
+    int base = 10;
+    std::size_t start = 0;
+
+    if(str.length() >= 3 && str[0] == '0' && (str[1] == 'x' || str[1] == 'b')) {
+        base = str[1] == 'x' ? 16 : 2;
+        start = 2;
     }
-    else {
-        return std::atoi(str.c_str());
+
+    errno = 0;
+    long long value = std::strtoll(str.c_str() + start, NULL, base);
+
+    if(errno == ERANGE || value > UINT32_MAX) {
+        SourceLocation loc = source().location(offset());
+        report(parser_exception(loc.line, loc.column, str, "integer constant too large"));
+        return 0;
     }
+
+    return static_cast<int>(static_cast<std::uint32_t>(value));
 }
 
 char Parser::sanitizeCharacterToken(const std::string& str) {
@@ -0,0 +1,331 @@
+#include "placement.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+namespace microc {
+
+namespace {
+
+const double loop_factor = 8;           // iterations per loop entry
+const double stay_probability = 7.0 / 8;
+const double cold_probability = 1.0 / 16;
+
+class Edge {
+    public:
+        std::uint32_t from;
+        std::uint32_t to;
+        double weight;
+};
+
+/*
+ * Natural loops, from the back edges of a depth-first search.
+ */
+class Loops {
+    public:
+        explicit Loops(const ir::Function& function):
+            function_(function),
+            predecessors_(function.blocks.size())
+        {
+            for(const auto& block : function.blocks) {
+                if(block.terminated()) {
+                    for(std::uint32_t succ : block.successors()) {
+                        predecessors_[succ].push_back(block.id);
+                    }
+                }
+            }
+
+            search();
+        }
+
+        const std::vector<std::uint32_t>& predecessors(std::uint32_t b) const { return predecessors_[b]; }
+
+        std::uint32_t depth(std::uint32_t b) const {
+            return std::count_if(bodies.begin(), bodies.end(), [b](const std::vector<bool>& body) { return body[b]; });
+        }
+
+        // whether the edge leaves a loop around from
+        bool exits(std::uint32_t from, std::uint32_t to) const {
+            return std::any_of(bodies.begin(), bodies.end(), [&](const std::vector<bool>& body) {
+                return body[from] && !body[to];
+            });
+        }
+
+    public:
+        std::vector<std::vector<bool>> bodies;
+
+    private:
+        // iterative, functions may have long chains of blocks
+        void search() {
+            std::vector<std::uint8_t> state(function_.blocks.size());     // unvisited, on the stack, done
+            std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 0}};   // block, next successor
+            state[0] = 1;
+
+            while(!stack.empty()) {
+                std::uint32_t b = stack.back().first;
+                const ir::Block& block = function_.blocks[b];
+                std::vector<std::uint32_t> succs = block.terminated() ? block.successors() : std::vector<std::uint32_t>();
+
+                if(stack.back().second == succs.size()) {
+                    state[b] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+
+                std::uint32_t succ = succs[stack.back().second++];
+
+                if(state[succ] == 0) {
+                    state[succ] = 1;
+                    stack.emplace_back(succ, 0);
+                }
+                else if(state[succ] == 1) {
+                    add_loop(succ, b);
+                }
+            }
+        }
+
+        // the blocks reaching the latch without going through the header
+        void add_loop(std::uint32_t header, std::uint32_t latch) {
+            std::vector<bool> body(function_.blocks.size());
+            std::vector<std::uint32_t> work = {latch};
+            body[header] = true;
+
+            while(!work.empty()) {
+                std::uint32_t b = work.back();
+                work.pop_back();
+
+                if(body[b]) {
+                    continue;
+                }
+
+                body[b] = true;
+                work.insert(work.end(), predecessors_[b].begin(), predecessors_[b].end());
+            }
+
+            bodies.push_back(std::move(body));
+        }
+
+    private:
+        const ir::Function& function_;
+        std::vector<std::vector<std::uint32_t>> predecessors_;
+};
+
+bool is_error_call(const ir::Instr& instr) {
+    return instr.op == ir::Opcode::Call && (instr.symbol == "exit" || instr.symbol == "abort");
+}
+
+/*
+ * Cold blocks without a profile: the ones lowering marked, the error paths,
+ * then backwards the blocks which only lead to cold ones, and forwards the
+ * ones only reached from cold ones.
+ */
+std::vector<bool> predict_cold(const ir::Function& function, const Loops& loops) {
+    std::vector<bool> cold(function.blocks.size());
+
+    for(const auto& block : function.blocks) {
+        cold[block.id] = block.cold || std::any_of(block.instrs.begin(), block.instrs.end(), is_error_call);
+    }
+
+    for(bool changed = true; changed;) {
+        changed = false;
+
+        for(const auto& block : function.blocks) {
+            if(cold[block.id] || block.id == 0) {
+                continue;
+            }
+
+            std::vector<std::uint32_t> succs = block.terminated() ? block.successors() : std::vector<std::uint32_t>();
+            const std::vector<std::uint32_t>& preds = loops.predecessors(block.id);
+
+            auto is_cold = [&](std::uint32_t b) { return cold[b]; };
+            bool leads_to_cold = !succs.empty() && std::all_of(succs.begin(), succs.end(), is_cold);
+            bool reached_from_cold = !preds.empty() && std::all_of(preds.begin(), preds.end(), is_cold);
+
+            if(leads_to_cold || reached_from_cold) {
+                cold[block.id] = true;
+                changed = true;
+            }
+        }
+    }
+
+    cold[0] = false;
+    return cold;
+}
+
+std::vector<double> estimate_frequencies(const ir::Function& function, const Loops& loops, const std::vector<bool>& cold) {
+    std::vector<double> frequency(function.blocks.size());
+
+    for(std::uint32_t b = 0; b < frequency.size(); ++b) {
+        frequency[b] = std::pow(loop_factor, std::min<std::uint32_t>(loops.depth(b), 4));
+
+        if(cold[b]) {
+            frequency[b] *= cold_probability;
+        }
+    }
+
+    return frequency;
+}
+
+std::vector<Edge> profiled_edges(const ir::Function& function) {
+    std::vector<Edge> edges;
+
+    for(const auto& block : function.blocks) {
+        if(!block.terminated()) {
+            continue;
+        }
+
+        const ir::Instr& term = block.terminator();
+        double count = function.counts[block.id];
+
+        if(term.op == ir::Opcode::Jump) {
+            edges.push_back(Edge{block.id, term.targets[0], count});
+        }
+        else if(term.op == ir::Opcode::Branch) {
+            double taken = std::min<double>(function.taken[block.id], count);
+            edges.push_back(Edge{block.id, term.targets[0], taken});
+            edges.push_back(Edge{block.id, term.targets[1], count - taken});
+        }
+    }
+
+    return edges;
+}
+
+std::vector<Edge> estimated_edges(const ir::Function& function, const Loops& loops, const std::vector<bool>& cold,
+                                  const std::vector<double>& frequencies) {
+    std::vector<Edge> edges;
+
+    for(const auto& block : function.blocks) {
+        if(!block.terminated()) {
+            continue;
+        }
+
+        const ir::Instr& term = block.terminator();
+        double frequency = frequencies[block.id];
+
+        if(term.op == ir::Opcode::Jump) {
+            edges.push_back(Edge{block.id, term.targets[0], frequency});
+        }
+        else if(term.op == ir::Opcode::Branch) {
+            std::uint32_t t = term.targets[0], f = term.targets[1];
+            double p = 0.5;
+
+            if(cold[t] != cold[f]) {
+                p = cold[t] ? cold_probability : 1 - cold_probability;
+            }
+            else if(loops.exits(block.id, t) != loops.exits(block.id, f)) {
+                p = loops.exits(block.id, t) ? 1 - stay_probability : stay_probability;
+            }
+
+            edges.push_back(Edge{block.id, t, frequency * p});
+            edges.push_back(Edge{block.id, f, frequency * (1 - p)});
+        }
+    }
+
+    return edges;
+}
+
+} // namespace
+
+void place_blocks(ir::Function& function) {
+    std::size_t n = function.blocks.size();
+    Loops loops(function);
+    bool profiled = !function.counts.empty() && function.counts[0] > 0;
+    std::vector<bool> cold(n);
+    std::vector<double> heat(n);    // of each block, then of each chain by its first block
+
+    if(profiled) {
+        for(std::uint32_t b = 0; b < n; ++b) {
+            cold[b] = b != 0 && function.counts[b] == 0;
+            heat[b] = function.counts[b];
+        }
+    }
+    else {
+        cold = predict_cold(function, loops);
+        heat = estimate_frequencies(function, loops, cold);
+    }
+
+    std::vector<Edge> edges = profiled ? profiled_edges(function) : estimated_edges(function, loops, cold, heat);
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.weight > b.weight; });
+
+    // chains as linked lists of blocks, each block knowing its chain by
+    // its first block
+    std::vector<std::uint32_t> next(n, n), first(n);
+    std::vector<std::uint32_t> last(n);
+    std::iota(first.begin(), first.end(), 0);
+    std::iota(last.begin(), last.end(), 0);
+
+    for(const auto& edge : edges) {
+        std::uint32_t head = first[edge.from], tail = first[edge.to];
+
+        // hot and cold code do not share a chain
+        if(edge.from == edge.to || edge.to == 0 || last[head] != edge.from || tail != edge.to
+           || head == tail || cold[edge.from] != cold[edge.to]) {
+            continue;
+        }
+
+        next[edge.from] = edge.to;
+        last[head] = last[tail];
+        heat[head] = std::max(heat[head], heat[tail]);
+
+        for(std::uint32_t b = tail; b != n; b = next[b]) {
+            first[b] = head;
+        }
+    }
+
+    std::vector<std::uint32_t> chains;
+
+    for(std::uint32_t b = 1; b < n; ++b) {
+        if(first[b] == b) {
+            chains.push_back(b);
+        }
+    }
+
+    std::stable_sort(chains.begin(), chains.end(), [&](std::uint32_t a, std::uint32_t b) {
+        if(cold[a] != cold[b]) {
+            return !cold[a];
+        }
+
+        return heat[a] > heat[b];
+    });
+
+    chains.insert(chains.begin(), 0);
+    std::vector<std::uint32_t> order;
+
+    for(std::uint32_t chain : chains) {
+        for(std::uint32_t b = chain; b != n; b = next[b]) {
+            order.push_back(b);
+        }
+    }
+
+    for(std::uint32_t b = 0; b < n; ++b) {
+        function.blocks[b].cold = cold[b];
+        function.blocks[b].align = false;
+    }
+
+    // the first block of each loop in the new order
+    std::vector<std::uint32_t> position(n);
+
+    for(std::uint32_t i = 0; i < n; ++i) {
+        position[order[i]] = i;
+    }
+
+    for(const auto& body : loops.bodies) {
+        std::uint32_t top = n;
+
+        for(std::uint32_t b = 0; b < n; ++b) {
+            if(body[b] && (top == n || position[b] < position[top])) {
+                top = b;
+            }
+        }
+
+        if(top != 0 && !cold[top]) {
+            function.blocks[top].align = true;
+        }
+    }
+
+    function.reorder(order);
+}
+
+} // namespace microc
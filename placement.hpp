@@ -0,0 +1,30 @@
+#ifndef MICROC_PLACEMENT_HPP
+#define MICROC_PLACEMENT_HPP
+
+#include "ir.hpp"
+
+namespace microc {
+
+/*
+ * Orders the blocks of a function, Pettis-Hansen style: every block starts
+ * as a chain of its own, and going through the edges from the most to the
+ * least taken, the chain ending with the source of an edge is joined to
+ * the one starting with its target. The chain of the entry goes first,
+ * then the hot chains, hottest first, then the cold ones, so that cold
+ * code is out of line, at the end of the function.
+ *
+ * Edges are weighted by the counts of the profile if the function has one
+ * and ran. Otherwise they are estimated: a block runs 8 times more often
+ * per loop around it, a branch stays in its loop 7 times out of 8, and
+ * goes to a cold block 1 time out of 16. Cold blocks are else branches,
+ * error paths, i.e. blocks calling exit() or abort() and blocks which only
+ * lead to them, and blocks only reached from cold ones.
+ *
+ * Blocks which never ran or are predicted cold are marked cold, and the
+ * first block of each loop which is not cold is marked to be aligned.
+ */
+void place_blocks(ir::Function& function);
+
+} // namespace microc
+
+#endif // MICROC_PLACEMENT_HPP
@@ -0,0 +1,208 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace microc {
+
+profile_exception::profile_exception(const std::string& path, const std::string& message):
+    what_(path + ": " + message)
+{}
+
+const char* profile_exception::what() const noexcept {
+    return what_.c_str();
+}
+
+namespace {
+
+class Reader {
+    public:
+        Reader(const std::string& path, const std::string& data):
+            path_(path),
+            data_(data)
+        {}
+
+        bool done() const { return pos_ == data_.size(); }
+
+        std::uint32_t word() {
+            std::uint32_t value;
+            std::memcpy(&value, bytes(4), 4);
+            return value;
+        }
+
+        std::string string() {
+            std::uint32_t length = word();
+            std::string value(bytes(length), length);
+            bytes((4 - length % 4) % 4);
+            return value;
+        }
+
+    private:
+        const char* bytes(std::size_t n) {
+            if(n > data_.size() - pos_) {
+                throw profile_exception(path_, "truncated profile");
+            }
+
+            pos_ += n;
+            return data_.data() + pos_ - n;
+        }
+
+    private:
+        const std::string& path_;
+        const std::string& data_;
+        std::size_t pos_ = 0;
+};
+
+void word(std::string& data, std::uint32_t value) {
+    data.append(reinterpret_cast<const char*>(&value), 4);
+}
+
+bool ends_with_branch(const ir::Block& block) {
+    return block.terminated() && block.terminator().op == ir::Opcode::Branch;
+}
+
+} // namespace
+
+Profile Profile::read(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+
+    if(!in.is_open()) {
+        throw profile_exception(path, "cannot open profile");
+    }
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    Reader reader(path, data);
+    Profile profile;
+
+    while(!reader.done()) {
+        std::string name = reader.string();
+        std::uint32_t checksum = reader.word();
+        std::vector<std::uint64_t> counters(reader.word());
+
+        for(auto& counter : counters) {
+            std::uint64_t low = reader.word();
+            counter = low | static_cast<std::uint64_t>(reader.word()) << 32;
+        }
+
+        auto it = profile.functions.find(name);
+
+        if(it == profile.functions.end()) {
+            profile.functions[name] = FunctionProfile{checksum, std::move(counters)};
+        }
+        else if(it->second.checksum == checksum && it->second.counters.size() == counters.size()) {
+            for(std::size_t i = 0; i < counters.size(); ++i) {
+                it->second.counters[i] += counters[i];
+            }
+        }
+        else {
+            throw profile_exception(path, "different profiles of '" + name + "'");
+        }
+    }
+
+    return profile;
+}
+
+void Profile::write(const std::string& path) const {
+    std::string data;
+
+    for(const auto& function : functions) {
+        word(data, function.first.size());
+        data += function.first;
+        data.append((4 - function.first.size() % 4) % 4, '\0');
+        word(data, function.second.checksum);
+        word(data, function.second.counters.size());
+
+        for(std::uint64_t counter : function.second.counters) {
+            word(data, counter & 0xffffffff);
+            word(data, counter >> 32);
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), data.size());
+
+    if(!out) {
+        throw profile_exception(path, "cannot write profile");
+    }
+}
+
+const FunctionProfile* Profile::find(const std::string& name, std::uint32_t checksum) const {
+    auto it = functions.find(name);
+    return it != functions.end() && it->second.checksum == checksum ? &it->second : nullptr;
+}
+
+// FNV-1a over the terminators of the blocks
+std::uint32_t profile_checksum(const ir::Function& function) {
+    std::uint32_t hash = 2166136261u;
+
+    auto mix = [&](std::uint32_t value) {
+        for(int i = 0; i < 4; ++i) {
+            hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 16777619u;
+        }
+    };
+
+    mix(function.blocks.size());
+
+    for(const auto& block : function.blocks) {
+        mix(block.instrs.size());
+
+        if(block.terminated()) {
+            mix(static_cast<std::uint32_t>(block.terminator().op));
+
+            for(std::uint32_t succ : block.successors()) {
+                mix(succ);
+            }
+        }
+    }
+
+    return hash;
+}
+
+void instrument(ir::Function& function) {
+    function.checksum = profile_checksum(function);
+    std::uint32_t branch = function.blocks.size();
+
+    for(auto& block : function.blocks) {
+        if(ends_with_branch(block)) {
+            const ir::Instr& term = block.terminator();
+            ir::Instr count(ir::Opcode::Count);
+            count.cond = term.cond;
+            count.a = term.a;
+            count.b = term.b;
+            count.disp = branch++;
+            count.offset = term.offset;
+            block.instrs.insert(block.instrs.end() - 1, count);
+        }
+
+        ir::Instr count(ir::Opcode::Count);
+        count.disp = block.id;
+        count.offset = block.instrs.empty() ? function.offset : block.instrs.front().offset;
+        block.instrs.insert(block.instrs.begin(), count);
+    }
+
+    function.counters = branch;
+}
+
+void annotate(ir::Function& function, const Profile& profile) {
+    function.checksum = profile_checksum(function);
+    const FunctionProfile* found = profile.find(function.name, function.checksum);
+    std::size_t branches = std::count_if(function.blocks.begin(), function.blocks.end(), ends_with_branch);
+
+    if(found == nullptr || found->counters.size() != function.blocks.size() + branches) {
+        return;
+    }
+
+    function.counts.assign(found->counters.begin(), found->counters.begin() + function.blocks.size());
+    function.taken.assign(function.blocks.size(), 0);
+    std::size_t next = function.blocks.size();
+
+    for(const auto& block : function.blocks) {
+        if(ends_with_branch(block)) {
+            function.taken[block.id] = found->counters[next++];
+        }
+    }
+}
+
+} // namespace microc
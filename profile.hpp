@@ -0,0 +1,78 @@
+#ifndef MICROC_PROFILE_HPP
+#define MICROC_PROFILE_HPP
+
+#include "ir.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace microc {
+
+class profile_exception : public std::exception {
+    public:
+        profile_exception(const std::string& path, const std::string& message);
+        virtual const char* what() const noexcept;
+
+    private:
+        std::string what_;
+};
+
+/*
+ * Counters of one function: one per block, executions of the block, then
+ * one per block ending with a Branch, in block order, times the branch went
+ * to its first target.
+ */
+class FunctionProfile {
+    public:
+        std::uint32_t checksum = 0;
+        std::vector<std::uint64_t> counters;
+};
+
+/*
+ * Execution counts of a program, written when an instrumented program
+ * ends, for --profile-use.
+ *
+ * A profile file is the content of the microc_profile section of the
+ * program, made of 32-bit words in host byte order: a record per function,
+ * with the length of its name, its name padded to a word, the checksum
+ * of its blocks, the number of counters and the 64-bit counters. Profiles
+ * of several runs can be concatenated, the counters of a function being
+ * summed when read.
+ */
+class Profile {
+    public:
+        static Profile read(const std::string& path);
+        void write(const std::string& path) const;
+
+        // the profile of a function, null if there is none or if the
+        // function changed since
+        const FunctionProfile* find(const std::string& name, std::uint32_t checksum) const;
+
+    public:
+        std::map<std::string, FunctionProfile> functions;
+};
+
+/*
+ * Checksum of the control flow graph of a function as lowered, so that a
+ * profile is only used for the code it was collected on.
+ */
+std::uint32_t profile_checksum(const ir::Function& function);
+
+/*
+ * Adds the Count instructions of --profile-generate: one at the start of
+ * each block, and one before each Branch, counting when it is taken.
+ */
+void instrument(ir::Function& function);
+
+/*
+ * Gives the function the counts of its profile, if any: Function::counts
+ * and Function::taken.
+ */
+void annotate(ir::Function& function, const Profile& profile);
+
+} // namespace microc
+
+#endif // MICROC_PROFILE_HPP
@@ -0,0 +1,364 @@
+#include "regalloc.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <utility>
+
+namespace microc {
+
+namespace x86 {
+
+const char* register_str(Register r, std::uint8_t size) {
+    static const char* const names[3][8] = {
+        {"%al", "%cl", "%dl", "%bl", nullptr, nullptr, nullptr, nullptr},
+        {"%ax", "%cx", "%dx", "%bx", "%sp", "%bp", "%si", "%di"},
+        {"%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi"},
+    };
+
+    const char* name = names[size == 1 ? 0 : size == 2 ? 1 : 2][r];
+    assert(name != nullptr && "register has no such part");
+    return name;
+}
+
+namespace {
+
+x86::Register letter_register(char letter) {
+    switch(letter) {
+        case 'a': return x86::eax;
+        case 'b': return x86::ebx;
+        case 'c': return x86::ecx;
+        case 'd': return x86::edx;
+        case 'S': return x86::esi;
+        default:  return x86::edi;
+    }
+}
+
+} // namespace
+
+} // namespace x86
+
+AsmRegisters::AsmRegisters(const ir::Instr& instr):
+    operands(instr.extended->operands.size(), x86::eax)
+{
+    static const char* const names[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+    const auto& asm_operands = instr.extended->operands;
+
+    for(std::string clobber : instr.extended->clobbers) {
+        if(!clobber.empty() && clobber[0] == '%') {
+            clobber.erase(0, 1);
+        }
+
+        for(std::uint8_t r = 0; r < 8; ++r) {
+            if(clobber == names[r]) {
+                clobbered |= 1u << r;
+            }
+        }
+    }
+
+    for(std::size_t i = 0; i < asm_operands.size(); ++i) {
+        char c = asm_operands[i].constraint;
+
+        if(std::string("abcdSD").find(c) != std::string::npos) {
+            operands[i] = x86::letter_register(c);
+            clobbered |= 1u << operands[i];
+        }
+    }
+
+    static const x86::Register any[] = {x86::eax, x86::ecx, x86::edx, x86::esi, x86::edi, x86::ebx};
+
+    for(std::size_t i = 0; i < asm_operands.size(); ++i) {
+        char c = asm_operands[i].constraint;
+
+        if(c != 'r' && c != 'm') {
+            continue;
+        }
+
+        for(x86::Register r : any) {
+            if(!clobbers(r)) {
+                operands[i] = r;
+                clobbered |= 1u << r;
+                break;
+            }
+        }
+    }
+
+    for(std::size_t i = 0; i < asm_operands.size(); ++i) {
+        char c = asm_operands[i].constraint;
+
+        if(c >= '0' && c <= '9') {
+            operands[i] = operands[c - '0'];
+        }
+    }
+}
+
+Liveness::Liveness(const ir::Function& function):
+    live_in(function.blocks.size(), std::vector<bool>(function.registers + 1)),
+    live_out(function.blocks.size(), std::vector<bool>(function.registers + 1))
+{
+    std::size_t n = function.blocks.size();
+    std::vector<std::vector<bool>> gen(n, std::vector<bool>(function.registers + 1));
+    std::vector<std::vector<bool>> kill(n, std::vector<bool>(function.registers + 1));
+
+    for(const auto& block : function.blocks) {
+        for(const auto& instr : block.instrs) {
+            for(ir::Register r : instr.uses()) {
+                if(!kill[block.id][r]) {
+                    gen[block.id][r] = true;
+                }
+            }
+
+            if(instr.dst != ir::no_register) {
+                kill[block.id][instr.dst] = true;
+            }
+
+            for(ir::Register r : instr.results) {
+                kill[block.id][r] = true;
+            }
+        }
+    }
+
+    bool changed = true;
+
+    while(changed) {
+        changed = false;
+
+        for(std::size_t i = n; i-- > 0;) {
+            std::vector<bool> out(function.registers + 1);
+
+            for(std::uint32_t succ : function.blocks[i].successors()) {
+                for(ir::Register r = 1; r <= function.registers; ++r) {
+                    if(live_in[succ][r]) {
+                        out[r] = true;
+                    }
+                }
+            }
+
+            std::vector<bool> in = gen[i];
+
+            for(ir::Register r = 1; r <= function.registers; ++r) {
+                if(out[r] && !kill[i][r]) {
+                    in[r] = true;
+                }
+            }
+
+            if(in != live_in[i] || out != live_out[i]) {
+                live_in[i] = std::move(in);
+                live_out[i] = std::move(out);
+                changed = true;
+            }
+        }
+    }
+}
+
+namespace {
+
+class Interval {
+    public:
+        ir::Register reg;
+        std::uint32_t start;
+        std::uint32_t end;
+};
+
+} // namespace
+
+Allocation::Allocation(const ir::Function& function):
+    locations(function.registers + 1)
+{
+    Liveness liveness(function);
+
+    // instruction n reads its operands at 2n and writes its result at 2n + 1
+    const std::uint32_t none = static_cast<std::uint32_t>(-1);
+    std::vector<std::uint32_t> start(function.registers + 1, none);
+    std::vector<std::uint32_t> end(function.registers + 1, 0);
+    std::vector<std::uint32_t> asm_positions;
+    std::vector<std::pair<std::uint32_t, std::uint8_t>> extended_asms;    // position, clobbered registers
+
+    // with a profile, the times each register is read or written
+    bool profiled = !function.counts.empty();
+    std::vector<std::uint64_t> weight(function.registers + 1);
+
+    auto extend = [&](ir::Register r, std::uint32_t pos) {
+        start[r] = std::min(start[r], pos);
+        end[r] = std::max(end[r], pos);
+    };
+
+    std::uint32_t n = 0;
+
+    for(const auto& block : function.blocks) {
+        std::uint32_t block_start = 2 * n;
+        std::uint64_t count = profiled ? function.counts[block.id] : 0;
+
+        for(const auto& instr : block.instrs) {
+            for(ir::Register r : instr.uses()) {
+                extend(r, 2 * n);
+                weight[r] += count;
+            }
+
+            if(instr.dst != ir::no_register) {
+                extend(instr.dst, 2 * n + 1);
+                weight[instr.dst] += count;
+            }
+
+            for(ir::Register r : instr.results) {
+                extend(r, 2 * n + 1);
+                weight[r] += count;
+            }
+
+            if(instr.op == ir::Opcode::Asm && instr.extended) {
+                AsmRegisters registers(instr);
+                extended_asms.emplace_back(2 * n, registers.clobbered);
+
+                for(x86::Register r : {x86::ebx, x86::esi, x86::edi}) {
+                    if(registers.clobbers(r) && std::find(saved.begin(), saved.end(), r) == saved.end()) {
+                        saved.push_back(r);
+                    }
+                }
+            }
+            else if(instr.op == ir::Opcode::Asm) {
+                asm_positions.push_back(2 * n);
+            }
+
+            ++n;
+        }
+
+        std::uint32_t block_end = 2 * n;
+
+        for(ir::Register r = 1; r <= function.registers; ++r) {
+            if(liveness.live_in[block.id][r]) {
+                extend(r, block_start);
+            }
+
+            if(liveness.live_out[block.id][r]) {
+                extend(r, block_end);
+            }
+        }
+    }
+
+    std::vector<Interval> intervals;
+
+    for(ir::Register r = 1; r <= function.registers; ++r) {
+        if(start[r] == none) {
+            continue;
+        }
+
+        bool across_asm = std::any_of(asm_positions.begin(), asm_positions.end(), [&](std::uint32_t pos) {
+            return start[r] < pos && pos < end[r];
+        });
+
+        if(across_asm) {
+            locations[r].kind = Location::Kind::Spill;
+        }
+        else {
+            intervals.push_back(Interval{r, start[r], end[r]});
+        }
+    }
+
+    std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) {
+        return a.start < b.start;
+    });
+
+    // the registers an extended asm uses may hold neither its operands nor
+    // the values live across it
+    auto forbidden = [&](const Interval& interval) {
+        std::uint8_t mask = 0;
+
+        for(const auto& position : extended_asms) {
+            if(interval.start <= position.first + 1 && position.first <= interval.end) {
+                mask |= position.second;
+            }
+        }
+
+        return mask;
+    };
+
+    std::vector<x86::Register> free = {x86::edi, x86::esi, x86::ebx};
+    std::vector<Interval> active;
+
+    for(const auto& current : intervals) {
+        // expire the intervals ending before this one starts
+        for(auto it = active.begin(); it != active.end();) {
+            if(it->end < current.start) {
+                free.push_back(locations[it->reg].reg);
+                it = active.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        std::uint8_t mask = forbidden(current);
+        auto allowed = std::find_if(free.rbegin(), free.rend(), [&](x86::Register r) {
+            return (mask & (1u << r)) == 0;
+        });
+
+        if(allowed != free.rend()) {
+            x86::Register reg = *allowed;
+            free.erase(std::next(allowed).base());
+            locations[current.reg].kind = Location::Kind::Register;
+            locations[current.reg].reg = reg;
+
+            if(std::find(saved.begin(), saved.end(), reg) == saved.end()) {
+                saved.push_back(reg);
+            }
+
+            active.push_back(current);
+            continue;
+        }
+
+        // spill the interval ending last, or with a profile the one used
+        // the least often
+        auto victim = profiled
+            ? std::min_element(active.begin(), active.end(), [&](const Interval& a, const Interval& b) {
+                  return weight[a.reg] < weight[b.reg];
+              })
+            : std::max_element(active.begin(), active.end(), [](const Interval& a, const Interval& b) {
+                  return a.end < b.end;
+              });
+        bool better = victim != active.end()
+                      && (profiled ? weight[victim->reg] < weight[current.reg] : victim->end > current.end);
+
+        if(better && (mask & (1u << locations[victim->reg].reg)) == 0) {
+            locations[current.reg] = locations[victim->reg];
+            locations[victim->reg].kind = Location::Kind::Spill;
+            *victim = current;
+        }
+        else {
+            locations[current.reg].kind = Location::Kind::Spill;
+        }
+    }
+
+    // a spill slot is reused once the value in it is dead, but not by the
+    // result of the instruction reading it last
+    std::vector<ir::Register> spilled;
+    std::vector<std::uint32_t> ends;    // of the value last put in each spill slot
+
+    for(ir::Register r = 1; r <= function.registers; ++r) {
+        if(locations[r].kind == Location::Kind::Spill) {
+            spilled.push_back(r);
+        }
+    }
+
+    std::sort(spilled.begin(), spilled.end(), [&](ir::Register a, ir::Register b) {
+        return start[a] < start[b];
+    });
+
+    for(ir::Register r : spilled) {
+        auto slot = std::find_if(ends.begin(), ends.end(), [&](std::uint32_t e) {
+            return e + 1 < start[r];
+        });
+
+        if(slot == ends.end()) {
+            slot = ends.insert(ends.end(), end[r]);
+        }
+
+        *slot = end[r];
+        locations[r].spill = slot - ends.begin();
+    }
+
+    spills = ends.size();
+
+    std::sort(saved.begin(), saved.end());
+}
+
+} // namespace microc
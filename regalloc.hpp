@@ -0,0 +1,101 @@
+#ifndef MICROC_REGALLOC_HPP
+#define MICROC_REGALLOC_HPP
+
+#include "ir.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace microc {
+
+namespace x86 {
+
+/*
+ * Numbered as in the instruction encoding, which is also the DWARF
+ * numbering on i386.
+ */
+enum Register : std::uint8_t {
+    eax,
+    ecx,
+    edx,
+    ebx,
+    esp,
+    ebp,
+    esi,
+    edi,
+};
+
+const char* register_str(Register r, std::uint8_t size = 4);
+
+} // namespace x86
+
+/*
+ * The registers given to the operands of an extended asm: named ones
+ * first, then r and m operands take the remaining ones, scratch registers
+ * first, and tied inputs share the register of their output.
+ */
+class AsmRegisters {
+    public:
+        explicit AsmRegisters(const ir::Instr& instr);
+
+        bool clobbers(x86::Register r) const { return (clobbered & (1u << r)) != 0; }
+
+    public:
+        std::vector<x86::Register> operands;    // unused for i and n operands
+        std::uint8_t clobbered = 0;             // operand and clobbered registers, by bit
+};
+
+/*
+ * Virtual registers live at the entry and at the exit of every block.
+ */
+class Liveness {
+    public:
+        explicit Liveness(const ir::Function& function);
+
+    public:
+        std::vector<std::vector<bool>> live_in;
+        std::vector<std::vector<bool>> live_out;
+};
+
+class Location {
+    public:
+        enum class Kind : std::uint8_t {
+            None,       // never defined
+            Register,
+            Spill,
+        };
+
+    public:
+        Kind kind = Kind::None;
+        x86::Register reg = x86::eax;
+        std::uint32_t spill = 0;    // index of the spill slot
+};
+
+/*
+ * Linear scan over one live interval per virtual register. Only the
+ * callee-saved registers ebx, esi and edi are allocated, so values survive
+ * calls; eax, ecx and edx are left to the code generator as scratch
+ * registers. Values live across a basic inline assembly block are spilled
+ * since it may clobber anything; those live across an extended one only
+ * stay out of the registers it uses or clobbers.
+ *
+ * When registers run out, the value whose interval ends last is spilled,
+ * unless the function has a profile: the value read and written the least
+ * often, by the counts of the blocks, is spilled then. Spilled values whose
+ * intervals do not overlap share a spill slot.
+ */
+class Allocation {
+    public:
+        explicit Allocation(const ir::Function& function);
+
+        const Location& operator[](ir::Register r) const { return locations[r]; }
+
+    public:
+        std::vector<Location> locations;    // indexed by virtual register
+        std::vector<x86::Register> saved;   // callee-saved registers used
+        std::uint32_t spills = 0;          // spill slots
+};
+
+} // namespace microc
+
+#endif // MICROC_REGALLOC_HPP
@@ -0,0 +1,131 @@
+#ifndef MICROC_RING_HPP
+#define MICROC_RING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace microc {
+
+/*
+ * Lock-free queue from one producer thread to one consumer thread, over a
+ * ring of a power of 2 slots. Each side only writes its own index, and
+ * rereads the other one only when the ring looks full or empty.
+ *
+ * A side which has to wait yields the processor, and counts the seconds
+ * it waited, so that a pipeline can tell which stage holds the others.
+ * Either side may close the ring: push() then fails at once, and pop()
+ * once the ring is empty.
+ */
+template<typename T>
+class SpscRing {
+    public:
+        explicit SpscRing(std::size_t capacity):
+            slots_(round_up(capacity)),
+            mask_(slots_.size() - 1)
+        {}
+
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        // producer side
+        bool push(T&& value) {
+            std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+            if(tail - head_cache_ == slots_.size()) {
+                head_cache_ = head_.load(std::memory_order_acquire);
+
+                if(tail - head_cache_ == slots_.size()) {
+                    auto start = std::chrono::steady_clock::now();
+
+                    while(tail - head_cache_ == slots_.size() && !closed()) {
+                        std::this_thread::yield();
+                        head_cache_ = head_.load(std::memory_order_acquire);
+                    }
+
+                    push_wait_ += seconds_since(start);
+                }
+            }
+
+            if(closed()) {
+                return false;
+            }
+
+            slots_[tail & mask_] = std::move(value);
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side
+        bool pop(T& value) {
+            std::size_t head = head_.load(std::memory_order_relaxed);
+
+            if(head == tail_cache_) {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+
+                if(head == tail_cache_) {
+                    auto start = std::chrono::steady_clock::now();
+
+                    // the producer closes after its last push
+                    while(head == tail_cache_ && !closed()) {
+                        std::this_thread::yield();
+                        tail_cache_ = tail_.load(std::memory_order_acquire);
+                    }
+
+                    tail_cache_ = tail_.load(std::memory_order_acquire);
+                    pop_wait_ += seconds_since(start);
+
+                    if(head == tail_cache_) {
+                        return false;
+                    }
+                }
+            }
+
+            value = std::move(slots_[head & mask_]);
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        void close() { closed_.store(true, std::memory_order_release); }
+        bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+        // seconds each side waited, to be read once both are done
+        double push_wait() const { return push_wait_; }
+        double pop_wait() const { return pop_wait_; }
+
+    private:
+        static std::size_t round_up(std::size_t n) {
+            std::size_t size = 2;
+
+            while(size < n) {
+                size *= 2;
+            }
+
+            return size;
+        }
+
+        static double seconds_since(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        std::vector<T> slots_;
+        std::size_t mask_;
+        std::atomic<bool> closed_{false};
+
+        // apart, so that the two sides do not write the same cache line
+        alignas(64) std::atomic<std::size_t> head_{0};
+        std::size_t tail_cache_ = 0;
+        double pop_wait_ = 0;
+
+        alignas(64) std::atomic<std::size_t> tail_{0};
+        std::size_t head_cache_ = 0;
+        double push_wait_ = 0;
+};
+
+} // namespace microc
+
+#endif // MICROC_RING_HPP
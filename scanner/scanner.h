@@ -4,20 +4,24 @@
 #define MICROC_SCANNER_SCANNER_H
 
 #include "scannerbase.h"
+#include "../source.hpp"
 
+#include <cstdint>
 #include <exception>
 
 namespace microc {
 
 class scanner_exception : public std::exception {
     public:
-        scanner_exception(int line, const std::string& matched);
+        scanner_exception(int line, int column, const std::string& matched);
         virtual const char* what() const noexcept;
         int line() const noexcept { return line_; }
+        int column() const noexcept { return column_; }
         const std::string& matched() const noexcept { return matched_; }
 
     private:
         int line_;
+        int column_;
         std::string matched_;
         std::string what_;
 };
@@ -31,10 +35,21 @@ class Scanner: public ScannerBase {
 
         int lex();
 
+        // offset of the last matched token from the beginning of the input
+        std::uint32_t offset() const { return d_offset; }
+        SourceLocation location() const { return d_source.location(d_offset); }
+        const SourceMap& source() const { return d_source; }
+
     private:
         int lex__();
         int executeAction__(size_t ruleNr);
 
+        void advance();     // moves the offset past the matched text
+
+        SourceMap d_source;
+        std::uint32_t d_offset = 0;
+        std::uint32_t d_nextOffset = 0;
+
         void print();
         void preCode();     // re-implement this function for code that must 
                             // be exec'ed before the patternmatching starts
@@ -45,15 +60,24 @@ class Scanner: public ScannerBase {
 };
 
 inline Scanner::Scanner(std::istream &in, std::ostream &out):
-    ScannerBase(in, out)
+    ScannerBase(in, out),
+    d_source(in)
 {}
 
 inline Scanner::Scanner(std::string const &infile, std::string const &outfile):
-    ScannerBase(infile, outfile)
+    ScannerBase(infile, outfile),
+    d_source(infile)
 {}
 
 inline int Scanner::lex() {
-    return lex__();
+    int token = lex__();
+    advance();
+    return token;
+}
+
+inline void Scanner::advance() {
+    d_offset = d_nextOffset;
+    d_nextOffset += matched().size();
 }
 
 inline void Scanner::preCode() {
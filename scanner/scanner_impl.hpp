@@ -6,11 +6,11 @@
 
 namespace microc {
 
-scanner_exception::scanner_exception(int line, const std::string& matched):
-    line_(line), matched_(matched)
+scanner_exception::scanner_exception(int line, int column, const std::string& matched):
+    line_(line), column_(column), matched_(matched)
 {
     std::stringstream ss;
-    ss << "error line " << line;
+    ss << "error line " << line << ", column " << column;
 
     if(matched.empty()) {
         ss << ", unexpected end of file";
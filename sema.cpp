@@ -0,0 +1,1228 @@
+#include "sema.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <sstream>
+#include <unordered_map>
+
+namespace microc {
+
+namespace {
+
+// the largest object, whose size and offsets must fit an int
+const std::uint64_t max_object_size = INT32_MAX;
+
+class Symbol {
+    public:
+        const ast::Type* type = nullptr;                // variables
+        const ast::FunctionEntity* function = nullptr;  // functions
+        bool local = false;
+};
+
+/*
+ * The counter of a for loop, while its body is analyzed. Variables are told
+ * apart by the type node of their declaration.
+ */
+class Counter {
+    public:
+        const ast::Type* variable;
+        bool assigned;
+};
+
+const ast::IntegerExpression* integer(const ast::Expression* e) {
+    return dynamic_cast<const ast::IntegerExpression*>(e);
+}
+
+const ast::IdentExpression* ident(const ast::Expression* e) {
+    return dynamic_cast<const ast::IdentExpression*>(e);
+}
+
+bool is_lvalue(const ast::Expression* e) {
+    return dynamic_cast<const ast::IdentExpression*>(e)
+           || dynamic_cast<const ast::AccessExpression*>(e)
+           || dynamic_cast<const ast::MemberExpression*>(e)
+           || dynamic_cast<const ast::IndexExpression*>(e);
+}
+
+/*
+ * asm constraint letters: a register (r), a given register (a, b, c, d, S,
+ * D), memory (m), and for inputs only an immediate (i, n).
+ */
+bool constraint_letter(char c, bool input) {
+    return std::string("rabcdSDm").find(c) != std::string::npos || (input && (c == 'i' || c == 'n'));
+}
+
+/*
+ * The constraint letter of a clobbered register, 0 for "memory" and "cc",
+ * -1 for an unknown name.
+ */
+int clobber_letter(std::string name) {
+    static const char* const names[] = {"eax", "ebx", "ecx", "edx", "esi", "edi"};
+
+    if(name == "memory" || name == "cc") {
+        return 0;
+    }
+
+    if(!name.empty() && name[0] == '%') {
+        name.erase(0, 1);
+    }
+
+    auto it = std::find(std::begin(names), std::end(names), name);
+    return it == std::end(names) ? -1 : "abcdSD"[it - std::begin(names)];
+}
+
+std::string quote(const ast::Type& type) {
+    std::ostringstream o;
+    o << "'" << type << "'";
+    return o.str();
+}
+
+/*
+ * Whether a value of type from can be stored in a variable of type to.
+ */
+bool assignable(const ast::Type& to, const ast::Type& from) {
+    ast::TypeKind t(to), f(from);
+
+    if(t.kind == ast::TypeKind::Boolean) {
+        return f.kind == ast::TypeKind::Boolean;
+    }
+
+    if(t.is_integral()) {
+        return f.is_integral();
+    }
+
+    if(t.kind == ast::TypeKind::Pointer) {
+        if(f.kind == ast::TypeKind::Null) {
+            return true;
+        }
+
+        if(f.kind != ast::TypeKind::Pointer) {
+            return false;
+        }
+
+        // void* converts to and from any pointer
+        return *t.pointed == *f.pointed
+            || ast::TypeKind(*t.pointed).kind == ast::TypeKind::Void
+            || ast::TypeKind(*f.pointed).kind == ast::TypeKind::Void;
+    }
+
+    return false;
+}
+
+class Analyzer : public ast::EntityVisitor, public ast::InstructionVisitor, public ast::ExpressionVisitor {
+    public:
+        Analyzer(ast::Program& prog, Interner& names):
+            int_(make_type(prog, std::make_unique<ast::IntegerType>(4))),
+            bool_(make_type(prog, std::make_unique<ast::BooleanType>(1))),
+            char_(make_type(prog, std::make_unique<ast::CharType>(1))),
+            null_(make_type(prog, std::make_unique<ast::NullType>(4))),
+            string_(make_type(prog, std::make_unique<ast::PointerType>(std::make_unique<ast::CharType>(1), 4))),
+            prog_(prog),
+            names_(names)
+        {}
+
+        void analyze(const ast::Program& prog) {
+            for(const auto& entity : prog.entities) {
+                declare_global(*entity);
+            }
+
+            // before anything needs the size of a struct
+            for(const auto& entity : prog.entities) {
+                if(auto structure = dynamic_cast<const ast::StructEntity*>(entity.get())) {
+                    lay_out(*structure);
+                }
+            }
+
+            for(const auto& entity : prog.entities) {
+                entity->accept(*this);
+            }
+        }
+
+        /*
+         * For streaming: entity comes after the ones already analyzed, and
+         * can only use what they declare, except for calls to functions
+         * defined later, see remember_call().
+         */
+        void analyze(const ast::Entity& entity) {
+            streaming_ = true;
+            declare_global(entity);
+
+            if(auto structure = dynamic_cast<const ast::StructEntity*>(&entity)) {
+                lay_out(*structure);
+            }
+
+            entity.accept(*this);
+        }
+
+        // frees the types made while checking the functions analyzed so far
+        void release() {
+            prog_.types.resize(kept_types_);
+            decayed_.clear();
+        }
+
+        std::vector<SemanticError>& errors() { return errors_; }
+
+        /*
+         * Entities
+         */
+        virtual void visit(const ast::AssemblyEntity&) {}
+        virtual void visit(const ast::GlobalEntity& e) {
+            check_size(*e.type);
+        }
+        virtual void visit(const ast::StructEntity&) {}
+
+        virtual void visit(const ast::FunctionEntity& e) {
+            // checked where it is defined
+            if(e.imported) {
+                return;
+            }
+
+            function_ = &e;
+            symbols_.enter();
+
+            if(ast::TypeKind(*e.return_type).kind == ast::TypeKind::Struct) {
+                error(e.offset, "function '" + e.name + "' cannot return a struct by value");
+            }
+
+            for(const auto& arg : e.arguments) {
+                if(ast::TypeKind(*arg.type).kind == ast::TypeKind::Struct) {
+                    error(arg.offset, "argument '" + arg.name + "' cannot be a struct passed by value");
+                }
+
+                declare_variable(arg.name, *arg.type, arg.offset);
+            }
+
+            check(e.instructions);
+            symbols_.leave();
+            function_ = nullptr;
+        }
+
+        /*
+         * Instructions
+         */
+        virtual void visit(const ast::BlockInstruction& i) {
+            check_scope(i.instructions);
+        }
+
+        virtual void visit(const ast::DeclarationInstruction& i) {
+            if(i.expression) {
+                const ast::Type* type = check(*i.expression);
+
+                if(type != nullptr && !assignable(*i.type, *type)) {
+                    error(i.expression->offset, "cannot initialize a variable of type " + quote(*i.type)
+                                                + " with a value of type " + quote(*type));
+                }
+            }
+
+            declare_variable(i.name, *i.type, i.offset);
+            check_size(*i.type);
+        }
+
+        virtual void visit(const ast::ExpressionInstruction& i) {
+            check(*i.expression);
+        }
+
+        virtual void visit(const ast::IfInstruction& i) {
+            check_condition(*i.condition);
+            check_scope(i.true_instrs);
+            check_scope(i.false_instrs);
+        }
+
+        virtual void visit(const ast::WhileInstruction& i) {
+            check_condition(*i.condition);
+            check_loop(i.instructions);
+        }
+
+        virtual void visit(const ast::ForInstruction& i) {
+            symbols_.enter();
+
+            if(i.initialization) {
+                i.initialization->accept(*this);
+            }
+
+            if(i.condition) {
+                check_condition(*i.condition);
+            }
+
+            if(i.step) {
+                check(*i.step);
+            }
+
+            const ast::Type* counter = find_counter(i);
+
+            if(counter != nullptr) {
+                counters_.push_back(Counter{counter, false});
+            }
+
+            check_loop(i.instructions);
+
+            if(counter != nullptr) {
+                if(counters_.back().assigned) {
+                    i.counter.clear();
+                }
+
+                counters_.pop_back();
+            }
+
+            symbols_.leave();
+        }
+
+        virtual void visit(const ast::BreakInstruction& i) {
+            if(loops_ == 0) {
+                error(i.offset, "'break' statement not in a loop");
+            }
+        }
+
+        virtual void visit(const ast::ContinueInstruction& i) {
+            if(loops_ == 0) {
+                error(i.offset, "'continue' statement not in a loop");
+            }
+        }
+
+        virtual void visit(const ast::ReturnInstruction& i) {
+            const ast::Type* type = check(*i.expression);
+            const ast::Type& expected = *function_->return_type;
+
+            if(type == nullptr) {
+                return;
+            }
+
+            if(ast::TypeKind(expected).kind == ast::TypeKind::Void) {
+                error(i.offset, "void function '" + function_->name + "' should not return a value");
+            }
+            else if(!assignable(expected, *type)) {
+                error(i.expression->offset, "cannot return a value of type " + quote(*type)
+                                            + " from a function returning " + quote(expected));
+            }
+        }
+
+        /*
+         * Extended asm: operands are checked as expressions, outputs as the
+         * left side of an assignment, and the registers they require must
+         * fit in the six general purpose registers.
+         */
+        virtual void visit(const ast::AssemblyInstruction& i) {
+            if(!i.extended) {
+                return;
+            }
+
+            std::string registers;
+            std::size_t any = 0;
+
+            for(const auto& operand : i.outputs) {
+                const std::string& c = operand.constraint;
+                std::size_t letter = c.size() > 1 && c[1] == '&' ? 2 : 1;
+
+                if(c.size() != letter + 1 || (c[0] != '=' && c[0] != '+') || !constraint_letter(c[letter], false)) {
+                    error(operand.expression->offset, "invalid output constraint '" + c + "' in asm");
+                }
+                else if(!is_lvalue(operand.expression.get())) {
+                    error(operand.expression->offset, "asm output is not assignable");
+                }
+                else {
+                    count_register(c.back(), registers, any);
+                }
+
+                check_operand(operand);
+                assign(operand.expression.get());
+
+                const ast::Type* type = operand.expression->resolved_type;
+
+                if(type != nullptr && ast::TypeKind(*type).kind == ast::TypeKind::Array) {
+                    error(operand.expression->offset, "array type " + quote(*type) + " is not assignable");
+                }
+            }
+
+            for(const auto& operand : i.inputs) {
+                const std::string& c = operand.constraint;
+
+                if(c.size() == 1 && c[0] >= '0' && c[0] <= '9') {
+                    std::size_t tied = c[0] - '0';
+
+                    if(tied >= i.outputs.size() || i.outputs[tied].constraint.empty() || i.outputs[tied].constraint.back() == 'm') {
+                        error(operand.expression->offset, "matching constraint '" + c + "' does not refer to a register output");
+                    }
+                }
+                else if(c.size() != 1 || !constraint_letter(c[0], true)) {
+                    error(operand.expression->offset, "invalid input constraint '" + c + "' in asm");
+                }
+                else {
+                    count_register(c[0], registers, any);
+                }
+
+                check_operand(operand);
+            }
+
+            for(const auto& clobber : i.clobbers) {
+                int letter = clobber_letter(clobber);
+
+                if(letter < 0) {
+                    error(i.offset, "unknown register name '" + clobber + "' in asm");
+                }
+                else if(letter > 0) {
+                    count_register(static_cast<char>(letter), registers, any);
+                }
+            }
+
+            if(registers.size() + any > 6) {
+                error(i.offset, "asm requires more registers than available");
+            }
+        }
+
+        /*
+         * Expressions
+         */
+        virtual void visit(const ast::IdentExpression& e) {
+            const Symbol* symbol = symbols_.find(names_.intern(e.name));
+
+            if(symbol == nullptr) {
+                error(e.offset, "undeclared identifier '" + e.name + "'");
+            }
+            else if(symbol->type == nullptr) {
+                error(e.offset, "'" + e.name + "' is a function, not a variable");
+            }
+            else {
+                e.resolved_type = symbol->type;
+            }
+        }
+
+        virtual void visit(const ast::IntegerExpression& e) {
+            e.resolved_type = int_;
+        }
+
+        virtual void visit(const ast::CharExpression& e) {
+            e.resolved_type = char_;
+        }
+
+        virtual void visit(const ast::StringExpression& e) {
+            e.resolved_type = string_;
+        }
+
+        virtual void visit(const ast::TrueExpression& e) {
+            e.resolved_type = bool_;
+        }
+
+        virtual void visit(const ast::FalseExpression& e) {
+            e.resolved_type = bool_;
+        }
+
+        virtual void visit(const ast::NullExpression& e) {
+            e.resolved_type = null_;
+        }
+
+        virtual void visit(const ast::UnaryExpression& e) {
+            const ast::Type* type = check(*e.expression);
+
+            if(type == nullptr) {
+                return;
+            }
+
+            ast::TypeKind kind(*type);
+
+            if(e.op == ast::UnaryOperator::Not) {
+                if(kind.is_scalar()) {
+                    e.resolved_type = bool_;
+                }
+                else {
+                    invalid_operand(e, *type);
+                }
+            }
+            else if(kind.is_integral()) {
+                e.resolved_type = int_;
+            }
+            else {
+                invalid_operand(e, *type);
+            }
+        }
+
+        virtual void visit(const ast::BinaryExpression& e) {
+            const ast::Type* left = check(*e.left);
+            const ast::Type* right = check(*e.right);
+
+            if(left == nullptr || right == nullptr) {
+                return;
+            }
+
+            ast::TypeKind l(*left), r(*right);
+            bool comparable_pointers = l.is_pointer() && r.is_pointer()
+                                       && (assignable(*left, *right) || assignable(*right, *left));
+
+            switch(e.op) {
+                case ast::BinaryOperator::Add:
+                    if(l.is_integral() && r.is_integral()) {
+                        e.resolved_type = int_;
+                    }
+                    else if(l.kind == ast::TypeKind::Pointer && r.is_integral()) {
+                        e.resolved_type = left;
+                    }
+                    else if(l.is_integral() && r.kind == ast::TypeKind::Pointer) {
+                        e.resolved_type = right;
+                    }
+                    break;
+                case ast::BinaryOperator::Sub:
+                    if(l.is_integral() && r.is_integral()) {
+                        e.resolved_type = int_;
+                    }
+                    else if(l.kind == ast::TypeKind::Pointer && r.is_integral()) {
+                        e.resolved_type = left;
+                    }
+                    else if(l.kind == ast::TypeKind::Pointer && *left == *right) {
+                        e.resolved_type = int_;
+                    }
+                    break;
+                case ast::BinaryOperator::Mul:
+                case ast::BinaryOperator::Div:
+                case ast::BinaryOperator::Mod:
+                case ast::BinaryOperator::BitOr:
+                case ast::BinaryOperator::BitAnd:
+                case ast::BinaryOperator::BitXor:
+                case ast::BinaryOperator::Lshift:
+                case ast::BinaryOperator::Rshift:
+                    if(l.is_integral() && r.is_integral()) {
+                        e.resolved_type = int_;
+                    }
+                    break;
+                case ast::BinaryOperator::Or:
+                case ast::BinaryOperator::And:
+                    if(l.is_scalar() && r.is_scalar()) {
+                        e.resolved_type = bool_;
+                    }
+                    break;
+                case ast::BinaryOperator::Eq:
+                case ast::BinaryOperator::Neq:
+                case ast::BinaryOperator::Inf:
+                case ast::BinaryOperator::InfEq:
+                case ast::BinaryOperator::Sup:
+                case ast::BinaryOperator::SupEq:
+                    if((l.is_integral() && r.is_integral()) || comparable_pointers) {
+                        e.resolved_type = bool_;
+                    }
+                    break;
+                default:
+                    assert(false && "unknown binary operator");
+            }
+
+            if(e.resolved_type == nullptr) {
+                error(e.offset, std::string("invalid operands to binary '") + ast::BinaryExpression::operator_str(e.op)
+                                + "' (have " + quote(*left) + " and " + quote(*right) + ")");
+            }
+        }
+
+        virtual void visit(const ast::AffectationExpression& e) {
+            const ast::Type* affected = check(*e.affected);
+            const ast::Type* value = check(*e.value);
+
+            assign(e.affected.get());
+
+            if(!is_lvalue(e.affected.get())) {
+                error(e.affected->offset, "expression is not assignable");
+                return;
+            }
+
+            if(affected == nullptr || value == nullptr) {
+                return;
+            }
+
+            if(ast::TypeKind(*e.affected->resolved_type).kind == ast::TypeKind::Array) {
+                error(e.affected->offset, "array type " + quote(*e.affected->resolved_type) + " is not assignable");
+                return;
+            }
+
+            if(!assignable(*affected, *value)) {
+                error(e.value->offset, "cannot assign a value of type " + quote(*value)
+                                       + " to a variable of type " + quote(*affected));
+                return;
+            }
+
+            e.resolved_type = affected;
+        }
+
+        virtual void visit(const ast::CastExpression& e) {
+            const ast::Type* type = check(*e.expression);
+
+            if(!resolve(*e.type) || type == nullptr) {
+                return;
+            }
+
+            ast::TypeKind from(*type), to(*e.type);
+
+            if(to.kind == ast::TypeKind::Struct || (to.kind != ast::TypeKind::Void && !from.is_scalar())) {
+                error(e.offset, "cannot cast a value of type " + quote(*type) + " to " + quote(*e.type));
+                return;
+            }
+
+            e.resolved_type = e.type.get();
+        }
+
+        virtual void visit(const ast::AccessExpression& e) {
+            const ast::Type* type = check(*e.expression);
+
+            if(type == nullptr) {
+                return;
+            }
+
+            ast::TypeKind kind(*type);
+
+            if(kind.kind != ast::TypeKind::Pointer || ast::TypeKind(*kind.pointed).kind == ast::TypeKind::Void) {
+                error(e.offset, "cannot dereference a value of type " + quote(*type));
+                return;
+            }
+
+            e.resolved_type = kind.pointed;
+        }
+
+        virtual void visit(const ast::MemberExpression& e) {
+            const ast::Type* type = check(*e.expression);
+
+            if(type == nullptr) {
+                return;
+            }
+
+            ast::TypeKind kind(*type);
+
+            if(e.arrow) {
+                if(kind.kind != ast::TypeKind::Pointer) {
+                    error(e.offset, "member reference type " + quote(*type) + " is not a pointer");
+                    return;
+                }
+
+                kind = ast::TypeKind(*kind.pointed);
+            }
+
+            if(kind.kind != ast::TypeKind::Struct) {
+                error(e.offset, "member reference base type " + quote(*type) + " is not a struct");
+                return;
+            }
+
+            if(kind.structure == nullptr) {
+                // undefined struct, already reported
+                return;
+            }
+
+            e.field = kind.structure->find(e.member);
+
+            if(e.field < 0) {
+                error(e.offset, "no member named '" + e.member + "' in 'struct " + kind.structure->name + "'");
+                return;
+            }
+
+            e.resolved_type = kind.structure->fields[e.field].type.get();
+        }
+
+        virtual void visit(const ast::IndexExpression& e) {
+            const ast::Type* array = check(*e.array);
+            const ast::Type* index = check(*e.index);
+
+            if(array == nullptr || index == nullptr) {
+                return;
+            }
+
+            ast::TypeKind kind(*array);
+
+            if(kind.kind != ast::TypeKind::Pointer || ast::TypeKind(*kind.pointed).kind == ast::TypeKind::Void) {
+                error(e.offset, "subscripted value of type " + quote(*array) + " is not an array or a pointer");
+                return;
+            }
+
+            if(!ast::TypeKind(*index).is_integral()) {
+                error(e.index->offset, "array subscript has type " + quote(*index));
+                return;
+            }
+
+            e.resolved_type = kind.pointed;
+        }
+
+        virtual void visit(const ast::SizeofExpression& e) {
+            const ast::Type* type = e.type ? (resolve(*e.type) ? e.type.get() : nullptr) : check(*e.expression);
+
+            if(type == nullptr) {
+                return;
+            }
+
+            if(ast::TypeKind(*type).kind == ast::TypeKind::Void) {
+                error(e.offset, "invalid application of 'sizeof' to type 'void'");
+                return;
+            }
+
+            e.resolved_type = int_;
+        }
+
+        virtual void visit(const ast::CallExpression& e) {
+            std::vector<const ast::Type*> types;
+
+            for(const auto& arg : e.arguments) {
+                types.push_back(check(*arg));
+            }
+
+            const Symbol* symbol = symbols_.find(names_.intern(e.function_name));
+
+            if(symbol == nullptr) {
+                // defined in assembly, or later when streaming
+                if(streaming_) {
+                    remember_call(e, types);
+                }
+
+                e.resolved_type = int_;
+                return;
+            }
+
+            if(symbol->function == nullptr) {
+                error(e.offset, "'" + e.function_name + "' is not a function");
+                return;
+            }
+
+            const ast::FunctionEntity& function = *symbol->function;
+
+            std::vector<std::uint32_t> offsets;
+
+            for(const auto& arg : e.arguments) {
+                offsets.push_back(arg->offset);
+            }
+
+            check_arguments(function, e.offset, types, offsets);
+            e.resolved_type = function.return_type.get();
+        }
+
+    private:
+        void check_arguments(const ast::FunctionEntity& function, std::uint32_t offset,
+                             const std::vector<const ast::Type*>& types, const std::vector<std::uint32_t>& offsets) {
+            if(function.arguments.size() != types.size()) {
+                error(offset, "function '" + function.name + "' expects "
+                              + std::to_string(function.arguments.size()) + " argument(s), "
+                              + std::to_string(types.size()) + " given");
+                return;
+            }
+
+            for(std::size_t i = 0; i < types.size(); ++i) {
+                const ast::Type& expected = *function.arguments[i].type;
+
+                if(types[i] != nullptr && !assignable(expected, *types[i])) {
+                    error(offsets[i], "argument " + std::to_string(i + 1) + " of '" + function.name + "' has type "
+                                      + quote(*types[i]) + ", expected " + quote(expected));
+                }
+            }
+        }
+
+        /*
+         * A call to a function not defined yet is checked once it is, or
+         * never if it is defined in assembly. The function's body is gone
+         * by then, only a copy of the argument types is kept, once for
+         * every distinct list of argument types, with the first call.
+         */
+        void remember_call(const ast::CallExpression& e, const std::vector<const ast::Type*>& types) {
+            std::vector<CallAhead>& calls = calls_ahead_[e.function_name];
+
+            for(const auto& call : calls) {
+                bool same = call.arguments.size() == types.size();
+
+                for(std::size_t i = 0; same && i < types.size(); ++i) {
+                    same = types[i] == nullptr ? call.arguments[i] == nullptr
+                                               : call.arguments[i] != nullptr && *call.arguments[i] == *types[i];
+                }
+
+                if(same) {
+                    return;
+                }
+            }
+
+            CallAhead call;
+            call.offset = e.offset;
+
+            for(std::size_t i = 0; i < types.size(); ++i) {
+                call.arguments.push_back(types[i] ? types[i]->clone() : nullptr);
+                call.offsets.push_back(e.arguments[i]->offset);
+            }
+
+            calls.push_back(std::move(call));
+        }
+
+        /*
+         * The calls made to name before its definition, typed as calls to
+         * assembly returning an int.
+         */
+        void check_calls_ahead(const std::string& name, const ast::FunctionEntity* function) {
+            auto it = calls_ahead_.find(name);
+
+            if(it == calls_ahead_.end()) {
+                return;
+            }
+
+            for(const auto& call : it->second) {
+                if(function == nullptr) {
+                    error(call.offset, "'" + name + "' is not a function");
+                    continue;
+                }
+
+                ast::TypeKind::Kind returned = ast::TypeKind(*function->return_type).kind;
+
+                if(returned != ast::TypeKind::Integer && returned != ast::TypeKind::Void) {
+                    error(call.offset, "function '" + name + "' returns " + quote(*function->return_type)
+                                       + " and cannot be called before its definition when streaming");
+                }
+
+                std::vector<const ast::Type*> types;
+
+                for(const auto& argument : call.arguments) {
+                    types.push_back(argument.get());
+                }
+
+                check_arguments(*function, call.offset, types, call.offsets);
+            }
+
+            calls_ahead_.erase(it);
+        }
+
+        static const ast::Type* make_type(ast::Program& prog, std::unique_ptr<ast::Type>&& type) {
+            prog.types.push_back(std::move(type));
+            return prog.types.back().get();
+        }
+
+        void declare_global(const ast::Entity& entity) {
+            if(auto global = dynamic_cast<const ast::GlobalEntity*>(&entity)) {
+                declare_variable(global->name, *global->type, global->offset);
+                check_calls_ahead(global->name, nullptr);
+            }
+            else if(auto structure = dynamic_cast<const ast::StructEntity*>(&entity)) {
+                if(!structs_.emplace(structure->name, Layout{structure, Layout::State::None}).second) {
+                    error(structure->offset, "redefinition of 'struct " + structure->name + "'");
+                }
+            }
+            else if(auto function = dynamic_cast<const ast::FunctionEntity*>(&entity)) {
+                resolve(*function->return_type);
+                std::uint32_t name = names_.intern(function->name);
+
+                if(symbols_.declared_in_current_scope(name)) {
+                    error(function->offset, "redefinition of '" + function->name + "'");
+                    return;
+                }
+
+                Symbol symbol;
+                symbol.function = function;
+                symbols_.declare(name, symbol);
+                check_calls_ahead(function->name, function);
+            }
+        }
+
+        /*
+         * Links the struct types of type to their definition, returns false
+         * if one of them is not defined.
+         */
+        bool resolve(const ast::Type& type) {
+            ast::TypeKind kind(type);
+
+            if(kind.kind == ast::TypeKind::Pointer) {
+                return resolve(*kind.pointed);
+            }
+
+            if(kind.kind == ast::TypeKind::Array) {
+                if(kind.count == 0) {
+                    error(type.offset, "zero-size array " + quote(type));
+                    return false;
+                }
+
+                if(ast::TypeKind(*kind.pointed).kind == ast::TypeKind::Void) {
+                    error(type.offset, "array of void " + quote(type));
+                    return false;
+                }
+
+                return resolve(*kind.pointed);
+            }
+
+            if(kind.kind != ast::TypeKind::Struct) {
+                return true;
+            }
+
+            const auto& structure = static_cast<const ast::StructType&>(type);
+            auto it = structs_.find(structure.name);
+
+            if(it == structs_.end()) {
+                error(type.offset, "unknown type 'struct " + structure.name + "'");
+                return false;
+            }
+
+            structure.definition = it->second.entity;
+            return true;
+        }
+
+        /*
+         * Computes the offsets of the fields of s, and before them the layout
+         * of the structs it contains.
+         */
+        void lay_out(const ast::StructEntity& s) {
+            Layout& state = structs_.at(s.name);
+
+            if(state.entity != &s || state.state != Layout::State::None) {
+                return;
+            }
+
+            state.state = Layout::State::InProgress;
+            ast::StructLayout layout;
+            bool too_large = false;
+
+            if(s.alignment != 0 && !power_of_two(s.alignment)) {
+                error(s.offset, "requested alignment " + std::to_string(s.alignment) + " is not a power of 2");
+            }
+            else {
+                layout.alignment = std::max<std::uint32_t>(layout.alignment, s.alignment);
+            }
+
+            for(std::size_t i = 0; i < s.fields.size(); ++i) {
+                const ast::StructField& field = s.fields[i];
+                layout.offsets.push_back(layout.size);
+
+                if(s.find(field.name) != static_cast<int>(i)) {
+                    error(field.offset, "duplicate member '" + field.name + "'");
+                }
+
+                if(!resolve(*field.type)) {
+                    continue;
+                }
+
+                ast::TypeKind kind(*field.type);
+
+                while(kind.kind == ast::TypeKind::Array) {
+                    kind = ast::TypeKind(*kind.pointed);
+                }
+
+                if(kind.kind == ast::TypeKind::Void) {
+                    error(field.offset, "field '" + field.name + "' declared void");
+                    continue;
+                }
+
+                if(kind.kind == ast::TypeKind::Struct) {
+                    lay_out(*kind.structure);
+
+                    if(structs_.at(kind.structure->name).state != Layout::State::Done) {
+                        error(field.offset, "field '" + field.name + "' has incomplete type " + quote(*field.type));
+                        continue;
+                    }
+                }
+
+                if(!check_size(*field.type)) {
+                    continue;
+                }
+
+                std::uint32_t align = s.packed ? 1 : field.type->alignment();
+
+                if(field.alignment != 0 && !power_of_two(field.alignment)) {
+                    error(field.offset, "requested alignment " + std::to_string(field.alignment)
+                                        + " is not a power of 2");
+                }
+                else {
+                    align = std::max(align, field.alignment);
+                }
+
+                std::uint64_t offset = round_up(layout.size, align);
+                std::uint64_t end = offset + field.type->size();
+
+                if(too_large || round_up(end, std::max(layout.alignment, align)) > max_object_size) {
+                    if(!too_large) {
+                        error(field.offset, "size of 'struct " + s.name + "' is too large");
+                    }
+
+                    too_large = true;
+                    continue;
+                }
+
+                layout.offsets.back() = offset;
+                layout.size = end;
+                layout.alignment = std::max(layout.alignment, align);
+            }
+
+            layout.size = round_up(layout.size, layout.alignment);
+            s.layout = std::move(layout);
+            state.state = Layout::State::Done;
+        }
+
+        static bool power_of_two(std::uint32_t n) {
+            return n != 0 && (n & (n - 1)) == 0;
+        }
+
+        static std::uint64_t round_up(std::uint64_t n, std::uint32_t align) {
+            return (n + align - 1) / align * align;
+        }
+
+        /*
+         * Reports an array type whose size goes past max_object_size, once
+         * the structs it contains are laid out.
+         */
+        bool check_size(const ast::Type& type) {
+            ast::TypeKind kind(type);
+
+            if(kind.kind != ast::TypeKind::Array) {
+                return true;
+            }
+
+            if(!check_size(*kind.pointed)) {
+                return false;
+            }
+
+            if(static_cast<std::uint64_t>(kind.pointed->size()) * kind.count > max_object_size) {
+                error(type.offset, "size of array " + quote(type) + " is too large");
+                return false;
+            }
+
+            return true;
+        }
+
+        void declare_variable(const std::string& name, const ast::Type& type, std::uint32_t offset) {
+            std::uint32_t id = names_.intern(name);
+            resolve(type);
+
+            if(ast::TypeKind(type).kind == ast::TypeKind::Void) {
+                error(offset, "variable '" + name + "' declared void");
+            }
+
+            if(symbols_.declared_in_current_scope(id)) {
+                error(offset, "redefinition of '" + name + "'");
+                return;
+            }
+
+            Symbol symbol;
+            symbol.type = &type;
+            symbol.local = function_ != nullptr;
+            symbols_.declare(id, symbol);
+        }
+
+        /*
+         * The type of the value of e: arrays decay to a pointer to their
+         * first element, e.resolved_type keeps the array type.
+         */
+        const ast::Type* check(const ast::Expression& e) {
+            e.accept(*this);
+
+            if(e.resolved_type == nullptr || ast::TypeKind(*e.resolved_type).kind != ast::TypeKind::Array) {
+                return e.resolved_type;
+            }
+
+            const ast::Type*& decayed = decayed_[e.resolved_type];
+
+            if(decayed == nullptr) {
+                const ast::Type* element = ast::TypeKind(*e.resolved_type).pointed;
+                decayed = make_type(prog_, std::make_unique<ast::PointerType>(element->clone(), 4));
+            }
+
+            return decayed;
+        }
+
+        void check_operand(const ast::AsmOperand& operand) {
+            const ast::Type* type = check(*operand.expression);
+
+            if(type != nullptr && !ast::TypeKind(*type).is_scalar()) {
+                error(operand.expression->offset, "asm operand of type " + quote(*type) + " is not a scalar");
+            }
+        }
+
+        /*
+         * Registers are counted once when named, and once per operand which
+         * may be given any of them.
+         */
+        static void count_register(char letter, std::string& registers, std::size_t& any) {
+            if(letter == 'r' || letter == 'm') {
+                ++any;
+            }
+            else if(letter != 'i' && letter != 'n' && registers.find(letter) == std::string::npos) {
+                registers += letter;
+            }
+        }
+
+        /*
+         * Loops whose counter is assigned lose their known range.
+         */
+        void assign(const ast::Expression* affected) {
+            if(auto variable = ident(affected)) {
+                const Symbol* symbol = symbols_.find(names_.intern(variable->name));
+
+                for(auto& counter : counters_) {
+                    counter.assigned = counter.assigned || (symbol != nullptr && counter.variable == symbol->type);
+                }
+            }
+        }
+
+        /*
+         * Recognizes for(i = low; i < n; i = i + k), with k > 0 and i a local
+         * int, so that i is between low and n - 1 in the body. The caller
+         * checks that the body does not assign i.
+         */
+        const ast::Type* find_counter(const ast::ForInstruction& i) {
+            std::string name;
+            const ast::IntegerExpression* low = nullptr;
+
+            if(auto declaration = dynamic_cast<const ast::DeclarationInstruction*>(i.initialization.get())) {
+                name = declaration->name;
+                low = integer(declaration->expression.get());
+            }
+            else if(auto instruction = dynamic_cast<const ast::ExpressionInstruction*>(i.initialization.get())) {
+                auto init = dynamic_cast<const ast::AffectationExpression*>(instruction->expression.get());
+
+                if(init != nullptr && ident(init->affected.get())) {
+                    name = ident(init->affected.get())->name;
+                    low = integer(init->value.get());
+                }
+            }
+
+            auto condition = dynamic_cast<const ast::BinaryExpression*>(i.condition.get());
+            auto step = dynamic_cast<const ast::AffectationExpression*>(i.step.get());
+
+            if(low == nullptr || condition == nullptr || step == nullptr) {
+                return nullptr;
+            }
+
+            auto increment = dynamic_cast<const ast::BinaryExpression*>(step->value.get());
+            const ast::IntegerExpression* bound = integer(condition->right.get());
+            bool strict = condition->op == ast::BinaryOperator::Inf;
+
+            if(!strict && condition->op != ast::BinaryOperator::InfEq) {
+                return nullptr;
+            }
+
+            if(bound == nullptr || !ident(condition->left.get()) || ident(condition->left.get())->name != name
+               || !ident(step->affected.get()) || ident(step->affected.get())->name != name
+               || increment == nullptr || increment->op != ast::BinaryOperator::Add
+               || !ident(increment->left.get()) || ident(increment->left.get())->name != name
+               || !integer(increment->right.get()) || integer(increment->right.get())->value <= 0) {
+                return nullptr;
+            }
+
+            const Symbol* symbol = symbols_.find(names_.intern(name));
+            std::int32_t high = strict ? bound->value - 1 : bound->value;
+
+            // i + k must not wrap around before the condition fails
+            if(symbol == nullptr || !symbol->local || symbol->type == nullptr
+               || ast::TypeKind(*symbol->type).kind != ast::TypeKind::Integer
+               || high > INT32_MAX - integer(increment->right.get())->value) {
+                return nullptr;
+            }
+
+            i.counter = name;
+            i.low = low->value;
+            i.high = high;
+            return symbol->type;
+        }
+
+        void check(const std::vector<std::unique_ptr<ast::Instruction>>& instructions) {
+            for(const auto& instr : instructions) {
+                instr->accept(*this);
+            }
+        }
+
+        void check_scope(const std::vector<std::unique_ptr<ast::Instruction>>& instructions) {
+            symbols_.enter();
+            check(instructions);
+            symbols_.leave();
+        }
+
+        void check_loop(const std::vector<std::unique_ptr<ast::Instruction>>& instructions) {
+            ++loops_;
+            check_scope(instructions);
+            --loops_;
+        }
+
+        void check_condition(const ast::Expression& e) {
+            const ast::Type* type = check(e);
+
+            if(type != nullptr && !ast::TypeKind(*type).is_scalar()) {
+                error(e.offset, "condition has type " + quote(*type));
+            }
+        }
+
+        void invalid_operand(const ast::UnaryExpression& e, const ast::Type& type) {
+            error(e.offset, std::string("invalid operand to unary '") + ast::UnaryExpression::operator_str(e.op)
+                            + "' (have " + quote(type) + ")");
+        }
+
+        void error(std::uint32_t offset, const std::string& message) {
+            errors_.emplace_back(offset, message);
+        }
+
+    private:
+        const ast::Type* int_;
+        const ast::Type* bool_;
+        const ast::Type* char_;
+        const ast::Type* null_;
+        const ast::Type* string_;
+
+        class Layout {
+            public:
+                enum class State : std::uint8_t {
+                    None,
+                    InProgress,     // a struct reaching itself contains itself
+                    Done,
+                };
+
+            public:
+                const ast::StructEntity* entity;
+                State state;
+        };
+
+        // structs live in their own namespace, and are all global
+        std::unordered_map<std::string, Layout> structs_;
+
+        ast::Program& prog_;
+        std::unordered_map<const ast::Type*, const ast::Type*> decayed_;
+        std::size_t kept_types_ = prog_.types.size();   // made by the constructor, kept by release()
+
+        class CallAhead {
+            public:
+                std::uint32_t offset;
+                std::vector<std::unique_ptr<ast::Type>> arguments;  // null where the argument has errors
+                std::vector<std::uint32_t> offsets;
+        };
+
+        bool streaming_ = false;
+        std::unordered_map<std::string, std::vector<CallAhead>> calls_ahead_;   // by function name
+
+        Interner& names_;
+        ScopedTable<Symbol> symbols_;
+        std::vector<Counter> counters_;
+        const ast::FunctionEntity* function_ = nullptr;
+        int loops_ = 0;     // loops enclosing the current instruction
+        std::vector<SemanticError> errors_;
+};
+
+} // namespace
+
+class StreamAnalyzer::Impl {
+    public:
+        Impl(ast::Program& declarations, Interner& names): analyzer(declarations, names) {}
+
+        Analyzer analyzer;
+};
+
+StreamAnalyzer::StreamAnalyzer(ast::Program& declarations, Interner& names):
+    impl_(std::make_unique<Impl>(declarations, names))
+{}
+
+StreamAnalyzer::~StreamAnalyzer() {}
+
+std::vector<SemanticError> StreamAnalyzer::analyze(const ast::Entity& entity) {
+    std::vector<SemanticError>& errors = impl_->analyzer.errors();
+    errors.clear();
+    impl_->analyzer.analyze(entity);
+
+    std::stable_sort(errors.begin(), errors.end(), [](const SemanticError& a, const SemanticError& b) {
+        return a.offset < b.offset;
+    });
+
+    return errors;
+}
+
+void StreamAnalyzer::release() {
+    impl_->analyzer.release();
+}
+
+std::vector<SemanticError> analyze(ast::Program& prog, Interner& names) {
+    Analyzer analyzer(prog, names);
+    analyzer.analyze(prog);
+
+    std::vector<SemanticError>& errors = analyzer.errors();
+    std::stable_sort(errors.begin(), errors.end(), [](const SemanticError& a, const SemanticError& b) {
+        return a.offset < b.offset;
+    });
+
+    return std::move(errors);
+}
+
+} // namespace microc
@@ -0,0 +1,71 @@
+#ifndef MICROC_SEMA_HPP
+#define MICROC_SEMA_HPP
+
+#include "ast.hpp"
+#include "symbols.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace microc {
+
+class SemanticError {
+    public:
+        SemanticError(std::uint32_t offset, const std::string& message):
+            offset(offset),
+            message(message)
+        {}
+
+    public:
+        std::uint32_t offset;
+        std::string message;
+};
+
+/*
+ * Checks that every name is declared and that expressions are well typed,
+ * and sets Expression::resolved_type on every expression. Global
+ * declarations are collected first, so a function may be called, or a
+ * struct used, before its definition. Struct types are linked to their
+ * definition, whose layout is computed here.
+ * Calls to undeclared functions are assumed to target assembly code
+ * returning an int, and are not checked.
+ *
+ * Names are interned in names, which may be shared between programs.
+ *
+ * Returns the errors found, in source order.
+ */
+std::vector<SemanticError> analyze(ast::Program& prog, Interner& names);
+
+/*
+ * analyze(), one entity at a time, for programs compiled as they are
+ * parsed. An entity may only use the globals and structs defined before
+ * it. A function may still be called before its definition: the call is
+ * typed as a call to assembly, and checked once the definition comes,
+ * which must then return int or void.
+ *
+ * Analyzed entities must outlive the analyzer, but the body of a function
+ * is no longer needed once it has been analyzed and compiled. The types
+ * made while checking it go to the types of declarations, until release().
+ */
+class StreamAnalyzer {
+    public:
+        StreamAnalyzer(ast::Program& declarations, Interner& names);
+        ~StreamAnalyzer();
+
+        // returns the errors found, by offset, with those of the calls
+        // made to entity before it
+        std::vector<SemanticError> analyze(const ast::Entity& entity);
+
+        // frees the types made for the functions analyzed so far
+        void release();
+
+    private:
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+};
+
+} // namespace microc
+
+#endif // MICROC_SEMA_HPP
@@ -0,0 +1,357 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace microc {
+
+namespace {
+
+const std::size_t chunk_size = 1 << 16;
+
+// longest string of a message, a bound on what a client can make us allocate
+const std::uint32_t max_string_size = 64 << 20;
+
+// waits between two accept() once out of descriptors or memory
+const std::chrono::milliseconds min_backoff(10);
+const std::chrono::milliseconds max_backoff(1000);
+
+class protocol_error : public std::exception {
+    public:
+        virtual const char* what() const noexcept { return "malformed message"; }
+};
+
+/*
+ * Buffered reads and writes of the strings messages are made of.
+ */
+class Channel {
+    public:
+        explicit Channel(int fd): fd_(fd) {}
+
+        ~Channel() {
+            close(fd_);
+        }
+
+        void write(const std::string& s) {
+            std::uint32_t size = s.size();
+
+            for(int i = 0; i < 4; ++i) {
+                out_ += static_cast<char>((size >> (8 * i)) & 0xff);
+            }
+
+            out_ += s;
+
+            if(out_.size() >= chunk_size) {
+                flush();
+            }
+        }
+
+        void flush() {
+            std::size_t sent = 0;
+
+            while(sent < out_.size()) {
+                ssize_t n = send(fd_, out_.data() + sent, out_.size() - sent, MSG_NOSIGNAL);
+
+                if(n < 0 && errno != EINTR) {
+                    throw std::system_error(errno, std::generic_category(), "cannot write to socket");
+                }
+
+                sent += n < 0 ? 0 : n;
+            }
+
+            out_.clear();
+        }
+
+        std::string read() {
+            unsigned char header[4];
+            receive(reinterpret_cast<char*>(header), 4);
+            std::uint32_t size = header[0] | header[1] << 8 | header[2] << 16 | static_cast<std::uint32_t>(header[3]) << 24;
+
+            if(size > max_string_size) {
+                throw protocol_error();
+            }
+
+            std::string s(size, '\0');
+            receive(&s[0], size);
+            return s;
+        }
+
+        std::uint32_t read_number() {
+            std::string s = read();
+            char* end;
+            unsigned long n = std::strtoul(s.c_str(), &end, 10);
+
+            if(s.empty() || *end != '\0') {
+                throw protocol_error();
+            }
+
+            return n;
+        }
+
+    private:
+        void receive(char* data, std::size_t size) {
+            while(size > 0) {
+                ssize_t n = recv(fd_, data, size, 0);
+
+                if(n == 0) {
+                    throw protocol_error();
+                }
+
+                if(n < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+
+                    throw std::system_error(errno, std::generic_category(), "cannot read from socket");
+                }
+
+                data += n;
+                size -= n;
+            }
+        }
+
+    private:
+        int fd_;
+        std::string out_;
+};
+
+sockaddr_un address(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(path.size() >= sizeof(addr.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+    }
+
+    std::strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+void handle(int fd, const RequestHandler& handler) {
+    Channel channel(fd);
+    CompileRequest request;
+    CompileResponse response;
+
+    try {
+        request.directory = channel.read();
+        std::uint32_t count = channel.read_number();
+
+        for(std::uint32_t i = 0; i < count; ++i) {
+            request.arguments.push_back(channel.read());
+        }
+
+        std::string kind = channel.read();
+
+        if(kind == "source") {
+            request.has_source = true;
+            request.source = channel.read();
+        }
+        else if(kind != "path") {
+            throw protocol_error();
+        }
+
+        request.input = channel.read();
+
+        response = handler(request);
+
+        for(std::size_t i = 0; i < response.output.size(); i += chunk_size) {
+            channel.write("output");
+            channel.write(response.output.substr(i, chunk_size));
+        }
+
+        // the program run may have written any amount to fd 2
+        for(std::size_t i = 0; i < response.diagnostics.size(); i += chunk_size) {
+            channel.write("diagnostics");
+            channel.write(response.diagnostics.substr(i, chunk_size));
+        }
+
+        for(const auto& usage : response.stack_usage) {
+            channel.write("stack");
+            channel.write(usage.name);
+
+            for(std::uint32_t n : {usage.offset, usage.frame, usage.depth}) {
+                channel.write(std::to_string(n));
+            }
+
+            channel.write(std::to_string(usage.bounded) + std::to_string(usage.external));
+        }
+
+        channel.write("run");
+        channel.write(std::to_string(response.exit_status));
+        channel.write("exit");
+        channel.write(std::to_string(response.code));
+        channel.flush();
+    }
+    catch(const std::exception&) {
+        // the client went away or does not speak the protocol
+    }
+}
+
+} // namespace
+
+void serve(const std::string& path, unsigned workers, const RequestHandler& handler) {
+    sockaddr_un addr = address(path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+
+    if(listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+       || listen(listener, 128) < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot listen on " + path);
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<int> pending;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    for(unsigned i = 0; i < std::max(workers, 1u); ++i) {
+        threads.emplace_back([&]() {
+            while(true) {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&]() { return !pending.empty() || stopping; });
+
+                if(pending.empty()) {
+                    return;
+                }
+
+                int fd = pending.front();
+                pending.pop_front();
+                lock.unlock();
+
+                handle(fd, handler);
+            }
+        });
+    }
+
+    std::chrono::milliseconds backoff(0);
+    int error = 0;
+
+    while(true) {
+        int fd = accept(listener, nullptr, nullptr);
+
+        if(fd < 0) {
+            error = errno;
+
+            if(error == EINTR || error == ECONNABORTED) {
+                continue;
+            }
+
+            // out of descriptors or memory until connections are closed
+            if(error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                backoff = std::min(std::max(2 * backoff, min_backoff), max_backoff);
+                std::this_thread::sleep_for(backoff);
+                continue;
+            }
+
+            break;
+        }
+
+        backoff = std::chrono::milliseconds(0);
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(fd);
+        ready.notify_one();
+    }
+
+    // the connections accepted are still handled
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    ready.notify_all();
+
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    close(listener);
+    throw std::system_error(error, std::generic_category(), "cannot accept connections on " + path);
+}
+
+CompileResponse send_request(const std::string& path, const CompileRequest& request) {
+    sockaddr_un addr = address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        int error = errno;
+
+        if(fd >= 0) {
+            close(fd);
+        }
+
+        throw std::system_error(error, std::generic_category(), "cannot connect to " + path);
+    }
+
+    Channel channel(fd);
+    channel.write(request.directory);
+    channel.write(std::to_string(request.arguments.size()));
+
+    for(const auto& argument : request.arguments) {
+        channel.write(argument);
+    }
+
+    channel.write(request.has_source ? "source" : "path");
+
+    if(request.has_source) {
+        channel.write(request.source);
+    }
+
+    channel.write(request.input);
+
+    channel.flush();
+
+    CompileResponse response;
+
+    try {
+        while(true) {
+            std::string kind = channel.read();
+
+            if(kind == "output") {
+                response.output += channel.read();
+            }
+            else if(kind == "diagnostics") {
+                response.diagnostics += channel.read();
+            }
+            else if(kind == "stack") {
+                StackUsage usage;
+                usage.name = channel.read();
+                usage.offset = channel.read_number();
+                usage.frame = channel.read_number();
+                usage.depth = channel.read_number();
+                std::string flags = channel.read();
+                usage.bounded = flags.size() == 2 && flags[0] == '1';
+                usage.external = flags.size() == 2 && flags[1] == '1';
+                response.stack_usage.push_back(usage);
+            }
+            else if(kind == "run") {
+                response.exit_status = channel.read_number();
+            }
+            else if(kind == "exit") {
+                response.code = channel.read_number();
+                return response;
+            }
+            else {
+                throw protocol_error();
+            }
+        }
+    }
+    catch(const protocol_error&) {
+        throw std::system_error(EPROTO, std::generic_category(), "bad response from " + path);
+    }
+}
+
+} // namespace microc
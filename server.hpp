@@ -0,0 +1,60 @@
+#ifndef MICROC_SERVER_HPP
+#define MICROC_SERVER_HPP
+
+#include "codegen.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace microc {
+
+class CompileRequest {
+    public:
+        std::string directory;              // of the client, relative paths are resolved from it
+        std::vector<std::string> arguments; // command line, without the program name
+        bool has_source = false;            // false if the server reads the file named in arguments
+        std::string source;
+        std::string input;                  // of the program run with --run
+};
+
+class CompileResponse {
+    public:
+        int code = 0;                       // exit status of the command line, that of the program aside
+        int exit_status = 0;                // of the program run with --run
+        std::string output;
+        std::string diagnostics;
+        std::vector<StackUsage> stack_usage;
+};
+
+typedef std::function<CompileResponse(const CompileRequest&)> RequestHandler;
+
+/*
+ * Serves compile requests on a Unix domain socket, never returning. A
+ * connection carries one request; connections are queued and handled by
+ * workers threads, each calling handler.
+ *
+ * Every message is a sequence of strings, each one a 32-bit little endian
+ * length followed by its bytes, at most 64 MiB of them. A request is its
+ * directory, its number of arguments, the arguments, "path" or "source"
+ * followed by the source, then the input of the program run. The response is a sequence of tagged
+ * records: "output" and "diagnostics" chunks, one "stack" record per
+ * function, "run" and the status of the program run, then "exit" and the
+ * status of the command line.
+ *
+ * Throws std::system_error if the socket cannot be created, or once it
+ * fails to accept connections for another reason than a lack of
+ * descriptors or memory, which only slows accepting down; the connections
+ * already accepted are handled first.
+ */
+void serve(const std::string& path, unsigned workers, const RequestHandler& handler);
+
+/*
+ * Sends request to the server listening on path, and waits for its
+ * response. Throws std::system_error if the server cannot be reached.
+ */
+CompileResponse send_request(const std::string& path, const CompileRequest& request);
+
+} // namespace microc
+
+#endif // MICROC_SERVER_HPP
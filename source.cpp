@@ -0,0 +1,69 @@
+#include "source.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+namespace microc {
+
+SourceLocation SourceMap::location(std::uint32_t offset) const {
+    if(line_starts_.empty()) {
+        build();
+    }
+
+    auto it = std::upper_bound(line_starts_.begin(), line_starts_.end(), offset);
+    int line = it - line_starts_.begin();
+    int column = offset - *(it - 1) + 1;
+    return SourceLocation{line, column};
+}
+
+void SourceMap::prepare() const {
+    if(line_starts_.empty()) {
+        build();
+    }
+}
+
+void SourceMap::build() const {
+    line_starts_.push_back(0);
+
+    std::ifstream file;
+    std::istream* in = in_;
+
+    if(!path_.empty()) {
+        file.open(path_);
+        in = &file;
+    }
+
+    if(in == nullptr) {
+        return;
+    }
+
+    // the scanner may still be reading from the stream, restore its state
+    std::ios::iostate state = in->rdstate();
+    in->clear();
+    std::streampos pos = in->tellg();
+
+    if(pos == std::streampos(-1) || !in->seekg(0)) {
+        // not seekable, every offset maps to the first line
+        in->clear(state);
+        return;
+    }
+
+    char buffer[4096];
+    std::uint32_t offset = 0;
+
+    while(in->read(buffer, sizeof(buffer)) || in->gcount() > 0) {
+        for(std::streamsize i = 0; i < in->gcount(); ++i) {
+            if(buffer[i] == '\n') {
+                line_starts_.push_back(offset + i + 1);
+            }
+        }
+
+        offset += in->gcount();
+    }
+
+    in->clear();
+    in->seekg(pos);
+    in->clear(state);
+}
+
+} // namespace microc
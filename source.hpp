@@ -0,0 +1,46 @@
+#ifndef MICROC_SOURCE_HPP
+#define MICROC_SOURCE_HPP
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace microc {
+
+class SourceLocation {
+    public:
+        int line;
+        int column;
+};
+
+/*
+ * Converts the 32-bit offsets stored in the AST into line and column numbers.
+ *
+ * The table of line starts is only built the first time a location is
+ * requested, by reading the input again, so that scanning and parsing pay
+ * nothing for it.
+ */
+class SourceMap {
+    public:
+        explicit SourceMap(std::istream& in): in_(&in) {}
+        explicit SourceMap(const std::string& path): in_(nullptr), path_(path) {}
+
+        SourceLocation location(std::uint32_t offset) const;
+
+        // builds the table now, after which location() may be called from
+        // any thread, even while the input is being scanned
+        void prepare() const;
+
+    private:
+        void build() const;
+
+    private:
+        std::istream* in_;
+        std::string path_;
+        mutable std::vector<std::uint32_t> line_starts_;
+};
+
+} // namespace microc
+
+#endif // MICROC_SOURCE_HPP
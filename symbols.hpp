@@ -0,0 +1,141 @@
+#ifndef MICROC_SYMBOLS_HPP
+#define MICROC_SYMBOLS_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace microc {
+
+/*
+ * Maps every distinct name to a small integer, starting at 1. An interner
+ * may be shared by several programs: clearing it keeps its buckets.
+ */
+class Interner {
+    public:
+        std::uint32_t intern(const std::string& name) {
+            auto it = ids_.emplace(name, ids_.size() + 1).first;
+            return it->second;
+        }
+
+        std::size_t size() const { return ids_.size(); }
+        void clear() { ids_.clear(); }
+
+    private:
+        std::unordered_map<std::string, std::uint32_t> ids_;
+};
+
+/*
+ * Symbol table for nested scopes, keyed by interned names.
+ *
+ * Bindings live in a single open-addressing table with linear probing.
+ * Declaring a name saves its previous binding in an undo log, and leaving a
+ * scope replays the log down to the mark taken when entering it, so entering
+ * and leaving a scope costs as much as the declarations it contains.
+ * Entries are never removed: the table grows with the number of distinct
+ * names, not with the nesting depth.
+ */
+template<typename T>
+class ScopedTable {
+    public:
+        ScopedTable(): entries_(16) {}
+
+        void enter() {
+            marks_.push_back(undo_.size());
+        }
+
+        void leave() {
+            std::size_t mark = marks_.back();
+            marks_.pop_back();
+
+            while(undo_.size() > mark) {
+                Undo& undo = undo_.back();
+                Entry& entry = entries_[probe(undo.name)];
+                entry.bound = undo.bound;
+                entry.depth = undo.depth;
+                entry.value = std::move(undo.value);
+                undo_.pop_back();
+            }
+        }
+
+        // nullptr if the name is not bound
+        const T* find(std::uint32_t name) const {
+            const Entry& entry = entries_[probe(name)];
+            return entry.name == name && entry.bound ? &entry.value : nullptr;
+        }
+
+        bool declared_in_current_scope(std::uint32_t name) const {
+            const Entry& entry = entries_[probe(name)];
+            return entry.name == name && entry.bound && entry.depth == marks_.size();
+        }
+
+        void declare(std::uint32_t name, T value) {
+            if(2 * (used_ + 1) > entries_.size()) {
+                grow();
+            }
+
+            Entry& entry = entries_[probe(name)];
+
+            if(entry.name != name) {
+                entry.name = name;
+                ++used_;
+            }
+
+            undo_.push_back(Undo{name, entry.bound, entry.depth, std::move(entry.value)});
+            entry.bound = true;
+            entry.depth = marks_.size();
+            entry.value = std::move(value);
+        }
+
+    private:
+        class Entry {
+            public:
+                std::uint32_t name = 0;     // 0 for a free entry
+                bool bound = false;
+                std::uint32_t depth = 0;
+                T value = T();
+        };
+
+        class Undo {
+            public:
+                std::uint32_t name;
+                bool bound;
+                std::uint32_t depth;
+                T value;
+        };
+
+        // index of the entry of name, or of the free entry where it goes
+        std::size_t probe(std::uint32_t name) const {
+            std::size_t mask = entries_.size() - 1;
+            std::size_t i = (name * 2654435769u) & mask;
+
+            while(entries_[i].name != 0 && entries_[i].name != name) {
+                i = (i + 1) & mask;
+            }
+
+            return i;
+        }
+
+        void grow() {
+            std::vector<Entry> old(entries_.size() * 2);
+            std::swap(old, entries_);
+
+            for(auto& entry : old) {
+                if(entry.name != 0) {
+                    entries_[probe(entry.name)] = std::move(entry);
+                }
+            }
+        }
+
+    private:
+        std::vector<Entry> entries_;    // size is a power of two
+        std::vector<Undo> undo_;
+        std::vector<std::size_t> marks_;
+        std::size_t used_ = 0;
+};
+
+} // namespace microc
+
+#endif // MICROC_SYMBOLS_HPP
@@ -0,0 +1,400 @@
+#include "compiler.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Regression tests, built and run by `make check`.
+ *
+ * Each case is a program run by the interpreter, with and without
+ * optimization, whose output and exit status must be those expected, or
+ * which must be rejected or trap with the diagnostic expected.
+ *
+ * The division by constants, strength reduced when optimizing, is then
+ * compared with the division of the host over random dividends and a wide
+ * range of divisors.
+ *
+ * Last, a module and a program importing it are compiled to assembly,
+ * assembled and linked with the x86 as and ld, and run.
+ */
+
+namespace {
+
+using microc::CompileOptions;
+using microc::CompileResult;
+using microc::CompileStatus;
+
+class Case {
+    public:
+        const char* name;
+        const char* source;
+        const char* input;      // read by the program
+        const char* output;     // written by the program
+        int exit_status;
+        const char* error;      // part of the diagnostic of an error or trap, null if the program must run
+};
+
+const Case cases[] = {
+    {"write and read in bounds",
+     "char buffer[4];\n"
+     "int main() {\n"
+     "    buffer[0] = 'o';\n"
+     "    buffer[1] = 'k';\n"
+     "    write(1, buffer, 2);\n"
+     "    write(1, buffer, 0);\n"
+     "    return read(0, buffer, 4);\n"
+     "}\n",
+     "abc", "ok", 3, nullptr},
+    // the end of the buffer wraps around to an address in bounds
+    {"write with a negative count",
+     "char buffer[100];\n"
+     "int main() {\n"
+     "    return write(1, buffer + 50, -10);\n"
+     "}\n",
+     "", "", 0, "invalid memory access"},
+    {"read with a negative count",
+     "char buffer[100];\n"
+     "int main() {\n"
+     "    return read(0, buffer + 50, -10);\n"
+     "}\n",
+     "abc", "", 0, "invalid memory access"},
+    {"write with a huge count",
+     "char buffer[100];\n"
+     "int main() {\n"
+     "    return write(1, buffer, 0x7fffffff);\n"
+     "}\n",
+     "", "", 0, "invalid memory access"},
+    // the value of an assignment is that of the char assigned
+    {"assignment to a char",
+     "int assign(int n) {\n"
+     "    char c;\n"
+     "    int x = (c = n + 44);\n"
+     "    return x;\n"
+     "}\n"
+     "int main() {\n"
+     "    char c;\n"
+     "    int y = 0;\n"
+     "    y = (c = 200);\n"
+     "    return assign(256) * 1000 + y;\n"
+     "}\n",
+     "", "", 43944, nullptr},
+    // sizes and offsets are ints
+    {"array of 4 GiB",
+     "int a[1073741824];\n"
+     "int main() {\n"
+     "    return sizeof(a);\n"
+     "}\n",
+     "", "", 0, "size of array 'int[1073741824]' is too large"},
+    {"struct of 4 GiB",
+     "struct s {\n"
+     "    int a[536870911];\n"
+     "    int b[536870911];\n"
+     "};\n"
+     "int main() {\n"
+     "    return sizeof(struct s);\n"
+     "}\n",
+     "", "", 0, "size of 'struct s' is too large"},
+    {"dimension past 32 bits",
+     "int a[30000000000];\n"
+     "int main() {\n"
+     "    return 0;\n"
+     "}\n",
+     "", "", 0, "integer constant too large"},
+    {"globals too large to run",
+     "char a[2000000000];\n"
+     "char b[2000000000];\n"
+     "int main() {\n"
+     "    return 0;\n"
+     "}\n",
+     "", "", 0, "global variables too large to run"},
+};
+
+bool contains(const std::vector<std::string>& diagnostics, const std::string& part) {
+    for(const auto& diagnostic : diagnostics) {
+        if(diagnostic.find(part) != std::string::npos) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool check(const Case& test, bool optimize) {
+    std::istringstream input(test.input);
+    CompileOptions options;
+    options.run = true;
+    options.input = &input;
+    options.codegen.lowering.optimize = optimize;
+
+    CompileResult result = microc::compile(test.source, options);
+    bool passed;
+
+    if(test.error != nullptr) {
+        passed = result.status != CompileStatus::Success && contains(result.diagnostics, test.error);
+    }
+    else {
+        passed = result.status == CompileStatus::Success && result.exit_status == test.exit_status;
+    }
+
+    passed = passed && result.output == test.output;
+
+    if(!passed) {
+        std::cerr << "FAIL: " << test.name << (optimize ? " (optimized)" : "") << std::endl
+                  << "status " << static_cast<int>(result.status) << ", exit " << result.exit_status << std::endl;
+
+        for(const auto& diagnostic : result.diagnostics) {
+            std::cerr << diagnostic << std::endl;
+        }
+
+        std::cerr << "output:" << std::endl << result.output << std::endl;
+    }
+
+    return passed;
+}
+
+// what the program writes on fd 2 goes to the error stream of the options, not std::cerr
+bool check_error_stream() {
+    std::ostringstream error;
+    CompileOptions options;
+    options.run = true;
+    options.error = &error;
+
+    CompileResult result = microc::compile("char s[4];\n"
+                                           "int main() {\n"
+                                           "    s[0] = 'o';\n"
+                                           "    s[1] = 'k';\n"
+                                           "    s[2] = '!';\n"
+                                           "    write(1, s, 2);\n"
+                                           "    return write(2, s + 2, 1);\n"
+                                           "}\n", options);
+
+    if(result.status != CompileStatus::Success || result.exit_status != 1 || result.output != "ok"
+       || error.str() != "!") {
+        std::cerr << "FAIL: write to fd 2" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// as a microc expression, INT_MIN having no literal
+std::string literal(std::int32_t value) {
+    return value == INT_MIN ? "(-2147483647 - 1)" : std::to_string(value);
+}
+
+/*
+ * Divides dividends loaded from memory, so that they are not constants,
+ * by divisor, the program returning the index of the first wrong quotient
+ * or remainder, plus one.
+ */
+bool check_division(std::int32_t divisor, const std::vector<std::int32_t>& dividends) {
+    std::ostringstream o;
+    std::size_t n = dividends.size();
+    o << "int xs[" << n << "];\nint qs[" << n << "];\nint rs[" << n << "];\n\nint main() {\n";
+
+    for(std::size_t i = 0; i < n; ++i) {
+        std::int32_t x = dividends[i];
+        o << "    xs[" << i << "] = " << literal(x) << ";\n"
+          << "    qs[" << i << "] = " << literal(x / divisor) << ";\n"
+          << "    rs[" << i << "] = " << literal(x % divisor) << ";\n";
+    }
+
+    o << "    for(int i = 0; i < " << n << "; i = i + 1) {\n"
+      << "        if(xs[i] / " << literal(divisor) << " != qs[i] || xs[i] % " << literal(divisor) << " != rs[i]) {\n"
+      << "            return i + 1;\n"
+      << "        }\n"
+      << "    }\n"
+      << "    return 0;\n"
+      << "}\n";
+
+    CompileOptions options;
+    options.run = true;
+    CompileResult result = microc::compile(o.str(), options);
+
+    if(result.status != CompileStatus::Success || result.exit_status != 0) {
+        std::cerr << "FAIL: division by " << divisor;
+
+        if(result.status == CompileStatus::Success) {
+            std::cerr << " of " << dividends[result.exit_status - 1];
+        }
+
+        std::cerr << std::endl;
+
+        for(const auto& diagnostic : result.diagnostics) {
+            std::cerr << diagnostic << std::endl;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Divisors of every magnitude and sign, powers of two and INT_MIN among
+ * them; dividends at the edges of the range, around multiples of the
+ * divisor, and random.
+ */
+unsigned check_divisions(unsigned& total) {
+    std::mt19937 random(20260101);
+    std::vector<std::int32_t> divisors = {INT_MIN, INT_MAX, INT_MIN + 1};
+
+    for(int k = 0; k < 31; ++k) {
+        divisors.push_back(1 << k);
+        divisors.push_back(-(1 << k));
+    }
+
+    for(std::int32_t d = 3; d <= 100; ++d) {
+        divisors.push_back(d);
+        divisors.push_back(-d);
+    }
+
+    for(int i = 0; i < 200; ++i) {
+        // spread over every magnitude, not only the large ones
+        std::int32_t d = static_cast<std::int32_t>(random()) >> (random() % 31);
+        divisors.push_back(d != 0 ? d : 7);
+    }
+
+    unsigned failed = 0;
+
+    for(std::int32_t divisor : divisors) {
+        std::vector<std::int32_t> dividends = {0, 1, -1, 2, -2, INT_MAX, INT_MIN, INT_MAX - 1, INT_MIN + 1};
+        std::int32_t multiple = divisor * static_cast<std::int32_t>(INT_MAX / divisor);
+
+        for(std::int32_t m : {divisor, multiple}) {
+            for(std::int32_t delta : {-1, 0, 1}) {
+                for(std::int32_t sign : {1, -1}) {
+                    std::int64_t x = sign * (static_cast<std::int64_t>(m) + delta);
+
+                    if(x >= INT_MIN && x <= INT_MAX) {
+                        dividends.push_back(static_cast<std::int32_t>(x));
+                    }
+                }
+            }
+        }
+
+        for(int i = 0; i < 32; ++i) {
+            dividends.push_back(static_cast<std::int32_t>(random()) >> (random() % 31));
+        }
+
+        // the one quotient which overflows
+        if(divisor == -1) {
+            dividends.erase(std::remove(dividends.begin(), dividends.end(), INT_MIN), dividends.end());
+        }
+
+        ++total;
+        failed += !check_division(divisor, dividends);
+    }
+
+    return failed;
+}
+
+const char* const module_source =
+    "int addmul(int a, int b, int c) {\n"
+    "    return a * b + c;\n"
+    "}\n"
+    "int scale(int x, int k) {\n"
+    "    return x * k;\n"
+    "}\n"
+    "int twice(int x) {\n"
+    "    return scale(x, 2);\n"
+    "}\n";
+
+// 50 + 3 + 10 = 63, if the module's functions take their arguments as passed
+const char* const importer_source =
+    "asm(\".globl _start\\n_start:\\n\\tcall main\\n\\tmovl %eax, %ebx\\n\\tmovl $1, %eax\\n\\tint $0x80\");\n"
+    "int main() {\n"
+    "    return addmul(6, 7, 8) + scale(1, 3) + twice(5);\n"
+    "}\n";
+
+bool assemble(const std::string& directory, const std::string& name, const CompileOptions& options,
+              const std::string& source) {
+    CompileResult result = microc::compile(source, options);
+
+    for(const auto& diagnostic : result.diagnostics) {
+        std::cerr << name << ": " << diagnostic << std::endl;
+    }
+
+    std::ofstream(directory + "/" + name + ".s") << result.output;
+    std::string command = "as --32 -o " + directory + "/" + name + ".o " + directory + "/" + name + ".s";
+    return result.status == CompileStatus::Success && std::system(command.c_str()) == 0;
+}
+
+/*
+ * The functions of a module may be called from its importers, which only
+ * know their prototypes: with -mregparm, they must still take their
+ * arguments on the stack, and none may be specialized for the calls the
+ * module makes.
+ */
+bool check_module(bool optimize) {
+    char directory[] = "/tmp/microc-check.XXXXXX";
+
+    if(mkdtemp(directory) == nullptr) {
+        std::cerr << "FAIL: cannot create a temporary directory" << std::endl;
+        return false;
+    }
+
+    std::string d = directory;
+    std::ofstream(d + "/shared.c") << module_source;
+
+    CompileOptions options;
+    options.codegen.regparm = 3;
+    options.codegen.lowering.optimize = optimize;
+    bool passed = assemble(d, "shared", options, module_source);
+
+    options.imports.push_back(d + "/shared.c");
+    passed = passed && assemble(d, "prog", options, importer_source);
+
+    std::string link = "ld -m elf_i386 -o " + d + "/prog " + d + "/prog.o " + d + "/shared.o";
+    int status = passed && std::system(link.c_str()) == 0 ? std::system((d + "/prog").c_str()) : -1;
+    passed = WIFEXITED(status) && WEXITSTATUS(status) == 63;
+
+    if(!passed) {
+        std::cerr << "FAIL: module with -mregparm=3" << (optimize ? " (optimized)" : "") << std::endl;
+    }
+
+    for(const char* file : {"shared.c", "shared.c.mcm", "shared.s", "shared.o", "prog.s", "prog.o", "prog"}) {
+        std::remove((d + "/" + file).c_str());
+    }
+
+    rmdir(directory);
+    return passed;
+}
+
+} // namespace
+
+int main() {
+    unsigned failed = 0, total = 0;
+
+    for(const Case& test : cases) {
+        for(bool optimize : {false, true}) {
+            ++total;
+            failed += !check(test, optimize);
+        }
+    }
+
+    ++total;
+    failed += !check_error_stream();
+
+    failed += check_divisions(total);
+
+    for(bool optimize : {false, true}) {
+        ++total;
+        failed += !check_module(optimize);
+    }
+
+    std::cout << total - failed << "/" << total << " passed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,578 @@
+#include "vectorize.hpp"
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace microc {
+
+namespace {
+
+const std::int32_t vector_bytes = 16;
+const std::size_t max_body_blocks = 4;
+
+/*
+ * The element of an array at the index of the loop: base is a slot, a
+ * symbol, or a register of the loop holding a pointer loaded from a slot.
+ */
+class Access {
+    public:
+        ir::Operand base;
+        std::string symbol;
+        const ir::Instr* pointer = nullptr;
+        std::int32_t disp = 0;
+        std::uint8_t size = 0;
+
+        bool same_object(const Access& o) const {
+            if(base.kind != o.base.kind) {
+                return false;
+            }
+
+            switch(base.kind) {
+                case ir::Operand::Kind::Slot:   return base.value == o.base.value;
+                case ir::Operand::Kind::Symbol: return symbol == o.symbol;
+                default:                        return pointer->a == o.pointer->a;
+            }
+        }
+
+        // whether writing one never changes the other
+        bool independent(const Access& o) const {
+            if(same_object(o)) {
+                return disp == o.disp;
+            }
+
+            return base.kind != ir::Operand::Kind::Register && o.base.kind != ir::Operand::Kind::Register;
+        }
+};
+
+/*
+ * What a register of the loop holds.
+ */
+class Value {
+    public:
+        enum class Kind : std::uint8_t {
+            Index,          // the induction variable
+            Next,           // the induction variable plus 1
+            Invariant,      // loaded from a slot the loop does not write
+            Element,
+            Operation,
+        };
+
+    public:
+        Kind kind = Kind::Invariant;
+        Access access;      // Element
+};
+
+// an operand of the operation of the loop
+class Term {
+    public:
+        bool array = false;
+        Access access;          // array
+        ir::Operand value;      // otherwise: an immediate or an Invariant register
+};
+
+class Kernel {
+    public:
+        std::uint32_t header = 0;
+        std::uint32_t latch = 0;
+        std::uint32_t slot = 0;         // of the induction variable
+        ir::Operand bound;
+        std::uint8_t size = 0;
+        Access store;
+        ir::Opcode op = ir::Opcode::Copy;
+        Term terms[2];
+        std::unordered_map<ir::Register, const ir::Instr*> loads;   // of the Invariant registers and bound
+};
+
+class Matcher {
+    public:
+        Matcher(const ir::Function& function):
+            function_(function),
+            predecessors_(function.blocks.size()),
+            escaped_(function.escaped_slots())
+        {
+            for(const auto& block : function.blocks) {
+                if(block.terminated()) {
+                    for(std::uint32_t succ : block.successors()) {
+                        predecessors_[succ].push_back(block.id);
+                    }
+                }
+            }
+        }
+
+        /*
+         * The header loads i and n, the body is a chain of blocks back to
+         * it, storing the element then i + 1 into i.
+         */
+        bool match(std::uint32_t header, Kernel& kernel) {
+            const ir::Block& block = function_.blocks[header];
+
+            if(header == 0 || !block.terminated() || block.terminator().op != ir::Opcode::Branch
+               || block.terminator().cond != ir::Cond::Lt || block.instrs.size() > 3) {
+                return false;
+            }
+
+            const ir::Instr& branch = block.terminator();
+            std::unordered_map<ir::Register, const ir::Instr*> loads;
+
+            for(std::size_t i = 0; i + 1 < block.instrs.size(); ++i) {
+                const ir::Instr& instr = block.instrs[i];
+
+                if(!is_scalar_load(instr)) {
+                    return false;
+                }
+
+                loads[instr.dst] = &instr;
+            }
+
+            auto induction = branch.a.is_register() ? loads.find(branch.a.value) : loads.end();
+
+            if(induction == loads.end() || induction->second->size != 4) {
+                return false;
+            }
+
+            kernel = Kernel();
+            kernel.header = header;
+            kernel.slot = induction->second->a.value;
+            kernel.bound = branch.b;
+
+            if(branch.b.is_register()) {
+                auto bound = loads.find(branch.b.value);
+
+                if(bound == loads.end() || bound->second->a.value == static_cast<std::int32_t>(kernel.slot)) {
+                    return false;
+                }
+
+                kernel.loads[branch.b.value] = bound->second;
+            }
+            else if(!branch.b.is_immediate()) {
+                return false;
+            }
+
+            std::vector<std::uint32_t> chain;
+
+            for(std::uint32_t b = branch.targets[0];;) {
+                const ir::Block& body = function_.blocks[b];
+
+                if(b == header || b == 0 || predecessors_[b].size() != 1 || chain.size() == max_body_blocks
+                   || !body.terminated() || body.terminator().op != ir::Opcode::Jump) {
+                    return false;
+                }
+
+                chain.push_back(b);
+
+                if(body.terminator().targets[0] == header) {
+                    break;
+                }
+
+                b = body.terminator().targets[0];
+            }
+
+            kernel.latch = chain.back();
+            return match_body(chain, induction->first, kernel);
+        }
+
+    private:
+        bool is_scalar_load(const ir::Instr& instr) const {
+            return instr.op == ir::Opcode::Load && instr.a.kind == ir::Operand::Kind::Slot
+                   && instr.index.is_none() && instr.disp == 0 && !escaped_[instr.a.value];
+        }
+
+        // index is the register of i in the header, which the body may use
+        // rather than loading i again
+        bool match_body(const std::vector<std::uint32_t>& chain, ir::Register index, Kernel& kernel) {
+            std::unordered_map<ir::Register, Value> values;
+            ir::Register operation = ir::no_register;
+            bool stored = false;
+            bool updated = false;
+
+            values[index].kind = Value::Kind::Index;
+
+            if(kernel.bound.is_register()) {
+                values[kernel.bound.value].kind = Value::Kind::Invariant;
+            }
+
+            for(std::uint32_t b : chain) {
+                const ir::Block& block = function_.blocks[b];
+
+                for(std::size_t i = 0; i + 1 < block.instrs.size(); ++i) {
+                    const ir::Instr& instr = block.instrs[i];
+                    Value value;
+
+                    // the update of i comes last
+                    if(updated) {
+                        return false;
+                    }
+
+                    switch(instr.op) {
+                        case ir::Opcode::Load:
+                            if(is_scalar_load(instr)) {
+                                if(instr.a.value == static_cast<std::int32_t>(kernel.slot)) {
+                                    value.kind = Value::Kind::Index;
+                                }
+                                else {
+                                    kernel.loads[instr.dst] = &instr;
+                                }
+                            }
+                            else if(element(instr, values, kernel, value.access)) {
+                                value.kind = Value::Kind::Element;
+                            }
+                            else {
+                                return false;
+                            }
+
+                            values[instr.dst] = value;
+                            break;
+                        case ir::Opcode::Add:
+                            if(is(values, instr.a, Value::Kind::Index) && instr.b == ir::Operand::imm(1)) {
+                                value.kind = Value::Kind::Next;
+                                values[instr.dst] = value;
+                                break;
+                            }
+                            // fall through
+                        case ir::Opcode::Sub:
+                        case ir::Opcode::And:
+                        case ir::Opcode::Or:
+                        case ir::Opcode::Xor:
+                            if(operation != ir::no_register || !term(instr.a, values, kernel.terms[0])
+                               || !term(instr.b, values, kernel.terms[1])) {
+                                return false;
+                            }
+
+                            kernel.op = instr.op;
+                            operation = instr.dst;
+                            value.kind = Value::Kind::Operation;
+                            values[instr.dst] = value;
+                            break;
+                        case ir::Opcode::Store:
+                            if(instr.a == ir::Operand::slot(kernel.slot) && instr.index.is_none() && instr.disp == 0) {
+                                if(instr.size != 4 || !is(values, instr.b, Value::Kind::Next)) {
+                                    return false;
+                                }
+
+                                updated = true;
+                            }
+                            else if(stored || !element(instr, values, kernel, kernel.store)) {
+                                return false;
+                            }
+                            else if(operation != ir::no_register) {
+                                if(instr.b != ir::Operand::reg(operation)) {
+                                    return false;
+                                }
+
+                                stored = true;
+                            }
+                            else if(!term(instr.b, values, kernel.terms[0])) {
+                                return false;
+                            }
+                            else {
+                                stored = true;
+                            }
+                            break;
+                        default:
+                            return false;
+                    }
+                }
+            }
+
+            if(!stored || !updated) {
+                return false;
+            }
+
+            kernel.size = kernel.store.size;
+
+            for(const auto& term : kernel.terms) {
+                // an iteration would read what an other one writes
+                if(term.array && (term.access.size != kernel.size
+                                  || (term.access.same_object(kernel.store) && term.access.disp != kernel.store.disp))) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool is(const std::unordered_map<ir::Register, Value>& values, const ir::Operand& op, Value::Kind kind) const {
+            auto it = op.is_register() ? values.find(op.value) : values.end();
+            return it != values.end() && it->second.kind == kind;
+        }
+
+        bool element(const ir::Instr& instr, const std::unordered_map<ir::Register, Value>& values, const Kernel& kernel,
+                     Access& access) const {
+            if(!is(values, instr.index, Value::Kind::Index) || instr.scale != instr.size
+               || (instr.size != 1 && instr.size != 4)) {
+                return false;
+            }
+
+            access.base = instr.a;
+            access.symbol = instr.symbol;
+            access.disp = instr.disp;
+            access.size = instr.size;
+
+            switch(instr.a.kind) {
+                case ir::Operand::Kind::Slot:
+                case ir::Operand::Kind::Symbol:
+                    return true;
+                case ir::Operand::Kind::Register: {
+                    auto it = kernel.loads.find(instr.a.value);
+
+                    if(!is(values, instr.a, Value::Kind::Invariant) || it == kernel.loads.end()) {
+                        return false;
+                    }
+
+                    access.pointer = it->second;
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        bool term(const ir::Operand& op, const std::unordered_map<ir::Register, Value>& values, Term& term) const {
+            term = Term();
+
+            if(op.is_immediate()) {
+                term.value = op;
+                return true;
+            }
+
+            auto it = op.is_register() ? values.find(op.value) : values.end();
+
+            if(it == values.end()) {
+                return false;
+            }
+            else if(it->second.kind == Value::Kind::Element) {
+                term.array = true;
+                term.access = it->second.access;
+                return true;
+            }
+            else if(it->second.kind == Value::Kind::Invariant) {
+                term.value = op;
+                return true;
+            }
+
+            return false;
+        }
+
+    private:
+        const ir::Function& function_;
+        std::vector<std::vector<std::uint32_t>> predecessors_;
+        std::vector<bool> escaped_;
+};
+
+/*
+ * The value to fill the elements with through __microc_memset, if it is
+ * the same for all their bytes.
+ */
+bool fills_bytes(const Kernel& kernel) {
+    const Term& term = kernel.terms[0];
+
+    if(kernel.op != ir::Opcode::Copy || term.array) {
+        return false;
+    }
+
+    std::uint32_t v = term.value.value;
+    return kernel.size == 1 || (term.value.is_immediate() && v == (v & 0xff) * 0x01010101u);
+}
+
+/*
+ * Builds the code running before the loop, in new blocks, the loop being
+ * entered from the last one.
+ */
+class Preheader {
+    public:
+        Preheader(ir::Function& function, const Kernel& kernel):
+            function_(function),
+            kernel_(kernel),
+            offset_(function.blocks[kernel.header].terminator().offset),
+            block_(function.new_block())
+        {}
+
+        std::uint32_t first() const { return block_; }
+
+        void emit(ir::Instr instr) {
+            instr.offset = offset_;
+            function_.blocks[block_].instrs.push_back(std::move(instr));
+        }
+
+        ir::Operand binary(ir::Opcode op, const ir::Operand& a, const ir::Operand& b) {
+            ir::Instr instr(op);
+            instr.dst = function_.new_register();
+            instr.a = a;
+            instr.b = b;
+            emit(instr);
+            return ir::Operand::reg(instr.dst);
+        }
+
+        // the loop, as it was, takes over if (a cond b)
+        void unless(ir::Cond cond, const ir::Operand& a, const ir::Operand& b) {
+            std::uint32_t next = function_.new_block();
+            ir::Instr branch(ir::Opcode::Branch);
+            branch.cond = cond;
+            branch.a = a;
+            branch.b = b;
+            branch.targets[0] = kernel_.header;
+            branch.targets[1] = next;
+            emit(branch);
+            block_ = next;
+        }
+
+        // the value of an invariant operand of the loop, loaded again here
+        ir::Operand value(const ir::Operand& op) {
+            if(!op.is_register()) {
+                return op;
+            }
+
+            auto it = values_.find(op.value);
+
+            if(it != values_.end()) {
+                return it->second;
+            }
+
+            ir::Instr load = *kernel_.loads.at(op.value);
+            load.dst = function_.new_register();
+            emit(load);
+            return values_[op.value] = ir::Operand::reg(load.dst);
+        }
+
+        ir::Operand address(const Access& access, const ir::Operand& index) {
+            ir::Instr instr(ir::Opcode::Address);
+            instr.dst = function_.new_register();
+            instr.a = value(access.base);
+            instr.symbol = access.symbol;
+            instr.disp = access.disp;
+            instr.index = index;
+            instr.scale = access.size;
+            emit(instr);
+            return ir::Operand::reg(instr.dst);
+        }
+
+    private:
+        ir::Function& function_;
+        const Kernel& kernel_;
+        std::uint32_t offset_;
+        std::uint32_t block_;
+        std::unordered_map<ir::Register, ir::Operand> values_;
+};
+
+void transform(ir::Function& function, const Kernel& kernel) {
+    std::uint32_t blocks = function.blocks.size();
+    Preheader pre(function, kernel);
+
+    // the loop is entered through the new blocks
+    for(std::uint32_t b = 0; b < blocks; ++b) {
+        ir::Block& block = function.blocks[b];
+
+        if(b != kernel.latch && block.terminated()
+           && (block.terminator().op == ir::Opcode::Jump || block.terminator().op == ir::Opcode::Branch)) {
+            for(auto& target : block.instrs.back().targets) {
+                target = target == kernel.header ? pre.first() : target;
+            }
+        }
+    }
+
+    ir::Instr load(ir::Opcode::Load);
+    load.dst = function.new_register();
+    load.a = ir::Operand::slot(kernel.slot);
+    pre.emit(load);
+
+    ir::Operand first = ir::Operand::reg(load.dst);
+    ir::Operand bound = pre.value(kernel.bound);
+    pre.unless(ir::Cond::Ge, first, bound);
+
+    ir::Operand elements = pre.binary(ir::Opcode::Sub, bound, first);
+    bool fill = fills_bytes(kernel);
+    bool copy = kernel.op == ir::Opcode::Copy && kernel.terms[0].array;
+
+    // the loop does the remaining iterations
+    if(!fill && !copy) {
+        pre.unless(ir::Cond::Below, elements, ir::Operand::imm(vector_bytes / kernel.size));
+        elements = pre.binary(ir::Opcode::And, elements, ir::Operand::imm(-vector_bytes / kernel.size));
+    }
+
+    ir::Operand bytes = kernel.size == 1 ? elements : pre.binary(ir::Opcode::Shl, elements, ir::Operand::imm(2));
+    ir::Operand dst = pre.address(kernel.store, first);
+    std::vector<ir::Operand> args;
+    std::vector<ir::Operand> overlapping;
+
+    for(std::size_t i = 0; i < (kernel.op == ir::Opcode::Copy ? 1 : 2); ++i) {
+        const Term& term = kernel.terms[i];
+
+        if(!term.array) {
+            args.push_back(pre.value(term.value));
+        }
+        else if(kernel.store.independent(term.access)) {
+            args.push_back(pre.address(term.access, first));
+        }
+        else {
+            args.push_back(pre.address(term.access, first));
+            overlapping.push_back(args.back());
+        }
+    }
+
+    // 0 < dst - src < bytes, the arrays being read before being written
+    // when dst is below src
+    if(!overlapping.empty()) {
+        ir::Operand last = pre.binary(ir::Opcode::Sub, bytes, ir::Operand::imm(1));
+
+        for(const auto& src : overlapping) {
+            ir::Operand distance = pre.binary(ir::Opcode::Sub, dst, src);
+            pre.unless(ir::Cond::Below, pre.binary(ir::Opcode::Sub, distance, ir::Operand::imm(1)), last);
+        }
+    }
+
+    if(fill || copy) {
+        ir::Instr call(ir::Opcode::Call);
+        call.symbol = fill ? "__microc_memset" : "__microc_memcpy";
+        call.args = {dst, args[0], bytes};
+        pre.emit(call);
+    }
+    else {
+        auto op = std::make_shared<ir::VectorOp>();
+        op->op = kernel.op;
+
+        for(std::size_t i = 0; i < args.size(); ++i) {
+            op->arrays[i] = kernel.terms[i].array;
+        }
+
+        ir::Instr vector(ir::Opcode::Vector);
+        vector.size = kernel.size;
+        vector.a = dst;
+        vector.b = bytes;
+        vector.args = args;
+        vector.vector = op;
+        pre.emit(vector);
+    }
+
+    ir::Instr store(ir::Opcode::Store);
+    store.a = ir::Operand::slot(kernel.slot);
+    store.b = pre.binary(ir::Opcode::Add, first, elements);
+    pre.emit(store);
+
+    ir::Instr jump(ir::Opcode::Jump);
+    jump.targets[0] = kernel.header;
+    pre.emit(jump);
+
+    // the new blocks run as often as the loop is entered
+    if(!function.counts.empty()) {
+        std::uint64_t header = function.counts[kernel.header], latch = function.counts[kernel.latch];
+        function.counts.resize(function.blocks.size(), header > latch ? header - latch : 0);
+        function.taken.resize(function.blocks.size(), 0);
+    }
+}
+
+} // namespace
+
+void vectorize_loops(ir::Function& function) {
+    Matcher matcher(function);
+    std::uint32_t blocks = function.blocks.size();
+    Kernel kernel;
+
+    for(std::uint32_t header = 0; header < blocks; ++header) {
+        if(matcher.match(header, kernel)) {
+            transform(function, kernel);
+        }
+    }
+}
+
+} // namespace microc
@@ -0,0 +1,32 @@
+#ifndef MICROC_VECTORIZE_HPP
+#define MICROC_VECTORIZE_HPP
+
+#include "ir.hpp"
+
+namespace microc {
+
+/*
+ * Vectorizes the counted loops of a function which store one element of
+ * an array per iteration, for -msse2:
+ *
+ *     while(i < n) { d[i] = x[i] op y[i]; i = i + 1; }
+ *
+ * where each operand is an element of an array at i or a value which does
+ * not change in the loop, the elements being of 1 or 4 bytes and op one
+ * of + - & | ^, or no operation at all. Since only d is written, and only
+ * at i, no iteration depends on an earlier one, unless d overlaps one of
+ * the arrays read: this is checked when the loop starts, unless the arrays
+ * are distinct objects.
+ *
+ * A Vector instruction then does most of the iterations, 16 bytes at a
+ * time, and the loop, left as it was, does the remaining ones, or all of
+ * them when the arrays overlap. Filling an array with a byte or with zero,
+ * and copying one, become calls to __microc_memset(d, value, bytes) and
+ * __microc_memcpy(d, x, bytes), which copies forward, and the loop does
+ * nothing more.
+ */
+void vectorize_loops(ir::Function& function);
+
+} // namespace microc
+
+#endif // MICROC_VECTORIZE_HPP